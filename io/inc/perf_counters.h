@@ -0,0 +1,65 @@
+#ifndef PERF_COUNTERS_H
+#define PERF_COUNTERS_H
+
+#include <stdint.h>
+
+/*============================================================================*/
+
+// Max number of counters in a set
+#define PERF_COUNTERS_MAX			12
+
+// Counter not available (failed to open or never scheduled)
+#define PERF_COUNTER_NA				UINT64_MAX
+
+
+/*============================================================================*/
+
+/**
+ * Counter description (perf_event_attr type and config).
+ */
+typedef struct perf_event_desc_s {
+
+	const char	*name;			// counter name
+	uint32_t	type;			// PERF_TYPE_HARDWARE, PERF_TYPE_SOFTWARE, ...
+	uint64_t	config;			// event config
+
+} perf_event_desc_t;
+
+/**
+ * Counter set.
+ *
+ * Hardware and software counters are opened in two different groups, so that
+ * software counters are still scheduled if the hardware group is not.
+ */
+typedef struct perf_counters_s {
+
+	const perf_event_desc_t	*desc[PERF_COUNTERS_MAX];	// counters description
+	int						fd[PERF_COUNTERS_MAX];		// counters fd (-1 if NA)
+	int						group[PERF_COUNTERS_MAX];	// counters group
+	uint64_t				value[PERF_COUNTERS_MAX];	// (scaled) values
+	int						leader[2];					// groups leader fd
+	int						nr;							// number of counters
+	int						hw;							// hw counters opened
+
+} perf_counters_t;
+
+
+/*============================================================================*/
+
+// Open a counter set for calling thread (and threads it creates)
+int perf_counters_open(perf_counters_t *pc, const perf_event_desc_t *events,
+					int nr);
+
+// Reset and enable counters
+int perf_counters_start(perf_counters_t *pc);
+
+// Disable counters and read values
+int perf_counters_stop(perf_counters_t *pc);
+
+// Get counter value by perf type and config (PERF_COUNTER_NA if missing)
+uint64_t perf_counters_get(perf_counters_t *pc, uint32_t type, uint64_t config);
+
+// Close counter set
+void perf_counters_close(perf_counters_t *pc);
+
+#endif	// PERF_COUNTERS_H
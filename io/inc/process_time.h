@@ -1,12 +1,20 @@
 #ifndef PROCESS_TIME_H
 #define PROCESS_TIME_H
 
+#include "histogram.h"
+
 // Timer init
 void process_time_init(void);
 
 // Register timer
 int process_time_register(void);
 
+// Attach histogram to timer (record wall time instead of printing)
+int process_time_histogram(int, histogram_t *);
+
+// Enable counters mode for timer (perf_event_open counters)
+int process_time_counters(int);
+
 // Start timer
 int process_time_start(int);
 
@@ -0,0 +1,82 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+
+/**
+ * Config: Enable/Disable trace macros (compile away when disabled)
+ */
+#define TRACE_ENABLE				1
+
+// Events per thread ring buffer (power of two)
+#define TRACE_RING_SIZE				(1 << 16)
+
+// Flusher thread period (microseconds)
+#define TRACE_FLUSH_PERIOD_US		1000
+
+// Environment variable with trace file path (trace_start_env)
+#define TRACE_FILE_ENV				"TRACE_FILE"
+
+
+/*============================================================================*/
+
+/**
+ * Trace output formats.
+ *
+ * JSON is the Chrome trace event format (chrome://tracing, ui.perfetto.dev),
+ * while binary is a compact format that must be converted using
+ * trace_convert().
+ */
+#define TRACE_FORMAT_JSON			0
+#define TRACE_FORMAT_BIN			1
+
+/**
+ * Event phases (Chrome trace event format).
+ */
+#define TRACE_PHASE_BEGIN			'B'
+#define TRACE_PHASE_END				'E'
+#define TRACE_PHASE_INSTANT			'i'
+
+
+/*============================================================================*/
+
+// Start tracing into file (path may contain "%d" that is replaced by pid)
+int trace_start(const char *path, int format);
+
+// Start tracing into TRACE_FILE_ENV file (".json" selects JSON format)
+int trace_start_env(void);
+
+// Stop tracing (flush all events and close file)
+void trace_stop(void);
+
+// Record an event for calling thread (name must be a static string)
+void trace_event(char phase, const char *name);
+
+// Convert a binary trace into a Chrome JSON trace
+int trace_convert(const char *bin_path, const char *json_path);
+
+// Scope end (cleanup attribute, do not call directly)
+void __trace_scope_end(const char **name);
+
+
+/*============================================================================*/
+
+// Trace macros
+#if TRACE_ENABLE
+#	define TRACE_BEGIN(name)		trace_event(TRACE_PHASE_BEGIN, name)
+#	define TRACE_END(name)			trace_event(TRACE_PHASE_END, name)
+#	define TRACE_INSTANT(name)		trace_event(TRACE_PHASE_INSTANT, name)
+#	define __TRACE_CONCAT(a, b)		a##b
+#	define __TRACE_VAR(line)		__TRACE_CONCAT(__trace_scope_, line)
+#	define TRACE_SCOPE(name)		\
+		const char *__TRACE_VAR(__LINE__)	\
+			__attribute__((cleanup(__trace_scope_end))) =	\
+			(trace_event(TRACE_PHASE_BEGIN, name), name)
+#else
+#	define TRACE_BEGIN(name)	{}
+#	define TRACE_END(name)		{}
+#	define TRACE_INSTANT(name)	{}
+#	define TRACE_SCOPE(name)	{}
+#endif
+
+#endif	// TRACE_H
@@ -20,6 +20,10 @@
  * time, data is cached.
  *
  * Use 10M as destination file for example.
+ *
+ * Each buffer size is run REPEAT_NUM times and the copy time is recorded in a
+ * histogram, so that percentiles are reported across repetitions instead of a
+ * single (noisy) sample.
  */
 
 #include <stdio.h>
@@ -35,6 +39,12 @@
 
 extern int errno;
 
+/*============================================================================*/
+/**
+ * Number of copies performed for each buffer size.
+ */
+#define REPEAT_NUM			5
+
 /*============================================================================*/
 /**
  * Copy data from source file to destination file.
@@ -43,10 +53,12 @@ extern int errno;
  * @buf_size: Size of the buffer.
  * @fd_src	: Source file descriptor.
  * @fd_dst	: Destination file descriptor.
+ * @hist	: Histogram to record copy time.
  *
  * Return 0 on success and <0 otherwise.
  */
-static int __copy(void *buf, unsigned int buf_size, int fd_src, int fd_dst)
+static int __copy(void *buf, unsigned int buf_size, int fd_src, int fd_dst,
+				histogram_t *hist)
 {
 	int timer_fd, rv = 0;
 	ssize_t bytes_r, bytes_w;
@@ -60,9 +72,14 @@ static int __copy(void *buf, unsigned int buf_size, int fd_src, int fd_dst)
 		rv = -1; goto end;
 	}
 
+	if (process_time_histogram(timer_fd, hist) < 0) {
+		ERROR("Fail to attach histogram!\n");
+		rv = -2; goto timer_release;
+	}
+
 	if (process_time_start(timer_fd) < 0) {
 		ERROR("Fail to start timer!\n");
-		rv = -2; goto end;
+		rv = -2; goto timer_release;
 	}
 
 	/**
@@ -73,7 +90,7 @@ static int __copy(void *buf, unsigned int buf_size, int fd_src, int fd_dst)
 		bytes_r = read(fd_src, buf, buf_size);
 		if (bytes_r < 0) {
 			ERROR("%s!\n", strerror(errno));
-			rv = -3; goto end;
+			rv = -3; goto timer_release;
 		}
 
 		if (!bytes_r)
@@ -82,26 +99,28 @@ static int __copy(void *buf, unsigned int buf_size, int fd_src, int fd_dst)
 		bytes_w = write(fd_dst, buf, bytes_r);
 		if (bytes_w < 0) {
 			ERROR("%s!\n", strerror(errno));
-			rv = -4; goto end;
+			rv = -4; goto timer_release;
 		}
 
 		if (bytes_r != bytes_w) {
 			ERROR("Fail to write data!\n");
-			rv = -5; goto end;
+			rv = -5; goto timer_release;
 		}
 	}
 
 	/**
-	 * Stop and release timer.
+	 * Stop and release timer (released on errors too).
 	 */
 	if (process_time_end(timer_fd) < 0) {
 		ERROR("Fail to stop timer!\n");
-		rv = -6; goto end;
+		rv = -6; goto timer_release;
 	}
 
+timer_release:
 	if (process_time_release(timer_fd)) {
 		ERROR("Fail to release timer!\n");
-		rv = -7; goto end;
+		if (!rv)
+			rv = -7;
 	}
 
 end:
@@ -117,6 +136,7 @@ int main(int argc, char *argv[])
 	char *src, *dst;
 	int fd_src, fd_dst, rv = 0;
 	unsigned int buf_size;
+	static histogram_t hist;
 
 	/**
 	 * Validate arguments.
@@ -139,65 +159,73 @@ int main(int argc, char *argv[])
 	 */
 	for (int i = 0; i < 14; i++) {
 
-		/**********************************************************************
-		 * Files open.
-		 * 1) src: mandatory to exist (open in read-only mode)
-		 * 2) dst: create if doesn't exist (open in write-only mode) (rw-rw-rw-)
-		 **********************************************************************/
-		fd_src = open(src, O_RDONLY);
-		if (fd_src == -1) {
-			ERROR("%s!\n", strerror(errno));
-			rv = -2; goto end;
-		}
+		buf_size = (2 << i);
+		printf("Running with buffer_size = %u\n", buf_size);
 
-		mode = S_IRUSR|S_IWUSR|S_IRGRP|S_IWGRP|S_IROTH|S_IWOTH;
-		fd_dst = open(dst, O_WRONLY|O_CREAT, mode);
-		if (fd_dst == -1) {
-			if (close(fd_src) == -1) {
+		histogram_init(&hist);
+
+		for (int r = 0; r < REPEAT_NUM; r++) {
+
+			/******************************************************************
+			 * Files open.
+			 * 1) src: mandatory to exist (open in read-only mode)
+			 * 2) dst: create if doesn't exist (open in write-only mode)
+			 * (rw-rw-rw-)
+			 ******************************************************************/
+			fd_src = open(src, O_RDONLY);
+			if (fd_src == -1) {
+				ERROR("%s!\n", strerror(errno));
+				rv = -2; goto end;
+			}
+
+			mode = S_IRUSR|S_IWUSR|S_IRGRP|S_IWGRP|S_IROTH|S_IWOTH;
+			fd_dst = open(dst, O_WRONLY|O_CREAT, mode);
+			if (fd_dst == -1) {
+				if (close(fd_src) == -1) {
+					ERROR("%s!\n", strerror(errno));
+					rv = -3; goto end;
+				}
 				ERROR("%s!\n", strerror(errno));
 				rv = -3; goto end;
 			}
-			ERROR("%s!\n", strerror(errno));
-			rv = -3; goto end;
-		}
 
-		/***********************************************************************
-		 * Create buffer size, alloc buffer and move data.
-		 **********************************************************************/
-		buf_size = (2 << i);
-		printf("Running with buffer_size = %u\n", buf_size);
+			/******************************************************************
+			 * Alloc buffer and move data.
+			 ******************************************************************/
+			buf = malloc(buf_size);
+			if (!buf) {
+				ERROR("malloc failed!\n");
+				assert(close(fd_src) != -1);
+				assert(close(fd_dst) != -1);
+				rv = -4; goto end;
+			}
 
-		buf = malloc(buf_size);
-		if (!buf) {
-			ERROR("malloc failed!\n");
-			assert(close(fd_src) != -1);
-			assert(close(fd_dst) != -1);
-			rv = -4; goto end;
-		}
+			if (__copy(buf, buf_size, fd_src, fd_dst, &hist)) {
+				ERROR("copy failed!\n");
+				free(buf);
+				assert(close(fd_src) != -1);
+				assert(close(fd_dst) != -1);
+				rv = -5; goto end;
+			}
 
-		if (__copy(buf, buf_size, fd_src, fd_dst)) {
-			ERROR("copy failed!\n");
 			free(buf);
-			assert(close(fd_src) != -1);
-			assert(close(fd_dst) != -1);
-			rv = -5; goto end;
-		}
 
-		free(buf);
+			/******************************************************************
+			 * Close files.
+			 ******************************************************************/
+			if (close(fd_src) == -1) {
+				ERROR("%s!\n", strerror(errno));
+				assert(close(fd_dst) != -1);
+				rv = -5; goto end;
+			}
 
-		/***********************************************************************
-		 * Close files.
-		 **********************************************************************/
-		if (close(fd_src) == -1) {
-			ERROR("%s!\n", strerror(errno));
-			assert(close(fd_dst) != -1);
-			rv = -5; goto end;
+			if (close(fd_dst) == -1) {
+				ERROR("%s!\n", strerror(errno));
+				rv = -6; goto end;
+			}
 		}
 
-		if (close(fd_dst) == -1) {
-			ERROR("%s!\n", strerror(errno));
-			rv = -6; goto end;
-		}
+		histogram_print(&hist, "    copy", "ms", 1e6);
 	}
 
 end:
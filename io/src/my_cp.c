@@ -1,6 +1,11 @@
 /**
  * Linux cp command basic implementation.
  * Copyright (C) 2022 Lazar Razvan.
+ *
+ * Set TRACE_FILE environment variable to record read() and write() events
+ * (Chrome trace JSON if file ends in ".json", binary otherwise).
+ *
+ * TRACE_FILE=/tmp/my_cp.json ./run/my_cp <source> <destination>
  */
 
 #include <stdio.h>
@@ -11,6 +16,7 @@
 #include <stdlib.h>
 
 #include "debug.h"
+#include "trace.h"
 
 extern int errno;
 
@@ -32,6 +38,7 @@ static int __copy(int fd_src, int fd_dst)
 	int rv = 0;
 	void *buf = NULL;
 	ssize_t bytes_r, bytes_w;
+	TRACE_SCOPE("copy");
 
 	buf = malloc(BUF_SIZE);
 	if (!buf) {
@@ -44,7 +51,9 @@ static int __copy(int fd_src, int fd_dst)
 	 * to destination file.
 	 */
 	while (1) {
+		TRACE_BEGIN("read");
 		bytes_r = read(fd_src, buf, BUF_SIZE);
+		TRACE_END("read");
 		if (bytes_r < 0) {
 			ERROR("%s!\n", strerror(errno));
 			rv = -2; goto end;
@@ -53,7 +62,9 @@ static int __copy(int fd_src, int fd_dst)
 		if (!bytes_r)
 			break;	// source end-of-file reached
 
+		TRACE_BEGIN("write");
 		bytes_w = write(fd_dst, buf, bytes_r);
+		TRACE_END("write");
 		if (bytes_w < 0) {
 			ERROR("%s!\n", strerror(errno));
 			rv = -3; goto end;
@@ -88,6 +99,14 @@ int main(int argc, char *argv[])
 	src = argv[1];
 	dst = argv[2];
 
+	/**
+	 * Start tracing (if TRACE_FILE is set).
+	 */
+	if (trace_start_env()) {
+		ERROR("Fail to start tracing!\n");
+		rv = -1; goto end;
+	}
+
 	/**
 	 * Files open.
 	 * 1) src: mandatory to exist (open in read-only mode)
@@ -0,0 +1,282 @@
+/**
+ * Hardware and software performance counters using perf_event_open().
+ * Copyright (C) 2024 Lazar Razvan.
+ *
+ * Counters are opened for the calling thread (any CPU) in two groups:
+ * 	1) hardware group (cycles, instructions, cache and branch misses, ...)
+ * 	2) software group (context switches, page faults, task clock, ...)
+ *
+ * Counters of a group are scheduled together on the PMU, so ratios between
+ * them (IPC, miss rates) are computed on the same time interval. If the PMU
+ * is multiplexed, values are scaled using time_enabled / time_running.
+ *
+ * Hardware counters may not be available (virtual machines without a PMU or
+ * perf_event_paranoid restrictions). A counter is first opened including
+ * kernel events and if not permitted, it is retried for user space only. If
+ * no hardware counter can be opened, the set falls back to software counters
+ * that are always provided by the kernel.
+ *
+ * Counters are inherited: threads (and processes) created by the calling
+ * thread after the set is opened are counted too, so a parallel region is
+ * measured as a whole. Their counts are added when they exit, so they must be
+ * joined before the counters are stopped.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "debug.h"
+#include "perf_counters.h"
+
+/*============================================================================*/
+/**
+ * Group index for a counter.
+ */
+#define GROUP_HW					0
+#define GROUP_SW					1
+
+/**
+ * Group read format (PERF_FORMAT_GROUP | TOTAL_TIME_ENABLED | RUNNING).
+ */
+typedef struct group_read_s {
+
+	uint64_t	nr;							// number of counters
+	uint64_t	time_enabled;				// time group was enabled
+	uint64_t	time_running;				// time group was on PMU
+	uint64_t	values[PERF_COUNTERS_MAX];	// counters values
+
+} group_read_t;
+
+/*================================= STATIC ===================================*/
+
+/**
+ * perf_event_open() system call (no glibc wrapper).
+ */
+static inline int __perf_event_open(struct perf_event_attr *attr, pid_t pid,
+								int cpu, int group_fd, unsigned long flags)
+{
+	return syscall(SYS_perf_event_open, attr, pid, cpu, group_fd, flags);
+}
+
+/**
+ * Open a counter for calling thread (inherited by its new threads).
+ *
+ * Leader is created disabled and members follow the leader state.
+ */
+static int __counter_open(const perf_event_desc_t *desc, int leader)
+{
+	struct perf_event_attr attr;
+	int fd;
+
+	memset(&attr, 0, sizeof(struct perf_event_attr));
+	attr.size			= sizeof(struct perf_event_attr);
+	attr.type			= desc->type;
+	attr.config			= desc->config;
+	attr.disabled		= (leader == -1);
+	attr.exclude_hv		= 1;
+	attr.inherit		= 1;
+	attr.read_format	= PERF_FORMAT_GROUP |
+						PERF_FORMAT_TOTAL_TIME_ENABLED |
+						PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+	fd = __perf_event_open(&attr, 0, -1, leader, 0);
+	if (fd != -1 || (errno != EACCES && errno != EPERM))
+		return fd;
+
+	// not permitted to count kernel events, count user space only
+	attr.exclude_kernel = 1;
+
+	return __perf_event_open(&attr, 0, -1, leader, 0);
+}
+
+/**
+ * Read a group and scale members values.
+ */
+static int __group_read(perf_counters_t *pc, int group)
+{
+	group_read_t data;
+	double scale;
+	int slot = 0;
+
+	if (pc->leader[group] == -1)
+		return 0;
+
+	if (read(pc->leader[group], &data, sizeof(group_read_t)) < 0) {
+		ERROR("read() failed: %s!\n", strerror(errno));
+		return -1;
+	}
+
+	// group never scheduled (not enough PMU counters)
+	scale = data.time_running ?
+			(double)data.time_enabled / data.time_running : 0;
+
+	for (int i = 0; i < pc->nr; i++) {
+		if (pc->fd[i] == -1 || pc->group[i] != group)
+			continue;
+
+		pc->value[i] = scale ? (uint64_t)(data.values[slot] * scale) :
+							PERF_COUNTER_NA;
+		slot++;
+	}
+
+	return 0;
+}
+
+/*================================= PUBLIC ===================================*/
+
+/**
+ * Open a counter set for the calling thread and the threads it creates.
+ *
+ * Counters that can not be opened are skipped and reported as
+ * PERF_COUNTER_NA.
+ *
+ * @pc		: Counter set.
+ * @events	: Counters description.
+ * @nr		: Number of counters.
+ *
+ * Return number of opened counters on success and <0 on error.
+ *
+ * Errors:
+ * 	1) Invalid number of counters
+ * 	2) No counter can be opened
+ */
+int perf_counters_open(perf_counters_t *pc, const perf_event_desc_t *events,
+					int nr)
+{
+	int opened = 0, group;
+
+	if (nr <= 0 || nr > PERF_COUNTERS_MAX) {
+		ERROR("Invalid number of counters %d!\n", nr);
+		return -1;
+	}
+
+	pc->nr = nr;
+	pc->hw = 0;
+	pc->leader[GROUP_HW] = -1;
+	pc->leader[GROUP_SW] = -1;
+
+	for (int i = 0; i < nr; i++) {
+		group = (events[i].type == PERF_TYPE_SOFTWARE) ? GROUP_SW : GROUP_HW;
+
+		pc->desc[i] = &events[i];
+		pc->group[i] = group;
+		pc->value[i] = PERF_COUNTER_NA;
+		pc->fd[i] = __counter_open(&events[i], pc->leader[group]);
+		if (pc->fd[i] == -1) {
+			DEBUG("Counter %s not available: %s\n", events[i].name,
+					strerror(errno));
+			continue;
+		}
+
+		if (pc->leader[group] == -1)
+			pc->leader[group] = pc->fd[i];
+
+		if (group == GROUP_HW)
+			pc->hw++;
+
+		opened++;
+	}
+
+	if (!opened) {
+		ERROR("No performance counter available!\n");
+		return -2;
+	}
+
+	if (!pc->hw)
+		DEBUG("Hardware counters not available, using software counters\n");
+
+	return opened;
+}
+
+/**
+ * Reset and enable all counters.
+ *
+ * @pc	: Counter set.
+ *
+ * Return 0 on success and <0 on error.
+ */
+int perf_counters_start(perf_counters_t *pc)
+{
+	for (int g = GROUP_HW; g <= GROUP_SW; g++) {
+		if (pc->leader[g] == -1)
+			continue;
+
+		if (ioctl(pc->leader[g], PERF_EVENT_IOC_RESET,
+				PERF_IOC_FLAG_GROUP) == -1 ||
+			ioctl(pc->leader[g], PERF_EVENT_IOC_ENABLE,
+				PERF_IOC_FLAG_GROUP) == -1) {
+			ERROR("ioctl() failed: %s!\n", strerror(errno));
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * Disable all counters and read their values.
+ *
+ * @pc	: Counter set.
+ *
+ * Return 0 on success and <0 on error.
+ */
+int perf_counters_stop(perf_counters_t *pc)
+{
+	for (int g = GROUP_HW; g <= GROUP_SW; g++) {
+		if (pc->leader[g] == -1)
+			continue;
+
+		if (ioctl(pc->leader[g], PERF_EVENT_IOC_DISABLE,
+				PERF_IOC_FLAG_GROUP) == -1) {
+			ERROR("ioctl() failed: %s!\n", strerror(errno));
+			return -1;
+		}
+
+		if (__group_read(pc, g))
+			return -2;
+	}
+
+	return 0;
+}
+
+/**
+ * Get a counter value.
+ *
+ * @pc		: Counter set.
+ * @type	: Counter type.
+ * @config	: Counter config.
+ *
+ * Return counter value or PERF_COUNTER_NA if counter is not available.
+ */
+uint64_t perf_counters_get(perf_counters_t *pc, uint32_t type, uint64_t config)
+{
+	for (int i = 0; i < pc->nr; i++)
+		if (pc->desc[i]->type == type && pc->desc[i]->config == config)
+			return pc->value[i];
+
+	return PERF_COUNTER_NA;
+}
+
+/**
+ * Close all counters.
+ *
+ * @pc	: Counter set.
+ */
+void perf_counters_close(perf_counters_t *pc)
+{
+	for (int i = 0; i < pc->nr; i++) {
+		if (pc->fd[i] != -1)
+			close(pc->fd[i]);
+		pc->fd[i] = -1;
+	}
+
+	pc->leader[GROUP_HW] = -1;
+	pc->leader[GROUP_SW] = -1;
+	pc->nr = 0;
+}
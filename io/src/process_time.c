@@ -8,14 +8,31 @@
  *
  * Time is measured in units called "clock ticks". To obtain number of clock
  * ticks per seconds "sysconf(_SC_CLK_TCK)" can be used.
+ *
+ * Beside process time, wall time is measured using CLOCK_MONOTONIC. Since a
+ * single sample is not enough to understand the behavior of a region, a
+ * histogram can be attached to a timer. In this case, process_time_end()
+ * still print the CPU time, but record the wall time (in nanoseconds) into the
+ * histogram instead of printing it, so that percentiles are reported across
+ * repetitions.
+ *
+ * CPU time alone does not explain why a region is slow, so a timer may also
+ * be switched in counters mode. In this case, a perf_event_open() counter set
+ * (cycles, instructions, cache and branch misses, context switches and page
+ * faults) is enabled for the region and process_time_end() report the IPC and
+ * miss rates. If hardware counters are not permitted, only software counters
+ * are reported.
  */
 
 #include <time.h>
 #include <stdio.h>
 #include <unistd.h>
 #include <sys/times.h>
+#include <linux/perf_event.h>
 
 #include "debug.h"
+#include "histogram.h"
+#include "perf_counters.h"
 
 /*============================================================================*/
 /**
@@ -32,9 +49,32 @@ typedef struct _ptime {
 	char		used;		// check if timer is used (register method)
 	struct tms	start;		// track start time
 	struct tms	end;		// track end time
+	struct timespec	wall_start;	// track start wall time
+	struct timespec	wall_end;	// track end wall time
+	histogram_t	*hist;		// wall time histogram (if attached)
+	char		counters;	// check if counters mode is enabled
+	perf_counters_t	pc;		// performance counters (counters mode)
 
 } ptime;
 
+/**
+ * Counters reported in counters mode.
+ */
+static const perf_event_desc_t counters_events[] = {
+	{ "cycles",				PERF_TYPE_HARDWARE,	PERF_COUNT_HW_CPU_CYCLES },
+	{ "instructions",		PERF_TYPE_HARDWARE,	PERF_COUNT_HW_INSTRUCTIONS },
+	{ "cache-references",	PERF_TYPE_HARDWARE,	PERF_COUNT_HW_CACHE_REFERENCES },
+	{ "cache-misses",		PERF_TYPE_HARDWARE,	PERF_COUNT_HW_CACHE_MISSES },
+	{ "branches",			PERF_TYPE_HARDWARE,	PERF_COUNT_HW_BRANCH_INSTRUCTIONS },
+	{ "branch-misses",		PERF_TYPE_HARDWARE,	PERF_COUNT_HW_BRANCH_MISSES },
+	{ "task-clock",			PERF_TYPE_SOFTWARE,	PERF_COUNT_SW_TASK_CLOCK },
+	{ "context-switches",	PERF_TYPE_SOFTWARE,	PERF_COUNT_SW_CONTEXT_SWITCHES },
+	{ "page-faults",		PERF_TYPE_SOFTWARE,	PERF_COUNT_SW_PAGE_FAULTS },
+};
+
+#define COUNTERS_EVENTS_NUM	\
+		(sizeof(counters_events) / sizeof(counters_events[0]))
+
 /*============================================================================*/
 
 /**
@@ -79,6 +119,77 @@ static inline int __timer_fd_validate(int timer_fd)
 
 	return 0;
 }
+
+/**
+ * Get elapsed nanoseconds between two timespec.
+ */
+static inline uint64_t __timespec_diff_ns(struct timespec *start,
+										struct timespec *end)
+{
+	return (uint64_t)(end->tv_sec - start->tv_sec) * 1000000000ULL +
+			end->tv_nsec - start->tv_nsec;
+}
+
+/**
+ * Print a counter value (or n/a if not available).
+ */
+static inline void __counter_print(const char *name, uint64_t value)
+{
+	if (value == PERF_COUNTER_NA)
+		printf("%s: n/a\n", name);
+	else
+		printf("%s: %lu\n", name, value);
+}
+
+/**
+ * Print a ratio between two counters (or n/a if not available).
+ */
+static inline void __ratio_print(const char *name, uint64_t num, uint64_t den,
+								double mul)
+{
+	if (num == PERF_COUNTER_NA || den == PERF_COUNTER_NA || !den)
+		printf("%s: n/a\n", name);
+	else
+		printf("%s: %.3f\n", name, (double)num / den * mul);
+}
+
+/**
+ * Print counters of a timer.
+ */
+static void __counters_print(perf_counters_t *pc)
+{
+	uint64_t cycles, instr, cache_ref, cache_miss, branch, branch_miss;
+
+#define HW(c)	perf_counters_get(pc, PERF_TYPE_HARDWARE, PERF_COUNT_HW_##c)
+#define SW(c)	perf_counters_get(pc, PERF_TYPE_SOFTWARE, PERF_COUNT_SW_##c)
+
+	cycles		= HW(CPU_CYCLES);
+	instr		= HW(INSTRUCTIONS);
+	cache_ref	= HW(CACHE_REFERENCES);
+	cache_miss	= HW(CACHE_MISSES);
+	branch		= HW(BRANCH_INSTRUCTIONS);
+	branch_miss	= HW(BRANCH_MISSES);
+
+	if (pc->hw) {
+		__counter_print("cycles", cycles);
+		__counter_print("instructions", instr);
+		__ratio_print("IPC", instr, cycles, 1);
+		__counter_print("cache-misses", cache_miss);
+		__ratio_print("cache-miss rate (%)", cache_miss, cache_ref, 100);
+		__counter_print("branch-misses", branch_miss);
+		__ratio_print("branch-miss rate (%)", branch_miss, branch, 100);
+	} else {
+		printf("hardware counters not available (software counters only)\n");
+	}
+
+	__ratio_print("task-clock (ms)", SW(TASK_CLOCK), 1000000, 1);
+	__counter_print("context-switches", SW(CONTEXT_SWITCHES));
+	__counter_print("page-faults", SW(PAGE_FAULTS));
+
+#undef HW
+#undef SW
+}
+
 /*================================= PUBLIC ===================================*/
 
 /**
@@ -93,6 +204,8 @@ void process_time_init(void)
 	for (int i = 0; i < MAX_TIMERS; i++) {
 		tm[i].init = 0;
 		tm[i].used = 0;
+		tm[i].hist = NULL;
+		tm[i].counters = 0;
 	}
 }
 
@@ -120,10 +233,106 @@ int process_time_register(void)
 
 	tm[timer_fd].init = 0;
 	tm[timer_fd].used = 1;
+	tm[timer_fd].hist = NULL;
+	tm[timer_fd].counters = 0;
 
 	return timer_fd;
 }
 
+/**
+ * Attach a histogram to a timer.
+ *
+ * Each process_time_end() call will record the wall time (nanoseconds) of
+ * the region into the histogram, instead of printing it. User and sys CPU
+ * time are still printed.
+ *
+ * @timer_fd	: Timer descriptor.
+ * @hist		: Histogram (NULL to detach and print each sample).
+ *
+ * Return 0 on success and <0 on error.
+ *
+ * Errors:
+ * 	1) Invalid timer descriptor
+ * 	2) Timer not registered
+ */
+int process_time_histogram(int timer_fd, histogram_t *hist)
+{
+	// Check if process_time_init was previously called
+	if (!init_state) {
+		ERROR("timers not initialized\n");
+		return -1;
+	}
+
+	// Validate timer descriptor.
+	if (__timer_fd_validate(timer_fd)) {
+		ERROR("Invalid timer %d\n", timer_fd);
+		return -2;
+	}
+
+	// Check if timer was previously register
+	if (tm[timer_fd].used == 0) {
+		ERROR("Timer %d not previously registered!\n", timer_fd);
+		return -3;
+	}
+
+	tm[timer_fd].hist = hist;
+
+	return 0;
+}
+
+/**
+ * Enable counters mode for a timer.
+ *
+ * Open performance counters for the calling thread, that are enabled between
+ * process_time_start() and process_time_end(). Threads created by the calling
+ * thread in between are counted too (they must be joined before
+ * process_time_end()). Counters are reported by process_time_end() (even if a
+ * histogram is attached).
+ *
+ * @timer_fd	: Timer descriptor.
+ *
+ * Return 0 on success and <0 on error.
+ *
+ * Errors:
+ * 	1) Invalid timer descriptor
+ * 	2) Timer not registered
+ * 	3) Counters not available
+ */
+int process_time_counters(int timer_fd)
+{
+	// Check if process_time_init was previously called
+	if (!init_state) {
+		ERROR("timers not initialized\n");
+		return -1;
+	}
+
+	// Validate timer descriptor.
+	if (__timer_fd_validate(timer_fd)) {
+		ERROR("Invalid timer %d\n", timer_fd);
+		return -2;
+	}
+
+	// Check if timer was previously register
+	if (tm[timer_fd].used == 0) {
+		ERROR("Timer %d not previously registered!\n", timer_fd);
+		return -3;
+	}
+
+	// Already enabled
+	if (tm[timer_fd].counters)
+		return 0;
+
+	if (perf_counters_open(&tm[timer_fd].pc, counters_events,
+						COUNTERS_EVENTS_NUM) < 0) {
+		ERROR("Timer %d counters not available!\n", timer_fd);
+		return -4;
+	}
+
+	tm[timer_fd].counters = 1;
+
+	return 0;
+}
+
 /**
  * Start measuring process time for a given timer.
  *
@@ -161,6 +370,17 @@ int process_time_start(int timer_fd)
 		return -4;
 	}
 
+	if (clock_gettime(CLOCK_MONOTONIC, &tm[timer_fd].wall_start) == -1) {
+		ERROR("clock_gettime error!\n");
+		return -5;
+	}
+
+	// Start counters last, so that timers are not counted
+	if (tm[timer_fd].counters && perf_counters_start(&tm[timer_fd].pc)) {
+		ERROR("Timer %d counters start error!\n", timer_fd);
+		return -6;
+	}
+
 	tm[timer_fd].init = 1;
 
 	return 0;
@@ -206,12 +426,27 @@ int process_time_end(int timer_fd)
 		return -4;
 	}
 
+	// Stop counters first, so that timers are not counted
+	if (tm[timer_fd].counters && perf_counters_stop(&tm[timer_fd].pc)) {
+		ERROR("Timer %d counters stop error!\n", timer_fd);
+		return -6;
+	}
+
 	// Get end
+	if (clock_gettime(CLOCK_MONOTONIC, &tm[timer_fd].wall_end) == -1) {
+		ERROR("clock_gettime error!\n");
+		return -5;
+	}
+
 	if (times(&tm[timer_fd].end) == -1) {
 		ERROR("times error!\n");
 		return -5;
 	}
 
+	// Print counters
+	if (tm[timer_fd].counters)
+		__counters_print(&tm[timer_fd].pc);
+
 	// Print time
 	printf("user CPU time: %.3f\n",
 		(double)(tm[timer_fd].end.tms_utime - tm[timer_fd].start.tms_utime) /
@@ -221,6 +456,17 @@ int process_time_end(int timer_fd)
 		(double)(tm[timer_fd].end.tms_stime - tm[timer_fd].start.tms_stime) /
 		clk_ticks_per_sec);
 
+	// Record wall time (reported by the histogram)
+	if (tm[timer_fd].hist) {
+		histogram_record_atomic(tm[timer_fd].hist,
+			__timespec_diff_ns(&tm[timer_fd].wall_start, &tm[timer_fd].wall_end));
+		return 0;
+	}
+
+	printf("wall time: %.6f\n",
+		__timespec_diff_ns(&tm[timer_fd].wall_start, &tm[timer_fd].wall_end) /
+		1e9);
+
 	return 0;
 }
 
@@ -256,6 +502,11 @@ int process_time_release(int timer_fd)
 	}
 
 	// Release timer
+	if (tm[timer_fd].counters)
+		perf_counters_close(&tm[timer_fd].pc);
+
+	tm[timer_fd].counters = 0;
+	tm[timer_fd].hist = NULL;
 	__timer_free(timer_fd);
 
 	return 0;
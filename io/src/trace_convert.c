@@ -0,0 +1,33 @@
+/**
+ * Convert a binary trace into Chrome trace JSON.
+ * Copyright (C) 2024 Lazar Razvan.
+ *
+ * Binary traces are written by trace module when TRACE_FILE does not end with
+ * ".json". The JSON output can be loaded in chrome://tracing or
+ * ui.perfetto.dev.
+ *
+ * Usage:
+ * ./run/trace_convert <binary trace> <json trace>
+ */
+
+#include <stdio.h>
+
+#include "debug.h"
+#include "trace.h"
+
+/*============================================================================*/
+
+int main(int argc, char *argv[])
+{
+	if (argc != 3) {
+		ERROR("Invalid format: ./trace_convert <binary> <json>\n");
+		return -1;
+	}
+
+	if (trace_convert(argv[1], argv[2])) {
+		ERROR("Fail to convert %s!\n", argv[1]);
+		return -2;
+	}
+
+	return 0;
+}
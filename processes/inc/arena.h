@@ -0,0 +1,87 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+/**
+ * Config: Arena allocator
+ */
+
+// Default size of a region reserved from the OS (bytes)
+#define ARENA_CHUNK_SIZE			(1 << 20)
+
+// Default alignment of allocations (bytes, power of two)
+#define ARENA_ALIGN_DEFAULT			16
+
+
+/*============================================================================*/
+
+/**
+ * Arena backends (how regions are reserved from the OS).
+ */
+#define ARENA_BACKEND_SBRK			0
+#define ARENA_BACKEND_MMAP			1
+
+/**
+ * Region reserved from the OS (header placed at region start).
+ */
+typedef struct arena_chunk_s {
+
+	struct arena_chunk_s	*prev;		// previous (older) chunk
+	size_t					size;		// chunk size (including header)
+
+} arena_chunk_t;
+
+/**
+ * Arena.
+ */
+typedef struct arena_s {
+
+	arena_chunk_t	*chunk;				// current chunk
+	arena_chunk_t	*spare;				// released chunks kept for reuse
+	char			*ptr;				// bump pointer (current chunk)
+	char			*end;				// end of current chunk
+	size_t			chunk_size;			// region size reserved from the OS
+	int				backend;			// ARENA_BACKEND_*
+	size_t			used;				// bytes allocated
+	size_t			reserved;			// bytes reserved from the OS
+
+} arena_t;
+
+/**
+ * Arena scope (position to roll back to).
+ */
+typedef struct arena_scope_s {
+
+	arena_t			*arena;				// arena
+	arena_chunk_t	*chunk;				// chunk at scope begin
+	char			*ptr;				// bump pointer at scope begin
+	size_t			used;				// bytes allocated at scope begin
+
+} arena_scope_t;
+
+
+/*============================================================================*/
+
+// Init arena (chunk_size 0 for ARENA_CHUNK_SIZE)
+int arena_init(arena_t *arena, int backend, size_t chunk_size);
+
+// Allocate size bytes (ARENA_ALIGN_DEFAULT aligned)
+void *arena_alloc(arena_t *arena, size_t size);
+
+// Allocate size bytes aligned to align (power of two)
+void *arena_alloc_align(arena_t *arena, size_t size, size_t align);
+
+// Free all allocations (first chunk is kept)
+void arena_reset(arena_t *arena);
+
+// Free all allocations and return all chunks to the OS
+void arena_destroy(arena_t *arena);
+
+// Begin a scope (scopes may be nested)
+void arena_scope_begin(arena_t *arena, arena_scope_t *scope);
+
+// End a scope (free all allocations done since scope begin)
+void arena_scope_end(arena_scope_t *scope);
+
+#endif	// ARENA_H
@@ -0,0 +1,139 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+
+/**
+ * Config: Pool allocator
+ */
+
+// Default virtual region reserved for slabs (bytes)
+#define POOL_REGION_SIZE			(1UL << 30)
+
+// Objects in a per-thread magazine
+#define POOL_MAGAZINE_SIZE			64
+
+// Full magazines kept in depot (more are returned to slabs)
+#define POOL_DEPOT_MAX				16
+
+// Empty slabs kept resident (pool_trim() releases them too)
+#define POOL_EMPTY_KEEP				4
+
+// Empty slabs unused for longer are returned to the OS (milliseconds)
+#define POOL_DECAY_MS				100
+
+
+/*============================================================================*/
+
+/**
+ * Slab header (kept outside slab memory, so that slab pages can be released
+ * using MADV_DONTNEED).
+ */
+typedef struct pool_slab_s {
+
+	struct pool_slab_s	*next;			// next slab in list
+	struct pool_slab_s	*prev;			// previous slab in list
+	void				*free;			// intrusive free list
+	uint32_t			inuse;			// allocated objects
+	uint32_t			carved;			// objects used since slab is resident
+	int					list;			// list the slab is on
+	uint64_t			emptied;		// time slab became empty (ms)
+
+} pool_slab_t;
+
+/**
+ * Magazine (stack of free objects).
+ */
+typedef struct pool_magazine_s {
+
+	struct pool_magazine_s	*next;		// next magazine in depot
+	int						rounds;		// objects in magazine
+	void					*objs[POOL_MAGAZINE_SIZE];
+
+} pool_magazine_t;
+
+/**
+ * Slab lists.
+ */
+typedef struct pool_list_s {
+
+	pool_slab_t		*head;				// first slab (most recently added)
+	pool_slab_t		*tail;				// last slab
+	size_t			nr;					// number of slabs
+
+} pool_list_t;
+
+/**
+ * Pool statistics.
+ */
+typedef struct pool_stats_s {
+
+	size_t		slabs;					// slabs ever used
+	size_t		full;					// slabs without free objects
+	size_t		partial;				// slabs with free objects
+	size_t		empty;					// empty slabs kept resident
+	size_t		released;				// empty slabs returned to the OS
+	size_t		madvise;				// MADV_DONTNEED calls
+
+} pool_stats_t;
+
+/**
+ * Fixed size object pool.
+ */
+typedef struct pool_s {
+
+	size_t				obj_size;		// object size
+	uint32_t			slab_objs;		// objects for each slab
+	size_t				slab_size;		// slab size (one page)
+	unsigned int		slab_shift;		// log2(slab_size)
+
+	// slab layer
+	char				*base;			// virtual region for slabs
+	pool_slab_t			*slabs;			// slab headers
+	size_t				nr_slabs;		// slabs in region
+	size_t				top;			// slabs ever used
+	pool_list_t			partial;		// slabs with free objects
+	pool_list_t			empty;			// empty slabs kept resident
+	pool_list_t			released;		// empty slabs returned to the OS
+	size_t				madvise;		// MADV_DONTNEED calls
+	pthread_mutex_t		slab_lock;		// slab layer lock
+
+	// depot layer
+	pool_magazine_t		*depot_full;	// full magazines
+	pool_magazine_t		*depot_empty;	// empty magazines
+	int					depot_nr;		// number of full magazines
+	pthread_mutex_t		depot_lock;		// depot lock
+
+	// per-thread magazines
+	pthread_key_t		key;			// per-thread cache
+
+} pool_t;
+
+
+/*============================================================================*/
+
+// Init pool of obj_size objects, at most a page (region_size 0 for
+// POOL_REGION_SIZE)
+int pool_init(pool_t *pool, size_t obj_size, size_t region_size);
+
+// Destroy pool (all objects are freed)
+void pool_destroy(pool_t *pool);
+
+// Allocate an object
+void *pool_alloc(pool_t *pool);
+
+// Free an object (on any thread)
+void pool_free(pool_t *pool, void *obj);
+
+// Return calling thread magazines (done on thread exit)
+void pool_cache_flush(pool_t *pool);
+
+// Return all empty slabs to the OS
+void pool_trim(pool_t *pool);
+
+// Get pool statistics
+void pool_stats(pool_t *pool, pool_stats_t *stats);
+
+#endif	// POOL_H
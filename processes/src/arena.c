@@ -0,0 +1,338 @@
+/**
+ * Arena (bump) allocator.
+ * Copyright (C) 2024 Lazar Razvan.
+ *
+ * Large regions (chunks) are reserved from the OS and allocations are served
+ * by moving a pointer inside the current chunk. There is no per allocation
+ * metadata and no free() for a single allocation, memory is released all at
+ * once using arena_reset() or arena_destroy(), or back to a previously saved
+ * position using scopes.
+ *
+ *  ---------------------------------------------------------------
+ *  | Header   | Alloc 1 | Alloc 2 | ... | Alloc N |    Free      |
+ *  | (prev,L) |         |         |     |         |              |
+ *  ---------------------------------------------------------------
+ *                                                 |              |
+ *                                                ptr            end
+ *
+ * Chunks are reserved using one of the backends:
+ * 	1) sbrk()
+ * 		Chunks are placed on top of the heap segment, increasing the program
+ * 	break. A chunk can only be returned to the OS if it is still on top of the
+ * 	heap (program break not moved by malloc() in between).
+ *
+ * 	2) mmap()
+ * 		Chunks are anonymous private mappings returned to the OS using
+ * 	munmap().
+ *
+ * Chunks released by arena_reset() or by the end of a scope are kept in a
+ * spare list and reused, so that an arena reset on each iteration of a loop
+ * does not reserve (and page fault) memory again. They are returned to the OS
+ * by arena_destroy().
+ *
+ * Scopes may be nested, since a scope only saves the current chunk and bump
+ * pointer and ending it releases the chunks reserved after it.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+
+#include "debug.h"
+#include "arena.h"
+
+/*============================================================================*/
+
+/**
+ * Align value up (align is a power of two).
+ */
+#define ALIGN_UP(x, align)		(((x) + (align) - 1) & ~((uintptr_t)(align) - 1))
+
+/*==================================STATIC====================================*/
+
+/**
+ * Reserve a chunk of size bytes (multiple of page size) from the OS.
+ */
+static arena_chunk_t *__chunk_alloc(arena_t *arena, size_t size)
+{
+	uintptr_t brk, pad;
+	void *p;
+
+	if (arena->backend == ARENA_BACKEND_MMAP) {
+		p = mmap(NULL, size, PROT_READ | PROT_WRITE,
+				MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (p == MAP_FAILED) {
+			ERROR("mmap() failed for %zu bytes!\n", size);
+			return NULL;
+		}
+	} else {
+		// keep chunks page aligned
+		brk = (uintptr_t)sbrk(0);
+		pad = ALIGN_UP(brk, sysconf(_SC_PAGE_SIZE)) - brk;
+
+		p = sbrk(pad + size);
+		if (p == (void *)-1) {
+			ERROR("sbrk() failed for %zu bytes!\n", size);
+			return NULL;
+		}
+
+		p = (char *)p + pad;
+	}
+
+	arena->reserved += size;
+	((arena_chunk_t *)p)->size = size;
+
+	return (arena_chunk_t *)p;
+}
+
+/**
+ * Return a chunk to the OS.
+ *
+ * Return 0 on success and <0 if chunk is not on top of the heap (sbrk).
+ */
+static int __chunk_release(arena_t *arena, arena_chunk_t *chunk)
+{
+	if (arena->backend == ARENA_BACKEND_MMAP) {
+		arena->reserved -= chunk->size;
+		munmap(chunk, chunk->size);
+		return 0;
+	}
+
+	// program break moved after chunk was reserved
+	if (sbrk(0) != (char *)chunk + chunk->size)
+		return -1;
+
+	arena->reserved -= chunk->size;
+	sbrk(-(intptr_t)chunk->size);
+
+	return 0;
+}
+
+/**
+ * Make chunk the current one (bump pointer at the start of its data).
+ */
+static inline void __chunk_use(arena_t *arena, arena_chunk_t *chunk)
+{
+	arena->chunk = chunk;
+	arena->ptr = chunk ? (char *)(chunk + 1) : NULL;
+	arena->end = chunk ? (char *)chunk + chunk->size : NULL;
+}
+
+/**
+ * Move chunks newer than last (NULL for all of them) to spare list.
+ */
+static void __chunks_retire(arena_t *arena, arena_chunk_t *last)
+{
+	arena_chunk_t *chunk;
+
+	while (arena->chunk != last) {
+		chunk = arena->chunk;
+		arena->chunk = chunk->prev;
+		chunk->prev = arena->spare;
+		arena->spare = chunk;
+	}
+}
+
+/**
+ * Add a new chunk with enough space for size bytes aligned to align.
+ */
+static int __arena_grow(arena_t *arena, size_t size, size_t align)
+{
+	arena_chunk_t *chunk, **spare;
+	size_t need, chunk_size;
+
+	need = sizeof(arena_chunk_t) + size + align;
+
+	// reuse a spare chunk if large enough
+	for (spare = &arena->spare; *spare; spare = &(*spare)->prev) {
+		if ((*spare)->size >= need) {
+			chunk = *spare;
+			*spare = chunk->prev;
+			goto use;
+		}
+	}
+
+	chunk_size = (need > arena->chunk_size) ? need : arena->chunk_size;
+	chunk_size = ALIGN_UP(chunk_size, sysconf(_SC_PAGE_SIZE));
+
+	chunk = __chunk_alloc(arena, chunk_size);
+	if (!chunk)
+		return -1;
+
+use:
+	chunk->prev = arena->chunk;
+	__chunk_use(arena, chunk);
+
+	return 0;
+}
+
+/*==================================PUBLIC====================================*/
+
+/**
+ * Init an arena.
+ *
+ * No memory is reserved until first allocation.
+ *
+ * @arena		: Arena.
+ * @backend		: ARENA_BACKEND_SBRK or ARENA_BACKEND_MMAP.
+ * @chunk_size	: Region size reserved from the OS (0 for ARENA_CHUNK_SIZE).
+ *
+ * Return 0 on success and <0 otherwise.
+ *
+ * Errors:
+ * 	1) Invalid backend
+ */
+int arena_init(arena_t *arena, int backend, size_t chunk_size)
+{
+	if (backend != ARENA_BACKEND_SBRK && backend != ARENA_BACKEND_MMAP) {
+		ERROR("Invalid arena backend %d!\n", backend);
+		return -1;
+	}
+
+	__chunk_use(arena, NULL);
+	arena->spare = NULL;
+	arena->backend = backend;
+	arena->chunk_size = chunk_size ? chunk_size : ARENA_CHUNK_SIZE;
+	arena->used = 0;
+	arena->reserved = 0;
+
+	return 0;
+}
+
+/**
+ * Allocate memory from arena (ARENA_ALIGN_DEFAULT aligned).
+ *
+ * @arena	: Arena.
+ * @size	: Size in bytes.
+ *
+ * Return address on success and NULL otherwise.
+ */
+void *arena_alloc(arena_t *arena, size_t size)
+{
+	return arena_alloc_align(arena, size, ARENA_ALIGN_DEFAULT);
+}
+
+/**
+ * Allocate aligned memory from arena.
+ *
+ * @arena	: Arena.
+ * @size	: Size in bytes.
+ * @align	: Alignment in bytes (power of two).
+ *
+ * Return address on success and NULL otherwise.
+ */
+void *arena_alloc_align(arena_t *arena, size_t size, size_t align)
+{
+	uintptr_t p;
+
+	if (!align || (align & (align - 1))) {
+		ERROR("Invalid alignment %zu!\n", align);
+		return NULL;
+	}
+
+	p = ALIGN_UP((uintptr_t)arena->ptr, align);
+	if (!arena->chunk || p + size > (uintptr_t)arena->end) {
+		if (__arena_grow(arena, size, align))
+			return NULL;
+
+		p = ALIGN_UP((uintptr_t)arena->ptr, align);
+	}
+
+	arena->ptr = (char *)(p + size);
+	arena->used += size;
+
+	return (void *)p;
+}
+
+/**
+ * Free all allocations.
+ *
+ * First chunk stays the current one and the others are moved to the spare
+ * list, so that an arena reset on each iteration of a loop does not reserve
+ * memory from the OS again.
+ *
+ * @arena	: Arena.
+ */
+void arena_reset(arena_t *arena)
+{
+	arena_chunk_t *first = arena->chunk;
+
+	if (!first)
+		return;
+
+	while (first->prev)
+		first = first->prev;
+
+	__chunks_retire(arena, first);
+	__chunk_use(arena, first);
+	arena->used = 0;
+}
+
+/**
+ * Free all allocations and return chunks to the OS.
+ *
+ * For sbrk backend, chunks below the program break of another heap user can
+ * not be returned to the OS and remain part of the heap segment.
+ *
+ * @arena	: Arena.
+ */
+void arena_destroy(arena_t *arena)
+{
+	arena_chunk_t **spare, *chunk, *prev;
+	int released;
+
+	__chunks_retire(arena, NULL);
+	__chunk_use(arena, NULL);
+	arena->used = 0;
+
+	// sbrk chunks are released from the top of the heap, so retry the list
+	do {
+		released = 0;
+		for (spare = &arena->spare; *spare; ) {
+			chunk = *spare;
+			prev = chunk->prev;
+
+			if (__chunk_release(arena, chunk)) {
+				spare = &chunk->prev;
+				continue;
+			}
+
+			*spare = prev;
+			released = 1;
+		}
+	} while (released && arena->spare);
+}
+
+/**
+ * Begin a scope.
+ *
+ * @arena	: Arena.
+ * @scope	: Scope to save current position into.
+ */
+void arena_scope_begin(arena_t *arena, arena_scope_t *scope)
+{
+	scope->arena = arena;
+	scope->chunk = arena->chunk;
+	scope->ptr = arena->ptr;
+	scope->used = arena->used;
+}
+
+/**
+ * End a scope.
+ *
+ * All allocations done after scope begin (including the ones of nested
+ * scopes) are freed.
+ *
+ * @scope	: Scope.
+ */
+void arena_scope_end(arena_scope_t *scope)
+{
+	arena_t *arena = scope->arena;
+
+	__chunks_retire(arena, scope->chunk);
+	__chunk_use(arena, scope->chunk);
+	arena->ptr = scope->ptr;
+	arena->used = scope->used;
+}
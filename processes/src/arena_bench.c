@@ -0,0 +1,283 @@
+/**
+ * Arena allocator benchmark.
+ * Copyright (C) 2024 Lazar Razvan.
+ *
+ * Repeat the program_break allocation pattern (ALLOC_NUM allocations of
+ * BLK_SIZE bytes, then free all of them) ROUNDS times using:
+ * 	1) glibc malloc() and free()
+ * 	2) arena with sbrk() backend and arena_reset()
+ * 	3) arena with mmap() backend and arena_reset()
+ * 	4) arena with mmap() backend and a scope for each round
+ *
+ * For each allocator, the allocation throughput (allocations per second,
+ * including the free of each round), the resident set size and the program
+ * break growth (at the end of last round, before free) are reported. Each
+ * allocator runs in a separate child process, so that RSS and program break
+ * are not affected by the previous one.
+ *
+ * Usage:
+ * 	./run/arena_bench [rounds]
+ */
+
+#include <time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include <sys/wait.h>
+
+#include "debug.h"
+#include "arena.h"
+
+/*============================================================================*/
+
+/* Allocations number */
+#define ALLOC_NUM					1000
+
+/* Allocation mem size */
+#define BLK_SIZE					2048
+
+/* Default number of rounds */
+#define ROUNDS						1000
+
+/* Buffer to track allocated addresses */
+static void *mem[ALLOC_NUM];
+
+/* Initialized before running an allocator */
+static void *_base_program_break = NULL;
+
+/**
+ * Allocator result (at the end of last round, before free).
+ */
+typedef struct bench_result_s {
+
+	long	rss;				// resident set size (bytes)
+	long	brk;				// program break growth (bytes)
+
+} bench_result_t;
+
+/**
+ * Allocator benchmark.
+ */
+typedef struct bench_s {
+
+	const char	*name;
+	int			(*run)(int rounds, bench_result_t *res);
+
+} bench_t;
+
+/*==================================STATIC====================================*/
+
+/**
+ * Get resident set size (bytes) from /proc/self/statm.
+ */
+static long __get_rss(void)
+{
+	long size, resident = 0;
+	FILE *f;
+
+	f = fopen("/proc/self/statm", "r");
+	if (!f) {
+		ERROR("Fail to open /proc/self/statm!\n");
+		return 0;
+	}
+
+	if (fscanf(f, "%ld %ld", &size, &resident) != 2)
+		ERROR("Fail to read /proc/self/statm!\n");
+
+	fclose(f);
+
+	return resident * sysconf(_SC_PAGE_SIZE);
+}
+
+/**
+ * Record RSS and program break growth.
+ */
+static inline void __result_record(bench_result_t *res)
+{
+	res->rss = __get_rss();
+	res->brk = (char *)sbrk(0) - (char *)_base_program_break;
+}
+
+/**
+ * glibc malloc() and free().
+ */
+static int __bench_malloc(int rounds, bench_result_t *res)
+{
+	for (int r = 0; r < rounds; r++) {
+		for (int i = 0; i < ALLOC_NUM; i++) {
+			mem[i] = malloc(BLK_SIZE);
+			if (!mem[i]) {
+				ERROR("malloc error!\n");
+				return -1;
+			}
+			*(char *)mem[i] = i;
+		}
+
+		if (r == rounds - 1)
+			__result_record(res);
+
+		for (int i = 0; i < ALLOC_NUM; i++)
+			free(mem[i]);
+	}
+
+	return 0;
+}
+
+/**
+ * Arena with reset after each round.
+ */
+static int __bench_arena(int backend, int rounds, bench_result_t *res)
+{
+	arena_t arena;
+	int rv = 0;
+
+	if (arena_init(&arena, backend, 0))
+		return -1;
+
+	for (int r = 0; r < rounds; r++) {
+		for (int i = 0; i < ALLOC_NUM; i++) {
+			mem[i] = arena_alloc(&arena, BLK_SIZE);
+			if (!mem[i]) {
+				ERROR("arena_alloc error!\n");
+				rv = -2;
+				goto destroy;
+			}
+			*(char *)mem[i] = i;
+		}
+
+		if (r == rounds - 1)
+			__result_record(res);
+
+		arena_reset(&arena);
+	}
+
+destroy:
+	arena_destroy(&arena);
+	return rv;
+}
+
+static int __bench_arena_sbrk(int rounds, bench_result_t *res)
+{
+	return __bench_arena(ARENA_BACKEND_SBRK, rounds, res);
+}
+
+static int __bench_arena_mmap(int rounds, bench_result_t *res)
+{
+	return __bench_arena(ARENA_BACKEND_MMAP, rounds, res);
+}
+
+/**
+ * Arena with a scope for each round (nested in a scope for all rounds).
+ */
+static int __bench_arena_scope(int rounds, bench_result_t *res)
+{
+	arena_scope_t outer, inner;
+	arena_t arena;
+	int rv = 0;
+
+	if (arena_init(&arena, ARENA_BACKEND_MMAP, 0))
+		return -1;
+
+	arena_scope_begin(&arena, &outer);
+
+	for (int r = 0; r < rounds; r++) {
+		arena_scope_begin(&arena, &inner);
+
+		for (int i = 0; i < ALLOC_NUM; i++) {
+			mem[i] = arena_alloc(&arena, BLK_SIZE);
+			if (!mem[i]) {
+				ERROR("arena_alloc error!\n");
+				rv = -2;
+				goto destroy;
+			}
+			*(char *)mem[i] = i;
+		}
+
+		if (r == rounds - 1)
+			__result_record(res);
+
+		arena_scope_end(&inner);
+	}
+
+destroy:
+	arena_scope_end(&outer);
+	arena_destroy(&arena);
+	return rv;
+}
+
+/**
+ * Allocators.
+ */
+static const bench_t benches[] = {
+	{ "malloc",				__bench_malloc		},
+	{ "arena (sbrk)",		__bench_arena_sbrk	},
+	{ "arena (mmap)",		__bench_arena_mmap	},
+	{ "arena (mmap, scope)",	__bench_arena_scope	},
+};
+
+/**
+ * Run an allocator benchmark in a child process.
+ */
+static void __bench_run(const bench_t *bench, int rounds)
+{
+	struct timespec start, end;
+	bench_result_t res = { 0 };
+	double sec;
+	pid_t pid;
+
+	fflush(stdout);
+
+	pid = fork();
+	if (pid == -1) {
+		ERROR("fork error!\n");
+		return;
+	}
+
+	if (pid) {
+		waitpid(pid, NULL, 0);
+		return;
+	}
+
+	_base_program_break = sbrk(0);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	if (bench->run(rounds, &res)) {
+		ERROR("%s failed!\n", bench->name);
+		exit(1);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	sec = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+	printf("%-24s %14.0f %12ld %12ld\n", bench->name,
+			(double)rounds * ALLOC_NUM / sec, res.rss / 1024, res.brk / 1024);
+
+	exit(0);
+}
+
+/*============================================================================*/
+
+int main(int argc, char *argv[])
+{
+	int rounds = ROUNDS;
+
+	if (argc > 1)
+		rounds = atoi(argv[1]);
+
+	if (rounds <= 0) {
+		ERROR("Invalid number of rounds!\n");
+		return -1;
+	}
+
+	printf("%d rounds of %d allocations of %d bytes\n", rounds, ALLOC_NUM,
+			BLK_SIZE);
+	printf("%-24s %14s %12s %12s\n", "allocator", "allocs/s", "rss (KB)",
+			"break (KB)");
+
+	for (int i = 0; i < sizeof(benches) / sizeof(benches[0]); i++)
+		__bench_run(&benches[i], rounds);
+
+	return 0;
+}
@@ -0,0 +1,289 @@
+/**
+ * Copy-on-write cost benchmark.
+ * Copyright (C) 2024 Lazar Razvan.
+ *
+ * After fork(), parent and child share all private pages read-only and the
+ * first write to a page (from either process) triggers a minor fault that
+ * copies it (copy-on-write). This tool measures that cost in practice:
+ *
+ * 	- parent allocates and fills a buffer (all pages resident)
+ * 	- parent forks and the writer (child by default, parent with -p) writes
+ * 	one byte every stride bytes of the buffer
+ * 	- minor faults (getrusage()), total write time and time per touched page
+ * 	are reported, together with fork() time
+ *
+ * Same measurement is done with transparent huge pages disabled
+ * (MADV_NOHUGEPAGE) and enabled (MADV_HUGEPAGE), since a write to a huge page
+ * shared after fork() either copies the whole 2 MB or splits it, depending on
+ * kernel version.
+ *
+ * A snapshot-by-fork persistence scheme (child serializes the buffer while
+ * parent keeps serving writes) pays the parent writer cost (-p) for each page
+ * written during the snapshot.
+ *
+ * Usage:
+ * 	./run/cow_bench [-p] [size ...]
+ * 	./run/cow_bench -p 64M 1G
+ */
+
+#include <time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+
+#include "debug.h"
+
+/*============================================================================*/
+
+/* Huge page size (bytes) */
+#define HUGE_PAGE_SIZE				(2UL << 20)
+
+static const char *default_sizes[] = { "64M", "512M" };
+
+/* Write strides (bytes) */
+static const size_t strides[] = {
+	64, 4096, 16 * 1024, 64 * 1024, 256 * 1024, 2 * 1024 * 1024
+};
+
+/* Parent is the writer (child holds the snapshot) */
+static int parent_writer;
+
+/*==================================STATIC====================================*/
+
+/**
+ * Parse a size in bytes (K, M or G suffix).
+ *
+ * Return size on success and 0 otherwise.
+ */
+static size_t __size_parse(const char *str)
+{
+	unsigned long long size;
+	char *end;
+
+	size = strtoull(str, &end, 10);
+	switch (*end) {
+	case 'G':
+	case 'g':
+		size <<= 10;
+		// fallthrough
+	case 'M':
+	case 'm':
+		size <<= 10;
+		// fallthrough
+	case 'K':
+	case 'k':
+		size <<= 10;
+		end++;
+		break;
+	}
+
+	if (*end != '\0')
+		return 0;
+
+	return size;
+}
+
+static inline double __time_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static inline long __minflt(void)
+{
+	struct rusage usage;
+
+	getrusage(RUSAGE_SELF, &usage);
+
+	return usage.ru_minflt;
+}
+
+/**
+ * Get AnonHugePages of the process (KB) from /proc/self/smaps_rollup.
+ */
+static long __get_thp(void)
+{
+	char line[128];
+	long kb = 0;
+	FILE *f;
+
+	f = fopen("/proc/self/smaps_rollup", "r");
+	if (!f)
+		return 0;
+
+	while (fgets(line, sizeof(line), f))
+		if (sscanf(line, "AnonHugePages: %ld kB", &kb) == 1)
+			break;
+
+	fclose(f);
+
+	return kb;
+}
+
+/**
+ * Write one byte every stride bytes and print faults and time.
+ */
+static void __writer(char *buf, size_t size, size_t stride, double fork_time)
+{
+	size_t pages, page_size = sysconf(_SC_PAGE_SIZE);
+	long minflt;
+	double t;
+
+	// touched pages (a stride lower than page size touches every page)
+	pages = stride < page_size ? size / page_size : size / stride;
+
+	minflt = __minflt();
+	t = __time_now();
+	for (size_t i = 0; i < size; i += stride)
+		buf[i]++;
+	t = __time_now() - t;
+	minflt = __minflt() - minflt;
+
+	printf("%10zu %10.3f %10zu %10ld %10.3f %12.1f\n", stride, fork_time * 1e3,
+			pages, minflt, t * 1e3, t * 1e9 / pages);
+	fflush(stdout);
+}
+
+/**
+ * Fork and let the writer touch the buffer.
+ */
+static void __bench_stride(char *buf, size_t size, size_t stride)
+{
+	int pipe_fd[2];
+	double t;
+	char c;
+	pid_t pid;
+
+	if (pipe(pipe_fd) == -1) {
+		ERROR("pipe error: %s!\n", strerror(errno));
+		return;
+	}
+
+	fflush(stdout);
+
+	t = __time_now();
+	pid = fork();
+	t = __time_now() - t;
+
+	switch (pid) {
+	case -1:
+		ERROR("fork error: %s!\n", strerror(errno));
+		close(pipe_fd[0]);
+		close(pipe_fd[1]);
+		return;
+
+	case 0:
+		close(pipe_fd[1]);
+
+		if (parent_writer) {
+			// hold the snapshot until parent is done
+			if (read(pipe_fd[0], &c, 1) == -1)
+				ERROR("read error: %s!\n", strerror(errno));
+		} else {
+			__writer(buf, size, stride, t);
+		}
+
+		_exit(0);
+
+	default:
+		close(pipe_fd[0]);
+
+		if (parent_writer)
+			__writer(buf, size, stride, t);
+
+		// release child (closed pipe wakes it up)
+		close(pipe_fd[1]);
+		waitpid(pid, NULL, 0);
+		break;
+	}
+}
+
+/**
+ * Run all strides on a buffer with THP enabled or disabled.
+ */
+static void __bench(size_t size, int thp)
+{
+	size_t map_size = size + HUGE_PAGE_SIZE;
+	long thp_kb;
+	char *map, *buf;
+
+	map = mmap(NULL, map_size, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (map == MAP_FAILED) {
+		ERROR("mmap error: %s!\n", strerror(errno));
+		return;
+	}
+
+	// align to huge page size, so that THP can back the whole buffer
+	buf = (char *)(((uintptr_t)map + HUGE_PAGE_SIZE - 1) &
+					~(HUGE_PAGE_SIZE - 1));
+	if (madvise(buf, size, thp ? MADV_HUGEPAGE : MADV_NOHUGEPAGE))
+		ERROR("madvise error: %s!\n", strerror(errno));
+
+	thp_kb = __get_thp();
+	memset(buf, 1, size);
+	thp_kb = __get_thp() - thp_kb;
+
+	printf("================ %zu MB, THP %s (anon huge pages %ld MB), "
+			"%s writes ================\n", size >> 20, thp ? "on" : "off",
+			thp_kb >> 10, parent_writer ? "parent" : "child");
+	printf("%10s %10s %10s %10s %10s %12s\n", "stride", "fork ms",
+			"pages", "minflt", "write ms", "ns/page");
+
+	for (int i = 0; i < sizeof(strides) / sizeof(strides[0]); i++)
+		if (strides[i] <= size)
+			__bench_stride(buf, size, strides[i]);
+
+	munmap(map, map_size);
+}
+
+/*============================================================================*/
+
+int main(int argc, char *argv[])
+{
+	const char **sizes;
+	int opt, nr_sizes;
+	size_t size;
+
+	while ((opt = getopt(argc, argv, "p")) != -1) {
+		switch (opt) {
+		case 'p':
+			parent_writer = 1;
+			break;
+		default:
+			printf("Usage: %s [-p] [size ...]\n", argv[0]);
+			return -1;
+		}
+	}
+
+	if (optind < argc) {
+		sizes = (const char **)&argv[optind];
+		nr_sizes = argc - optind;
+	} else {
+		sizes = default_sizes;
+		nr_sizes = sizeof(default_sizes) / sizeof(default_sizes[0]);
+	}
+
+	for (int i = 0; i < nr_sizes; i++) {
+		size = __size_parse(sizes[i]);
+		if (!size) {
+			ERROR("Invalid size %s!\n", sizes[i]);
+			continue;
+		}
+
+		__bench(size, 0);
+		__bench(size, 1);
+	}
+
+	return 0;
+}
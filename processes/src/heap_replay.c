@@ -0,0 +1,705 @@
+/**
+ * Heap allocation trace replay.
+ * Copyright (C) 2024 Lazar Razvan.
+ *
+ * Replay a malloc_trace.so trace (or a hand written trace file using the same
+ * format) against different allocators:
+ * 	1) glibc malloc() with default settings
+ * 	2) glibc malloc() with a lower mmap threshold (M_MMAP_THRESHOLD), so that
+ * 	large blocks are served by mmap() and returned to the OS on free()
+ * 	3) arena (frees are ignored, memory is released when the arena is
+ * 	destroyed), showing how large an arena has to be for the traced program
+ * 	4) pools for power of two size classes (up to POOL_CLASS_MAX bytes, larger
+ * 	blocks are served by glibc)
+ *
+ * Each allocated block is fully written, so that its pages are resident. For
+ * each allocator, the following are reported:
+ * 	- RSS when live bytes peak (current RSS, read right after the event that
+ * 	reaches the peak, since ru_maxrss of the child also counts the parsed
+ * 	trace inherited from the parent)
+ * 	- fragmentation ratio (RSS growth at peak / peak live bytes requested)
+ * 	- program break peak growth and number of times the break shrinks
+ *
+ * Pointers of the trace are mapped to slots while parsing, so replay does not
+ * need any lookup. Each allocator is replayed in a separate child process.
+ *
+ * Usage:
+ * 	./run/heap_replay [-m mmap_threshold] <trace file>
+ */
+
+#include <time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <malloc.h>
+#include <unistd.h>
+
+#include <sys/wait.h>
+
+#include "debug.h"
+#include "arena.h"
+#include "pool.h"
+
+/*============================================================================*/
+
+/* Default mmap threshold for glibc (bytes) */
+#define MMAP_THRESHOLD				(16 * 1024)
+
+/* Pool size classes (16 bytes up to POOL_CLASS_MAX) */
+#define POOL_CLASS_MIN_SHIFT		4
+#define POOL_CLASS_MAX_SHIFT		12
+#define POOL_CLASS_MAX				(1 << POOL_CLASS_MAX_SHIFT)
+#define POOL_CLASSES				\
+		(POOL_CLASS_MAX_SHIFT - POOL_CLASS_MIN_SHIFT + 1)
+
+/**
+ * Trace event.
+ */
+typedef struct event_s {
+
+	char		op;				// 'm' (alloc), 'r' (realloc) or 'f' (free)
+	uint32_t	slot;			// block slot
+	uint32_t	old;			// old block slot (realloc)
+	size_t		size;			// block size
+
+} event_t;
+
+/**
+ * Parsed trace.
+ */
+typedef struct trace_s {
+
+	event_t		*events;		// events
+	size_t		nr;				// number of events
+	size_t		cap;			// events capacity
+	uint32_t	slots;			// number of slots
+	size_t		allocs;			// number of allocations
+	size_t		live;			// live bytes
+	size_t		peak;			// peak live bytes
+	size_t		peak_event;		// event reaching peak live bytes
+
+} trace_t;
+
+/**
+ * Pointer to slot map entry (open addressing).
+ */
+typedef struct map_entry_s {
+
+	uintptr_t	ptr;			// pointer (0 for empty, 1 for deleted)
+	uint32_t	slot;			// slot
+	size_t		size;			// block size
+
+} map_entry_t;
+
+/**
+ * Replay allocator.
+ */
+typedef struct allocator_s {
+
+	const char	*name;
+	int			(*init)(void);
+	void		*(*alloc)(size_t size);
+	void		*(*realloc)(void *ptr, size_t old, size_t size);
+	void		(*free)(void *ptr, size_t size);
+	void		(*fini)(void);
+
+} allocator_t;
+
+/**
+ * Replay result.
+ */
+typedef struct result_s {
+
+	double		sec;			// replay time
+	long		rss_base;		// RSS before replay
+	long		rss_peak;		// RSS at peak live bytes
+	long		brk_peak;		// program break peak growth
+	long		brk_shrink;		// number of program break decreases
+
+} result_t;
+
+static size_t mmap_threshold = MMAP_THRESHOLD;
+static pool_t pools[POOL_CLASSES];
+static arena_t arena;
+static trace_t trace;
+
+/* Pointer to slot map */
+static map_entry_t *map;
+static size_t map_cap;
+static size_t map_used;
+
+/* Free slots stack */
+static uint32_t *free_slots;
+static size_t free_nr;
+static size_t free_cap;
+
+/*==================================STATIC====================================*/
+
+/**
+ * Get resident set size (bytes) from /proc/self/statm.
+ */
+static long __get_rss(void)
+{
+	long size, resident = 0;
+	FILE *f;
+
+	f = fopen("/proc/self/statm", "r");
+	if (!f) {
+		ERROR("Fail to open /proc/self/statm!\n");
+		return 0;
+	}
+
+	if (fscanf(f, "%ld %ld", &size, &resident) != 2)
+		ERROR("Fail to read /proc/self/statm!\n");
+
+	fclose(f);
+
+	return resident * sysconf(_SC_PAGE_SIZE);
+}
+
+static inline size_t __map_hash(uintptr_t ptr)
+{
+	return (ptr >> 4) * 0x9E3779B97F4A7C15ULL;
+}
+
+static int __map_insert(uintptr_t ptr, uint32_t slot, size_t size);
+
+/**
+ * Grow map and drop deleted entries.
+ */
+static int __map_grow(void)
+{
+	map_entry_t *old = map;
+	size_t old_cap = map_cap;
+
+	map_cap = map_cap ? map_cap * 2 : 1024;
+	map = calloc(map_cap, sizeof(map_entry_t));
+	if (!map) {
+		ERROR("Fail to alloc map!\n");
+		return -1;
+	}
+
+	map_used = 0;
+	for (size_t i = 0; i < old_cap; i++)
+		if (old[i].ptr > 1)
+			__map_insert(old[i].ptr, old[i].slot, old[i].size);
+
+	free(old);
+
+	return 0;
+}
+
+static int __map_insert(uintptr_t ptr, uint32_t slot, size_t size)
+{
+	size_t i;
+
+	if ((map_used + 1) * 2 > map_cap && __map_grow())
+		return -1;
+
+	for (i = __map_hash(ptr) & (map_cap - 1); map[i].ptr > 1;
+			i = (i + 1) & (map_cap - 1))
+		;
+
+	// deleted entries are counted until next grow
+	if (map[i].ptr == 0)
+		map_used++;
+
+	map[i].ptr = ptr;
+	map[i].slot = slot;
+	map[i].size = size;
+
+	return 0;
+}
+
+/**
+ * Remove pointer from map.
+ *
+ * Return map entry (valid until next insert) or NULL if not found.
+ */
+static map_entry_t *__map_remove(uintptr_t ptr)
+{
+	size_t i;
+
+	if (!map_cap)
+		return NULL;
+
+	for (i = __map_hash(ptr) & (map_cap - 1); map[i].ptr;
+			i = (i + 1) & (map_cap - 1)) {
+		if (map[i].ptr == ptr) {
+			map[i].ptr = 1;
+			return &map[i];
+		}
+	}
+
+	return NULL;
+}
+
+/**
+ * Get a free slot.
+ */
+static uint32_t __slot_get(void)
+{
+	if (free_nr)
+		return free_slots[--free_nr];
+
+	return trace.slots++;
+}
+
+static int __slot_put(uint32_t slot)
+{
+	uint32_t *slots;
+
+	if (free_nr == free_cap) {
+		free_cap = free_cap ? free_cap * 2 : 1024;
+		slots = realloc(free_slots, free_cap * sizeof(uint32_t));
+		if (!slots) {
+			ERROR("Fail to alloc free slots!\n");
+			return -1;
+		}
+		free_slots = slots;
+	}
+
+	free_slots[free_nr++] = slot;
+
+	return 0;
+}
+
+/**
+ * Append an event to trace.
+ */
+static event_t *__event_add(char op)
+{
+	event_t *events;
+
+	if (trace.nr == trace.cap) {
+		trace.cap = trace.cap ? trace.cap * 2 : 4096;
+		events = realloc(trace.events, trace.cap * sizeof(event_t));
+		if (!events) {
+			ERROR("Fail to alloc events!\n");
+			return NULL;
+		}
+		trace.events = events;
+	}
+
+	trace.events[trace.nr].op = op;
+
+	return &trace.events[trace.nr++];
+}
+
+/**
+ * Record a block allocation (new slot mapped to pointer).
+ */
+static int __trace_alloc(event_t *ev, uintptr_t ptr, size_t size)
+{
+	ev->slot = __slot_get();
+	ev->size = size;
+
+	trace.allocs++;
+	trace.live += size;
+	if (trace.live > trace.peak) {
+		trace.peak = trace.live;
+		trace.peak_event = trace.nr - 1;
+	}
+
+	return __map_insert(ptr, ev->slot, size);
+}
+
+/**
+ * Parse a trace file into events.
+ *
+ * Frees and reallocs of pointers not allocated in trace are ignored.
+ *
+ * Return 0 on success and <0 otherwise.
+ */
+static int __trace_parse(const char *path)
+{
+	void *ptr, *old;
+	map_entry_t *e;
+	char line[128];
+	event_t *ev;
+	size_t size;
+	int rv = 0;
+	FILE *f;
+
+	f = fopen(path, "r");
+	if (!f) {
+		ERROR("Fail to open %s!\n", path);
+		return -1;
+	}
+
+	while (fgets(line, sizeof(line), f)) {
+		switch (line[0]) {
+		case 'm':
+			if (sscanf(line, "m %zu %p", &size, &ptr) != 2)
+				goto invalid;
+
+			ev = __event_add('m');
+			if (!ev || __trace_alloc(ev, (uintptr_t)ptr, size))
+				goto error;
+			break;
+
+		case 'r':
+			if (sscanf(line, "r %p %zu %p", &old, &size, &ptr) != 3)
+				goto invalid;
+
+			e = __map_remove((uintptr_t)old);
+			if (!e)
+				break;
+
+			ev = __event_add('r');
+			if (!ev)
+				goto error;
+
+			ev->old = e->slot;
+			trace.live -= e->size;
+			if (__slot_put(e->slot) || __trace_alloc(ev, (uintptr_t)ptr, size))
+				goto error;
+			break;
+
+		case 'f':
+			if (sscanf(line, "f %p", &ptr) != 1)
+				goto invalid;
+
+			e = __map_remove((uintptr_t)ptr);
+			if (!e)
+				break;
+
+			ev = __event_add('f');
+			if (!ev)
+				goto error;
+
+			ev->slot = e->slot;
+			ev->size = e->size;
+			trace.live -= e->size;
+			if (__slot_put(e->slot))
+				goto error;
+			break;
+
+		default:
+			goto invalid;
+		}
+	}
+
+	goto close;
+
+invalid:
+	ERROR("Invalid trace line: %s", line);
+error:
+	rv = -2;
+close:
+	fclose(f);
+	free(map);
+	free(free_slots);
+
+	return rv;
+}
+
+/**
+ * glibc allocator.
+ */
+static int __glibc_init(void)
+{
+	return 0;
+}
+
+static int __glibc_mmap_init(void)
+{
+	if (!mallopt(M_MMAP_THRESHOLD, mmap_threshold)) {
+		ERROR("mallopt() failed!\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+static void *__glibc_alloc(size_t size)
+{
+	return malloc(size);
+}
+
+static void *__glibc_realloc(void *ptr, size_t old, size_t size)
+{
+	return realloc(ptr, size);
+}
+
+static void __glibc_free(void *ptr, size_t size)
+{
+	free(ptr);
+}
+
+static void __glibc_fini(void)
+{
+}
+
+/**
+ * Arena allocator (frees ignored).
+ */
+static int __arena_init(void)
+{
+	return arena_init(&arena, ARENA_BACKEND_MMAP, 0);
+}
+
+static void *__arena_alloc(size_t size)
+{
+	return arena_alloc(&arena, size);
+}
+
+static void *__arena_realloc(void *ptr, size_t old, size_t size)
+{
+	void *p = arena_alloc(&arena, size);
+
+	if (p)
+		memcpy(p, ptr, old < size ? old : size);
+
+	return p;
+}
+
+static void __arena_free(void *ptr, size_t size)
+{
+}
+
+static void __arena_fini(void)
+{
+	arena_destroy(&arena);
+}
+
+/**
+ * Pool allocators (power of two size classes).
+ */
+static inline int __pool_class(size_t size)
+{
+	int c = 0;
+
+	while (((size_t)1 << (c + POOL_CLASS_MIN_SHIFT)) < size)
+		c++;
+
+	return c;
+}
+
+static int __pool_init(void)
+{
+	for (int c = 0; c < POOL_CLASSES; c++)
+		if (pool_init(&pools[c], 1 << (c + POOL_CLASS_MIN_SHIFT), 0))
+			return -1;
+
+	return 0;
+}
+
+static void *__pool_alloc(size_t size)
+{
+	if (size > POOL_CLASS_MAX)
+		return malloc(size);
+
+	return pool_alloc(&pools[__pool_class(size)]);
+}
+
+static void __pool_free(void *ptr, size_t size)
+{
+	if (size > POOL_CLASS_MAX)
+		free(ptr);
+	else
+		pool_free(&pools[__pool_class(size)], ptr);
+}
+
+static void *__pool_realloc(void *ptr, size_t old, size_t size)
+{
+	void *p;
+
+	if (old > POOL_CLASS_MAX && size > POOL_CLASS_MAX)
+		return realloc(ptr, size);
+
+	p = __pool_alloc(size);
+	if (p) {
+		memcpy(p, ptr, old < size ? old : size);
+		__pool_free(ptr, old);
+	}
+
+	return p;
+}
+
+static void __pool_fini(void)
+{
+	for (int c = 0; c < POOL_CLASSES; c++)
+		pool_destroy(&pools[c]);
+}
+
+static const allocator_t allocators[] = {
+	{
+		.name		= "glibc",
+		.init		= __glibc_init,
+		.alloc		= __glibc_alloc,
+		.realloc	= __glibc_realloc,
+		.free		= __glibc_free,
+		.fini		= __glibc_fini,
+	},
+	{
+		.name		= "glibc (mmap threshold)",
+		.init		= __glibc_mmap_init,
+		.alloc		= __glibc_alloc,
+		.realloc	= __glibc_realloc,
+		.free		= __glibc_free,
+		.fini		= __glibc_fini,
+	},
+	{
+		.name		= "arena (no free)",
+		.init		= __arena_init,
+		.alloc		= __arena_alloc,
+		.realloc	= __arena_realloc,
+		.free		= __arena_free,
+		.fini		= __arena_fini,
+	},
+	{
+		.name		= "pool (size classes)",
+		.init		= __pool_init,
+		.alloc		= __pool_alloc,
+		.realloc	= __pool_realloc,
+		.free		= __pool_free,
+		.fini		= __pool_fini,
+	},
+};
+
+/**
+ * Replay trace events.
+ *
+ * Return 0 on success and <0 otherwise.
+ */
+static int __replay(const allocator_t *a, result_t *res)
+{
+	struct timespec start, end;
+	char *brk_base, *brk, *brk_last;
+	void **slots;
+	size_t *sizes;
+	event_t *ev;
+
+	slots = calloc(trace.slots, sizeof(void *));
+	sizes = calloc(trace.slots, sizeof(size_t));
+	if (!slots || !sizes) {
+		ERROR("Fail to alloc slots!\n");
+		return -1;
+	}
+
+	if (a->init()) {
+		ERROR("Fail to init %s!\n", a->name);
+		return -2;
+	}
+
+	res->rss_base = __get_rss();
+	brk_base = brk_last = sbrk(0);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	for (size_t i = 0; i < trace.nr; i++) {
+		ev = &trace.events[i];
+
+		switch (ev->op) {
+		case 'm':
+			slots[ev->slot] = a->alloc(ev->size);
+			break;
+		case 'r':
+			slots[ev->slot] = a->realloc(slots[ev->old], sizes[ev->old],
+										ev->size);
+			break;
+		case 'f':
+			a->free(slots[ev->slot], sizes[ev->slot]);
+			slots[ev->slot] = NULL;
+			break;
+		}
+
+		if (ev->op != 'f') {
+			if (!slots[ev->slot] && ev->size) {
+				ERROR("%s failed to alloc %zu bytes!\n", a->name, ev->size);
+				return -3;
+			}
+
+			sizes[ev->slot] = ev->size;
+			memset(slots[ev->slot], 0xa5, ev->size);
+		}
+
+		if (i == trace.peak_event)
+			res->rss_peak = __get_rss();
+
+		brk = sbrk(0);
+		if (brk < brk_last)
+			res->brk_shrink++;
+		if (brk - brk_base > res->brk_peak)
+			res->brk_peak = brk - brk_base;
+		brk_last = brk;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	res->sec = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+	a->fini();
+
+	return 0;
+}
+
+/**
+ * Replay trace in a child process and print result.
+ */
+static void __replay_run(const allocator_t *a)
+{
+	result_t res = { 0 };
+	pid_t pid;
+
+	fflush(stdout);
+
+	pid = fork();
+	if (pid == -1) {
+		ERROR("fork error!\n");
+		return;
+	}
+
+	if (pid) {
+		waitpid(pid, NULL, 0);
+		return;
+	}
+
+	if (__replay(a, &res))
+		exit(1);
+
+	printf("%-24s %10.3f %12ld %8.2f %12ld %8ld\n", a->name, res.sec * 1e3,
+			res.rss_peak / 1024,
+			trace.peak ? (double)(res.rss_peak - res.rss_base) / trace.peak : 0,
+			res.brk_peak / 1024, res.brk_shrink);
+
+	exit(0);
+}
+
+/*============================================================================*/
+
+int main(int argc, char *argv[])
+{
+	int opt;
+
+	while ((opt = getopt(argc, argv, "m:")) != -1) {
+		switch (opt) {
+		case 'm':
+			mmap_threshold = atol(optarg);
+			break;
+		default:
+			goto usage;
+		}
+	}
+
+	if (optind != argc - 1)
+		goto usage;
+
+	if (__trace_parse(argv[optind]))
+		return -1;
+
+	printf("%zu events, %zu allocations, peak live %zu KB, mmap threshold %zu\n",
+			trace.nr, trace.allocs, trace.peak / 1024, mmap_threshold);
+	printf("%-24s %10s %12s %8s %12s %8s\n", "allocator", "time (ms)",
+			"rss@peak(KB)", "frag", "brk peak(KB)", "shrinks");
+
+	for (int i = 0; i < sizeof(allocators) / sizeof(allocators[0]); i++)
+		__replay_run(&allocators[i]);
+
+	return 0;
+
+usage:
+	printf("Usage: %s [-m mmap_threshold] <trace file>\n", argv[0]);
+	return -1;
+}
@@ -0,0 +1,433 @@
+/**
+ * Huge pages benchmark.
+ * Copyright (C) 2024 Lazar Razvan.
+ *
+ * Allocate a large buffer using different memory backings:
+ * 	1) mmap()
+ * 		Anonymous mapping with transparent huge pages disabled
+ * 	(MADV_NOHUGEPAGE), so that only base pages are used.
+ *
+ * 	2) mmap() + madvise(MADV_HUGEPAGE)
+ * 		Transparent huge pages (THP). Mapping is aligned to the huge page
+ * 	size, so that page faults allocate huge pages when available.
+ *
+ * 	3) mmap(MAP_HUGETLB)
+ * 		Huge pages from the hugetlbfs pool (reserved using vm.nr_hugepages).
+ *
+ * 	4) memfd_create(MFD_HUGETLB)
+ * 		Shareable file descriptor backed by the hugetlbfs pool.
+ *
+ * For each backing, the following are measured:
+ * 	- fault time: first write to each base page
+ * 	- streaming read and write throughput over the whole buffer
+ * 	- random read latency (independent reads at random offsets)
+ *
+ * A base page maps 4 KB while a huge page maps 2 MB, so the same number of
+ * TLB entries cover 512x more memory and a TLB miss walks one page table
+ * level less. dTLB misses are counted using perf events (when hardware
+ * counters are available) and page faults using software counters.
+ *
+ * Usage:
+ * 	./run/hugepage_bench [size]
+ * 	./run/hugepage_bench 4G
+ */
+
+#define _GNU_SOURCE
+
+#include <time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include <sys/mman.h>
+#include <linux/perf_event.h>
+
+#include "debug.h"
+#include "perf_counters.h"
+
+/*============================================================================*/
+
+/* Default buffer size (bytes) */
+#define BUF_SIZE					(512UL << 20)
+
+/* Huge page size (bytes) */
+#define HUGE_PAGE_SIZE				(2UL << 20)
+
+/* Random reads for latency kernel */
+#define RANDOM_READS				(16 * 1024 * 1024)
+
+/**
+ * Counters (dTLB misses and page faults).
+ */
+#define DTLB_READ_MISS		(PERF_COUNT_HW_CACHE_DTLB |					\
+							(PERF_COUNT_HW_CACHE_OP_READ << 8) |		\
+							(PERF_COUNT_HW_CACHE_RESULT_MISS << 16))
+#define DTLB_WRITE_MISS		(PERF_COUNT_HW_CACHE_DTLB |					\
+							(PERF_COUNT_HW_CACHE_OP_WRITE << 8) |		\
+							(PERF_COUNT_HW_CACHE_RESULT_MISS << 16))
+
+static const perf_event_desc_t counters_events[] = {
+	{ "dTLB-load-misses",	PERF_TYPE_HW_CACHE,	DTLB_READ_MISS				},
+	{ "dTLB-store-misses",	PERF_TYPE_HW_CACHE,	DTLB_WRITE_MISS				},
+	{ "page-faults",		PERF_TYPE_SOFTWARE,	PERF_COUNT_SW_PAGE_FAULTS	},
+};
+
+/**
+ * Memory backing.
+ */
+typedef struct backing_s {
+
+	const char	*name;
+	void		*(*alloc)(size_t size);
+	void		(*free)(void *buf, size_t size);
+
+} backing_t;
+
+static perf_counters_t pc;
+static int pc_opened;
+
+/* Unaligned mapping (THP backing) */
+static void *thp_map;
+static size_t thp_map_size;
+
+/*==================================STATIC====================================*/
+
+/**
+ * Parse a size in bytes (K, M or G suffix).
+ *
+ * Return size on success and 0 otherwise.
+ */
+static size_t __size_parse(const char *str)
+{
+	unsigned long long size;
+	char *end;
+
+	size = strtoull(str, &end, 10);
+	switch (*end) {
+	case 'G':
+	case 'g':
+		size <<= 10;
+		// fallthrough
+	case 'M':
+	case 'm':
+		size <<= 10;
+		// fallthrough
+	case 'K':
+	case 'k':
+		size <<= 10;
+		end++;
+		break;
+	}
+
+	if (*end != '\0')
+		return 0;
+
+	return size;
+}
+
+static inline double __time_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * Get AnonHugePages of the process (KB) from /proc/self/smaps_rollup.
+ */
+static long __get_thp(void)
+{
+	char line[128];
+	long kb = 0;
+	FILE *f;
+
+	f = fopen("/proc/self/smaps_rollup", "r");
+	if (!f)
+		return 0;
+
+	while (fgets(line, sizeof(line), f))
+		if (sscanf(line, "AnonHugePages: %ld kB", &kb) == 1)
+			break;
+
+	fclose(f);
+
+	return kb;
+}
+
+/**
+ * Counters start and stop (no-op if counters not available).
+ */
+static inline void __counters_start(void)
+{
+	if (pc_opened && perf_counters_start(&pc))
+		ERROR("Fail to start counters!\n");
+}
+
+static inline void __counters_stop(void)
+{
+	if (pc_opened && perf_counters_stop(&pc))
+		ERROR("Fail to stop counters!\n");
+}
+
+static inline uint64_t __counter(uint32_t type, uint64_t config)
+{
+	return pc_opened ? perf_counters_get(&pc, type, config) : PERF_COUNTER_NA;
+}
+
+/**
+ * Print a counter divided by a number of operations.
+ */
+static void __counter_print(const char *name, uint64_t value, double ops)
+{
+	if (value == PERF_COUNTER_NA)
+		printf("    %s: n/a\n", name);
+	else
+		printf("    %s: %lu (%.4f per access)\n", name, value, value / ops);
+}
+
+/**
+ * Plain mmap() with THP disabled.
+ */
+static void *__mmap_alloc(size_t size)
+{
+	void *buf;
+
+	buf = mmap(NULL, size, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (buf == MAP_FAILED)
+		return NULL;
+
+	if (madvise(buf, size, MADV_NOHUGEPAGE))
+		DEBUG("madvise(MADV_NOHUGEPAGE) failed: %s\n", strerror(errno));
+
+	return buf;
+}
+
+static void __mmap_free(void *buf, size_t size)
+{
+	munmap(buf, size);
+}
+
+/**
+ * mmap() aligned to huge page size and madvise(MADV_HUGEPAGE).
+ */
+static void *__thp_alloc(size_t size)
+{
+	uintptr_t buf;
+
+	thp_map_size = size + HUGE_PAGE_SIZE;
+	thp_map = mmap(NULL, thp_map_size, PROT_READ | PROT_WRITE,
+				MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (thp_map == MAP_FAILED)
+		return NULL;
+
+	buf = ((uintptr_t)thp_map + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+	if (madvise((void *)buf, size, MADV_HUGEPAGE)) {
+		ERROR("madvise(MADV_HUGEPAGE) failed: %s!\n", strerror(errno));
+		munmap(thp_map, thp_map_size);
+		return NULL;
+	}
+
+	return (void *)buf;
+}
+
+static void __thp_free(void *buf, size_t size)
+{
+	munmap(thp_map, thp_map_size);
+}
+
+/**
+ * mmap(MAP_HUGETLB) from hugetlbfs pool.
+ */
+static void *__hugetlb_alloc(size_t size)
+{
+	void *buf;
+
+	buf = mmap(NULL, size, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+	if (buf == MAP_FAILED)
+		return NULL;
+
+	return buf;
+}
+
+/**
+ * memfd_create(MFD_HUGETLB) from hugetlbfs pool.
+ */
+static void *__memfd_alloc(size_t size)
+{
+	void *buf;
+	int fd;
+
+	fd = memfd_create("hugepage_bench", MFD_CLOEXEC | MFD_HUGETLB);
+	if (fd == -1)
+		return NULL;
+
+	if (ftruncate(fd, size) == -1) {
+		close(fd);
+		return NULL;
+	}
+
+	buf = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+	// mapping keeps the file alive
+	close(fd);
+
+	if (buf == MAP_FAILED)
+		return NULL;
+
+	return buf;
+}
+
+static const backing_t backings[] = {
+	{ "mmap",						__mmap_alloc,		__mmap_free	},
+	{ "mmap + MADV_HUGEPAGE",		__thp_alloc,		__thp_free	},
+	{ "mmap + MAP_HUGETLB",			__hugetlb_alloc,	__mmap_free	},
+	{ "memfd + MFD_HUGETLB",		__memfd_alloc,		__mmap_free	},
+};
+
+/**
+ * Kernels.
+ */
+static void __kernel_fault(char *buf, size_t size)
+{
+	long page_size = sysconf(_SC_PAGE_SIZE);
+
+	for (size_t i = 0; i < size; i += page_size)
+		buf[i] = 1;
+}
+
+static uint64_t __kernel_read(const uint64_t *buf, size_t n)
+{
+	uint64_t sum = 0;
+
+	for (size_t i = 0; i < n; i++)
+		sum += buf[i];
+
+	return sum;
+}
+
+static uint64_t __kernel_random(const uint64_t *buf, size_t n)
+{
+	uint64_t sum = 0, x = 88172645463325252ULL;
+
+	for (size_t i = 0; i < RANDOM_READS; i++) {
+		x ^= x << 13;
+		x ^= x >> 7;
+		x ^= x << 17;
+		sum += buf[x % n];
+	}
+
+	return sum;
+}
+
+/**
+ * Run all kernels on a backing.
+ */
+static void __bench(const backing_t *b, size_t size)
+{
+	size_t n = size / sizeof(uint64_t);
+	volatile uint64_t sink;
+	long thp_before;
+	double t;
+	char *buf;
+
+	printf("---------------- %s ----------------\n", b->name);
+
+	thp_before = __get_thp();
+	buf = b->alloc(size);
+	if (!buf) {
+		printf("not available: %s\n", strerror(errno));
+		if (errno == ENOMEM || errno == EINVAL)
+			printf("(reserve huge pages using sysctl vm.nr_hugepages)\n");
+		return;
+	}
+
+	// fault
+	__counters_start();
+	t = __time_now();
+	__kernel_fault(buf, size);
+	t = __time_now() - t;
+	__counters_stop();
+
+	printf("fault: %.3f ms, anon huge pages: %ld KB\n", t * 1e3,
+			__get_thp() - thp_before);
+	__counter_print("page-faults",
+				__counter(PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS),
+				size / sysconf(_SC_PAGE_SIZE));
+
+	// streaming write
+	__counters_start();
+	t = __time_now();
+	memset(buf, 0x5a, size);
+	t = __time_now() - t;
+	__counters_stop();
+
+	printf("stream write: %.3f GB/s\n", size / t / 1e9);
+	__counter_print("dTLB-store-misses",
+				__counter(PERF_TYPE_HW_CACHE, DTLB_WRITE_MISS), n);
+
+	// streaming read
+	__counters_start();
+	t = __time_now();
+	sink = __kernel_read((uint64_t *)buf, n);
+	t = __time_now() - t;
+	__counters_stop();
+
+	printf("stream read: %.3f GB/s\n", size / t / 1e9);
+	__counter_print("dTLB-load-misses",
+				__counter(PERF_TYPE_HW_CACHE, DTLB_READ_MISS), n);
+
+	// random read
+	__counters_start();
+	t = __time_now();
+	sink = __kernel_random((uint64_t *)buf, n);
+	t = __time_now() - t;
+	__counters_stop();
+
+	printf("random read: %.3f ns/access\n", t * 1e9 / RANDOM_READS);
+	__counter_print("dTLB-load-misses",
+				__counter(PERF_TYPE_HW_CACHE, DTLB_READ_MISS), RANDOM_READS);
+
+	(void)sink;
+	b->free(buf, size);
+}
+
+/*============================================================================*/
+
+int main(int argc, char *argv[])
+{
+	size_t size = BUF_SIZE;
+
+	if (argc > 1) {
+		size = __size_parse(argv[1]);
+		if (!size) {
+			printf("Usage: %s [size]\n", argv[0]);
+			return -1;
+		}
+	}
+
+	// huge page backings need a multiple of huge page size
+	size = (size + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+
+	printf("Buffer size = %zu MB, page size = %ld, huge page size = %lu\n",
+			size >> 20, sysconf(_SC_PAGE_SIZE), HUGE_PAGE_SIZE);
+
+	pc_opened = perf_counters_open(&pc, counters_events,
+						sizeof(counters_events) / sizeof(counters_events[0])) > 0;
+	if (pc_opened && !pc.hw)
+		printf("hardware counters not available (software counters only)\n");
+
+	for (int i = 0; i < sizeof(backings) / sizeof(backings[0]); i++)
+		__bench(&backings[i], size);
+
+	if (pc_opened)
+		perf_counters_close(&pc);
+
+	return 0;
+}
@@ -0,0 +1,265 @@
+/**
+ * Heap allocation trace (LD_PRELOAD shim).
+ * Copyright (C) 2024 Lazar Razvan.
+ *
+ * Intercept malloc(), calloc(), realloc(), free() and aligned allocations of
+ * a program and record them into a trace file that is replayed by heap_replay
+ * against different allocators.
+ *
+ * Trace file is a text file with one event per line:
+ * 	m <size> <ptr>				malloc(), calloc(), aligned allocations
+ * 	r <old ptr> <size> <ptr>	realloc()
+ * 	f <ptr>						free()
+ *
+ * Trace file path is taken from HEAP_TRACE_FILE environment variable ("%d" is
+ * replaced by pid) and defaults to heap_trace.<pid>. Events are buffered and
+ * written using write() system call, since stdio would allocate memory. A
+ * forked child traces into its own file.
+ *
+ * Note that an event is recorded after the glibc call returns, so for multi
+ * threaded programs, a block released by realloc() may be reused by another
+ * thread before the realloc() event is recorded.
+ *
+ * Usage:
+ * 	LD_PRELOAD=./run/malloc_trace.so ./run/program_break
+ * 	HEAP_TRACE_FILE=/tmp/trace.%d LD_PRELOAD=./run/malloc_trace.so <program>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <pthread.h>
+
+/*============================================================================*/
+
+/* Trace buffer size (bytes) */
+#define TRACE_BUF_SIZE				(64 * 1024)
+
+/* Max length of an event line */
+#define TRACE_LINE_MAX				80
+
+/* Environment variable with trace file path */
+#define TRACE_FILE_ENV				"HEAP_TRACE_FILE"
+
+/* Default trace file path */
+#define TRACE_FILE_DEFAULT			"heap_trace.%d"
+
+/**
+ * glibc allocator entry points (no dlsym() needed, that allocates memory).
+ */
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void *__libc_memalign(size_t alignment, size_t size);
+extern void __libc_free(void *ptr);
+
+static char trace_buf[TRACE_BUF_SIZE];
+static size_t trace_len;
+static int trace_fd = -1;
+static int trace_lock;
+
+/* Set while recording, so that allocations of the shim are not recorded */
+static __thread int trace_busy;
+
+/*==================================STATIC====================================*/
+
+static inline void __lock(void)
+{
+	while (__atomic_exchange_n(&trace_lock, 1, __ATOMIC_ACQUIRE))
+		;
+}
+
+static inline void __unlock(void)
+{
+	__atomic_store_n(&trace_lock, 0, __ATOMIC_RELEASE);
+}
+
+/**
+ * Write buffered events (lock held).
+ */
+static void __flush(void)
+{
+	size_t off = 0;
+	ssize_t rv;
+
+	while (trace_fd != -1 && off < trace_len) {
+		rv = write(trace_fd, trace_buf + off, trace_len - off);
+		if (rv <= 0)
+			break;
+		off += rv;
+	}
+
+	trace_len = 0;
+}
+
+/**
+ * Open trace file (lock held).
+ *
+ * Path comes from the environment, so it is never used as a format string,
+ * only its first "%d" is replaced by pid.
+ */
+static void __open(void)
+{
+	const char *path = getenv(TRACE_FILE_ENV), *p;
+	char name[256];
+
+	if (!path)
+		path = TRACE_FILE_DEFAULT;
+
+	p = strstr(path, "%d");
+	if (p)
+		snprintf(name, sizeof(name), "%.*s%d%s", (int)(p - path), path,
+				getpid(), p + 2);
+	else
+		snprintf(name, sizeof(name), "%s", path);
+
+	trace_fd = open(name, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+}
+
+/**
+ * Record an event line.
+ */
+static void __record(const char *fmt, ...)
+	__attribute__((format(printf, 1, 2)));
+
+static void __record(const char *fmt, ...)
+{
+	va_list args;
+
+	if (trace_busy)
+		return;
+
+	trace_busy = 1;
+	__lock();
+
+	if (trace_fd == -1)
+		__open();
+
+	if (trace_len + TRACE_LINE_MAX > TRACE_BUF_SIZE)
+		__flush();
+
+	va_start(args, fmt);
+	trace_len += vsnprintf(trace_buf + trace_len, TRACE_LINE_MAX, fmt, args);
+	va_end(args);
+
+	__unlock();
+	trace_busy = 0;
+}
+
+/**
+ * Flush events before fork (child must not write parent events again) and
+ * trace child into its own file.
+ */
+static void __atfork_prepare(void)
+{
+	__lock();
+	__flush();
+}
+
+static void __atfork_parent(void)
+{
+	__unlock();
+}
+
+static void __atfork_child(void)
+{
+	if (trace_fd != -1)
+		close(trace_fd);
+	trace_fd = -1;
+	__unlock();
+}
+
+__attribute__((constructor))
+static void __trace_init(void)
+{
+	pthread_atfork(__atfork_prepare, __atfork_parent, __atfork_child);
+}
+
+__attribute__((destructor))
+static void __trace_fini(void)
+{
+	__lock();
+	__flush();
+	__unlock();
+}
+
+/*==================================PUBLIC====================================*/
+
+void *malloc(size_t size)
+{
+	void *ptr = __libc_malloc(size);
+
+	if (ptr)
+		__record("m %zu %p\n", size, ptr);
+
+	return ptr;
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+	void *ptr = __libc_calloc(nmemb, size);
+
+	if (ptr)
+		__record("m %zu %p\n", nmemb * size, ptr);
+
+	return ptr;
+}
+
+void *realloc(void *old, size_t size)
+{
+	void *ptr = __libc_realloc(old, size);
+
+	if (!old && ptr)
+		__record("m %zu %p\n", size, ptr);
+	else if (old && !size)
+		__record("f %p\n", old);
+	else if (ptr)
+		__record("r %p %zu %p\n", old, size, ptr);
+
+	return ptr;
+}
+
+void free(void *ptr)
+{
+	if (ptr)
+		__record("f %p\n", ptr);
+
+	__libc_free(ptr);
+}
+
+void *memalign(size_t alignment, size_t size)
+{
+	void *ptr = __libc_memalign(alignment, size);
+
+	if (ptr)
+		__record("m %zu %p\n", size, ptr);
+
+	return ptr;
+}
+
+void *aligned_alloc(size_t alignment, size_t size)
+{
+	return memalign(alignment, size);
+}
+
+int posix_memalign(void **memptr, size_t alignment, size_t size)
+{
+	void *ptr;
+
+	// power of two multiple of sizeof(void *), as glibc checks
+	if (!alignment || alignment % sizeof(void *) ||
+		(alignment & (alignment - 1)))
+		return EINVAL;
+
+	ptr = memalign(alignment, size);
+	if (!ptr)
+		return ENOMEM;
+
+	*memptr = ptr;
+
+	return 0;
+}
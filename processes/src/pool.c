@@ -0,0 +1,640 @@
+/**
+ * Fixed size object pool (slab allocator with per-thread magazines).
+ * Copyright (C) 2024 Lazar Razvan.
+ *
+ * Objects are served by three layers:
+ * 	1) per-thread magazines
+ * 		Each thread caches free objects in two magazines (loaded and
+ * 	previous). Most allocations and frees only push or pop a pointer on the
+ * 	loaded magazine, without any lock or atomic operation.
+ *
+ * 	2) depot
+ * 		When both magazines of a thread are empty (alloc) or full (free), a
+ * 	whole magazine is exchanged with the depot under a lock. Objects freed on
+ * 	a consumer thread travel back to the producer thread as full magazines, so
+ * 	the lock is taken once for POOL_MAGAZINE_SIZE objects.
+ *
+ * 	3) slabs
+ * 		A virtual region is reserved once and split in slabs of one page
+ * 	(sysconf(_SC_PAGESIZE) at pool init), the unit madvise() releases.
+ * 	Free objects of a slab are linked in an intrusive list (first word of a
+ * 	free object) and objects never used are carved from slab end, so a new
+ * 	slab is not touched until its objects are allocated. Slab headers are kept
+ * 	in a separate array, so that empty slabs are returned to the OS using
+ * 	madvise(MADV_DONTNEED) while their header is still valid. Empty slabs are
+ * 	only released after POOL_DECAY_MS, so that a working set that shrinks and
+ * 	grows again does not page fault each time.
+ *
+ *  -----------------------------------------------------------------
+ *  | Slab 0          | Slab 1          | Slab 2          |   ...   |
+ *  | obj obj obj ... | obj obj obj ... | (released)      |         |
+ *  -----------------------------------------------------------------
+ *     slabs[0]          slabs[1]          slabs[2]        (headers)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include <sys/mman.h>
+
+#include "debug.h"
+#include "pool.h"
+
+/*============================================================================*/
+
+/**
+ * Slab lists.
+ */
+#define POOL_LIST_FULL				0
+#define POOL_LIST_PARTIAL			1
+#define POOL_LIST_EMPTY				2
+#define POOL_LIST_RELEASED			3
+
+/**
+ * Per-thread cache.
+ */
+typedef struct pool_cache_s {
+
+	pool_t				*pool;			// pool
+	pool_magazine_t		*loaded;		// magazine used for alloc and free
+	pool_magazine_t		*prev;			// previous magazine
+
+} pool_cache_t;
+
+/*==================================STATIC====================================*/
+
+/**
+ * Get slab list.
+ */
+static inline pool_list_t *__list_get(pool_t *pool, int list)
+{
+	switch (list) {
+	case POOL_LIST_PARTIAL:
+		return &pool->partial;
+	case POOL_LIST_EMPTY:
+		return &pool->empty;
+	case POOL_LIST_RELEASED:
+		return &pool->released;
+	}
+
+	return NULL;
+}
+
+/**
+ * Move slab to list (removed from current one).
+ */
+static void __list_move(pool_t *pool, pool_slab_t *slab, int list)
+{
+	pool_list_t *l;
+
+	// remove from current list
+	l = __list_get(pool, slab->list);
+	if (l) {
+		if (slab->prev)
+			slab->prev->next = slab->next;
+		else
+			l->head = slab->next;
+
+		if (slab->next)
+			slab->next->prev = slab->prev;
+		else
+			l->tail = slab->prev;
+
+		l->nr--;
+	}
+
+	// add to new list
+	slab->list = list;
+	slab->prev = NULL;
+	slab->next = NULL;
+
+	l = __list_get(pool, list);
+	if (l) {
+		slab->next = l->head;
+		if (l->head)
+			l->head->prev = slab;
+		else
+			l->tail = slab;
+		l->head = slab;
+		l->nr++;
+	}
+}
+
+/**
+ * Get slab of an object.
+ */
+static inline pool_slab_t *__slab_of(pool_t *pool, void *obj)
+{
+	return &pool->slabs[((char *)obj - pool->base) >> pool->slab_shift];
+}
+
+/**
+ * Get a slab with free objects (slab lock held).
+ */
+static pool_slab_t *__slab_next(pool_t *pool)
+{
+	pool_slab_t *slab;
+
+	if (pool->partial.head)
+		return pool->partial.head;
+
+	if (pool->empty.head)
+		slab = pool->empty.head;
+	else if (pool->released.head)
+		slab = pool->released.head;
+	else if (pool->top < pool->nr_slabs)
+		slab = &pool->slabs[pool->top++];
+	else
+		return NULL;
+
+	__list_move(pool, slab, POOL_LIST_PARTIAL);
+
+	return slab;
+}
+
+/**
+ * Get up to nr objects from slabs.
+ *
+ * Return number of objects.
+ */
+static int __slab_get(pool_t *pool, void **objs, int nr)
+{
+	pool_slab_t *slab;
+	char *slab_base;
+	int got = 0;
+
+	pthread_mutex_lock(&pool->slab_lock);
+
+	while (got < nr) {
+		slab = __slab_next(pool);
+		if (!slab)
+			break;
+
+		slab_base = pool->base + (slab - pool->slabs) * pool->slab_size;
+
+		while (got < nr && slab->inuse < pool->slab_objs) {
+			if (slab->free) {
+				objs[got] = slab->free;
+				slab->free = *(void **)slab->free;
+			} else {
+				objs[got] = slab_base + slab->carved * pool->obj_size;
+				slab->carved++;
+			}
+
+			slab->inuse++;
+			got++;
+		}
+
+		if (slab->inuse == pool->slab_objs)
+			__list_move(pool, slab, POOL_LIST_FULL);
+	}
+
+	pthread_mutex_unlock(&pool->slab_lock);
+
+	return got;
+}
+
+/**
+ * Get time in milliseconds (coarse clock, no system call).
+ */
+static inline uint64_t __time_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+
+	return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/**
+ * Return least recently emptied slabs to the OS (slab lock held).
+ *
+ * POOL_EMPTY_KEEP slabs and slabs empty for less than POOL_DECAY_MS are kept,
+ * unless forced (all empty slabs are released). Pages are zero filled on next
+ * access, so released slabs are carved again.
+ */
+static void __slabs_trim(pool_t *pool, int force)
+{
+	uint64_t now = __time_ms();
+	pool_slab_t *slab;
+	char *slab_base;
+
+	while (pool->empty.nr > (force ? 0 : POOL_EMPTY_KEEP)) {
+		slab = pool->empty.tail;
+		if (!force && now - slab->emptied < POOL_DECAY_MS)
+			break;
+
+		slab_base = pool->base + (slab - pool->slabs) * pool->slab_size;
+		if (madvise(slab_base, pool->slab_size, MADV_DONTNEED))
+			ERROR("madvise() failed: %s!\n", strerror(errno));
+
+		slab->free = NULL;
+		slab->carved = 0;
+		pool->madvise++;
+		__list_move(pool, slab, POOL_LIST_RELEASED);
+	}
+}
+
+/**
+ * Return nr objects to their slabs.
+ */
+static void __slab_put(pool_t *pool, void **objs, int nr)
+{
+	pool_slab_t *slab;
+
+	pthread_mutex_lock(&pool->slab_lock);
+
+	for (int i = 0; i < nr; i++) {
+		slab = __slab_of(pool, objs[i]);
+
+		*(void **)objs[i] = slab->free;
+		slab->free = objs[i];
+
+		if (slab->inuse-- == pool->slab_objs)
+			__list_move(pool, slab, POOL_LIST_PARTIAL);
+
+		if (!slab->inuse) {
+			slab->emptied = __time_ms();
+			__list_move(pool, slab, POOL_LIST_EMPTY);
+		}
+	}
+
+	__slabs_trim(pool, 0);
+
+	pthread_mutex_unlock(&pool->slab_lock);
+}
+
+/**
+ * Get an empty magazine (from depot or a new one).
+ */
+static pool_magazine_t *__magazine_empty(pool_t *pool)
+{
+	pool_magazine_t *mag;
+
+	pthread_mutex_lock(&pool->depot_lock);
+	mag = pool->depot_empty;
+	if (mag)
+		pool->depot_empty = mag->next;
+	pthread_mutex_unlock(&pool->depot_lock);
+
+	if (!mag) {
+		mag = malloc(sizeof(pool_magazine_t));
+		if (!mag)
+			return NULL;
+	}
+
+	mag->rounds = 0;
+
+	return mag;
+}
+
+/**
+ * Exchange an empty magazine with a full one from depot.
+ *
+ * Return full magazine or NULL if depot has none.
+ */
+static pool_magazine_t *__depot_get_full(pool_t *pool, pool_magazine_t *empty)
+{
+	pool_magazine_t *mag;
+
+	pthread_mutex_lock(&pool->depot_lock);
+	mag = pool->depot_full;
+	if (mag) {
+		pool->depot_full = mag->next;
+		pool->depot_nr--;
+		empty->next = pool->depot_empty;
+		pool->depot_empty = empty;
+	}
+	pthread_mutex_unlock(&pool->depot_lock);
+
+	return mag;
+}
+
+/**
+ * Put a full magazine in depot.
+ *
+ * Return 0 on success and <0 if depot is full.
+ */
+static int __depot_put_full(pool_t *pool, pool_magazine_t *full)
+{
+	int rv = -1;
+
+	pthread_mutex_lock(&pool->depot_lock);
+	if (pool->depot_nr < POOL_DEPOT_MAX) {
+		full->next = pool->depot_full;
+		pool->depot_full = full;
+		pool->depot_nr++;
+		rv = 0;
+	}
+	pthread_mutex_unlock(&pool->depot_lock);
+
+	return rv;
+}
+
+/**
+ * Return cache objects to slabs and free its magazines.
+ */
+static void __cache_destroy(void *arg)
+{
+	pool_cache_t *cache = (pool_cache_t *)arg;
+	pool_t *pool = cache->pool;
+
+	__slab_put(pool, cache->loaded->objs, cache->loaded->rounds);
+	__slab_put(pool, cache->prev->objs, cache->prev->rounds);
+
+	free(cache->loaded);
+	free(cache->prev);
+	free(cache);
+}
+
+/**
+ * Get calling thread cache (created on first use).
+ */
+static pool_cache_t *__cache_get(pool_t *pool)
+{
+	pool_cache_t *cache;
+
+	cache = pthread_getspecific(pool->key);
+	if (cache)
+		return cache;
+
+	cache = calloc(1, sizeof(pool_cache_t));
+	if (!cache)
+		goto error;
+
+	cache->pool = pool;
+	cache->loaded = calloc(1, sizeof(pool_magazine_t));
+	cache->prev = calloc(1, sizeof(pool_magazine_t));
+	if (!cache->loaded || !cache->prev)
+		goto free_cache;
+
+	if (pthread_setspecific(pool->key, cache))
+		goto free_cache;
+
+	return cache;
+
+free_cache:
+	free(cache->loaded);
+	free(cache->prev);
+	free(cache);
+error:
+	ERROR("Fail to create thread cache!\n");
+	return NULL;
+}
+
+static inline void __magazines_swap(pool_cache_t *cache)
+{
+	pool_magazine_t *mag = cache->loaded;
+
+	cache->loaded = cache->prev;
+	cache->prev = mag;
+}
+
+/*==================================PUBLIC====================================*/
+
+/**
+ * Init an object pool.
+ *
+ * Region is only reserved (not backed by memory) until slabs are used.
+ *
+ * @pool		: Pool.
+ * @obj_size	: Object size (rounded up to pointer size, at most a page).
+ * @region_size	: Virtual region for slabs (0 for POOL_REGION_SIZE).
+ *
+ * Return 0 on success and <0 otherwise.
+ *
+ * Errors:
+ * 	1) Invalid object size
+ * 	2) Fail to reserve region
+ * 	3) Fail to create thread cache key
+ */
+int pool_init(pool_t *pool, size_t obj_size, size_t region_size)
+{
+	size_t slab_size = sysconf(_SC_PAGESIZE);
+
+	obj_size = (obj_size + sizeof(void *) - 1) & ~(sizeof(void *) - 1);
+	if (!obj_size || obj_size > slab_size) {
+		ERROR("Invalid object size %zu!\n", obj_size);
+		return -1;
+	}
+
+	memset(pool, 0, sizeof(pool_t));
+	pool->obj_size = obj_size;
+	pool->slab_size = slab_size;
+	pool->slab_shift = __builtin_ctzl(slab_size);
+	pool->slab_objs = slab_size / obj_size;
+	pool->nr_slabs = (region_size ? region_size : POOL_REGION_SIZE) /
+					slab_size;
+
+	pool->base = mmap(NULL, pool->nr_slabs * slab_size,
+					PROT_READ | PROT_WRITE,
+					MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (pool->base == MAP_FAILED) {
+		ERROR("mmap() failed: %s!\n", strerror(errno));
+		return -2;
+	}
+
+	pool->slabs = mmap(NULL, pool->nr_slabs * sizeof(pool_slab_t),
+					PROT_READ | PROT_WRITE,
+					MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (pool->slabs == MAP_FAILED) {
+		ERROR("mmap() failed: %s!\n", strerror(errno));
+		munmap(pool->base, pool->nr_slabs * pool->slab_size);
+		return -2;
+	}
+
+	if (pthread_key_create(&pool->key, __cache_destroy)) {
+		ERROR("pthread_key_create() failed!\n");
+		munmap(pool->slabs, pool->nr_slabs * sizeof(pool_slab_t));
+		munmap(pool->base, pool->nr_slabs * pool->slab_size);
+		return -3;
+	}
+
+	pthread_mutex_init(&pool->slab_lock, NULL);
+	pthread_mutex_init(&pool->depot_lock, NULL);
+
+	return 0;
+}
+
+/**
+ * Destroy an object pool.
+ *
+ * All threads using the pool must have exited or called pool_cache_flush().
+ *
+ * @pool	: Pool.
+ */
+void pool_destroy(pool_t *pool)
+{
+	pool_magazine_t *mag;
+
+	pool_cache_flush(pool);
+
+	while ((mag = pool->depot_full)) {
+		pool->depot_full = mag->next;
+		free(mag);
+	}
+
+	while ((mag = pool->depot_empty)) {
+		pool->depot_empty = mag->next;
+		free(mag);
+	}
+
+	pthread_key_delete(pool->key);
+	pthread_mutex_destroy(&pool->slab_lock);
+	pthread_mutex_destroy(&pool->depot_lock);
+
+	munmap(pool->slabs, pool->nr_slabs * sizeof(pool_slab_t));
+	munmap(pool->base, pool->nr_slabs * pool->slab_size);
+}
+
+/**
+ * Allocate an object.
+ *
+ * @pool	: Pool.
+ *
+ * Return object on success and NULL otherwise.
+ */
+void *pool_alloc(pool_t *pool)
+{
+	pool_cache_t *cache;
+	pool_magazine_t *mag;
+
+	cache = __cache_get(pool);
+	if (!cache)
+		return NULL;
+
+	if (cache->loaded->rounds)
+		return cache->loaded->objs[--cache->loaded->rounds];
+
+	if (cache->prev->rounds) {
+		__magazines_swap(cache);
+		return cache->loaded->objs[--cache->loaded->rounds];
+	}
+
+	// both magazines empty, get a full one from depot
+	mag = __depot_get_full(pool, cache->prev);
+	if (mag) {
+		cache->prev = cache->loaded;
+		cache->loaded = mag;
+		return cache->loaded->objs[--cache->loaded->rounds];
+	}
+
+	// depot empty, fill magazine from slabs
+	cache->loaded->rounds = __slab_get(pool, cache->loaded->objs,
+									POOL_MAGAZINE_SIZE);
+	if (!cache->loaded->rounds) {
+		ERROR("Pool out of memory!\n");
+		return NULL;
+	}
+
+	return cache->loaded->objs[--cache->loaded->rounds];
+}
+
+/**
+ * Free an object.
+ *
+ * Object may be freed by a different thread than the one that allocated it.
+ *
+ * @pool	: Pool.
+ * @obj		: Object.
+ */
+void pool_free(pool_t *pool, void *obj)
+{
+	pool_cache_t *cache;
+	pool_magazine_t *mag;
+
+	cache = __cache_get(pool);
+	if (!cache) {
+		__slab_put(pool, &obj, 1);
+		return;
+	}
+
+	if (cache->loaded->rounds < POOL_MAGAZINE_SIZE) {
+		cache->loaded->objs[cache->loaded->rounds++] = obj;
+		return;
+	}
+
+	if (cache->prev->rounds == 0) {
+		__magazines_swap(cache);
+		cache->loaded->objs[cache->loaded->rounds++] = obj;
+		return;
+	}
+
+	// both magazines full, move previous one to depot (or slabs)
+	mag = __magazine_empty(pool);
+	if (!mag) {
+		__slab_put(pool, &obj, 1);
+		return;
+	}
+
+	if (__depot_put_full(pool, cache->prev)) {
+		__slab_put(pool, cache->prev->objs, cache->prev->rounds);
+		free(cache->prev);
+	}
+
+	cache->prev = cache->loaded;
+	cache->loaded = mag;
+	cache->loaded->objs[cache->loaded->rounds++] = obj;
+}
+
+/**
+ * Return calling thread magazines objects to slabs.
+ *
+ * Done automatically when a thread exits.
+ *
+ * @pool	: Pool.
+ */
+void pool_cache_flush(pool_t *pool)
+{
+	pool_cache_t *cache;
+
+	cache = pthread_getspecific(pool->key);
+	if (!cache)
+		return;
+
+	pthread_setspecific(pool->key, NULL);
+	__cache_destroy(cache);
+}
+
+/**
+ * Return empty slabs to the OS.
+ *
+ * Empty slabs beyond POOL_EMPTY_KEEP are released after POOL_DECAY_MS on
+ * following frees, this releases all of them now, POOL_EMPTY_KEEP included
+ * (objects cached in magazines are not returned to slabs).
+ *
+ * @pool	: Pool.
+ */
+void pool_trim(pool_t *pool)
+{
+	pthread_mutex_lock(&pool->slab_lock);
+	__slabs_trim(pool, 1);
+	pthread_mutex_unlock(&pool->slab_lock);
+}
+
+/**
+ * Get pool statistics.
+ *
+ * Objects cached in magazines are counted as allocated.
+ *
+ * @pool	: Pool.
+ * @stats	: Statistics.
+ */
+void pool_stats(pool_t *pool, pool_stats_t *stats)
+{
+	pthread_mutex_lock(&pool->slab_lock);
+
+	stats->slabs = pool->top;
+	stats->partial = pool->partial.nr;
+	stats->empty = pool->empty.nr;
+	stats->released = pool->released.nr;
+	stats->full = pool->top - pool->partial.nr - pool->empty.nr -
+				pool->released.nr;
+	stats->madvise = pool->madvise;
+
+	pthread_mutex_unlock(&pool->slab_lock);
+}
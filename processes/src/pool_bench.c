@@ -0,0 +1,327 @@
+/**
+ * Pool allocator multi-threaded benchmark.
+ * Copyright (C) 2024 Lazar Razvan.
+ *
+ * Producer/consumer pairs of threads share a lock-free single producer single
+ * consumer ring. Producers allocate objects of BLK_SIZE bytes, write them and
+ * push them in the ring, while consumers pop them, read them and free them, so
+ * each object is freed on a different thread than the one that allocated it.
+ *
+ * The same workload is run using glibc malloc() and free() and using the pool
+ * allocator. For each allocator, the throughput (objects per second), the peak
+ * RSS and the RSS after all threads exited (and allocator trimmed) are
+ * reported. Each allocator runs in a separate child process, so that RSS is
+ * not affected by the previous one.
+ *
+ * Usage:
+ * 	./run/pool_bench [pairs] [objects per producer]
+ */
+
+#include <time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <malloc.h>
+#include <unistd.h>
+#include <sched.h>
+#include <pthread.h>
+
+#include <sys/wait.h>
+#include <sys/resource.h>
+
+#include "debug.h"
+#include "pool.h"
+
+/*============================================================================*/
+
+/* Allocation mem size */
+#define BLK_SIZE					2048
+
+/* Default producer/consumer pairs */
+#define PAIRS						2
+
+/* Default objects allocated by each producer */
+#define OBJECTS						1000000
+
+/* Maximum producer/consumer pairs */
+#define PAIRS_MAX					32
+
+/* Objects in a ring (power of two) */
+#define RING_SIZE					4096
+
+/**
+ * Single producer single consumer ring.
+ */
+typedef struct ring_s {
+
+	void	*objs[RING_SIZE];
+	size_t	head __attribute__((aligned(64)));		// consumer position
+	size_t	tail __attribute__((aligned(64)));		// producer position
+
+} ring_t;
+
+/**
+ * Allocator.
+ */
+typedef struct allocator_s {
+
+	const char	*name;
+	int			(*init)(void);
+	void		*(*alloc)(void);
+	void		(*free)(void *);
+	void		(*trim)(void);
+	void		(*stats)(void);
+
+} allocator_t;
+
+static const allocator_t *allocator;
+static ring_t rings[PAIRS_MAX];
+static long objects = OBJECTS;
+static pool_t pool;
+
+/*==================================STATIC====================================*/
+
+/**
+ * Get resident set size (bytes) from /proc/self/statm.
+ */
+static long __get_rss(void)
+{
+	long size, resident = 0;
+	FILE *f;
+
+	f = fopen("/proc/self/statm", "r");
+	if (!f) {
+		ERROR("Fail to open /proc/self/statm!\n");
+		return 0;
+	}
+
+	if (fscanf(f, "%ld %ld", &size, &resident) != 2)
+		ERROR("Fail to read /proc/self/statm!\n");
+
+	fclose(f);
+
+	return resident * sysconf(_SC_PAGE_SIZE);
+}
+
+/**
+ * glibc allocator.
+ */
+static int __malloc_init(void)
+{
+	return 0;
+}
+
+static void *__malloc_alloc(void)
+{
+	return malloc(BLK_SIZE);
+}
+
+static void __malloc_free(void *obj)
+{
+	free(obj);
+}
+
+static void __malloc_trim(void)
+{
+	malloc_trim(0);
+}
+
+static void __malloc_stats(void)
+{
+}
+
+/**
+ * Pool allocator.
+ */
+static int __pool_init(void)
+{
+	return pool_init(&pool, BLK_SIZE, 0);
+}
+
+static void *__pool_alloc(void)
+{
+	return pool_alloc(&pool);
+}
+
+static void __pool_free(void *obj)
+{
+	pool_free(&pool, obj);
+}
+
+static void __pool_trim(void)
+{
+	pool_trim(&pool);
+}
+
+static void __pool_stats(void)
+{
+	pool_stats_t stats;
+
+	pool_stats(&pool, &stats);
+	printf("    slabs: used=%zu full=%zu partial=%zu empty=%zu released=%zu "
+			"madvise=%zu\n", stats.slabs, stats.full, stats.partial,
+			stats.empty, stats.released, stats.madvise);
+}
+
+static const allocator_t allocators[] = {
+	{
+		.name	= "malloc",
+		.init	= __malloc_init,
+		.alloc	= __malloc_alloc,
+		.free	= __malloc_free,
+		.trim	= __malloc_trim,
+		.stats	= __malloc_stats,
+	},
+	{
+		.name	= "pool",
+		.init	= __pool_init,
+		.alloc	= __pool_alloc,
+		.free	= __pool_free,
+		.trim	= __pool_trim,
+		.stats	= __pool_stats,
+	},
+};
+
+/**
+ * Producer thread (allocate and push objects).
+ */
+static void *__producer(void *arg)
+{
+	ring_t *ring = (ring_t *)arg;
+	size_t tail;
+	void *obj;
+
+	for (long i = 0; i < objects; i++) {
+		obj = allocator->alloc();
+		if (obj)
+			memset(obj, i, 64);
+		else
+			ERROR("Fail to alloc object!\n");
+
+		tail = ring->tail;
+		while (tail - __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) ==
+				RING_SIZE)
+			sched_yield();
+
+		ring->objs[tail & (RING_SIZE - 1)] = obj;
+		__atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+	}
+
+	return NULL;
+}
+
+/**
+ * Consumer thread (pop and free objects).
+ */
+static void *__consumer(void *arg)
+{
+	ring_t *ring = (ring_t *)arg;
+	volatile char sink;
+	size_t head;
+	void *obj;
+
+	for (long i = 0; i < objects; i++) {
+		head = ring->head;
+		while (__atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) == head)
+			sched_yield();
+
+		obj = ring->objs[head & (RING_SIZE - 1)];
+		__atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+
+		if (!obj)
+			continue;
+
+		sink = *(char *)obj;
+		(void)sink;
+		allocator->free(obj);
+	}
+
+	return NULL;
+}
+
+/**
+ * Run allocator benchmark in a child process.
+ */
+static void __bench_run(const allocator_t *a, int pairs)
+{
+	pthread_t producers[PAIRS_MAX], consumers[PAIRS_MAX];
+	struct timespec start, end;
+	struct rusage usage;
+	double sec;
+	pid_t pid;
+
+	fflush(stdout);
+
+	pid = fork();
+	if (pid == -1) {
+		ERROR("fork error!\n");
+		return;
+	}
+
+	if (pid) {
+		waitpid(pid, NULL, 0);
+		return;
+	}
+
+	allocator = a;
+	if (allocator->init()) {
+		ERROR("Fail to init %s allocator!\n", allocator->name);
+		exit(1);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	for (int i = 0; i < pairs; i++) {
+		if (pthread_create(&consumers[i], NULL, __consumer, &rings[i]) ||
+			pthread_create(&producers[i], NULL, __producer, &rings[i])) {
+			ERROR("pthread_create error!\n");
+			exit(1);
+		}
+	}
+
+	for (int i = 0; i < pairs; i++) {
+		pthread_join(producers[i], NULL);
+		pthread_join(consumers[i], NULL);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	getrusage(RUSAGE_SELF, &usage);
+	allocator->trim();
+
+	sec = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+	printf("%-12s %14.0f %14ld %14ld\n", allocator->name,
+			(double)objects * pairs / sec, usage.ru_maxrss, __get_rss() / 1024);
+	allocator->stats();
+
+	exit(0);
+}
+
+/*============================================================================*/
+
+int main(int argc, char *argv[])
+{
+	int pairs = PAIRS;
+
+	if (argc > 1)
+		pairs = atoi(argv[1]);
+
+	if (argc > 2)
+		objects = atol(argv[2]);
+
+	if (pairs <= 0 || pairs > PAIRS_MAX || objects <= 0) {
+		ERROR("Invalid arguments!\n");
+		printf("Usage: %s [pairs] [objects per producer]\n", argv[0]);
+		return -1;
+	}
+
+	printf("%d producer/consumer pairs, %ld objects of %d bytes each\n",
+			pairs, objects, BLK_SIZE);
+	printf("%-12s %14s %14s %14s\n", "allocator", "objects/s",
+			"peak rss (KB)", "end rss (KB)");
+
+	for (int i = 0; i < sizeof(allocators) / sizeof(allocators[0]); i++)
+		__bench_run(&allocators[i], pairs);
+
+	return 0;
+}
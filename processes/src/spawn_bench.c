@@ -0,0 +1,367 @@
+/**
+ * Process spawn benchmark.
+ * Copyright (C) 2024 Lazar Razvan.
+ *
+ * Spawn a program (/bin/true by default) many times using different process
+ * creation mechanisms and report spawns per second and latency percentiles:
+ * 	1) fork() + execve()
+ * 		Child duplicates parent page tables (copy-on-write), so the cost of
+ * 	fork() grows with the parent resident memory. Parent continues as soon as
+ * 	fork() returns.
+ *
+ * 	2) vfork() + execve()
+ * 		Child borrows parent memory (no page tables copy) and parent is
+ * 	suspended until child calls execve() or _exit().
+ *
+ * 	3) posix_spawn()
+ * 		glibc implementation uses clone(CLONE_VM | CLONE_VFORK) with a
+ * 	separate stack for the child.
+ *
+ * 	4) clone3(CLONE_VFORK) + execve()
+ * 		Parent is suspended until execve(), but memory is not shared (no
+ * 	CLONE_VM), so page tables are still copied like fork().
+ *
+ * 	5) clone(CLONE_VM | CLONE_VFORK) + execve()
+ * 		Same as posix_spawn(), child runs a function on its own stack.
+ *
+ * Parent resident memory is scaled using a private anonymous mapping that is
+ * touched before the spawns (transparent huge pages are disabled, so each 4 KB
+ * page needs a page table entry to be copied by fork()).
+ *
+ * For each spawn two latencies are recorded:
+ * 	- create: until the spawn call returns in parent
+ * 	- spawn: until the child exited and was reaped by waitpid()
+ *
+ * Usage:
+ * 	./run/spawn_bench [-n spawns] [-e program] [rss ...]
+ * 	./run/spawn_bench -n 2000 1M 1G 4G
+ */
+
+#define _GNU_SOURCE
+
+#include <time.h>
+#include <sched.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <errno.h>
+
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <sys/syscall.h>
+#include <linux/sched.h>
+
+#include "debug.h"
+#include "histogram.h"
+
+/*============================================================================*/
+
+/* Default spawns for each mechanism */
+#define SPAWNS						1000
+
+/* Default spawned program */
+#define PROGRAM						"/bin/true"
+
+/* Stack size of clone() child (only used until execve()) */
+#define CLONE_STACK_SIZE			(64 * 1024)
+
+/**
+ * Spawn mechanism.
+ */
+typedef struct spawn_s {
+
+	const char	*name;
+	pid_t		(*spawn)(void);
+
+} spawn_t;
+
+extern char **environ;
+
+static const char *default_rss[] = { "1M", "64M", "1G" };
+static const char *program = PROGRAM;
+static char *program_argv[2];
+static char *clone_stack;
+
+/*==================================STATIC====================================*/
+
+/**
+ * Parse a size in bytes (K, M or G suffix).
+ *
+ * Return size on success and 0 otherwise.
+ */
+static size_t __size_parse(const char *str)
+{
+	unsigned long long size;
+	char *end;
+
+	size = strtoull(str, &end, 10);
+	switch (*end) {
+	case 'G':
+	case 'g':
+		size <<= 10;
+		// fallthrough
+	case 'M':
+	case 'm':
+		size <<= 10;
+		// fallthrough
+	case 'K':
+	case 'k':
+		size <<= 10;
+		end++;
+		break;
+	}
+
+	if (*end != '\0')
+		return 0;
+
+	return size;
+}
+
+static inline uint64_t __time_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * Get resident set size (bytes) from /proc/self/statm.
+ */
+static long __get_rss(void)
+{
+	long size, resident = 0;
+	FILE *f;
+
+	f = fopen("/proc/self/statm", "r");
+	if (!f) {
+		ERROR("Fail to open /proc/self/statm!\n");
+		return 0;
+	}
+
+	if (fscanf(f, "%ld %ld", &size, &resident) != 2)
+		ERROR("Fail to read /proc/self/statm!\n");
+
+	fclose(f);
+
+	return resident * sysconf(_SC_PAGE_SIZE);
+}
+
+/**
+ * Child after fork (only async-signal-safe calls).
+ */
+static void __child_exec(void)
+{
+	execve(program, program_argv, environ);
+	_exit(127);
+}
+
+static pid_t __spawn_fork(void)
+{
+	pid_t pid = fork();
+
+	if (pid == 0)
+		__child_exec();
+
+	return pid;
+}
+
+static pid_t __spawn_vfork(void)
+{
+	pid_t pid = vfork();
+
+	if (pid == 0)
+		__child_exec();
+
+	return pid;
+}
+
+static pid_t __spawn_posix(void)
+{
+	pid_t pid;
+	int rv;
+
+	rv = posix_spawn(&pid, program, NULL, NULL, program_argv, environ);
+	if (rv) {
+		errno = rv;
+		return -1;
+	}
+
+	return pid;
+}
+
+static pid_t __spawn_clone3(void)
+{
+	struct clone_args args;
+	pid_t pid;
+
+	memset(&args, 0, sizeof(args));
+	args.flags = CLONE_VFORK;
+	args.exit_signal = SIGCHLD;
+
+	pid = syscall(SYS_clone3, &args, sizeof(args));
+	if (pid == 0)
+		__child_exec();
+
+	return pid;
+}
+
+static int __clone_child(void *arg)
+{
+	__child_exec();
+
+	return 0;
+}
+
+static pid_t __spawn_clone_vm(void)
+{
+	return clone(__clone_child, clone_stack + CLONE_STACK_SIZE,
+				CLONE_VM | CLONE_VFORK | SIGCHLD, NULL);
+}
+
+static const spawn_t spawns[] = {
+	{ "fork + exec",			__spawn_fork		},
+	{ "vfork + exec",			__spawn_vfork		},
+	{ "posix_spawn",			__spawn_posix		},
+	{ "clone3(VFORK) + exec",	__spawn_clone3		},
+	{ "clone(VM|VFORK) + exec",	__spawn_clone_vm	},
+};
+
+/**
+ * Spawn and reap children using a mechanism.
+ *
+ * @s		: Spawn mechanism.
+ * @nr		: Number of spawns.
+ */
+static void __bench(const spawn_t *s, int nr)
+{
+	histogram_t create, spawn;
+	uint64_t start, t0, t1;
+	int status, failed = 0;
+	double sec;
+	pid_t pid;
+
+	histogram_init(&create);
+	histogram_init(&spawn);
+
+	start = __time_ns();
+	for (int i = 0; i < nr; i++) {
+		t0 = __time_ns();
+		pid = s->spawn();
+		t1 = __time_ns();
+
+		if (pid == -1) {
+			printf("%-24s not available: %s\n", s->name, strerror(errno));
+			return;
+		}
+
+		if (waitpid(pid, &status, 0) == -1) {
+			ERROR("waitpid error: %s!\n", strerror(errno));
+			return;
+		}
+
+		if (!WIFEXITED(status) || WEXITSTATUS(status))
+			failed++;
+
+		histogram_record(&create, t1 - t0);
+		histogram_record(&spawn, __time_ns() - t0);
+	}
+	sec = (__time_ns() - start) / 1e9;
+
+	printf("%-24s %10.0f %10.1f %10.1f %10.1f %10.1f %10.1f\n", s->name,
+			nr / sec,
+			histogram_percentile(&create, 50.0) / 1e3,
+			histogram_percentile(&create, 99.0) / 1e3,
+			histogram_percentile(&spawn, 50.0) / 1e3,
+			histogram_percentile(&spawn, 99.0) / 1e3,
+			histogram_percentile(&spawn, 99.9) / 1e3);
+
+	if (failed)
+		printf("    %d children failed to run %s\n", failed, program);
+}
+
+/*============================================================================*/
+
+int main(int argc, char *argv[])
+{
+	int opt, nr = SPAWNS, nr_rss;
+	const char **rss;
+	size_t size;
+	char *buf;
+
+	while ((opt = getopt(argc, argv, "n:e:")) != -1) {
+		switch (opt) {
+		case 'n':
+			nr = atoi(optarg);
+			break;
+		case 'e':
+			program = optarg;
+			break;
+		default:
+			printf("Usage: %s [-n spawns] [-e program] [rss ...]\n", argv[0]);
+			return -1;
+		}
+	}
+
+	if (nr < 1)
+		nr = 1;
+
+	if (optind < argc) {
+		rss = (const char **)&argv[optind];
+		nr_rss = argc - optind;
+	} else {
+		rss = default_rss;
+		nr_rss = sizeof(default_rss) / sizeof(default_rss[0]);
+	}
+
+	program_argv[0] = (char *)program;
+	program_argv[1] = NULL;
+
+	clone_stack = malloc(CLONE_STACK_SIZE);
+	if (!clone_stack) {
+		ERROR("Fail to alloc clone stack!\n");
+		return -1;
+	}
+
+	printf("%d spawns of %s for each mechanism (latencies in us)\n", nr,
+			program);
+
+	for (int i = 0; i < nr_rss; i++) {
+		size = __size_parse(rss[i]);
+		if (!size) {
+			ERROR("Invalid size %s!\n", rss[i]);
+			continue;
+		}
+
+		buf = mmap(NULL, size, PROT_READ | PROT_WRITE,
+				MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (buf == MAP_FAILED) {
+			ERROR("Fail to map %s: %s!\n", rss[i], strerror(errno));
+			continue;
+		}
+
+		// base pages only, so that fork() copies one PTE for each 4 KB
+		madvise(buf, size, MADV_NOHUGEPAGE);
+		memset(buf, 1, size);
+
+		printf("================ parent rss %ld MB ================\n",
+				__get_rss() >> 20);
+		printf("%-24s %10s %10s %10s %10s %10s %10s\n", "mechanism",
+				"spawns/s", "create p50", "create p99", "spawn p50",
+				"spawn p99", "spawn p99.9");
+
+		for (int j = 0; j < sizeof(spawns) / sizeof(spawns[0]); j++)
+			__bench(&spawns[j], nr);
+
+		munmap(buf, size);
+	}
+
+	free(clone_stack);
+
+	return 0;
+}
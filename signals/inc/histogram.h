@@ -0,0 +1,71 @@
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <stdint.h>
+
+/*============================================================================*/
+
+/**
+ * Config: Histogram precision.
+ *
+ * Each power of two range is split into 2^(HISTOGRAM_SUB_BITS - 1) linear
+ * sub-buckets, so recorded values keep a relative error lower than
+ * 1 / 2^(HISTOGRAM_SUB_BITS - 1) (7 bits => ~1.5%).
+ */
+#define HISTOGRAM_SUB_BITS			7
+
+// Values lower than this are recorded exactly
+#define HISTOGRAM_SUB_COUNT			(1ULL << HISTOGRAM_SUB_BITS)
+
+// Sub-buckets for each power of two range
+#define HISTOGRAM_HALF_COUNT		(HISTOGRAM_SUB_COUNT >> 1)
+
+// Total number of buckets (whole uint64_t range)
+#define HISTOGRAM_BUCKETS			\
+		((64 - HISTOGRAM_SUB_BITS) * HISTOGRAM_HALF_COUNT + HISTOGRAM_SUB_COUNT)
+
+
+/*============================================================================*/
+
+/**
+ * Log-linear histogram (HdrHistogram style).
+ */
+typedef struct histogram_s {
+
+	uint64_t	counts[HISTOGRAM_BUCKETS];	// samples per bucket
+	uint64_t	total;						// number of samples
+	uint64_t	sum;						// sum of samples (mean)
+	uint64_t	min;						// smallest sample
+	uint64_t	max;						// largest sample
+
+} histogram_t;
+
+
+/*============================================================================*/
+
+// Init (empty) histogram
+void histogram_init(histogram_t *h);
+
+// Record a value (owner thread only, no synchronization)
+void histogram_record(histogram_t *h, uint64_t value);
+
+// Record a value (shared histogram, lock-free)
+void histogram_record_atomic(histogram_t *h, uint64_t value);
+
+// Merge (lock-free) a per-thread histogram into a global one and reset it
+void histogram_merge(histogram_t *dst, histogram_t *src);
+
+// Copy a global histogram into snapshot and optionally reset it (interval)
+void histogram_snapshot(histogram_t *h, histogram_t *snap, int reset);
+
+// Value at a given percentile (0.0 - 100.0)
+uint64_t histogram_percentile(histogram_t *h, double percentile);
+
+// Mean value
+double histogram_mean(histogram_t *h);
+
+// Print count, mean, p50, p99, p99.9 and max (values scaled by div)
+void histogram_print(histogram_t *h, const char *name, const char *unit,
+					double div);
+
+#endif	// HISTOGRAM_H
@@ -0,0 +1,69 @@
+#ifndef PROF_H
+#define PROF_H
+
+#include <stdint.h>
+
+/**
+ * Config: Sampling profiler
+ */
+
+// Default sampling frequency (samples per second of cpu time)
+#define PROF_FREQ_HZ				1000
+
+// Max frames recorded for each sample (program counter included)
+#define PROF_DEPTH_MAX				16
+
+// Distinct stacks kept (power of two, samples of new stacks are dropped)
+#define PROF_STACKS_MAX				(16 * 1024)
+
+// Environment variable with folded stacks output path (prof_start_env)
+#define PROF_FILE_ENV				"PROF_FILE"
+
+
+/*============================================================================*/
+
+/**
+ * Timer modes.
+ *
+ * Per-thread timers (timer_create() on CLOCK_THREAD_CPUTIME_ID) send SIGPROF
+ * to the thread that consumed the cpu time, each thread must call
+ * prof_thread_start(). ITIMER_PROF is a single process timer, signal is
+ * delivered to one of the running threads.
+ */
+#define PROF_MODE_THREAD			0
+#define PROF_MODE_ITIMER			1
+
+/**
+ * Profiler statistics.
+ */
+typedef struct prof_stats_s {
+
+	uint64_t	samples;			// samples recorded
+	uint64_t	dropped;			// samples dropped (stacks table full)
+	uint64_t	stacks;				// distinct stacks
+	uint64_t	truncated;			// samples deeper than PROF_DEPTH_MAX
+
+} prof_stats_t;
+
+
+/*============================================================================*/
+
+// Start profiling calling thread (and process in ITIMER mode), written at exit
+int prof_start(const char *path, int hz, int mode);
+
+// Start profiling using PROF_FILE_ENV (no-op if not set)
+int prof_start_env(void);
+
+// Start profiling calling thread (thread stack bounds are needed to unwind)
+int prof_thread_start(void);
+
+// Stop profiling calling thread
+void prof_thread_stop(void);
+
+// Stop profiling and write folded stacks (flame graph input)
+void prof_stop(void);
+
+// Get profiler statistics
+void prof_stats(prof_stats_t *stats);
+
+#endif	// PROF_H
@@ -0,0 +1,63 @@
+#ifndef SIG_EVENT_H
+#define SIG_EVENT_H
+
+#include <signal.h>
+#include <sys/signalfd.h>
+
+/**
+ * Config: Signal events
+ */
+
+// Highest signal number that can be registered (standard and real-time)
+#define SIG_EVENT_NSIG				65
+
+// signalfd_siginfo structures read at once
+#define SIG_EVENT_BATCH				16
+
+
+/*============================================================================*/
+
+/**
+ * Signal event handler.
+ *
+ * Called synchronously from sig_event_dispatch(), so there are no
+ * async-signal-safety restrictions.
+ */
+typedef void (*sig_event_handler_t)(struct signalfd_siginfo *info, void *arg);
+
+/**
+ * Signal event source (signalfd).
+ */
+typedef struct sig_event_s {
+
+	int					fd;							// signalfd descriptor
+	sigset_t			mask;						// blocked signals
+	sigset_t			old_mask;					// mask before init
+	sig_event_handler_t	handlers[SIG_EVENT_NSIG];	// handler per signal
+	void				*args[SIG_EVENT_NSIG];		// handler argument
+
+} sig_event_t;
+
+
+/*============================================================================*/
+
+// Init signal events (call before creating threads, they inherit the mask)
+int sig_event_init(sig_event_t *se);
+
+// Block signal and deliver it to handler through signalfd
+int sig_event_register(sig_event_t *se, int signo, sig_event_handler_t handler,
+					void *arg);
+
+// Add signalfd to an epoll instance (data.fd is the signalfd)
+int sig_event_epoll_add(sig_event_t *se, int epoll_fd);
+
+// Read pending signals and call their handlers (signalfd is readable)
+int sig_event_dispatch(sig_event_t *se);
+
+// Restore signal mask before init (child process after fork())
+void sig_event_unblock(sig_event_t *se);
+
+// Close signalfd and restore signal mask
+void sig_event_destroy(sig_event_t *se);
+
+#endif	// SIG_EVENT_H
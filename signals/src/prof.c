@@ -0,0 +1,586 @@
+/**
+ * Sampling profiler (SIGPROF).
+ * Copyright (C) 2024 Lazar Razvan.
+ *
+ * A cpu time timer sends SIGPROF PROF_FREQ_HZ times per second of consumed cpu
+ * time, either for each thread (timer_create() on CLOCK_THREAD_CPUTIME_ID,
+ * signal directed to the thread using SIGEV_THREAD_ID) or for the whole
+ * process (setitimer(ITIMER_PROF)).
+ *
+ * Signal handler captures the interrupted program counter and walks the frame
+ * pointer chain (program must be built with -fno-omit-frame-pointer):
+ *
+ *      high addresses
+ *      | ...            |
+ *      | return address |  <- fp + 8
+ *      | caller fp      |  <- fp
+ *      | locals         |
+ *      low addresses
+ *
+ * A frame pointer is followed only while it is aligned, above the interrupted
+ * stack pointer and below the thread stack top (recorded by
+ * prof_thread_start()), so frames without a frame pointer (libraries built
+ * without it) end the walk instead of faulting.
+ *
+ * Stacks are aggregated in a lock-free hash table (stack hash as key, claimed
+ * with compare and swap, counters incremented atomically), so the handler
+ * never takes a lock and never allocates memory. When the program exits (or
+ * prof_stop() is called), stacks are symbolized using dladdr() (executable
+ * must be linked with -rdynamic to export its symbols, frames that are not
+ * exported are reported as [module]) and written as folded stacks, one
+ * stack per line with outermost frame first and the sample count:
+ *
+ * 	main;compute;hash 42
+ *
+ * Folded stacks are the input of flame graph tools (flamegraph.pl,
+ * speedscope, inferno).
+ */
+
+#define _GNU_SOURCE
+
+#include <time.h>
+#include <stdio.h>
+#include <dlfcn.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <ucontext.h>
+
+#include <sys/mman.h>
+#include <sys/time.h>
+
+#include "debug.h"
+#include "prof.h"
+
+/*============================================================================*/
+
+/* Probes in stacks table before a sample is dropped */
+#define PROF_PROBES_MAX				64
+
+/* Output path max length */
+#define PROF_PATH_MAX				256
+
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id		_sigev_un._tid
+#endif
+
+/**
+ * Stack entry (hash table slot).
+ */
+typedef struct prof_stack_s {
+
+	uint64_t	key;						// stack hash (0 if slot is free)
+	uint64_t	count;						// samples
+	uint32_t	depth;						// frames
+	uint32_t	ready;						// frames written
+	void		*pcs[PROF_DEPTH_MAX];		// frames (innermost first)
+
+} prof_stack_t;
+
+/**
+ * Profiler state.
+ */
+static struct {
+
+	prof_stack_t	*stacks;				// stacks table
+	int				running;				// samples are recorded
+	int				hz;						// sampling frequency
+	int				mode;					// PROF_MODE_*
+	int				atexit;					// prof_stop() registered
+	char			path[PROF_PATH_MAX];	// output path
+
+	uint64_t		samples;
+	uint64_t		dropped;
+	uint64_t		nr_stacks;
+	uint64_t		truncated;
+
+} _prof;
+
+/* Calling thread stack top (0 if unknown, only pc is recorded) */
+static __thread uintptr_t _stack_hi;
+
+/* Calling thread cpu time timer */
+static __thread timer_t _timer;
+static __thread int _timer_armed;
+
+/*==================================STATIC====================================*/
+
+/**
+ * Hash of a stack (FNV-1a, never 0).
+ */
+static inline uint64_t __stack_hash(void **pcs, int depth)
+{
+	uint64_t hash = 14695981039346656037ULL;
+
+	for (int i = 0; i < depth; i++) {
+		hash ^= (uintptr_t)pcs[i];
+		hash *= 1099511628211ULL;
+	}
+
+	return hash ? hash : 1;
+}
+
+/**
+ * Record a stack (async-signal-safe, lock-free).
+ */
+static void __stack_record(void **pcs, int depth)
+{
+	uint64_t key = __stack_hash(pcs, depth), expected;
+	uint32_t idx = key & (PROF_STACKS_MAX - 1);
+	prof_stack_t *slot;
+
+	for (int i = 0; i < PROF_PROBES_MAX; i++) {
+		slot = &_prof.stacks[(idx + i) & (PROF_STACKS_MAX - 1)];
+
+		expected = __atomic_load_n(&slot->key, __ATOMIC_ACQUIRE);
+		if (!expected) {
+			// claim free slot (another thread may claim it first)
+			if (__atomic_compare_exchange_n(&slot->key, &expected, key, 0,
+									__ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+				memcpy(slot->pcs, pcs, depth * sizeof(void *));
+				slot->depth = depth;
+				__atomic_store_n(&slot->ready, 1, __ATOMIC_RELEASE);
+				__atomic_fetch_add(&_prof.nr_stacks, 1, __ATOMIC_RELAXED);
+				expected = key;
+			}
+		}
+
+		if (expected == key) {
+			__atomic_fetch_add(&slot->count, 1, __ATOMIC_RELAXED);
+			__atomic_fetch_add(&_prof.samples, 1, __ATOMIC_RELAXED);
+			return;
+		}
+	}
+
+	__atomic_fetch_add(&_prof.dropped, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * SIGPROF handler.
+ */
+static void __prof_handler(int signo, siginfo_t *info, void *ctx)
+{
+	ucontext_t *uc = (ucontext_t *)ctx;
+	uintptr_t pc, fp, sp, next;
+	void *pcs[PROF_DEPTH_MAX];
+	int depth = 0;
+
+	if (!__atomic_load_n(&_prof.running, __ATOMIC_ACQUIRE))
+		return;
+
+#if defined(__x86_64__)
+	pc = uc->uc_mcontext.gregs[REG_RIP];
+	fp = uc->uc_mcontext.gregs[REG_RBP];
+	sp = uc->uc_mcontext.gregs[REG_RSP];
+#elif defined(__aarch64__)
+	pc = uc->uc_mcontext.pc;
+	fp = uc->uc_mcontext.regs[29];
+	sp = uc->uc_mcontext.sp;
+#else
+	pc = 0;
+	fp = sp = 0;
+#endif
+
+	pcs[depth++] = (void *)pc;
+
+	// frame pointer walk inside thread stack only
+	while (_stack_hi && depth < PROF_DEPTH_MAX) {
+		if ((fp & 7) || fp < sp || fp + 2 * sizeof(uintptr_t) > _stack_hi)
+			break;
+
+		next = ((uintptr_t *)fp)[0];
+		pc = ((uintptr_t *)fp)[1];
+		if (!pc)
+			break;
+
+		pcs[depth++] = (void *)pc;
+
+		// stack grows down, caller frame is always higher
+		if (next <= fp)
+			break;
+
+		sp = fp;
+		fp = next;
+	}
+
+	if (depth == PROF_DEPTH_MAX)
+		__atomic_fetch_add(&_prof.truncated, 1, __ATOMIC_RELAXED);
+
+	__stack_record(pcs, depth);
+}
+
+/**
+ * Write a frame name (function, or module if not exported).
+ *
+ * @caller	: Frame is a return address (points after the call).
+ */
+static void __frame_print(FILE *f, void *pc, int caller)
+{
+	const char *module;
+	Dl_info dl;
+
+	// return address may belong to next function (call is the last insn)
+	if (!dladdr((char *)pc - caller, &dl) || !dl.dli_fname) {
+		fprintf(f, "[unknown]");
+		return;
+	}
+
+	if (dl.dli_sname) {
+		fprintf(f, "%s", dl.dli_sname);
+		return;
+	}
+
+	// not exported (static function or stripped library), module only
+	module = strrchr(dl.dli_fname, '/');
+	module = module ? module + 1 : dl.dli_fname;
+	fprintf(f, "[%s]", module);
+}
+
+/**
+ * Folded stack line (symbolized stack and samples).
+ */
+typedef struct prof_line_s {
+
+	char		*text;
+	uint64_t	count;
+
+} prof_line_t;
+
+static int __line_cmp(const void *a, const void *b)
+{
+	return strcmp(((const prof_line_t *)a)->text,
+				((const prof_line_t *)b)->text);
+}
+
+/**
+ * Write folded stacks.
+ *
+ * Stacks that differ only by program counters inside the same functions fold
+ * to the same line, lines are sorted and merged before writing.
+ */
+static int __folded_write(const char *path)
+{
+	prof_line_t *lines;
+	prof_stack_t *slot;
+	int nr = 0, ret = 0;
+	size_t size;
+	FILE *f;
+
+	lines = calloc(PROF_STACKS_MAX, sizeof(prof_line_t));
+	if (!lines) {
+		ERROR("calloc error!\n");
+		return -1;
+	}
+
+	for (int i = 0; i < PROF_STACKS_MAX; i++) {
+		slot = &_prof.stacks[i];
+		if (!slot->key || !slot->count ||
+			!__atomic_load_n(&slot->ready, __ATOMIC_ACQUIRE))
+			continue;
+
+		f = open_memstream(&lines[nr].text, &size);
+		if (!f)
+			continue;
+
+		// outermost frame first
+		for (int j = slot->depth - 1; j >= 0; j--) {
+			__frame_print(f, slot->pcs[j], j > 0);
+			if (j)
+				fputc(';', f);
+		}
+		fclose(f);
+
+		lines[nr++].count = slot->count;
+	}
+
+	qsort(lines, nr, sizeof(prof_line_t), __line_cmp);
+
+	f = fopen(path, "w");
+	if (!f) {
+		ERROR("Fail to open %s: %s!\n", path, strerror(errno));
+		ret = -1;
+		goto free_lines;
+	}
+
+	for (int i = 0; i < nr; i++) {
+		if (i + 1 < nr && !strcmp(lines[i].text, lines[i + 1].text)) {
+			lines[i + 1].count += lines[i].count;
+			continue;
+		}
+		fprintf(f, "%s %lu\n", lines[i].text, lines[i].count);
+	}
+
+	fclose(f);
+
+free_lines:
+	for (int i = 0; i < nr; i++)
+		free(lines[i].text);
+	free(lines);
+
+	return ret;
+}
+
+/**
+ * Sampling period (nanoseconds), split by callers into seconds and the
+ * sub-second part (1 Hz is a full second, out of range for tv_nsec alone).
+ */
+static inline long long __period_ns(int hz)
+{
+	return 1000000000LL / hz;
+}
+
+/**
+ * Arm (or disarm if hz is 0) calling thread cpu time timer.
+ */
+static int __thread_timer_arm(int hz)
+{
+	struct itimerspec its;
+	struct sigevent sev;
+
+	if (!_timer_armed) {
+		if (!hz)
+			return 0;
+
+		memset(&sev, 0, sizeof(sev));
+		sev.sigev_notify = SIGEV_THREAD_ID;
+		sev.sigev_signo = SIGPROF;
+		sev.sigev_notify_thread_id = gettid();
+
+		if (timer_create(CLOCK_THREAD_CPUTIME_ID, &sev, &_timer)) {
+			ERROR("timer_create error: %s!\n", strerror(errno));
+			return -1;
+		}
+		_timer_armed = 1;
+	}
+
+	if (!hz) {
+		timer_delete(_timer);
+		_timer_armed = 0;
+		return 0;
+	}
+
+	its.it_interval.tv_sec = __period_ns(hz) / 1000000000LL;
+	its.it_interval.tv_nsec = __period_ns(hz) % 1000000000LL;
+	its.it_value = its.it_interval;
+
+	if (timer_settime(_timer, 0, &its, NULL)) {
+		ERROR("timer_settime error: %s!\n", strerror(errno));
+		return -2;
+	}
+
+	return 0;
+}
+
+/**
+ * Arm (or disarm if hz is 0) process ITIMER_PROF.
+ */
+static int __itimer_arm(int hz)
+{
+	struct itimerval itv;
+
+	memset(&itv, 0, sizeof(itv));
+	if (hz) {
+		itv.it_interval.tv_sec = __period_ns(hz) / 1000000000LL;
+		itv.it_interval.tv_usec = __period_ns(hz) % 1000000000LL / 1000;
+		itv.it_value = itv.it_interval;
+	}
+
+	if (setitimer(ITIMER_PROF, &itv, NULL)) {
+		ERROR("setitimer error: %s!\n", strerror(errno));
+		return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * Build output path, first "%d" is replaced by pid.
+ *
+ * Path comes from the environment, so it is never used as a format string.
+ */
+static void __path_expand(char *buf, size_t size, const char *path, pid_t pid)
+{
+	const char *p = strstr(path, "%d");
+
+	if (!p) {
+		snprintf(buf, size, "%s", path);
+		return;
+	}
+
+	snprintf(buf, size, "%.*s%d%s", (int)(p - path), path, pid, p + 2);
+}
+
+/*==================================PUBLIC====================================*/
+
+/**
+ * Start profiling.
+ *
+ * Calling thread is profiled (and all threads in PROF_MODE_ITIMER mode), other
+ * threads call prof_thread_start(). Folded stacks are written at exit.
+ *
+ * @path	: Output path (first "%d" is replaced by pid).
+ * @hz		: Sampling frequency (0 for PROF_FREQ_HZ, at most 1000000).
+ * @mode	: PROF_MODE_THREAD or PROF_MODE_ITIMER.
+ *
+ * Return 0 on success and <0 otherwise.
+ *
+ * Errors:
+ * 	-1: profiler already running
+ * 	-2: fail to allocate stacks table
+ * 	-3: fail to install SIGPROF handler
+ * 	-4: fail to arm timer
+ */
+int prof_start(const char *path, int hz, int mode)
+{
+	struct sigaction sa;
+
+	if (__atomic_load_n(&_prof.running, __ATOMIC_ACQUIRE)) {
+		ERROR("Profiler already running!\n");
+		return -1;
+	}
+
+	if (hz <= 0)
+		hz = PROF_FREQ_HZ;
+	if (hz > 1000000)
+		hz = 1000000;
+
+	_prof.hz = hz;
+	_prof.mode = mode;
+	__path_expand(_prof.path, sizeof(_prof.path), path, getpid());
+
+	// table is zeroed (free slots) here, never allocated by the handler
+	if (!_prof.stacks) {
+		_prof.stacks = mmap(NULL, PROF_STACKS_MAX * sizeof(prof_stack_t),
+						PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+						-1, 0);
+		if (_prof.stacks == MAP_FAILED) {
+			ERROR("mmap error: %s!\n", strerror(errno));
+			_prof.stacks = NULL;
+			return -2;
+		}
+	} else {
+		memset(_prof.stacks, 0, PROF_STACKS_MAX * sizeof(prof_stack_t));
+	}
+
+	_prof.samples = 0;
+	_prof.dropped = 0;
+	_prof.nr_stacks = 0;
+	_prof.truncated = 0;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_sigaction = __prof_handler;
+	sa.sa_flags = SA_SIGINFO | SA_RESTART;
+	sigemptyset(&sa.sa_mask);
+	if (sigaction(SIGPROF, &sa, NULL)) {
+		ERROR("sigaction error: %s!\n", strerror(errno));
+		return -3;
+	}
+
+	__atomic_store_n(&_prof.running, 1, __ATOMIC_RELEASE);
+
+	if (prof_thread_start() ||
+		(mode == PROF_MODE_ITIMER && __itimer_arm(hz))) {
+		__atomic_store_n(&_prof.running, 0, __ATOMIC_RELEASE);
+		return -4;
+	}
+
+	if (!_prof.atexit) {
+		atexit(prof_stop);
+		_prof.atexit = 1;
+	}
+
+	return 0;
+}
+
+/**
+ * Start profiling if PROF_FILE_ENV is set (PROF_MODE_THREAD).
+ *
+ * Return 0 on success (or if not set) and <0 otherwise.
+ */
+int prof_start_env(void)
+{
+	const char *path = getenv(PROF_FILE_ENV);
+
+	if (!path || !*path)
+		return 0;
+
+	return prof_start(path, PROF_FREQ_HZ, PROF_MODE_THREAD);
+}
+
+/**
+ * Start profiling calling thread.
+ *
+ * Thread stack bounds are recorded (needed to walk frame pointers safely) and
+ * a per-thread cpu time timer is armed in PROF_MODE_THREAD mode.
+ *
+ * Return 0 on success and <0 otherwise.
+ */
+int prof_thread_start(void)
+{
+	pthread_attr_t attr;
+	size_t size;
+	void *addr;
+
+	if (!__atomic_load_n(&_prof.running, __ATOMIC_ACQUIRE))
+		return 0;
+
+	if (!pthread_getattr_np(pthread_self(), &attr)) {
+		if (!pthread_attr_getstack(&attr, &addr, &size))
+			_stack_hi = (uintptr_t)addr + size;
+		pthread_attr_destroy(&attr);
+	}
+
+	if (_prof.mode == PROF_MODE_THREAD)
+		return __thread_timer_arm(_prof.hz);
+
+	return 0;
+}
+
+/**
+ * Stop profiling calling thread (call before thread exits).
+ */
+void prof_thread_stop(void)
+{
+	__thread_timer_arm(0);
+	_stack_hi = 0;
+}
+
+/**
+ * Stop profiling and write folded stacks.
+ *
+ * Timers of other threads may still fire, so SIGPROF is ignored from now on.
+ */
+void prof_stop(void)
+{
+	int running = 1;
+
+	if (!__atomic_compare_exchange_n(&_prof.running, &running, 0, 0,
+								__ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+		return;
+
+	if (_prof.mode == PROF_MODE_ITIMER)
+		__itimer_arm(0);
+
+	prof_thread_stop();
+	signal(SIGPROF, SIG_IGN);
+
+	if (!__folded_write(_prof.path))
+		DEBUG("Profile written to %s (%lu samples, %lu stacks)\n", _prof.path,
+				_prof.samples, _prof.nr_stacks);
+}
+
+/**
+ * Get profiler statistics.
+ *
+ * @stats	: Statistics.
+ */
+void prof_stats(prof_stats_t *stats)
+{
+	stats->samples = __atomic_load_n(&_prof.samples, __ATOMIC_RELAXED);
+	stats->dropped = __atomic_load_n(&_prof.dropped, __ATOMIC_RELAXED);
+	stats->stacks = __atomic_load_n(&_prof.nr_stacks, __ATOMIC_RELAXED);
+	stats->truncated = __atomic_load_n(&_prof.truncated, __ATOMIC_RELAXED);
+}
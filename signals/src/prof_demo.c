@@ -0,0 +1,219 @@
+/**
+ * Sampling profiler demo.
+ * Copyright (C) 2024 Lazar Razvan.
+ *
+ * Worker threads run a fixed cpu bound workload (hashing, floating point and
+ * sorting) first without the profiler and then with it (see prof.c), the
+ * fastest of a few runs is kept for each case and the profiler overhead is
+ * reported. Folded stacks are written to the given path, to render a flame
+ * graph:
+ * 	./run/prof_demo -o prof.folded
+ * 	flamegraph.pl prof.folded > prof.svg
+ *
+ * Workload functions are global and not inlined, so they appear in the stacks
+ * (executable is built with -fno-omit-frame-pointer and -rdynamic).
+ *
+ * Usage:
+ * 	./run/prof_demo [-t threads] [-f hz] [-i] [-o output]
+ * 	./run/prof_demo -t 4 -f 1000 -o prof.%d.folded
+ */
+
+#define _GNU_SOURCE
+
+#include <time.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "debug.h"
+#include "prof.h"
+
+/*============================================================================*/
+
+/* Default worker threads */
+#define THREADS						2
+
+/* Workload iterations for each thread */
+#define ITERATIONS					40
+
+/* Runs for each case (fastest one is kept) */
+#define RUNS						3
+
+/* Elements sorted for each iteration */
+#define SORT_SIZE					(16 * 1024)
+
+static int nr_threads = THREADS;
+static int profiled;
+
+/* Keep results alive */
+volatile uint64_t sink;
+
+/*==================================STATIC====================================*/
+
+static inline uint64_t __time_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int __cmp(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+
+	return (x > y) - (x < y);
+}
+
+/*==================================PUBLIC====================================*/
+
+__attribute__((noinline)) uint64_t work_hash(uint64_t seed)
+{
+	uint64_t hash = 14695981039346656037ULL;
+
+	for (int i = 0; i < 2000000; i++) {
+		hash ^= seed + i;
+		hash *= 1099511628211ULL;
+	}
+
+	return hash;
+}
+
+__attribute__((noinline)) double work_float(double x)
+{
+	double sum = 0;
+
+	for (int i = 1; i < 1000000; i++)
+		sum += sqrt(x * i) / i;
+
+	return sum;
+}
+
+__attribute__((noinline)) uint32_t work_sort(uint32_t seed)
+{
+	static __thread uint32_t data[SORT_SIZE];
+
+	for (int i = 0; i < SORT_SIZE; i++) {
+		seed = seed * 1103515245 + 12345;
+		data[i] = seed;
+	}
+	qsort(data, SORT_SIZE, sizeof(data[0]), __cmp);
+
+	return data[SORT_SIZE / 2];
+}
+
+__attribute__((noinline)) void work_iteration(int i)
+{
+	sink += work_hash(i);
+	sink += (uint64_t)work_float(i + 1);
+
+	// twice the hash cost, should show up as the widest frame
+	sink += work_hash(i * 31);
+	sink += work_sort(i);
+}
+
+void *worker(void *arg)
+{
+	if (profiled)
+		prof_thread_start();
+
+	for (int i = 0; i < ITERATIONS; i++)
+		work_iteration(i);
+
+	if (profiled)
+		prof_thread_stop();
+
+	return NULL;
+}
+
+/**
+ * Run workload on all threads.
+ *
+ * Return elapsed time (ns).
+ */
+uint64_t run_workload(void)
+{
+	pthread_t tids[nr_threads];
+	uint64_t start = __time_ns();
+
+	for (int i = 0; i < nr_threads; i++)
+		if (pthread_create(&tids[i], NULL, worker, NULL))
+			ERROR("pthread_create error!\n");
+
+	for (int i = 0; i < nr_threads; i++)
+		pthread_join(tids[i], NULL);
+
+	return __time_ns() - start;
+}
+
+int main(int argc, char *argv[])
+{
+	const char *output = "prof.%d.folded";
+	int opt, hz = PROF_FREQ_HZ, mode = PROF_MODE_THREAD;
+	uint64_t base = UINT64_MAX, prof = UINT64_MAX, ns;
+	prof_stats_t stats;
+
+	while ((opt = getopt(argc, argv, "t:f:io:")) != -1) {
+		switch (opt) {
+		case 't':
+			nr_threads = atoi(optarg);
+			break;
+		case 'f':
+			hz = atoi(optarg);
+			break;
+		case 'i':
+			mode = PROF_MODE_ITIMER;
+			break;
+		case 'o':
+			output = optarg;
+			break;
+		default:
+			printf("Usage: %s [-t threads] [-f hz] [-i] [-o output]\n",
+					argv[0]);
+			return -1;
+		}
+	}
+
+	if (nr_threads < 1)
+		nr_threads = 1;
+
+	printf("%d threads, %d Hz, %s timer\n", nr_threads, hz,
+			mode == PROF_MODE_THREAD ? "thread cpu" : "ITIMER_PROF");
+
+	// runs are interleaved, so frequency changes affect both cases
+	for (int i = 0; i < RUNS; i++) {
+		profiled = 0;
+		ns = run_workload();
+		if (ns < base)
+			base = ns;
+
+		if (prof_start(output, hz, mode)) {
+			ERROR("Fail to start profiler!\n");
+			return -1;
+		}
+
+		profiled = 1;
+		ns = run_workload();
+		if (ns < prof)
+			prof = ns;
+
+		// last run is written at exit
+		if (i < RUNS - 1)
+			prof_stop();
+	}
+
+	prof_stats(&stats);
+
+	printf("baseline  %10.2f ms\n", base / 1e6);
+	printf("profiled  %10.2f ms\n", prof / 1e6);
+	printf("overhead  %10.2f %%\n", 100.0 * ((double)prof - base) / base);
+	printf("samples %lu, stacks %lu, dropped %lu, truncated %lu\n",
+			stats.samples, stats.stacks, stats.dropped, stats.truncated);
+
+	return 0;
+}
@@ -0,0 +1,154 @@
+/**
+ * Event loop with signals delivered through signalfd.
+ * Copyright (C) 2024 Lazar Razvan.
+ *
+ * A timerfd simulates the work of a server (one tick each second) and signals
+ * are handled synchronously by the same epoll loop:
+ * 	- SIGTERM, SIGINT: graceful shutdown (loop exits and resources are
+ * 	released)
+ * 	- SIGHUP: reload (statistics are reset)
+ * 	- SIGUSR1: statistics dump
+ *
+ * Usage:
+ * 	./run/sig_loop &
+ * 	kill -USR1 <pid>; kill -HUP <pid>; kill -TERM <pid>
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+
+#include "debug.h"
+#include "sig_event.h"
+
+/*============================================================================*/
+
+/* Events handled by each epoll_wait() call */
+#define EVENTS_MAX					8
+
+/**
+ * Loop state.
+ */
+typedef struct loop_s {
+
+	int			running;		// cleared on shutdown
+	uint64_t	ticks;			// timer expirations (work done)
+	uint64_t	reloads;		// SIGHUP received
+
+} loop_t;
+
+/*==================================STATIC====================================*/
+
+static void __on_shutdown(struct signalfd_siginfo *info, void *arg)
+{
+	loop_t *loop = (loop_t *)arg;
+
+	printf("%s from pid %u, shutting down...\n", strsignal(info->ssi_signo),
+			info->ssi_pid);
+	loop->running = 0;
+}
+
+static void __on_reload(struct signalfd_siginfo *info, void *arg)
+{
+	loop_t *loop = (loop_t *)arg;
+
+	printf("reload: statistics reset\n");
+	loop->ticks = 0;
+	loop->reloads++;
+}
+
+static void __on_stats(struct signalfd_siginfo *info, void *arg)
+{
+	loop_t *loop = (loop_t *)arg;
+
+	printf("stats: ticks=%lu reloads=%lu\n", loop->ticks, loop->reloads);
+}
+
+/*============================================================================*/
+
+int main()
+{
+	struct itimerspec its = { { 1, 0 }, { 1, 0 } };
+	struct epoll_event ev, events[EVENTS_MAX];
+	int epoll_fd, timer_fd, nr, rv = -1;
+	loop_t loop = { 1, 0, 0 };
+	uint64_t expirations;
+	sig_event_t se;
+
+	// signals are blocked before any thread is created
+	if (sig_event_init(&se)) {
+		ERROR("Fail to init signal events!\n");
+		return -1;
+	}
+
+	if (sig_event_register(&se, SIGTERM, __on_shutdown, &loop) ||
+		sig_event_register(&se, SIGINT, __on_shutdown, &loop) ||
+		sig_event_register(&se, SIGHUP, __on_reload, &loop) ||
+		sig_event_register(&se, SIGUSR1, __on_stats, &loop)) {
+		ERROR("Fail to register signals!\n");
+		goto se_destroy;
+	}
+
+	epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (epoll_fd == -1) {
+		ERROR("epoll_create1 error: %s!\n", strerror(errno));
+		goto se_destroy;
+	}
+
+	timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (timer_fd == -1) {
+		ERROR("timerfd_create error: %s!\n", strerror(errno));
+		goto epoll_close;
+	}
+
+	if (timerfd_settime(timer_fd, 0, &its, NULL) == -1) {
+		ERROR("timerfd_settime error: %s!\n", strerror(errno));
+		goto timer_close;
+	}
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.fd = timer_fd;
+	if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, timer_fd, &ev) == -1 ||
+		sig_event_epoll_add(&se, epoll_fd)) {
+		ERROR("Fail to add descriptors to epoll!\n");
+		goto timer_close;
+	}
+
+	printf("pid %d: SIGUSR1 stats, SIGHUP reload, SIGTERM/SIGINT shutdown\n",
+			getpid());
+
+	while (loop.running) {
+		nr = epoll_wait(epoll_fd, events, EVENTS_MAX, -1);
+		if (nr == -1) {
+			ERROR("epoll_wait error: %s!\n", strerror(errno));
+			goto timer_close;
+		}
+
+		for (int i = 0; i < nr; i++) {
+			if (events[i].data.fd == se.fd) {
+				sig_event_dispatch(&se);
+			} else if (events[i].data.fd == timer_fd) {
+				if (read(timer_fd, &expirations, sizeof(expirations)) > 0)
+					loop.ticks += expirations;
+			}
+		}
+	}
+
+	printf("done: ticks=%lu\n", loop.ticks);
+	rv = 0;
+
+timer_close:
+	close(timer_fd);
+epoll_close:
+	close(epoll_fd);
+se_destroy:
+	sig_event_destroy(&se);
+
+	return rv;
+}
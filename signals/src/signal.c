@@ -8,6 +8,13 @@
  * system call.
  *
  * We will use SIGINT (interrupt) signal in the following example.
+ *
+ * A handler may interrupt the main program at any instruction, so a flag
+ * shared with it must be volatile sig_atomic_t (read and written in a single
+ * access that is never cached in a register). Main program waits for the
+ * signal using sigsuspend() instead of polling the flag with sleep(), so it
+ * wakes up as soon as the handler returns. See sig_event.c for a signalfd
+ * implementation without asynchronous handlers.
  */
 
 #include <stdio.h>
@@ -19,7 +26,7 @@
 #include "debug.h"
 
 /*============================================================================*/
-bool _signaled = false;
+static volatile sig_atomic_t _signaled = 0;
 
 /*==================================STATIC====================================*/
 /**
@@ -27,7 +34,7 @@ bool _signaled = false;
  */
 static void __test_handler(int signal_no)
 {
-	_signaled = true;
+	_signaled = 1;
 }
 
 /*============================================================================*/
@@ -35,6 +42,7 @@ static void __test_handler(int signal_no)
 int main()
 {
 	void (*old_handler)(int);
+	sigset_t block, old;
 
 	/**
 	 * Change SIGNINT signal disposition.
@@ -47,9 +55,26 @@ int main()
 		exit(1);
 	}
 
+	/**
+	 * Block SIGINT while checking the flag, so that it cannot be delivered
+	 * between the check and sigsuspend() (it would be lost until the next
+	 * one). sigsuspend() atomically restores the old mask and waits.
+	 */
+	sigemptyset(&block);
+	sigaddset(&block, SIGINT);
+	if (sigprocmask(SIG_BLOCK, &block, &old) == -1) {
+		ERROR("sigprocmask() error!\n");
+		exit(1);
+	}
+
 	printf("Waiting to send SIGINT (Ctrl + C) signal...\n");
 	while (!_signaled)
-		sleep(10);
+		sigsuspend(&old);
+
+	if (sigprocmask(SIG_SETMASK, &old, NULL) == -1) {
+		ERROR("sigprocmask() error!\n");
+		exit(1);
+	}
 
 
 	printf("SIGINT signal received...\n");
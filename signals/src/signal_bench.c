@@ -0,0 +1,517 @@
+/**
+ * Signal delivery latency and throughput benchmark.
+ * Copyright (C) 2024 Lazar Razvan.
+ *
+ * A sender process sends signals to a receiver process (child), each one
+ * optionally pinned to a given CPU. The receiver gets signals using:
+ * 	1) sigaction() handler
+ * 		Handler runs asynchronously, interrupting the receiver (which waits
+ * 	in sigsuspend()).
+ *
+ * 	2) sigwaitinfo()
+ * 		Signal is blocked and accepted synchronously.
+ *
+ * 	3) signalfd()
+ * 		Signal is blocked and read from a descriptor (see sig_event.c).
+ *
+ * 	4) self-pipe
+ * 		Handler writes the signal into a pipe that is read by the main loop,
+ * 	the classic way to move signal handling into an event loop.
+ *
+ * Each mechanism is measured with a standard signal (SIGUSR1, kill()) and a
+ * real-time signal (SIGRTMIN, sigqueue() with a sequence number payload):
+ * 	- latency: sender writes a timestamp in shared memory, sends one signal
+ * 	and waits for an acknowledge (pipe) before the next one, receiver records
+ * 	the time until the signal is handled
+ * 	- throughput: sender sends signals back to back; standard signals that
+ * 	are already pending coalesce (only one is delivered), while real-time
+ * 	signals are queued (sigqueue() fails with EAGAIN when RLIMIT_SIGPENDING is
+ * 	reached and is retried)
+ *
+ * Usage:
+ * 	./run/signal_bench [-n signals] [-s sender cpu] [-r receiver cpu]
+ * 	./run/signal_bench -n 100000 -s 0 -r 1
+ */
+
+#define _GNU_SOURCE
+
+#include <time.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <sys/signalfd.h>
+
+#include "debug.h"
+#include "histogram.h"
+
+/*============================================================================*/
+
+/* Default signals sent for each test */
+#define SIGNALS						10000
+
+/* Self-pipe size (bytes) */
+#define SELF_PIPE_SIZE				(1024 * 1024)
+
+/**
+ * Test mode.
+ */
+#define MODE_LATENCY				0
+#define MODE_THROUGHPUT				1
+
+/**
+ * Receive mechanism.
+ */
+typedef struct mechanism_s {
+
+	const char	*name;
+	void		(*setup)(void);
+	void		(*loop)(void);
+
+} mechanism_t;
+
+/**
+ * Memory shared by sender and receiver.
+ */
+typedef struct shared_s {
+
+	uint64_t	send_ns;		// timestamp of last signal sent (latency)
+	uint64_t	start_ns;		// timestamp of first signal sent (throughput)
+
+} shared_t;
+
+/**
+ * Self-pipe record.
+ */
+typedef struct record_s {
+
+	int			signo;
+	int			value;
+
+} record_t;
+
+static int nr_signals = SIGNALS;
+static int send_cpu = -1;
+static int recv_cpu = -1;
+
+static shared_t *shared;
+static int ack_fd[2];
+
+/* Receiver state */
+static int mode;
+static int data_sig, stop_sig;
+static sigset_t sig_set;
+static volatile sig_atomic_t done;
+static histogram_t hist;
+static long received, bad_payload;
+static int self_pipe[2];
+static volatile sig_atomic_t stop_pending;
+static long dropped;
+
+/*==================================STATIC====================================*/
+
+static inline uint64_t __time_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void __pin(int cpu)
+{
+	cpu_set_t set;
+
+	if (cpu < 0)
+		return;
+
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	if (sched_setaffinity(0, sizeof(set), &set))
+		ERROR("Fail to pin to cpu %d: %s!\n", cpu, strerror(errno));
+}
+
+/**
+ * Signal received (async-signal-safe, also called from handler).
+ */
+static void __on_receive(int signo, int value)
+{
+	char c = 0;
+
+	if (signo == stop_sig) {
+		done = 1;
+		return;
+	}
+
+	if (mode == MODE_LATENCY) {
+		histogram_record(&hist, __time_ns() - shared->send_ns);
+
+		// real-time signal payload is the sequence number
+		if (data_sig != SIGUSR1 && value != received)
+			bad_payload++;
+
+		received++;
+		if (write(ack_fd[1], &c, 1) != 1)
+			done = 1;
+	} else {
+		received++;
+	}
+}
+
+/**
+ * 1) sigaction() handler.
+ */
+static void __handler(int signo, siginfo_t *info, void *ctx)
+{
+	__on_receive(signo, info->si_value.sival_int);
+}
+
+static void __handler_setup(void)
+{
+	struct sigaction sa;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_sigaction = __handler;
+	sa.sa_flags = SA_SIGINFO | SA_RESTART;
+	sigfillset(&sa.sa_mask);
+
+	if (sigaction(data_sig, &sa, NULL) || sigaction(stop_sig, &sa, NULL))
+		ERROR("sigaction error: %s!\n", strerror(errno));
+}
+
+static void __handler_loop(void)
+{
+	sigset_t old;
+
+	// signals are blocked except inside sigsuspend() (no lost wake-up)
+	sigprocmask(SIG_BLOCK, &sig_set, &old);
+	while (!done)
+		sigsuspend(&old);
+}
+
+/**
+ * 2) sigwaitinfo().
+ */
+static void __block_setup(void)
+{
+	sigprocmask(SIG_BLOCK, &sig_set, NULL);
+}
+
+static void __sigwaitinfo_loop(void)
+{
+	siginfo_t info;
+	int signo;
+
+	while (!done) {
+		signo = sigwaitinfo(&sig_set, &info);
+		if (signo == -1) {
+			if (errno == EINTR)
+				continue;
+			ERROR("sigwaitinfo error: %s!\n", strerror(errno));
+			return;
+		}
+
+		__on_receive(signo, info.si_value.sival_int);
+	}
+}
+
+/**
+ * 3) signalfd().
+ */
+static void __signalfd_loop(void)
+{
+	struct signalfd_siginfo info[16];
+	ssize_t rv;
+	int fd;
+
+	fd = signalfd(-1, &sig_set, SFD_CLOEXEC);
+	if (fd == -1) {
+		ERROR("signalfd error: %s!\n", strerror(errno));
+		return;
+	}
+
+	while (!done) {
+		rv = read(fd, info, sizeof(info));
+		if (rv == -1) {
+			if (errno == EINTR)
+				continue;
+			ERROR("read error: %s!\n", strerror(errno));
+			break;
+		}
+
+		for (int i = 0; i < rv / sizeof(info[0]); i++)
+			__on_receive(info[i].ssi_signo, info[i].ssi_int);
+	}
+
+	close(fd);
+}
+
+/**
+ * 4) self-pipe.
+ */
+static void __self_pipe_handler(int signo, siginfo_t *info, void *ctx)
+{
+	record_t rec = { signo, info->si_value.sival_int };
+	int errno_bak = errno;
+
+	// stop record may not fit in a full pipe, loop checks the flag too
+	if (signo == stop_sig)
+		stop_pending = 1;
+
+	// pipe is non-blocking, handler must never block the main loop
+	if (write(self_pipe[1], &rec, sizeof(rec)) != sizeof(rec) &&
+		signo != stop_sig)
+		dropped++;
+
+	errno = errno_bak;
+}
+
+static void __self_pipe_setup(void)
+{
+	struct sigaction sa;
+
+	if (pipe2(self_pipe, O_NONBLOCK | O_CLOEXEC)) {
+		ERROR("pipe2 error: %s!\n", strerror(errno));
+		return;
+	}
+
+	// read end is blocking, write end (handler) is not
+	fcntl(self_pipe[0], F_SETFL, 0);
+	fcntl(self_pipe[1], F_SETPIPE_SZ, SELF_PIPE_SIZE);
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_sigaction = __self_pipe_handler;
+	sa.sa_flags = SA_SIGINFO | SA_RESTART;
+	sigfillset(&sa.sa_mask);
+
+	if (sigaction(data_sig, &sa, NULL) || sigaction(stop_sig, &sa, NULL))
+		ERROR("sigaction error: %s!\n", strerror(errno));
+}
+
+static void __self_pipe_loop(void)
+{
+	record_t rec[64];
+	ssize_t rv;
+
+	while (!done) {
+		rv = read(self_pipe[0], rec, sizeof(rec));
+		if (rv == -1) {
+			if (errno == EINTR)
+				continue;
+
+			// pipe drained and stop record was dropped (pipe full)
+			if (errno == EAGAIN) {
+				done = 1;
+				break;
+			}
+
+			ERROR("read error: %s!\n", strerror(errno));
+			return;
+		}
+
+		// records are written atomically (smaller than PIPE_BUF)
+		for (int i = 0; i < rv / sizeof(rec[0]); i++)
+			__on_receive(rec[i].signo, rec[i].value);
+
+		/**
+		 * Stop signal received: if its record was dropped, the pipe was
+		 * full, so drain what is left without blocking and stop.
+		 */
+		if (stop_pending)
+			fcntl(self_pipe[0], F_SETFL, O_NONBLOCK);
+	}
+}
+
+static const mechanism_t mechanisms[] = {
+	{ "handler",		__handler_setup,	__handler_loop		},
+	{ "sigwaitinfo",	__block_setup,		__sigwaitinfo_loop	},
+	{ "signalfd",		__block_setup,		__signalfd_loop		},
+	{ "self-pipe",		__self_pipe_setup,	__self_pipe_loop	},
+};
+
+/**
+ * Send a signal (standard signals using kill(), real-time using sigqueue()).
+ */
+static void __send(pid_t pid, int signo, int value)
+{
+	union sigval sv;
+
+	if (signo == SIGUSR1 || signo == SIGUSR2) {
+		kill(pid, signo);
+		return;
+	}
+
+	// real-time signal queue full (RLIMIT_SIGPENDING), retry
+	sv.sival_int = value;
+	while (sigqueue(pid, signo, sv) == -1 && errno == EAGAIN)
+		sched_yield();
+}
+
+/**
+ * Receiver (child process).
+ */
+static void __receiver(const mechanism_t *m)
+{
+	char c = 0;
+	uint64_t elapsed;
+
+	__pin(recv_cpu);
+
+	histogram_init(&hist);
+	sigemptyset(&sig_set);
+	sigaddset(&sig_set, data_sig);
+	sigaddset(&sig_set, stop_sig);
+
+	m->setup();
+
+	// ready
+	if (write(ack_fd[1], &c, 1) != 1)
+		_exit(1);
+
+	m->loop();
+
+	if (mode == MODE_LATENCY) {
+		printf("%-12s %-9s %10lu %10.2f %10.2f %10.2f %10.2f %10.2f\n",
+				m->name, data_sig == SIGUSR1 ? "standard" : "real-time",
+				hist.total, histogram_mean(&hist) / 1e3,
+				histogram_percentile(&hist, 50.0) / 1e3,
+				histogram_percentile(&hist, 99.0) / 1e3,
+				histogram_percentile(&hist, 99.9) / 1e3, hist.max / 1e3);
+		if (bad_payload)
+			printf("    %ld signals with unexpected payload\n", bad_payload);
+	} else {
+		elapsed = __time_ns() - shared->start_ns;
+		printf("%-12s %-9s %10d %10ld %12.0f\n", m->name,
+				data_sig == SIGUSR1 ? "standard" : "real-time", nr_signals,
+				received, received / (elapsed / 1e9));
+	}
+
+	if (dropped)
+		printf("    %ld signals dropped (self-pipe full)\n", dropped);
+
+	fflush(stdout);
+	_exit(0);
+}
+
+/**
+ * Run one test (sender is the calling process).
+ */
+static void __test(const mechanism_t *m, int test_mode, int rt)
+{
+	pid_t pid;
+	char c;
+
+	mode = test_mode;
+	data_sig = rt ? SIGRTMIN : SIGUSR1;
+	stop_sig = rt ? SIGRTMIN + 1 : SIGUSR2;
+
+	if (pipe(ack_fd)) {
+		ERROR("pipe error: %s!\n", strerror(errno));
+		return;
+	}
+
+	fflush(stdout);
+
+	pid = fork();
+	if (pid == -1) {
+		ERROR("fork error: %s!\n", strerror(errno));
+		goto close_pipe;
+	}
+
+	if (pid == 0)
+		__receiver(m);
+
+	// wait for receiver to be ready
+	if (read(ack_fd[0], &c, 1) != 1)
+		goto wait_child;
+
+	if (mode == MODE_LATENCY) {
+		for (int i = 0; i < nr_signals; i++) {
+			shared->send_ns = __time_ns();
+			__send(pid, data_sig, i);
+			if (read(ack_fd[0], &c, 1) != 1)
+				break;
+		}
+	} else {
+		shared->start_ns = __time_ns();
+		for (int i = 0; i < nr_signals; i++)
+			__send(pid, data_sig, i);
+	}
+
+	__send(pid, stop_sig, 0);
+
+wait_child:
+	waitpid(pid, NULL, 0);
+close_pipe:
+	close(ack_fd[0]);
+	close(ack_fd[1]);
+}
+
+/*============================================================================*/
+
+int main(int argc, char *argv[])
+{
+	int opt, nr = sizeof(mechanisms) / sizeof(mechanisms[0]);
+
+	while ((opt = getopt(argc, argv, "n:s:r:")) != -1) {
+		switch (opt) {
+		case 'n':
+			nr_signals = atoi(optarg);
+			break;
+		case 's':
+			send_cpu = atoi(optarg);
+			break;
+		case 'r':
+			recv_cpu = atoi(optarg);
+			break;
+		default:
+			printf("Usage: %s [-n signals] [-s sender cpu] [-r receiver cpu]\n",
+					argv[0]);
+			return -1;
+		}
+	}
+
+	if (nr_signals < 1)
+		nr_signals = 1;
+
+	shared = mmap(NULL, sizeof(shared_t), PROT_READ | PROT_WRITE,
+				MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (shared == MAP_FAILED) {
+		ERROR("mmap error: %s!\n", strerror(errno));
+		return -1;
+	}
+
+	__pin(send_cpu);
+
+	printf("%d signals, sender cpu %d, receiver cpu %d\n", nr_signals,
+			send_cpu, recv_cpu);
+
+	printf("================ latency (us) ================\n");
+	printf("%-12s %-9s %10s %10s %10s %10s %10s %10s\n", "mechanism",
+			"signal", "count", "mean", "p50", "p99", "p99.9", "max");
+	for (int i = 0; i < nr; i++) {
+		__test(&mechanisms[i], MODE_LATENCY, 0);
+		__test(&mechanisms[i], MODE_LATENCY, 1);
+	}
+
+	printf("================ throughput ================\n");
+	printf("%-12s %-9s %10s %10s %12s\n", "mechanism", "signal", "sent",
+			"received", "signals/s");
+	for (int i = 0; i < nr; i++) {
+		__test(&mechanisms[i], MODE_THROUGHPUT, 0);
+		__test(&mechanisms[i], MODE_THROUGHPUT, 1);
+	}
+
+	munmap(shared, sizeof(shared_t));
+
+	return 0;
+}
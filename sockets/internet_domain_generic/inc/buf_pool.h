@@ -0,0 +1,118 @@
+#ifndef BUF_POOL_H
+#define BUF_POOL_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*============================================================================*/
+
+/**
+ * Config: Buffer size classes.
+ *
+ * Power of two classes from 2^BUF_POOL_MIN_SHIFT (a connection starts there)
+ * to 2^BUF_POOL_MAX_SHIFT (bulk transfer).
+ */
+#define BUF_POOL_MIN_SHIFT			9
+#define BUF_POOL_MAX_SHIFT			16
+
+// Number of size classes
+#define BUF_POOL_CLASSES			(BUF_POOL_MAX_SHIFT - BUF_POOL_MIN_SHIFT + 1)
+
+// Smallest and largest buffer
+#define BUF_POOL_MIN_SIZE			(1U << BUF_POOL_MIN_SHIFT)
+#define BUF_POOL_MAX_SIZE			(1U << BUF_POOL_MAX_SHIFT)
+
+// Free buffers kept for each class (more are released to malloc)
+#define BUF_POOL_CACHE_MAX			256
+
+// Free buffers released to malloc once a server is idle this long (ms)
+#define BUF_POOL_TRIM_MS			1000
+
+/**
+ * Config: Adaptive connection buffer size.
+ *
+ * A read that fills the buffer grows it to the next class, while
+ * BUF_SIZER_SHRINK_READS reads in a row using less than a quarter of it
+ * shrink it to the previous class.
+ */
+#define BUF_SIZER_SHRINK_READS		16
+
+
+/*============================================================================*/
+
+/**
+ * Reference counted buffer.
+ *
+ * Data is shared, not copied, by taking a reference (buf_ref()) for each
+ * consumer (echo, fan out). Buffer goes back to its pool class when the last
+ * reference is dropped.
+ */
+typedef struct buf_s {
+
+	struct buf_s	*next;					// pool free list
+	uint32_t		refcnt;					// references (atomic)
+	uint32_t		size;					// data size (class size)
+	uint32_t		len;					// data used (owner)
+	uint8_t			cls;					// size class
+	char			data[] __attribute__((aligned(16)));
+
+} buf_t;
+
+/**
+ * Adaptive buffer size of a connection (observed read sizes).
+ */
+typedef struct buf_sizer_s {
+
+	uint8_t			cls;					// current size class
+	uint8_t			small;					// small reads in a row
+
+} buf_sizer_t;
+
+/**
+ * Pool counters (all classes).
+ */
+typedef struct buf_pool_stats_s {
+
+	uint64_t		allocs;					// buf_alloc() calls
+	uint64_t		hits;					// served from a free list
+	uint64_t		cached;					// free buffers in pool
+
+} buf_pool_stats_t;
+
+
+/*============================================================================*/
+
+// Allocate a buffer of at least size bytes (reference count 1)
+buf_t *buf_alloc(size_t size);
+
+// Take a reference
+buf_t *buf_ref(buf_t *b);
+
+// Drop a reference (last one returns buffer to its pool class)
+void buf_unref(buf_t *b);
+
+// Buffer referenced by other consumers too (data must not be overwritten)
+int buf_shared(buf_t *b);
+
+// Pool counters
+void buf_pool_stats(buf_pool_stats_t *stats);
+
+// Print pool counters
+void buf_pool_dump(const char *name);
+
+// Release all free buffers to malloc
+void buf_pool_trim(void);
+
+// Init connection size at smallest class
+void buf_sizer_init(buf_sizer_t *s);
+
+// Current connection buffer size
+size_t buf_sizer_size(buf_sizer_t *s);
+
+// Record a read (return 1 if size class changed)
+int buf_sizer_record(buf_sizer_t *s, size_t read_bytes);
+
+// Replace connection buffer if its size class changed or it is shared
+buf_t *buf_sizer_refresh(buf_sizer_t *s, buf_t *b);
+
+#endif	// BUF_POOL_H
@@ -10,4 +10,7 @@
 // Server port
 #define SERVER_PORT					"50001"
 
+// Pending connections of the servers listening socket (listen() backlog)
+#define LISTEN_BACKLOG				SOMAXCONN
+
 #endif	// COMMON_H
@@ -0,0 +1,96 @@
+#ifndef DEADLINE_H
+#define DEADLINE_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "stats.h"
+#include "timer_wheel.h"
+
+/**
+ * Config: Connection deadlines (milliseconds, 0 disables)
+ */
+
+// No request received (connection idle)
+#define DEADLINE_IDLE_MS			60000
+
+// Rest of a partially received request
+#define DEADLINE_READ_MS			10000
+
+// Send blocked (client does not read its replies)
+#define DEADLINE_WRITE_MS			10000
+
+// Environment variables overriding the defaults (deadline_config_env)
+#define DEADLINE_IDLE_ENV			"IDLE_TIMEOUT_MS"
+#define DEADLINE_READ_ENV			"READ_TIMEOUT_MS"
+#define DEADLINE_WRITE_ENV			"WRITE_TIMEOUT_MS"
+
+
+/*============================================================================*/
+
+/**
+ * Deadlines configuration.
+ */
+typedef struct deadline_config_s {
+
+	unsigned int	idle_ms;
+	unsigned int	read_ms;
+	unsigned int	write_ms;
+
+} deadline_config_t;
+
+/**
+ * Connection deadline (one for each connection, embedded in its state).
+ *
+ * Owned by the connection thread, the watchdog thread only expires it.
+ */
+typedef struct deadline_s {
+
+	wheel_timer_t	timer;			// watchdog timer (watchdog lock)
+	uint64_t		queued;			// tick timer is queued at (watchdog lock)
+	uint64_t		expires;		// current deadline (atomic)
+	const char		*what;			// current deadline kind (log)
+	int				fd;				// socket shut down on expiry
+	int				armed;			// timer queued (owner only)
+	int				expired;		// deadline expired (atomic)
+
+} deadline_t;
+
+
+/*============================================================================*/
+
+// Read deadlines from environment (defaults for variables not set)
+void deadline_config_env(deadline_config_t *cfg);
+
+// Current time in deadline ticks (milliseconds, CLOCK_MONOTONIC_COARSE)
+uint64_t deadline_now(void);
+
+// Start watchdog thread (expired connections are counted in stats)
+int deadline_start(server_stats_t *stats);
+
+// Stop watchdog thread
+void deadline_stop(void);
+
+// Init connection deadline (socket shut down when it expires)
+void deadline_init(deadline_t *d, int fd);
+
+// Set deadline ms from now (0 cancels), lock-free unless moved earlier
+void deadline_arm(deadline_t *d, const char *what, unsigned int ms);
+
+// Cancel deadline (call before closing the socket)
+void deadline_cancel(deadline_t *d);
+
+// Deadline expired (socket was shut down)
+int deadline_expired(deadline_t *d);
+
+// Send all data, write deadline is armed only if send would block
+ssize_t deadline_send(deadline_t *d, const void *buf, size_t len,
+					unsigned int ms);
+
+// epoll_wait() timeout until next event of an event loop timer wheel
+int deadline_wheel_timeout(timer_wheel_t *tw);
+
+// Socket write deadline for a single client event loop (SO_SNDTIMEO)
+int deadline_sndtimeo(int fd, unsigned int ms);
+
+#endif	// DEADLINE_H
@@ -3,8 +3,14 @@
 
 #include <stdio.h>
 
+#include "log.h"
+
 /**
  * Config: Enable/Disable macros
+ *
+ * Messages are recorded by the asynchronous logger (log.h) and written by a
+ * background thread. Use LOG_LEVEL environment variable or log_set_level()
+ * to change the level at runtime.
  */
 #define DEBUG_ENABLE		1
 #define ERROR_ENABLE		1
@@ -12,7 +18,7 @@
 // Debug macro
 #if DEBUG_ENABLE
 #	define DEBUG(fmt, ...) 		\
-		printf("%s:%d:debug::"fmt, __func__, __LINE__, ##__VA_ARGS__)
+		LOG(LOG_LEVEL_DEBUG, "debug", fmt, ##__VA_ARGS__)
 #else
 #	define DEBUG(fmt, ...)	{}
 #endif
@@ -20,10 +26,9 @@
 // Error macro
 #if ERROR_ENABLE
 #	define ERROR(fmt, ...) 		\
-		printf("%s:%d:error::"fmt, __func__, __LINE__, ##__VA_ARGS__)
+		LOG(LOG_LEVEL_ERROR, "error", fmt, ##__VA_ARGS__)
 #else
 #	define ERROR(fmt, ...)	{}
 #endif
 
 #endif	// DEBUG_H
-
@@ -0,0 +1,97 @@
+#ifndef FRAME_H
+#define FRAME_H
+
+#include <stdint.h>
+#include <sys/uio.h>
+#include <sys/types.h>
+
+
+/*============================================================================*/
+
+// Largest frame payload accepted by the parser
+#define FRAME_PAYLOAD_MAX					(64 * 1024)
+
+// Parser buffer size (at least one whole frame, more frames per recv())
+#define FRAME_BUF_SIZE						(2 * (FRAME_PAYLOAD_MAX + 4))
+
+// Frames coalesced by a batch into a single writev()
+#define FRAME_BATCH_MAX						64
+
+
+/*============================================================================*/
+
+/**
+ * Frame: 4 bytes payload length (network byte order), then payload.
+ */
+#define FRAME_HDR_SIZE						sizeof(uint32_t)
+
+typedef struct frame_s {
+
+	uint32_t	len;						// payload length
+	char		*payload;					// inside parser buffer
+
+} frame_t;
+
+/**
+ * Incremental parser, data is received into its buffer and complete frames
+ * are parsed in place (partial frames are kept for the next recv()).
+ */
+typedef struct frame_parser_s {
+
+	char		*buf;						// FRAME_BUF_SIZE bytes
+	size_t		start;						// first byte not parsed
+	size_t		end;						// end of received data
+
+} frame_parser_t;
+
+/**
+ * Batch of replies, headers and payloads sent with one writev().
+ */
+typedef struct frame_batch_s {
+
+	uint32_t		hdrs[FRAME_BATCH_MAX];			// headers (network order)
+	struct iovec	iov[2 * FRAME_BATCH_MAX];		// header and payload
+	int				nr;								// frames in batch
+	int				sent;							// iovecs sent (EAGAIN)
+
+} frame_batch_t;
+
+
+/*============================================================================*/
+
+// Initialize parser (allocate buffer)
+int frame_parser_init(frame_parser_t *p);
+
+// Free parser buffer
+void frame_parser_destroy(frame_parser_t *p);
+
+// Drop buffered data (parser reused for a new connection)
+void frame_parser_reset(frame_parser_t *p);
+
+// Receive data into parser buffer (recv() return value)
+ssize_t frame_parser_recv(frame_parser_t *p, int fd);
+
+// Bytes received and not parsed yet (partial frame)
+static inline size_t
+frame_parser_pending(const frame_parser_t *p)
+{
+	return p->end - p->start;
+}
+
+// Next complete frame (1 frame, 0 more data needed, -1 invalid frame)
+int frame_parser_next(frame_parser_t *p, frame_t *f);
+
+// Empty batch
+void frame_batch_init(frame_batch_t *b);
+
+// Add a frame to batch (-1 when batch is full)
+int frame_batch_add(frame_batch_t *b, const void *payload, uint32_t len);
+
+// Send all frames of batch (writev() until done or EAGAIN) and empty it
+int frame_batch_flush(frame_batch_t *b, int fd, int flags);
+
+// Send a single frame
+int frame_send(int fd, const void *payload, uint32_t len);
+
+
+#endif	// FRAME_H
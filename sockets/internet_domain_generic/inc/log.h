@@ -0,0 +1,87 @@
+#ifndef LOG_H
+#define LOG_H
+
+#include <stdint.h>
+
+/**
+ * Config: Logger
+ */
+
+// Records per thread ring buffer (power of two)
+#define LOG_RING_SIZE				1024
+
+// Max arguments per message (including '*' width and precision)
+#define LOG_ARGS_MAX				12
+
+// Bytes per message for copied string (%s) arguments
+#define LOG_STRS_MAX				256
+
+// Messages per second for each call site (0 to disable rate limiting)
+#define LOG_RATE_LIMIT				1000
+
+// Max delay of a message once background thread is woken up (microseconds),
+// messages recorded meanwhile are written together
+#define LOG_FLUSH_PERIOD_US			1000
+
+// Environment variable with initial log level (name or number)
+#define LOG_LEVEL_ENV				"LOG_LEVEL"
+
+
+/*============================================================================*/
+
+/**
+ * Log levels.
+ */
+#define LOG_LEVEL_NONE				-1
+#define LOG_LEVEL_ERROR				0
+#define LOG_LEVEL_WARN				1
+#define LOG_LEVEL_INFO				2
+#define LOG_LEVEL_DEBUG				3
+
+/**
+ * Call site (one static instance for each LOG() call).
+ */
+typedef struct log_site_s {
+
+	const char	*fmt;			// format string
+	const char	*func;			// function name
+	const char	*tag;			// level tag
+	int			line;			// line number
+	uint32_t	count;			// messages in current window (rate limit)
+	uint64_t	window;			// current window (seconds)
+	uint64_t	suppressed;		// messages dropped by rate limit
+
+} log_site_t;
+
+
+/*============================================================================*/
+
+// Current log level (set using log_set_level())
+extern int log_level;
+
+// Set log level at runtime
+void log_set_level(int level);
+
+// Format and write all pending messages (called at exit)
+void log_flush(void);
+
+// Record a message (use LOG() macro)
+void log_write(log_site_t *site, const char *fmt, ...)
+	__attribute__((format(printf, 2, 3)));
+
+
+/*============================================================================*/
+
+// Log macro (format string pointer and raw arguments are recorded)
+#define LOG(level, tag_str, fmt_str, ...)								\
+	do {																\
+		static log_site_t __log_site = {								\
+			.fmt = fmt_str, .func = __func__, .tag = tag_str,			\
+			.line = __LINE__,											\
+		};																\
+		if (__builtin_expect((level) <=								\
+			__atomic_load_n(&log_level, __ATOMIC_RELAXED), 1))			\
+			log_write(&__log_site, fmt_str, ##__VA_ARGS__);				\
+	} while (0)
+
+#endif	// LOG_H
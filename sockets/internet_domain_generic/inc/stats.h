@@ -0,0 +1,60 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdint.h>
+
+#include "sig_event.h"
+
+
+/*============================================================================*/
+
+/**
+ * Server statistics.
+ *
+ * Counters are updated atomically, so they may be shared between threads or
+ * between processes (stats_create() with shared set).
+ */
+typedef struct server_stats_s {
+
+	uint64_t		accepted;		// connections accepted
+	uint64_t		active;			// connections in progress
+	uint64_t		closed;			// connections closed
+	uint64_t		timeouts;		// connections closed by a deadline
+	uint64_t		bytes_in;		// bytes received
+	uint64_t		bytes_out;		// bytes sent
+	uint64_t		reloads;		// reloads (SIGHUP)
+
+} server_stats_t;
+
+
+/*============================================================================*/
+
+// Create statistics (shared between processes if shared is set)
+server_stats_t *stats_create(int shared);
+
+// Destroy statistics
+void stats_destroy(server_stats_t *stats, int shared);
+
+// Connection accepted
+void stats_conn_open(server_stats_t *stats);
+
+// Connection closed (return active connections left)
+uint64_t stats_conn_close(server_stats_t *stats);
+
+// Connection deadline expired (closed later, by its owner)
+void stats_conn_timeout(server_stats_t *stats);
+
+// Bytes received and sent
+void stats_bytes(server_stats_t *stats, uint64_t in, uint64_t out);
+
+// Reset counters (active connections are kept)
+void stats_reset(server_stats_t *stats);
+
+// Print counters
+void stats_dump(server_stats_t *stats, const char *name);
+
+// Register SIGTERM/SIGINT (clear running), SIGHUP (reset), SIGUSR1 (dump)
+int stats_signals_register(sig_event_t *se, server_stats_t *stats,
+						int *running);
+
+#endif	// STATS_H
@@ -0,0 +1,97 @@
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include <stdint.h>
+
+/*============================================================================*/
+
+/**
+ * Config: Timer wheel geometry.
+ *
+ * TIMER_WHEEL_LEVELS wheels of 2^TIMER_WHEEL_BITS slots each, level L slots
+ * are 2^(L * TIMER_WHEEL_BITS) ticks wide (4 x 256 slots => 2^32 ticks, ~49
+ * days with 1 ms ticks). Longer timers are parked in the last slot reachable
+ * and placed again when cascaded.
+ */
+#define TIMER_WHEEL_BITS			8
+#define TIMER_WHEEL_LEVELS			4
+
+// Slots for each level
+#define TIMER_WHEEL_SLOTS			(1U << TIMER_WHEEL_BITS)
+
+// Slot index mask
+#define TIMER_WHEEL_MASK			(TIMER_WHEEL_SLOTS - 1)
+
+// Largest delta placed without parking
+#define TIMER_WHEEL_MAX_DELTA		\
+		((1ULL << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS)) - 1)
+
+
+/*============================================================================*/
+
+struct wheel_timer_s;
+
+/**
+ * Timer callback.
+ *
+ * Called from timer_wheel_advance(), timer is no longer pending so it may be
+ * added again (or freed) by the callback.
+ */
+typedef void (*wheel_timer_cb_t)(struct wheel_timer_s *t, void *arg);
+
+/**
+ * Timer (embedded in the object it times out, no allocation).
+ */
+typedef struct wheel_timer_s {
+
+	struct wheel_timer_s	*next;			// slot list (NULL if not pending)
+	struct wheel_timer_s	*prev;
+	uint64_t				expires;		// expiry tick
+	wheel_timer_cb_t		cb;				// expiry callback
+	void					*arg;			// callback argument
+
+} wheel_timer_t;
+
+/**
+ * Hierarchical timer wheel.
+ *
+ * Slots are circular lists with a sentinel head. Not synchronized, callers
+ * sharing a wheel between threads must lock it.
+ */
+typedef struct timer_wheel_s {
+
+	wheel_timer_t	slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+	uint64_t		now;					// current tick
+	uint64_t		pending;				// timers pending
+
+} timer_wheel_t;
+
+
+/*============================================================================*/
+
+// Init (empty) wheel starting at tick now
+void timer_wheel_init(timer_wheel_t *tw, uint64_t now);
+
+// Init timer with its expiry callback
+void timer_wheel_timer_init(wheel_timer_t *t, wheel_timer_cb_t cb, void *arg);
+
+// Add (or move) timer to expire at tick expires, O(1)
+void timer_wheel_add(timer_wheel_t *tw, wheel_timer_t *t, uint64_t expires);
+
+// Cancel timer if pending, O(1)
+void timer_wheel_del(timer_wheel_t *tw, wheel_timer_t *t);
+
+// Timer pending
+static inline int
+timer_wheel_pending(const wheel_timer_t *t)
+{
+	return t->next != NULL;
+}
+
+// Advance wheel to tick now and run expired timers (return number expired)
+unsigned int timer_wheel_advance(timer_wheel_t *tw, uint64_t now);
+
+// Tick of next expiry or cascade (-1 if no timer pending)
+int timer_wheel_next(timer_wheel_t *tw, uint64_t *tick);
+
+#endif	// TIMER_WHEEL_H
@@ -22,6 +22,12 @@ int generic_listen(char *serv, int backlog, int sock_type, int fam_type);
 // Perform name resolution for a socket entry
 int sock2name(struct sockaddr *saddr, size_t saddrlen, char *host, char *serv);
 
+// Send a file descriptor (SCM_RIGHTS) together with data over a unix socket
+int send_fd(int sock_fd, int fd, void *data, size_t len);
+
+// Receive a file descriptor (SCM_RIGHTS) together with data from a unix socket
+ssize_t recv_fd(int sock_fd, int *fd, void *data, size_t len);
+
 
 #endif	// UTILS_H
 
@@ -0,0 +1,318 @@
+/**
+ * Reference counted buffer pool.
+ * Copyright (C) 2024 Lazar Razvan.
+ *
+ * Connection handlers receive into pool buffers instead of a fixed stack
+ * buffer (BUFFER_SIZE), so buffers are not tied to a thread stack and can be
+ * handed to another owner:
+ *
+ * 1) Size classes
+ * 		Buffers are powers of two between BUF_POOL_MIN_SIZE and
+ * 	BUF_POOL_MAX_SIZE. Each class has its own free list (and lock), so buffers
+ * 	are recycled without malloc() and without fragmentation. At most
+ * 	BUF_POOL_CACHE_MAX free buffers are kept for each class.
+ *
+ * 2) Reference counting
+ * 		One received buffer may be sent to several consumers (echo, fan out)
+ * 	by taking a reference for each one, data is never copied. The buffer goes
+ * 	back to its free list when the last reference is dropped.
+ *
+ * 3) Adaptive size (buf_sizer)
+ * 		A connection starts with the smallest class. A read that fills the
+ * 	buffer means more data is waiting (bulk transfer), so the next buffer is
+ * 	one class larger. A run of small reads shrinks it back, so memory follows
+ * 	what the connection actually reads.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "debug.h"
+#include "buf_pool.h"
+
+/*============================================================================*/
+
+/**
+ * Size class free list.
+ */
+typedef struct buf_class_s {
+
+	pthread_mutex_t	lock;
+	buf_t			*head;					// free buffers
+	uint32_t		count;					// free buffers in list
+	uint64_t		allocs;					// buf_alloc() calls
+	uint64_t		hits;					// served from free list
+
+} __attribute__((aligned(64))) buf_class_t;
+
+static buf_class_t _classes[BUF_POOL_CLASSES] = {
+	[0 ... BUF_POOL_CLASSES - 1] = { .lock = PTHREAD_MUTEX_INITIALIZER },
+};
+
+/*================================= STATIC ===================================*/
+
+/**
+ * Smallest class holding size bytes.
+ */
+static inline unsigned int __class(size_t size)
+{
+	unsigned int shift;
+
+	if (size <= BUF_POOL_MIN_SIZE)
+		return 0;
+
+	shift = 64 - __builtin_clzll(size - 1);
+
+	return shift - BUF_POOL_MIN_SHIFT;
+}
+
+/*================================== API =====================================*/
+
+/**
+ * Allocate a buffer.
+ *
+ * @size     : Bytes needed (at most BUF_POOL_MAX_SIZE).
+ *
+ * Return buffer (reference count 1, len 0) on success and NULL on error.
+ */
+buf_t *buf_alloc(size_t size)
+{
+	buf_class_t *c;
+	unsigned int cls;
+	buf_t *b;
+
+	if (size > BUF_POOL_MAX_SIZE) {
+		ERROR("Buffer too large: %zu bytes!\n", size);
+		return NULL;
+	}
+
+	//
+	cls = __class(size);
+	c = &_classes[cls];
+
+	pthread_mutex_lock(&c->lock);
+	c->allocs++;
+	b = c->head;
+	if (b) {
+		c->head = b->next;
+		c->count--;
+		c->hits++;
+	}
+	pthread_mutex_unlock(&c->lock);
+
+	//
+	if (!b) {
+		if (posix_memalign((void **)&b, 64,
+						sizeof(buf_t) + (BUF_POOL_MIN_SIZE << cls))) {
+			ERROR("posix_memalign() failed!\n");
+			return NULL;
+		}
+		b->cls = cls;
+		b->size = BUF_POOL_MIN_SIZE << cls;
+	}
+
+	b->next = NULL;
+	b->len = 0;
+	__atomic_store_n(&b->refcnt, 1, __ATOMIC_RELAXED);
+
+	return b;
+}
+
+/**
+ * Take a reference.
+ *
+ * @b        : Buffer.
+ *
+ * Return buffer.
+ */
+buf_t *buf_ref(buf_t *b)
+{
+	__atomic_fetch_add(&b->refcnt, 1, __ATOMIC_RELAXED);
+
+	return b;
+}
+
+/**
+ * Drop a reference, the last one returns buffer to its class free list.
+ *
+ * @b        : Buffer (may be NULL).
+ */
+void buf_unref(buf_t *b)
+{
+	buf_class_t *c;
+
+	if (!b || __atomic_sub_fetch(&b->refcnt, 1, __ATOMIC_ACQ_REL))
+		return;
+
+	//
+	c = &_classes[b->cls];
+
+	pthread_mutex_lock(&c->lock);
+	if (c->count < BUF_POOL_CACHE_MAX) {
+		b->next = c->head;
+		c->head = b;
+		c->count++;
+		b = NULL;
+	}
+	pthread_mutex_unlock(&c->lock);
+
+	// class cache full
+	free(b);
+}
+
+/**
+ * Buffer shared.
+ *
+ * @b        : Buffer.
+ *
+ * Return 1 if other references are held and 0 otherwise.
+ */
+int buf_shared(buf_t *b)
+{
+	return __atomic_load_n(&b->refcnt, __ATOMIC_ACQUIRE) > 1;
+}
+
+/**
+ * Pool counters.
+ *
+ * @stats    : Counters of all classes.
+ */
+void buf_pool_stats(buf_pool_stats_t *stats)
+{
+	memset(stats, 0, sizeof(*stats));
+
+	for (int i = 0; i < BUF_POOL_CLASSES; i++) {
+		pthread_mutex_lock(&_classes[i].lock);
+		stats->allocs += _classes[i].allocs;
+		stats->hits += _classes[i].hits;
+		stats->cached += _classes[i].count;
+		pthread_mutex_unlock(&_classes[i].lock);
+	}
+}
+
+/**
+ * Print pool counters (free list hit ratio and cached buffers).
+ *
+ * @name     : Server name.
+ */
+void buf_pool_dump(const char *name)
+{
+	buf_pool_stats_t stats;
+
+	buf_pool_stats(&stats);
+	printf("[%d] %s: buffers allocs=%lu hits=%lu (%.1f%%) cached=%lu\n",
+			getpid(), name, stats.allocs, stats.hits,
+			stats.allocs ? 100.0 * stats.hits / stats.allocs : 0.0,
+			stats.cached);
+	fflush(stdout);
+}
+
+/**
+ * Release all free buffers to malloc.
+ *
+ * Servers call it once idle for BUF_POOL_TRIM_MS, so memory of a load peak is
+ * not kept cached forever.
+ */
+void buf_pool_trim(void)
+{
+	buf_t *b, *next;
+
+	for (int i = 0; i < BUF_POOL_CLASSES; i++) {
+		pthread_mutex_lock(&_classes[i].lock);
+		b = _classes[i].head;
+		_classes[i].head = NULL;
+		_classes[i].count = 0;
+		pthread_mutex_unlock(&_classes[i].lock);
+
+		for (; b; b = next) {
+			next = b->next;
+			free(b);
+		}
+	}
+}
+
+
+/*============================================================================*/
+
+/**
+ * Init connection buffer size.
+ *
+ * @s        : Connection sizer.
+ */
+void buf_sizer_init(buf_sizer_t *s)
+{
+	s->cls = 0;
+	s->small = 0;
+}
+
+/**
+ * Current connection buffer size.
+ *
+ * @s        : Connection sizer.
+ */
+size_t buf_sizer_size(buf_sizer_t *s)
+{
+	return BUF_POOL_MIN_SIZE << s->cls;
+}
+
+/**
+ * Record a read into the connection buffer.
+ *
+ * @s        : Connection sizer.
+ * @read_bytes : Bytes read (into a buffer of buf_sizer_size()).
+ *
+ * Return 1 if size class changed and 0 otherwise.
+ */
+int buf_sizer_record(buf_sizer_t *s, size_t read_bytes)
+{
+	size_t size = buf_sizer_size(s);
+
+	// buffer filled, more data is likely waiting
+	if (read_bytes >= size) {
+		s->small = 0;
+		if (s->cls == BUF_POOL_CLASSES - 1)
+			return 0;
+		s->cls++;
+		return 1;
+	}
+
+	//
+	if (read_bytes > size / 4 || !s->cls) {
+		s->small = 0;
+		return 0;
+	}
+
+	if (++s->small < BUF_SIZER_SHRINK_READS)
+		return 0;
+
+	s->small = 0;
+	s->cls--;
+
+	return 1;
+}
+
+/**
+ * Get connection buffer for the next read.
+ *
+ * Buffer is replaced if its class is not the connection class anymore or if
+ * it is still referenced by other consumers (its data must be kept).
+ *
+ * @s        : Connection sizer.
+ * @b        : Current buffer (NULL allocates one).
+ *
+ * Return buffer on success and NULL on error (current buffer is released).
+ */
+buf_t *buf_sizer_refresh(buf_sizer_t *s, buf_t *b)
+{
+	if (b && b->cls == s->cls && !buf_shared(b)) {
+		b->len = 0;
+		return b;
+	}
+
+	buf_unref(b);
+
+	return buf_alloc(buf_sizer_size(s));
+}
@@ -0,0 +1,143 @@
+/**
+ * TCP connection setup benchmark.
+ *
+ * Open connections to the echo server one after another and measure the time
+ * from connect() until the first echo reply is received, which includes the
+ * time spent by the server to accept the connection and to create the process
+ * (or thread) that handles it. Latency percentiles and connections per second
+ * are reported.
+ *
+ * Usage:
+ * 	./run/conn_bench [-n connections] [host] [port]
+ *
+ * Copyright (C) 2024 Lazar Razvan.
+ */
+
+#include <time.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include <netdb.h>
+#include <sys/un.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+#include "debug.h"
+#include "utils.h"
+#include "common.h"
+#include "frame.h"
+#include "histogram.h"
+
+
+/*============================================================================*/
+
+// Default number of connections
+#define CONNECTIONS					1000
+
+
+/*============================================================================*/
+
+static inline uint64_t
+__time_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * Open a connection, exchange one message and close it.
+ *
+ * Return 0 on success and -1 on error.
+ */
+static int
+__connection(char *host, char *port)
+{
+	int sock_fd, rv = -1;
+	char _buf[BUFFER_SIZE];
+	ssize_t recv_bytes;
+
+	//
+	sock_fd = generic_connect(host, port, SOCK_STREAM, AF_INET);
+	if (sock_fd == -1) {
+		ERROR("generic_connect() failed!\n");
+		goto finish;
+	}
+
+	// framed, echoed unchanged by raw and framed servers
+	if (frame_send(sock_fd, "ping", 4)) {
+		ERROR("frame_send() failed!\n");
+		goto sock_close;
+	}
+
+	//
+	recv_bytes = recv(sock_fd, _buf, BUFFER_SIZE, 0);
+	if (recv_bytes <= 0) {
+		ERROR("recv() failed: %s!\n", strerror(errno));
+		goto sock_close;
+	}
+
+	rv = 0;
+
+sock_close:
+	close(sock_fd);
+finish:
+	return rv;
+}
+
+
+/*============================================================================*/
+
+int main(int argc, char *argv[])
+{
+	int opt, nr, failed;
+	char *host, *port;
+	uint64_t start, t0;
+	histogram_t hist;
+	double sec;
+
+	//
+	nr = CONNECTIONS;
+	while ((opt = getopt(argc, argv, "n:")) != -1) {
+		switch (opt) {
+		case 'n':
+			nr = atoi(optarg);
+			break;
+		default:
+			printf("Usage: %s [-n connections] [host] [port]\n", argv[0]);
+			return -1;
+		}
+	}
+
+	//
+	host = optind < argc ? argv[optind++] : "localhost";
+	port = optind < argc ? argv[optind++] : SERVER_PORT;
+
+	//
+	histogram_init(&hist);
+	failed = 0;
+
+	start = __time_ns();
+	for (int i = 0; i < nr; i++) {
+		t0 = __time_ns();
+		if (__connection(host, port)) {
+			failed++;
+			continue;
+		}
+		histogram_record(&hist, __time_ns() - t0);
+	}
+	sec = (__time_ns() - start) / 1e9;
+
+	//
+	printf("%d connections to %s:%s, %d failed, %.0f connections/s\n", nr,
+			host, port, failed, nr / sec);
+	histogram_print(&hist, "setup", "us", 1e3);
+
+	return 0;
+}
@@ -0,0 +1,407 @@
+/**
+ * Connection deadlines (idle, read and write timeouts).
+ * Copyright (C) 2024 Lazar Razvan.
+ *
+ * Connection threads (and processes) block in recv()/send(), so a client that
+ * stops sending or reading holds them forever. Each connection has a deadline
+ * kept in a timer wheel (timer_wheel.c) by a watchdog thread. When a deadline
+ * expires, the watchdog shuts the socket down, so the blocked recv()/send()
+ * returns and the connection is closed and counted as timed out.
+ *
+ * Deadlines are pushed forward on each request, so arming must be cheap:
+ * 	1) later deadline (next request, idle again)
+ * 		Only the new deadline is stored (atomic), the timer stays queued at
+ * 	the old tick. When it fires, the watchdog sees the new deadline and queues
+ * 	the timer again instead of expiring the connection.
+ *
+ * 	2) earlier deadline (partial request, blocked send)
+ * 		Timer is moved under the watchdog lock and the watchdog is woken up
+ * 	if it sleeps past the new deadline.
+ *
+ * Write deadline is armed by deadline_send() only if send() would block, so a
+ * request/reply exchange normally takes no lock at all.
+ */
+
+#include <time.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include <sys/time.h>
+#include <sys/socket.h>
+
+#include "debug.h"
+#include "deadline.h"
+
+/*============================================================================*/
+
+/**
+ * Watchdog state.
+ */
+typedef struct watchdog_s {
+
+	timer_wheel_t		wheel;			// connection deadlines
+	pthread_mutex_t		lock;			// wheel lock
+	pthread_cond_t		cond;			// earlier deadline or stop
+	pthread_t			tid;			// watchdog thread
+	uint64_t			wake;			// tick watchdog sleeps until
+	server_stats_t		*stats;			// timeouts counter
+	int					running;		// watchdog thread started
+	int					stop;			// stop request
+
+} watchdog_t;
+
+static watchdog_t _wd;
+
+/*================================= STATIC ===================================*/
+
+static unsigned int __env_ms(const char *name, unsigned int def)
+{
+	const char *value = getenv(name);
+
+	return value ? (unsigned int)strtoul(value, NULL, 10) : def;
+}
+
+/**
+ * Current time in milliseconds (watchdog).
+ *
+ * Precise clock, never behind the coarse one used to arm deadlines, so the
+ * watchdog does not wake up before it can expire them.
+ */
+static uint64_t __now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000;
+}
+
+/**
+ * Deadline timer fired (watchdog lock held).
+ */
+static void __on_timer(wheel_timer_t *t, void *arg)
+{
+	deadline_t *d = (deadline_t *)arg;
+	uint64_t expires;
+
+	// pushed forward since queued (lock-free arm), queue again
+	expires = __atomic_load_n(&d->expires, __ATOMIC_ACQUIRE);
+	if (expires > d->queued) {
+		__atomic_store_n(&d->queued, expires, __ATOMIC_RELEASE);
+		timer_wheel_add(&_wd.wheel, t, expires);
+		return;
+	}
+
+	//
+	DEBUG("[fd %d] %s deadline expired!\n", d->fd, d->what);
+	__atomic_store_n(&d->expired, 1, __ATOMIC_RELEASE);
+	shutdown(d->fd, SHUT_RDWR);
+	stats_conn_timeout(_wd.stats);
+}
+
+/**
+ * Watchdog thread: expire deadlines and sleep until the next one.
+ */
+static void *__watchdog(void *arg)
+{
+	struct timespec ts;
+	uint64_t tick;
+
+	pthread_mutex_lock(&_wd.lock);
+
+	while (!_wd.stop) {
+		timer_wheel_advance(&_wd.wheel, __now_ms());
+
+		//
+		if (timer_wheel_next(&_wd.wheel, &tick)) {
+			_wd.wake = UINT64_MAX;
+			pthread_cond_wait(&_wd.cond, &_wd.lock);
+			continue;
+		}
+
+		_wd.wake = tick;
+		ts.tv_sec = tick / 1000;
+		ts.tv_nsec = (tick % 1000) * 1000000;
+		pthread_cond_timedwait(&_wd.cond, &_wd.lock, &ts);
+	}
+
+	pthread_mutex_unlock(&_wd.lock);
+
+	return NULL;
+}
+
+/*================================== API =====================================*/
+
+/**
+ * Read deadlines from environment.
+ *
+ * @cfg      : Deadlines, DEADLINE_*_MS for variables not set.
+ */
+void deadline_config_env(deadline_config_t *cfg)
+{
+	cfg->idle_ms = __env_ms(DEADLINE_IDLE_ENV, DEADLINE_IDLE_MS);
+	cfg->read_ms = __env_ms(DEADLINE_READ_ENV, DEADLINE_READ_MS);
+	cfg->write_ms = __env_ms(DEADLINE_WRITE_ENV, DEADLINE_WRITE_MS);
+}
+
+/**
+ * Current time in milliseconds.
+ *
+ * Coarse clock is enough for deadlines and cheaper, it is read on each
+ * request.
+ */
+uint64_t deadline_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+
+	return ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000;
+}
+
+/**
+ * Start watchdog thread.
+ *
+ * Call after signals are blocked (sig_event_init()), thread inherits the mask.
+ *
+ * @stats    : Server statistics (timeouts).
+ *
+ * Return 0 on success and -1 on error.
+ */
+int deadline_start(server_stats_t *stats)
+{
+	pthread_condattr_t attr;
+
+	//
+	_wd.stats = stats;
+	_wd.stop = 0;
+	_wd.wake = UINT64_MAX;
+	timer_wheel_init(&_wd.wheel, __now_ms());
+
+	if (pthread_mutex_init(&_wd.lock, NULL)) {
+		ERROR("pthread_mutex_init() failed: %s!\n", strerror(errno));
+		return -1;
+	}
+
+	// deadlines are CLOCK_MONOTONIC based
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	if (pthread_cond_init(&_wd.cond, &attr)) {
+		ERROR("pthread_cond_init() failed: %s!\n", strerror(errno));
+		goto mutex_free;
+	}
+	pthread_condattr_destroy(&attr);
+
+	//
+	if (pthread_create(&_wd.tid, NULL, __watchdog, NULL)) {
+		ERROR("pthread_create() failed: %s!\n", strerror(errno));
+		goto cond_free;
+	}
+	_wd.running = 1;
+
+// success
+	return 0;
+
+cond_free:
+	pthread_cond_destroy(&_wd.cond);
+mutex_free:
+	pthread_mutex_destroy(&_wd.lock);
+	return -1;
+}
+
+/**
+ * Stop watchdog thread (connections must be closed).
+ */
+void deadline_stop(void)
+{
+	if (!_wd.running)
+		return;
+
+	pthread_mutex_lock(&_wd.lock);
+	_wd.stop = 1;
+	pthread_cond_signal(&_wd.cond);
+	pthread_mutex_unlock(&_wd.lock);
+
+	pthread_join(_wd.tid, NULL);
+	pthread_cond_destroy(&_wd.cond);
+	pthread_mutex_destroy(&_wd.lock);
+	_wd.running = 0;
+}
+
+/**
+ * Init a connection deadline (not armed).
+ *
+ * @d        : Deadline.
+ * @fd       : Connection socket.
+ */
+void deadline_init(deadline_t *d, int fd)
+{
+	timer_wheel_timer_init(&d->timer, __on_timer, d);
+	d->queued = 0;
+	d->expires = 0;
+	d->what = NULL;
+	d->fd = fd;
+	d->armed = 0;
+	d->expired = 0;
+}
+
+/**
+ * Set connection deadline.
+ *
+ * @d        : Deadline.
+ * @what     : Deadline kind, for log ("idle", "read", "write").
+ * @ms       : Milliseconds from now, 0 cancels the deadline.
+ */
+void deadline_arm(deadline_t *d, const char *what, unsigned int ms)
+{
+	uint64_t expires;
+
+	//
+	if (!ms) {
+		deadline_cancel(d);
+		return;
+	}
+
+	expires = deadline_now() + ms;
+	d->what = what;
+	__atomic_store_n(&d->expires, expires, __ATOMIC_RELEASE);
+
+	// later than queued timer, fixed up when it fires
+	if (d->armed && expires >= __atomic_load_n(&d->queued, __ATOMIC_ACQUIRE))
+		return;
+
+	//
+	pthread_mutex_lock(&_wd.lock);
+	__atomic_store_n(&d->queued, expires, __ATOMIC_RELEASE);
+	timer_wheel_add(&_wd.wheel, &d->timer, expires);
+	if (expires < _wd.wake)
+		pthread_cond_signal(&_wd.cond);
+	pthread_mutex_unlock(&_wd.lock);
+
+	d->armed = 1;
+}
+
+/**
+ * Cancel connection deadline.
+ *
+ * Once returned, the watchdog does not touch the deadline (nor its socket)
+ * anymore, so the socket may be closed.
+ *
+ * @d        : Deadline.
+ */
+void deadline_cancel(deadline_t *d)
+{
+	if (!d->armed)
+		return;
+
+	pthread_mutex_lock(&_wd.lock);
+	timer_wheel_del(&_wd.wheel, &d->timer);
+	pthread_mutex_unlock(&_wd.lock);
+
+	d->armed = 0;
+}
+
+/**
+ * Deadline expired.
+ *
+ * @d        : Deadline.
+ *
+ * Return 1 if the socket was shut down by the watchdog and 0 otherwise.
+ */
+int deadline_expired(deadline_t *d)
+{
+	return __atomic_load_n(&d->expired, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * Timeout until the next event of an event loop timer wheel.
+ *
+ * @tw       : Timer wheel (deadline_now() ticks).
+ *
+ * Return epoll_wait() timeout (milliseconds, -1 if no timer pending).
+ */
+int deadline_wheel_timeout(timer_wheel_t *tw)
+{
+	uint64_t tick, now;
+
+	if (timer_wheel_next(tw, &tick))
+		return -1;
+
+	now = deadline_now();
+
+	return tick > now ? (int)(tick - now) : 0;
+}
+
+/**
+ * Set socket write deadline (SO_SNDTIMEO).
+ *
+ * For an event loop serving one client at a time (no watchdog thread, nothing
+ * else to serve while the client is blocked), a blocked send() fails with
+ * EAGAIN (or sends less) once the write deadline expires. Event loops serving
+ * many clients use non-blocking sockets and a write timer instead.
+ *
+ * @fd       : Connection socket.
+ * @ms       : Write deadline (milliseconds, 0 disables).
+ *
+ * Return 0 on success and -1 on error.
+ */
+int deadline_sndtimeo(int fd, unsigned int ms)
+{
+	struct timeval tv;
+
+	tv.tv_sec = ms / 1000;
+	tv.tv_usec = (ms % 1000) * 1000;
+	if (setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv))) {
+		ERROR("setsockopt() failed: %s!\n", strerror(errno));
+		return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * Send all data on connection socket.
+ *
+ * Data is first sent without blocking, the write deadline is armed only for
+ * the rest (socket buffer full, client does not read). Caller arms its next
+ * deadline (idle) after the send.
+ *
+ * @d        : Deadline.
+ * @buf      : Data.
+ * @len      : Data length.
+ * @ms       : Write deadline (milliseconds).
+ *
+ * Return len on success and -1 on error (or deadline expired).
+ */
+ssize_t deadline_send(deadline_t *d, const void *buf, size_t len,
+					unsigned int ms)
+{
+	ssize_t sent;
+	size_t total = 0;
+	int flags = MSG_DONTWAIT | MSG_NOSIGNAL;
+
+	while (total < len) {
+		sent = send(d->fd, (const char *)buf + total, len - total, flags);
+		if (sent == -1) {
+			if (errno == EINTR)
+				continue;
+
+			// would block, wait with a write deadline
+			if ((errno == EAGAIN || errno == EWOULDBLOCK) &&
+				flags & MSG_DONTWAIT) {
+				flags = MSG_NOSIGNAL;
+				deadline_arm(d, "write", ms);
+				continue;
+			}
+			return -1;
+		}
+
+		total += sent;
+	}
+
+	return total;
+}
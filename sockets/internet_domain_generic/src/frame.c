@@ -0,0 +1,243 @@
+/**
+ * Length-prefixed framing for stream sockets.
+ *
+ * Stream sockets have no message boundaries: a recv() may return part of a
+ * message or several messages. Each message is sent as a frame (4 bytes
+ * payload length in network byte order, then payload) and the receiver parses
+ * frames incrementally:
+ *
+ * 1) frame_parser_recv()
+ * 		Append received data after the bytes not parsed yet (a partial frame
+ * 	from the previous recv() is moved to the start of the buffer first).
+ *
+ * 2) frame_parser_next()
+ * 		Return each complete frame in place (no copy) until only a partial
+ * 	frame is left, so all requests of a read are handled as a batch.
+ *
+ * 3) frame_batch_add()/frame_batch_flush()
+ * 		Replies of a batch are coalesced into one writev(), instead of one
+ * 	send() for each request. Payloads are referenced, not copied, so they
+ * 	must stay valid until the batch is flushed (before next recv()). A
+ * 	non-blocking flush (MSG_DONTWAIT) keeps the frames not sent yet, so the
+ * 	caller may flush the rest later (blocking, with a write deadline).
+ *
+ * Clients may have many requests outstanding on a connection (pipelining),
+ * replies are sent in request order.
+ *
+ * Copyright (C) 2024 Lazar Razvan.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+#include "debug.h"
+#include "frame.h"
+
+
+/*============================================================================*/
+
+/**
+ * Frame parser API.
+ */
+int
+frame_parser_init(frame_parser_t *p)
+{
+	p->start = 0;
+	p->end = 0;
+	p->buf = malloc(FRAME_BUF_SIZE);
+	if (!p->buf) {
+		ERROR("malloc() failed!\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+void
+frame_parser_destroy(frame_parser_t *p)
+{
+	free(p->buf);
+	p->buf = NULL;
+}
+
+void
+frame_parser_reset(frame_parser_t *p)
+{
+	p->start = 0;
+	p->end = 0;
+}
+
+/**
+ * Receive data into parser buffer.
+ *
+ * Frames returned by frame_parser_next() are invalid after this call.
+ *
+ * Return recv() value (0 on end-of-file, -1 on error).
+ */
+ssize_t
+frame_parser_recv(frame_parser_t *p, int fd)
+{
+	ssize_t recv_bytes;
+
+	/*********************************************************
+	 * move partial frame to the start of the buffer
+	 ********************************************************/
+	if (p->start) {
+		memmove(p->buf, p->buf + p->start, p->end - p->start);
+		p->end -= p->start;
+		p->start = 0;
+	}
+
+	//
+	do {
+		recv_bytes = recv(fd, p->buf + p->end, FRAME_BUF_SIZE - p->end, 0);
+	} while (recv_bytes == -1 && errno == EINTR);
+
+	if (recv_bytes > 0)
+		p->end += recv_bytes;
+
+	return recv_bytes;
+}
+
+/**
+ * Parse next complete frame.
+ *
+ * Return 1 if a frame is parsed, 0 if more data is needed and -1 if frame
+ * payload exceeds FRAME_PAYLOAD_MAX.
+ */
+int
+frame_parser_next(frame_parser_t *p, frame_t *f)
+{
+	size_t avail = p->end - p->start;
+	uint32_t len;
+
+	//
+	if (avail < FRAME_HDR_SIZE)
+		return 0;
+
+	memcpy(&len, p->buf + p->start, FRAME_HDR_SIZE);
+	len = ntohl(len);
+	if (len > FRAME_PAYLOAD_MAX) {
+		ERROR("Frame too large: %u bytes!\n", len);
+		return -1;
+	}
+
+	//
+	if (avail < FRAME_HDR_SIZE + len)
+		return 0;
+
+	f->len = len;
+	f->payload = p->buf + p->start + FRAME_HDR_SIZE;
+	p->start += FRAME_HDR_SIZE + len;
+
+	return 1;
+}
+
+
+/*============================================================================*/
+
+/**
+ * Frame batch API.
+ */
+void
+frame_batch_init(frame_batch_t *b)
+{
+	b->nr = 0;
+	b->sent = 0;
+}
+
+int
+frame_batch_add(frame_batch_t *b, const void *payload, uint32_t len)
+{
+	if (b->nr == FRAME_BATCH_MAX)
+		return -1;
+
+	//
+	b->hdrs[b->nr] = htonl(len);
+	b->iov[2 * b->nr].iov_base = &b->hdrs[b->nr];
+	b->iov[2 * b->nr].iov_len = FRAME_HDR_SIZE;
+	b->iov[2 * b->nr + 1].iov_base = (void *)payload;
+	b->iov[2 * b->nr + 1].iov_len = len;
+	b->nr++;
+
+	return 0;
+}
+
+/**
+ * Send all frames of a batch.
+ *
+ * A closed (or shut down) connection is not logged, it is the caller that
+ * knows why (client gone, deadline expired).
+ *
+ * @b        : Batch.
+ * @fd       : Connection socket.
+ * @flags    : sendmsg() flags (MSG_DONTWAIT for a non-blocking flush).
+ *
+ * Return 0 on success and -1 on error. On EAGAIN the frames not sent are kept
+ * in the batch and sent by the next flush.
+ */
+int
+frame_batch_flush(frame_batch_t *b, int fd, int flags)
+{
+	struct iovec *iov = b->iov + b->sent;
+	int iovcnt = 2 * b->nr - b->sent;
+	struct msghdr msg;
+	ssize_t sent;
+
+	//
+	while (iovcnt) {
+		// writev() with MSG_NOSIGNAL, peer gone (or shut down) is EPIPE
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = iov;
+		msg.msg_iovlen = iovcnt;
+		sent = sendmsg(fd, &msg, flags | MSG_NOSIGNAL);
+		if (sent == -1) {
+			if (errno == EINTR)
+				continue;
+			if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EPIPE &&
+				errno != ECONNRESET)
+				ERROR("sendmsg() failed: %s!\n", strerror(errno));
+			return -1;
+		}
+
+		// skip iovecs sent, adjust a partially sent one
+		while (iovcnt && sent >= iov->iov_len) {
+			sent -= iov->iov_len;
+			iov++;
+			iovcnt--;
+			b->sent++;
+		}
+
+		if (iovcnt) {
+			iov->iov_base = (char *)iov->iov_base + sent;
+			iov->iov_len -= sent;
+		}
+	}
+
+	b->nr = 0;
+	b->sent = 0;
+
+	return 0;
+}
+
+/**
+ * Send a single frame.
+ *
+ * Return 0 on success and -1 on error.
+ */
+int
+frame_send(int fd, const void *payload, uint32_t len)
+{
+	frame_batch_t b;
+
+	frame_batch_init(&b);
+	frame_batch_add(&b, payload, len);
+
+	return frame_batch_flush(&b, fd, 0);
+}
@@ -1,6 +1,29 @@
 /**
  * TCP server implementation using generic function in utils.
  *
+ * Listening socket, client socket and signals (signalfd) are handled by an
+ * epoll loop. Only one client is served at a time, so the listening socket is
+ * removed from epoll while a client is connected. Data received is echoed
+ * back, like the other servers (load generator, framed tcp_client).
+ *
+ * An idle client would block all the others, so it is closed once its idle
+ * deadline expires (timer wheel driven by the epoll_wait() timeout) and a
+ * client not reading its replies once the write deadline (SO_SNDTIMEO)
+ * expires.
+ *
+ * Data is received into a pool buffer (buf_pool.c) held only while it is
+ * echoed, its size follows the reads of the client (grown for bulk transfer).
+ * Free buffers are released to malloc once no client is served for
+ * BUF_POOL_TRIM_MS.
+ *
+ * Signals:
+ * 	SIGTERM, SIGINT: stop accepting and exit after current client
+ * 	SIGHUP: reload (statistics reset)
+ * 	SIGUSR1: statistics dump
+ *
+ * Usage:
+ * 	./run/it_tcp_server [-p port]
+ *
  * Copyright (C) 2024 Lazar Razvan.
  */
 
@@ -14,24 +37,103 @@
 #include <sys/un.h>
 #include <signal.h>
 #include <arpa/inet.h>
+#include <sys/epoll.h>
 #include <sys/socket.h>
 
 #include "debug.h"
 #include "utils.h"
 #include "common.h"
+#include "trace.h"
+#include "stats.h"
+#include "deadline.h"
+#include "buf_pool.h"
+#include "sig_event.h"
+
+
+/*============================================================================*/
+
+// Events handled by each epoll_wait() call
+#define EVENTS_MAX					8
+
+
+/*============================================================================*/
+
+/**
+ * Add (or remove if add is not set) a descriptor to epoll (EPOLLIN).
+ */
+static int
+__epoll_set(int epoll_fd, int fd, int add)
+{
+	struct epoll_event ev;
+
+	//
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.fd = fd;
+
+	//
+	if (epoll_ctl(epoll_fd, add ? EPOLL_CTL_ADD : EPOLL_CTL_DEL, fd, &ev)) {
+		ERROR("epoll_ctl() failed: %s!\n", strerror(errno));
+		return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * Idle deadline expired, client socket is shut down so the epoll loop closes
+ * it like a client that closed the connection.
+ */
+static void
+__on_idle(wheel_timer_t *t, void *arg)
+{
+	*(int *)arg = 1;
+}
+
+/**
+ * No client for BUF_POOL_TRIM_MS, release free buffers.
+ */
+static void
+__on_trim(wheel_timer_t *t, void *arg)
+{
+	buf_pool_trim();
+}
 
 
 /*============================================================================*/
 
 int main(int argc, char *argv[])
 {
+	sig_event_t se;
 	socklen_t addrlen;
-	ssize_t recv_bytes;
+	ssize_t recv_bytes, send_bytes;
+	server_stats_t *stats;
 	char host[NI_MAXHOST];
 	char serv[NI_MAXSERV];
-	char _buf[BUFFER_SIZE];
-	int sock_fd, client_fd;
 	struct sockaddr_in sa_client;
+	struct epoll_event events[EVENTS_MAX];
+	int sock_fd, client_fd, epoll_fd, running, nr, fd, opt;
+	char *port = SERVER_PORT;
+	deadline_config_t deadlines;
+	wheel_timer_t idle_timer, trim_timer;
+	timer_wheel_t wheel;
+	int timed_out = 0;
+	buf_sizer_t sizer;
+	buf_t *buf;
+
+	/*********************************************************
+	 * parse arguments
+	 ********************************************************/
+	while ((opt = getopt(argc, argv, "p:")) != -1) {
+		switch (opt) {
+		case 'p':
+			port = optarg;
+			break;
+		default:
+			printf("Usage: %s [-p port]\n", argv[0]);
+			goto finish;
+		}
+	}
 
 	/*********************************************************
 	 * overwrite SIGPIPE signal
@@ -45,58 +147,194 @@ int main(int argc, char *argv[])
 		goto finish;
 	}
 
+	/*********************************************************
+	 * block control signals and deliver them through signalfd
+	 ********************************************************/
+	running = 1;
+	stats = stats_create(0);
+	if (!stats) {
+		ERROR("stats_create() failed!\n");
+		goto finish;
+	}
+
+	if (sig_event_init(&se) || stats_signals_register(&se, stats, &running)) {
+		ERROR("Fail to init signal events!\n");
+		goto finish;
+	}
+
+	/*********************************************************
+	 * client deadlines (IDLE_TIMEOUT_MS and WRITE_TIMEOUT_MS
+	 * override defaults)
+	 ********************************************************/
+	deadline_config_env(&deadlines);
+	timer_wheel_init(&wheel, deadline_now());
+	timer_wheel_timer_init(&idle_timer, __on_idle, &timed_out);
+	timer_wheel_timer_init(&trim_timer, __on_trim, NULL);
+
+	/*********************************************************
+	 * start tracing (if TRACE_FILE is set)
+	 ********************************************************/
+	if (trace_start_env()) {
+		ERROR("trace_start_env() failed!\n");
+		goto finish;
+	}
+
 	/*********************************************************
 	 * create, bind and listen socket
 	 ********************************************************/
-	sock_fd = generic_listen(SERVER_PORT, 10, SOCK_STREAM, AF_INET);
+	sock_fd = generic_listen(port, LISTEN_BACKLOG, SOCK_STREAM, AF_INET);
 	if (sock_fd == -1) {
 		ERROR("generic_listen() failed!\n");
 		goto finish;
 	}
 
+	/*********************************************************
+	 * create epoll instance (signals and listening socket)
+	 ********************************************************/
+	epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (epoll_fd == -1) {
+		ERROR("epoll_create1() failed: %s!\n", strerror(errno));
+		goto finish;
+	}
+
+	if (sig_event_epoll_add(&se, epoll_fd) || __epoll_set(epoll_fd, sock_fd, 1))
+		goto finish;
+
 	/*********************************************************
 	 * accept connections and read data from clients
+	 *
+	 * On shutdown the listening socket is closed and the loop
+	 * ends when current client closes the connection.
 	 ********************************************************/
-	while (1) {
-		//
-		addrlen = sizeof(struct sockaddr_storage);
-		client_fd = accept(sock_fd, (struct sockaddr*)&sa_client, &addrlen);
-		if (client_fd == -1) {
-			ERROR("acccept() failed: %s!\n", strerror(errno));
-			continue;
+	client_fd = -1;
+	while (running || client_fd != -1) {
+		nr = epoll_wait(epoll_fd, events, EVENTS_MAX,
+						deadline_wheel_timeout(&wheel));
+		if (nr == -1) {
+			ERROR("epoll_wait() failed: %s!\n", strerror(errno));
+			break;
 		}
 
-		//
-		if (sock2name((struct sockaddr*)&sa_client, addrlen, host, serv)) {
-			ERROR("sock2name() failed!\n");
-			continue;
-		}
+		// idle client, closed by the next recv() (end-of-file)
+		timer_wheel_advance(&wheel, deadline_now());
+		if (timed_out && client_fd != -1)
+			shutdown(client_fd, SHUT_RDWR);
 
-		//
-		DEBUG("(client) HOST: %s\n", host);
-		DEBUG("(client) SERV: %s\n", serv);
+		for (int i = 0; i < nr; i++) {
+			fd = events[i].data.fd;
 
-		// client connection started
-		while (1) {
-			recv_bytes = recv(client_fd, _buf, BUFFER_SIZE, 0);
-			if (recv_bytes == -1) {
-				ERROR("recv() failed: %s!\n", strerror(errno));
-				goto next_connection;
+			// signals
+			if (fd == se.fd) {
+				sig_event_dispatch(&se);
+				if (!running && sock_fd != -1) {
+					close(sock_fd);
+					sock_fd = -1;
+				}
+				continue;
 			}
 
-			// client closed the connection
-			if (recv_bytes == 0) {
-				DEBUG("Connection closed!\n");
-				goto next_connection;
+			// new connection
+			if (fd == sock_fd) {
+				addrlen = sizeof(struct sockaddr_storage);
+				client_fd = accept(sock_fd, (struct sockaddr*)&sa_client,
+								&addrlen);
+				if (client_fd == -1) {
+					ERROR("acccept() failed: %s!\n", strerror(errno));
+					continue;
+				}
+				TRACE_BEGIN("connection");
+				stats_conn_open(stats);
+
+				//
+				if (!sock2name((struct sockaddr*)&sa_client, addrlen, host,
+								serv)) {
+					DEBUG("(client) HOST: %s\n", host);
+					DEBUG("(client) SERV: %s\n", serv);
+				} else {
+					ERROR("sock2name() failed!\n");
+				}
+
+				//
+				timer_wheel_del(&wheel, &trim_timer);
+				buf_sizer_init(&sizer);
+				deadline_sndtimeo(client_fd, deadlines.write_ms);
+				if (deadlines.idle_ms)
+					timer_wheel_add(&wheel, &idle_timer,
+									deadline_now() + deadlines.idle_ms);
+
+				// serve only this client until it closes the connection
+				__epoll_set(epoll_fd, sock_fd, 0);
+				__epoll_set(epoll_fd, client_fd, 1);
+				continue;
 			}
 
-			// print data from peer
-			DEBUG("Data received: [%.*s]!\n", (int)recv_bytes, _buf);
+			// client data
+			if (fd == client_fd) {
+				buf = buf_alloc(buf_sizer_size(&sizer));
+				if (!buf) {
+					ERROR("Fail to get a receive buffer!\n");
+					goto client_close;
+				}
+
+				TRACE_BEGIN("recv");
+				recv_bytes = recv(client_fd, buf->data, buf->size, 0);
+				TRACE_END("recv");
+				if (recv_bytes > 0) {
+					// print data from peer and echo it back
+					buf->len = recv_bytes;
+					DEBUG("Data received: [%.*s]!\n", (int)buf->len, buf->data);
+
+					TRACE_BEGIN("send");
+					send_bytes = send(client_fd, buf->data, buf->len, 0);
+					TRACE_END("send");
+					buf_unref(buf);
+					buf_sizer_record(&sizer, recv_bytes);
+					if (send_bytes == recv_bytes) {
+						stats_bytes(stats, recv_bytes, send_bytes);
+						if (deadlines.idle_ms)
+							timer_wheel_add(&wheel, &idle_timer,
+											deadline_now() + deadlines.idle_ms);
+						continue;
+					}
+
+					// write deadline (SO_SNDTIMEO) expired
+					if (send_bytes >= 0 || errno == EAGAIN)
+						timed_out = 1;
+					else
+						ERROR("send() failed: %s!\n", strerror(errno));
+				} else {
+					buf_unref(buf);
+				}
+
+				// client closed the connection (or error, deadline)
+				if (timed_out) {
+					DEBUG("Connection timed out!\n");
+					stats_conn_timeout(stats);
+				} else if (recv_bytes == -1) {
+					ERROR("recv() failed: %s!\n", strerror(errno));
+				} else if (recv_bytes == 0) {
+					DEBUG("Connection closed!\n");
+				}
+
+client_close:
+				timer_wheel_del(&wheel, &idle_timer);
+				timer_wheel_add(&wheel, &trim_timer,
+								deadline_now() + BUF_POOL_TRIM_MS);
+				timed_out = 0;
+				close(client_fd);
+				client_fd = -1;
+				stats_conn_close(stats);
+				TRACE_END("connection");
+
+				if (sock_fd != -1)
+					__epoll_set(epoll_fd, sock_fd, 1);
+			}
 		}
-next_connection:
-		close(client_fd);
 	}
 
+	stats_dump(stats, "it_tcp_server");
+	buf_pool_dump("it_tcp_server");
+
 finish:
 	return 0;
 }
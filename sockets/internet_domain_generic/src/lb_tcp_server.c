@@ -0,0 +1,922 @@
+/**
+ * TCP load balancing echo server using file descriptor passing.
+ *
+ * An acceptor process owns the listening socket and hands each accepted
+ * connection to one of a pool of worker processes, sending the client socket
+ * as SCM_RIGHTS ancillary data over a unix domain socket (SOCK_SEQPACKET, one
+ * connection per message):
+ *
+ * 	           +---------> worker 0 (epoll echo loop)
+ * 	acceptor --+---------> worker 1
+ * 	 (listen)  +---------> worker N
+ * 	               <------ load reports (active connections)
+ *
+ * Workers report their active connections back on the same socket after each
+ * connection is opened or closed, so the acceptor sends a new connection to
+ * the least loaded worker. Handoffs not yet acknowledged by a report are
+ * counted as load too, so a burst of connections is not sent to one worker.
+ *
+ * Since the listening socket is owned by the acceptor only, workers can be
+ * restarted without dropping it:
+ * 	- a worker that dies (kill -TERM <worker>) is replaced by a new one
+ * 	- on SIGHUP, all workers are replaced: the unix socket of each old worker
+ * 	is closed, so it stops receiving connections, finishes its active ones
+ * 	and exits, while new connections go to its replacement
+ *
+ * Connection sockets are non-blocking. A reply that does not fit in the socket
+ * buffer keeps a reference to its receive buffer and the rest is sent once the
+ * socket is writable (EPOLLOUT), no more data is read from that client until
+ * then. Workers close connections using a timer wheel (epoll_wait() sleeps
+ * until the next expiry):
+ * 	- idle deadline, re-armed on each request
+ * 	- write deadline, armed while a reply is pending (client does not read)
+ *
+ * Workers receive into pool buffers (buf_pool.c) taken only while the data is
+ * echoed, so memory does not grow with idle connections. Buffer size follows
+ * the reads of each connection (grown for bulk transfer). Free buffers are
+ * released to malloc once a worker has no connection for BUF_POOL_TRIM_MS.
+ *
+ * Handoff cost is measured for each connection: send_fd() call in the
+ * acceptor and the time from accept() until the worker owns the socket.
+ *
+ * Signals are handled by the acceptor through signalfd:
+ * 	SIGTERM, SIGINT: stop accepting and exit after workers finish
+ * 	SIGHUP: statistics reset and workers restart
+ * 	SIGUSR1: statistics, worker load and handoff cost dump
+ * 	SIGCHLD: reap (and replace) workers
+ *
+ * Usage:
+ * 	./run/lb_tcp_server [-w workers] [-p port]
+ *
+ * Copyright (C) 2024 Lazar Razvan.
+ */
+
+#include <time.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include <netdb.h>
+#include <sys/un.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <arpa/inet.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+
+#include "debug.h"
+#include "utils.h"
+#include "common.h"
+#include "stats.h"
+#include "histogram.h"
+#include "deadline.h"
+#include "buf_pool.h"
+#include "sig_event.h"
+
+
+/*============================================================================*/
+
+// Default number of workers
+#define WORKERS						4
+
+// Max number of workers
+#define WORKERS_MAX					64
+
+// Events handled by each epoll_wait() call
+#define EVENTS_MAX					32
+
+
+/*============================================================================*/
+
+/**
+ * Handoff message (sent together with the client socket).
+ */
+typedef struct handoff_s {
+
+	uint64_t		accept_ns;		// accept() timestamp (CLOCK_MONOTONIC)
+
+} handoff_t;
+
+/**
+ * Load report (worker to acceptor).
+ */
+typedef struct report_s {
+
+	uint64_t		received;		// connections received
+	uint32_t		active;			// connections in progress
+
+} report_t;
+
+/**
+ * Worker (acceptor view).
+ */
+typedef struct worker_s {
+
+	pid_t			pid;			// worker process
+	int				ctl_fd;			// unix socket (-1 if closed)
+	uint64_t		sent;			// connections sent
+	uint64_t		received;		// connections received (last report)
+	uint32_t		active;			// connections in progress (last report)
+	uint64_t		restarts;		// times the worker was replaced
+
+} worker_t;
+
+/**
+ * Worker connection (epoll data, NULL for the acceptor socket).
+ */
+typedef struct worker_conn_s {
+
+	int				fd;				// client socket
+	wheel_timer_t	idle;			// idle deadline
+	wheel_timer_t	write;			// write deadline (reply pending)
+	buf_sizer_t		sizer;			// receive buffer size
+	buf_t			*out;			// reply pending (buffer reference)
+	uint32_t		out_off;		// reply bytes sent
+	int				timed_out;		// deadline expired
+
+} worker_conn_t;
+
+/**
+ * Acceptor state.
+ */
+typedef struct balancer_s {
+
+	sig_event_t		se;					// signal events
+	server_stats_t	*stats;				// statistics (shared memory)
+	histogram_t		*handoff;			// accept to worker (shared memory)
+	histogram_t		send_cost;			// send_fd() call
+	deadline_config_t	deadlines;		// worker connection deadlines
+	worker_t		workers[WORKERS_MAX];
+	int				nr_workers;
+	int				last;				// last picked worker
+	int				children;			// worker processes not reaped
+	int				running;			// cleared on shutdown
+	int				listen_fd;
+	int				epoll_fd;
+
+} balancer_t;
+
+static balancer_t _lb;
+
+
+/*============================================================================*/
+
+static inline uint64_t
+__time_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * Add a descriptor to epoll (EPOLLIN).
+ */
+static int
+__epoll_add(int epoll_fd, int fd)
+{
+	struct epoll_event ev;
+
+	//
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.fd = fd;
+
+	//
+	if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev)) {
+		ERROR("epoll_ctl() failed: %s!\n", strerror(errno));
+		return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * Add (or modify if op is EPOLL_CTL_MOD) a worker descriptor in epoll, data is
+ * its connection.
+ */
+static int
+__worker_epoll_set(int epoll_fd, int op, int fd, uint32_t events,
+					worker_conn_t *conn)
+{
+	struct epoll_event ev;
+
+	//
+	memset(&ev, 0, sizeof(ev));
+	ev.events = events;
+	ev.data.ptr = conn;
+
+	//
+	if (epoll_ctl(epoll_fd, op, fd, &ev)) {
+		ERROR("epoll_ctl() failed: %s!\n", strerror(errno));
+		return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * Idle (or write) deadline expired, client socket is shut down so the event
+ * loop closes it like a client that closed the connection.
+ */
+static void
+__worker_on_deadline(wheel_timer_t *t, void *arg)
+{
+	worker_conn_t *conn = (worker_conn_t *)arg;
+
+	conn->timed_out = 1;
+	shutdown(conn->fd, SHUT_RDWR);
+}
+
+/**
+ * Worker without connections for BUF_POOL_TRIM_MS, release free buffers.
+ */
+static void
+__worker_on_trim(wheel_timer_t *t, void *arg)
+{
+	buf_pool_trim();
+}
+
+/**
+ * Send (the rest of) a reply without blocking.
+ *
+ * A reply not sent completely takes a reference to its buffer (conn->out), so
+ * the receive path drops its own and the rest is sent once the socket is
+ * writable.
+ *
+ * Return 0 if reply is sent, 1 if part of it is pending and -1 on error.
+ */
+static int
+__worker_send(worker_conn_t *conn, buf_t *buf, uint32_t off)
+{
+	ssize_t sent;
+
+	while (off < buf->len) {
+		sent = send(conn->fd, buf->data + off, buf->len - off, MSG_NOSIGNAL);
+		if (sent == -1) {
+			if (errno == EINTR)
+				continue;
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+				return -1;
+
+			//
+			if (!conn->out)
+				conn->out = buf_ref(buf);
+			conn->out_off = off;
+			return 1;
+		}
+
+		off += sent;
+	}
+
+	buf_unref(conn->out);
+	conn->out = NULL;
+
+	return 0;
+}
+
+/**
+ * Send a load report to the acceptor (never blocks, a lost report is
+ * corrected by the next one).
+ */
+static void
+__worker_report(int ctl_fd, uint64_t received, uint32_t active)
+{
+	report_t report;
+
+	//
+	if (ctl_fd == -1)
+		return;
+
+	report.received = received;
+	report.active = active;
+	send(ctl_fd, &report, sizeof(report), MSG_DONTWAIT | MSG_NOSIGNAL);
+}
+
+/**
+ * Worker main loop.
+ *
+ * Receive client sockets from the acceptor and echo data on all of them.
+ * Worker stops receiving connections when the acceptor closes the unix socket
+ * and exits once its active connections are closed.
+ */
+static void
+__worker(int ctl_fd)
+{
+	int epoll_fd, client_fd, nr, rv;
+	struct epoll_event events[EVENTS_MAX];
+	ssize_t recv_bytes;
+	deadline_config_t *dl;
+	worker_conn_t *conn;
+	wheel_timer_t trim;
+	timer_wheel_t wheel;
+	buf_t *buf;
+	uint64_t received;
+	uint32_t active;
+	handoff_t h;
+	pid_t pid;
+
+	//
+	pid = getpid();
+	received = 0;
+	active = 0;
+	dl = &_lb.deadlines;
+	timer_wheel_init(&wheel, deadline_now());
+	timer_wheel_timer_init(&trim, __worker_on_trim, NULL);
+	DEBUG("[%d] Worker started!\n", pid);
+
+	//
+	epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (epoll_fd == -1) {
+		ERROR("epoll_create1() failed: %s!\n", strerror(errno));
+		exit(1);
+	}
+
+	if (__worker_epoll_set(epoll_fd, EPOLL_CTL_ADD, ctl_fd, EPOLLIN, NULL))
+		exit(1);
+
+	//
+	while (ctl_fd != -1 || active) {
+		nr = epoll_wait(epoll_fd, events, EVENTS_MAX,
+						deadline_wheel_timeout(&wheel));
+		if (nr == -1) {
+			if (errno == EINTR)
+				continue;
+			ERROR("epoll_wait() failed: %s!\n", strerror(errno));
+			break;
+		}
+
+		// expired connections are shut down, closed below (end-of-file)
+		timer_wheel_advance(&wheel, deadline_now());
+
+		for (int i = 0; i < nr; i++) {
+			conn = events[i].data.ptr;
+
+			// new connection from acceptor
+			if (!conn) {
+				recv_bytes = recv_fd(ctl_fd, &client_fd, &h, sizeof(h));
+				if (recv_bytes <= 0) {
+					DEBUG("[%d] Worker retired, %u active connections!\n",
+						pid, active);
+					close(ctl_fd);
+					ctl_fd = -1;
+					continue;
+				}
+
+				//
+				if (recv_bytes != sizeof(h) || client_fd == -1) {
+					ERROR("[%d] Invalid handoff!\n", pid);
+					if (client_fd != -1)
+						close(client_fd);
+					continue;
+				}
+
+				histogram_record_atomic(_lb.handoff, __time_ns() - h.accept_ns);
+				received++;
+
+				//
+				conn = malloc(sizeof(worker_conn_t));
+				if (!conn ||
+					fcntl(client_fd, F_SETFL,
+						fcntl(client_fd, F_GETFL) | O_NONBLOCK) == -1 ||
+					__worker_epoll_set(epoll_fd, EPOLL_CTL_ADD, client_fd,
+										EPOLLIN, conn)) {
+					ERROR("[%d] Connection setup failed!\n", pid);
+					free(conn);
+					close(client_fd);
+					stats_conn_close(_lb.stats);
+				} else {
+					conn->fd = client_fd;
+					conn->out = NULL;
+					conn->out_off = 0;
+					conn->timed_out = 0;
+					buf_sizer_init(&conn->sizer);
+					timer_wheel_timer_init(&conn->idle, __worker_on_deadline,
+											conn);
+					timer_wheel_timer_init(&conn->write, __worker_on_deadline,
+											conn);
+					if (dl->idle_ms)
+						timer_wheel_add(&wheel, &conn->idle,
+										deadline_now() + dl->idle_ms);
+					timer_wheel_del(&wheel, &trim);
+					active++;
+				}
+
+				__worker_report(ctl_fd, received, active);
+				continue;
+			}
+
+			/*********************************************************
+			 * socket writable, send the rest of the pending reply
+			 * and read again once it is sent (a shut down socket
+			 * fails here too)
+			 ********************************************************/
+			if (conn->out) {
+				recv_bytes = conn->out->len;
+				rv = __worker_send(conn, conn->out, conn->out_off);
+				if (rv == 1)
+					continue;
+
+				if (!rv && !__worker_epoll_set(epoll_fd, EPOLL_CTL_MOD,
+												conn->fd, EPOLLIN, conn)) {
+					stats_bytes(_lb.stats, recv_bytes, recv_bytes);
+					timer_wheel_del(&wheel, &conn->write);
+					if (dl->idle_ms)
+						timer_wheel_add(&wheel, &conn->idle,
+										deadline_now() + dl->idle_ms);
+					continue;
+				}
+
+				if (rv && !conn->timed_out)
+					ERROR("[%d] send() failed: %s!\n", pid, strerror(errno));
+				goto conn_close;
+			}
+
+			// client data (buffer is returned to the pool once echoed)
+			buf = buf_alloc(buf_sizer_size(&conn->sizer));
+			if (!buf) {
+				ERROR("[%d] Fail to get a receive buffer!\n", pid);
+				goto conn_close;
+			}
+
+			recv_bytes = recv(conn->fd, buf->data, buf->size, 0);
+			if (recv_bytes == -1 && (errno == EAGAIN || errno == EINTR)) {
+				buf_unref(buf);
+				continue;
+			}
+
+			if (recv_bytes > 0) {
+				buf->len = recv_bytes;
+				rv = __worker_send(conn, buf, 0);
+				buf_unref(buf);
+				buf_sizer_record(&conn->sizer, recv_bytes);
+				if (!rv) {
+					stats_bytes(_lb.stats, recv_bytes, recv_bytes);
+					if (dl->idle_ms)
+						timer_wheel_add(&wheel, &conn->idle,
+										deadline_now() + dl->idle_ms);
+					continue;
+				}
+
+				// client does not read, wait for EPOLLOUT (write deadline)
+				if (rv == 1 && !__worker_epoll_set(epoll_fd, EPOLL_CTL_MOD,
+												conn->fd, EPOLLOUT, conn)) {
+					timer_wheel_del(&wheel, &conn->idle);
+					if (dl->write_ms)
+						timer_wheel_add(&wheel, &conn->write,
+										deadline_now() + dl->write_ms);
+					continue;
+				}
+
+				if (rv == -1 && !conn->timed_out)
+					ERROR("[%d] send() failed: %s!\n", pid, strerror(errno));
+			} else {
+				buf_unref(buf);
+				if (recv_bytes == -1 && !conn->timed_out)
+					ERROR("[%d] recv() failed: %s!\n", pid, strerror(errno));
+			}
+
+conn_close:
+			//
+			if (conn->timed_out) {
+				DEBUG("[%d] Connection timed out!\n", pid);
+				stats_conn_timeout(_lb.stats);
+			}
+
+			/*********************************************************
+			 * close() removes the socket from epoll only when it is
+			 * the last reference, while the acceptor may not have
+			 * closed its copy yet, so remove it explicitly
+			 ********************************************************/
+			timer_wheel_del(&wheel, &conn->idle);
+			timer_wheel_del(&wheel, &conn->write);
+			epoll_ctl(epoll_fd, EPOLL_CTL_DEL, conn->fd, NULL);
+			close(conn->fd);
+			buf_unref(conn->out);
+			free(conn);
+			if (!--active)
+				timer_wheel_add(&wheel, &trim,
+								deadline_now() + BUF_POOL_TRIM_MS);
+			stats_conn_close(_lb.stats);
+			__worker_report(ctl_fd, received, active);
+		}
+	}
+
+	close(epoll_fd);
+	DEBUG("[%d] Worker done (%lu connections)!\n", pid, received);
+	buf_pool_dump("lb_tcp_server worker");
+	exit(0);
+}
+
+/**
+ * Start (or replace) worker in a given slot.
+ *
+ * Return 0 on success and -1 on error.
+ */
+static int
+__worker_start(int idx)
+{
+	worker_t *w = &_lb.workers[idx];
+	int sv[2];
+	pid_t pid;
+
+	/*********************************************************
+	 * SOCK_SEQPACKET keeps each handoff (and its descriptor)
+	 * and each report a separate message.
+	 ********************************************************/
+	if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, sv) == -1) {
+		ERROR("socketpair() failed: %s!\n", strerror(errno));
+		return -1;
+	}
+
+	pid = fork();
+	switch (pid) {
+	case -1:
+		ERROR("fork() failed: %s!\n", strerror(errno));
+		close(sv[0]);
+		close(sv[1]);
+		return -1;
+	case 0:
+		/*********************************************************
+		 * worker keeps only its own unix socket, so it sees
+		 * end of file when acceptor closes it. Control signals
+		 * are handled by the acceptor, SIGTERM kills the worker.
+		 ********************************************************/
+		close(sv[0]);
+		close(_lb.listen_fd);
+		close(_lb.epoll_fd);
+		for (int i = 0; i < _lb.nr_workers; i++)
+			if (_lb.workers[i].ctl_fd != -1)
+				close(_lb.workers[i].ctl_fd);
+
+		signal(SIGINT, SIG_IGN);
+		signal(SIGHUP, SIG_IGN);
+		signal(SIGUSR1, SIG_IGN);
+		sig_event_destroy(&_lb.se);
+
+		__worker(sv[1]);
+		exit(1);
+	default:
+		break;
+	}
+
+	//
+	close(sv[1]);
+	w->pid = pid;
+	w->ctl_fd = sv[0];
+	w->sent = 0;
+	w->received = 0;
+	w->active = 0;
+	_lb.children++;
+
+	//
+	if (__epoll_add(_lb.epoll_fd, w->ctl_fd)) {
+		close(w->ctl_fd);
+		w->ctl_fd = -1;
+		return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * Close worker unix socket (worker retires once its connections close).
+ */
+static void
+__worker_close(worker_t *w)
+{
+	if (w->ctl_fd == -1)
+		return;
+
+	// removed from epoll since this is the only reference
+	close(w->ctl_fd);
+	w->ctl_fd = -1;
+}
+
+/**
+ * Read pending load reports of a worker.
+ */
+static void
+__worker_reports(worker_t *w)
+{
+	report_t report;
+	ssize_t rv;
+
+	while (w->ctl_fd != -1) {
+		rv = recv(w->ctl_fd, &report, sizeof(report), MSG_DONTWAIT);
+		if (rv == -1 && (errno == EAGAIN || errno == EINTR))
+			break;
+
+		// worker died, replaced on SIGCHLD
+		if (rv <= 0) {
+			__worker_close(w);
+			break;
+		}
+
+		if (rv == sizeof(report)) {
+			w->received = report.received;
+			w->active = report.active;
+		}
+	}
+}
+
+/**
+ * Pick the least loaded worker.
+ *
+ * Load is the number of active connections (last report) plus connections
+ * sent and not yet reported as received.
+ *
+ * Return worker on success and NULL if no worker is available.
+ */
+static worker_t *
+__worker_pick(void)
+{
+	worker_t *best = NULL, *w;
+	uint64_t load, best_load = UINT64_MAX;
+
+	// start after last pick, so ties are spread round-robin
+	for (int i = 1; i <= _lb.nr_workers; i++) {
+		w = &_lb.workers[(_lb.last + i) % _lb.nr_workers];
+		if (w->ctl_fd == -1)
+			continue;
+
+		load = w->active + (w->sent - w->received);
+		if (load < best_load) {
+			best_load = load;
+			best = w;
+		}
+	}
+
+	if (best)
+		_lb.last = best - _lb.workers;
+
+	return best;
+}
+
+/**
+ * SIGCHLD handler, reap workers and replace the ones that died.
+ */
+static void
+__on_child(struct signalfd_siginfo *info, void *arg)
+{
+	int status;
+	pid_t pid;
+
+	while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+		_lb.children--;
+
+		// retired workers are already replaced
+		for (int i = 0; i < _lb.nr_workers; i++) {
+			if (_lb.workers[i].pid != pid)
+				continue;
+
+			_lb.workers[i].pid = -1;
+			__worker_close(&_lb.workers[i]);
+			if (!_lb.running)
+				break;
+
+			DEBUG("Worker %d (%d) exited with status %d, restarting...\n", i,
+				pid, status);
+			_lb.workers[i].restarts++;
+			if (__worker_start(i))
+				ERROR("Fail to restart worker %d!\n", i);
+			break;
+		}
+	}
+}
+
+/**
+ * SIGHUP handler, reset statistics and replace all workers.
+ */
+static void
+__on_reload(struct signalfd_siginfo *info, void *arg)
+{
+	DEBUG("Reload, statistics reset and workers restart!\n");
+	stats_reset(_lb.stats);
+	__atomic_fetch_add(&_lb.stats->reloads, 1, __ATOMIC_RELAXED);
+	histogram_init(&_lb.send_cost);
+
+	/*********************************************************
+	 * old workers are no longer tracked by their slot, they
+	 * drain their connections and are only reaped
+	 ********************************************************/
+	for (int i = 0; i < _lb.nr_workers; i++) {
+		__worker_close(&_lb.workers[i]);
+		_lb.workers[i].pid = -1;
+		_lb.workers[i].restarts++;
+		if (__worker_start(i))
+			ERROR("Fail to restart worker %d!\n", i);
+	}
+}
+
+/**
+ * SIGUSR1 handler, dump statistics, worker load and handoff cost.
+ */
+static void
+__on_dump(struct signalfd_siginfo *info, void *arg)
+{
+	histogram_t snap;
+	worker_t *w;
+
+	//
+	stats_dump(_lb.stats, "lb_tcp_server");
+	for (int i = 0; i < _lb.nr_workers; i++) {
+		w = &_lb.workers[i];
+		printf("worker %2d pid %6d sent %8lu received %8lu active %6u "
+			"restarts %lu\n", i, w->pid, w->sent, w->received, w->active,
+			w->restarts);
+	}
+
+	//
+	histogram_snapshot(_lb.handoff, &snap, 0);
+	histogram_print(&_lb.send_cost, "send_fd", "us", 1e3);
+	histogram_print(&snap, "handoff", "us", 1e3);
+	fflush(stdout);
+}
+
+
+/*============================================================================*/
+
+int main(int argc, char *argv[])
+{
+	int client_fd, fd, opt, nr;
+	char *port = SERVER_PORT;
+	struct epoll_event events[EVENTS_MAX];
+	uint64_t t0;
+	worker_t *w;
+	handoff_t h;
+
+	/*********************************************************
+	 * parse arguments
+	 ********************************************************/
+	_lb.nr_workers = WORKERS;
+	while ((opt = getopt(argc, argv, "w:p:")) != -1) {
+		switch (opt) {
+		case 'w':
+			_lb.nr_workers = atoi(optarg);
+			break;
+		case 'p':
+			port = optarg;
+			break;
+		default:
+			printf("Usage: %s [-w workers] [-p port]\n", argv[0]);
+			goto finish;
+		}
+	}
+
+	if (_lb.nr_workers < 1)
+		_lb.nr_workers = 1;
+	if (_lb.nr_workers > WORKERS_MAX)
+		_lb.nr_workers = WORKERS_MAX;
+
+	for (int i = 0; i < WORKERS_MAX; i++) {
+		_lb.workers[i].pid = -1;
+		_lb.workers[i].ctl_fd = -1;
+	}
+
+	/*********************************************************
+	 * statistics and handoff histogram are shared with
+	 * workers
+	 ********************************************************/
+	_lb.running = 1;
+	_lb.stats = stats_create(1);
+	if (!_lb.stats) {
+		ERROR("stats_create() failed!\n");
+		goto finish;
+	}
+
+	_lb.handoff = mmap(NULL, sizeof(histogram_t), PROT_READ | PROT_WRITE,
+					MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (_lb.handoff == MAP_FAILED) {
+		ERROR("mmap() failed: %s!\n", strerror(errno));
+		goto finish;
+	}
+	histogram_init(_lb.handoff);
+	histogram_init(&_lb.send_cost);
+
+	// worker connection deadlines (IDLE_TIMEOUT_MS and WRITE_TIMEOUT_MS
+	// override defaults)
+	deadline_config_env(&_lb.deadlines);
+
+	/*********************************************************
+	 * block control signals and SIGCHLD, deliver them through
+	 * signalfd (SIGHUP and SIGUSR1 replace the default ones)
+	 ********************************************************/
+	if (sig_event_init(&_lb.se) ||
+		stats_signals_register(&_lb.se, _lb.stats, &_lb.running) ||
+		sig_event_register(&_lb.se, SIGHUP, __on_reload, NULL) ||
+		sig_event_register(&_lb.se, SIGUSR1, __on_dump, NULL) ||
+		sig_event_register(&_lb.se, SIGCHLD, __on_child, NULL)) {
+		ERROR("Fail to init signal events!\n");
+		goto finish;
+	}
+
+	/*********************************************************
+	 * create listening socket
+	 ********************************************************/
+	_lb.listen_fd = generic_listen(port, LISTEN_BACKLOG, SOCK_STREAM, AF_INET);
+	if (_lb.listen_fd == -1) {
+		ERROR("generic_listen() failed!\n");
+		goto finish;
+	}
+
+	/*********************************************************
+	 * create epoll instance (signals, listening socket and
+	 * worker reports) and start workers
+	 ********************************************************/
+	_lb.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (_lb.epoll_fd == -1) {
+		ERROR("epoll_create1() failed: %s!\n", strerror(errno));
+		goto finish;
+	}
+
+	if (sig_event_epoll_add(&_lb.se, _lb.epoll_fd) ||
+		__epoll_add(_lb.epoll_fd, _lb.listen_fd))
+		goto finish;
+
+	for (int i = 0; i < _lb.nr_workers; i++) {
+		if (__worker_start(i)) {
+			ERROR("__worker_start() failed!\n");
+			goto finish;
+		}
+	}
+
+	/*********************************************************
+	 * accept connections and hand them to workers
+	 *
+	 * On shutdown the listening socket and worker sockets are
+	 * closed and the loop ends when all workers exited.
+	 ********************************************************/
+	while (_lb.running || _lb.children) {
+		nr = epoll_wait(_lb.epoll_fd, events, EVENTS_MAX, -1);
+		if (nr == -1) {
+			ERROR("epoll_wait() failed: %s!\n", strerror(errno));
+			break;
+		}
+
+		for (int i = 0; i < nr; i++) {
+			fd = events[i].data.fd;
+
+			// signals
+			if (fd == _lb.se.fd) {
+				sig_event_dispatch(&_lb.se);
+				if (!_lb.running && _lb.listen_fd != -1) {
+					close(_lb.listen_fd);
+					_lb.listen_fd = -1;
+					for (int j = 0; j < _lb.nr_workers; j++)
+						__worker_close(&_lb.workers[j]);
+				}
+				continue;
+			}
+
+			// worker reports (socket may be closed already)
+			if (fd != _lb.listen_fd) {
+				for (int j = 0; j < _lb.nr_workers; j++)
+					if (_lb.workers[j].ctl_fd == fd)
+						__worker_reports(&_lb.workers[j]);
+				continue;
+			}
+
+			// new connection
+			client_fd = accept(_lb.listen_fd, NULL, NULL);
+			if (client_fd == -1) {
+				ERROR("acccept() failed: %s!\n", strerror(errno));
+				continue;
+			}
+			h.accept_ns = __time_ns();
+			stats_conn_open(_lb.stats);
+
+			//
+			w = __worker_pick();
+			if (!w) {
+				ERROR("No worker available!\n");
+				close(client_fd);
+				stats_conn_close(_lb.stats);
+				continue;
+			}
+
+			//
+			t0 = __time_ns();
+			if (send_fd(w->ctl_fd, client_fd, &h, sizeof(h))) {
+				ERROR("send_fd() failed!\n");
+				stats_conn_close(_lb.stats);
+			} else {
+				histogram_record(&_lb.send_cost, __time_ns() - t0);
+				w->sent++;
+			}
+			close(client_fd);
+		}
+	}
+
+	__on_dump(NULL, NULL);
+
+finish:
+	return 0;
+}
@@ -0,0 +1,816 @@
+/**
+ * TCP load generator for the echo servers.
+ *
+ * Connections are spread across threads, each thread drives its connections
+ * from an epoll loop (non-blocking connect, send and recv). Requests are
+ * length-prefixed frames (frame.h) of -s bytes, echoed unchanged by all
+ * servers, and each connection has at most one request outstanding.
+ *
+ * Modes:
+ * 	closed (default): each connection sends its next request as soon as the
+ * 	reply is received, so the concurrency is fixed (-c connections) and the
+ * 	request rate is whatever the server sustains.
+ *
+ * 	open (-r rate): requests arrive at a fixed rate (requests per second,
+ * 	split between threads), independent of the server. An arrival waits for
+ * 	an idle connection if all are busy.
+ *
+ * Coordinated omission: a load generator measuring latency from the moment a
+ * request is actually sent stops sending while the server stalls, so the
+ * requests that should have been sent during the stall are never measured
+ * and percentiles look much better than what users see. In open mode the
+ * latency is measured from the intended send time of each arrival
+ * (start + k * interval), including the time spent waiting for a connection,
+ * and arrivals still waiting (or in flight) when the test ends are recorded
+ * with their time so far. The latency from the actual send is reported too
+ * (uncorrected) to show the difference. Threads wake up for each arrival with
+ * a nanosecond timeout (epoll_pwait2()), so arrivals are not delayed by the
+ * millisecond resolution of epoll_wait().
+ *
+ * All connections are established before the test clock starts (for at most
+ * CONNECT_TIMEOUT seconds), so connections delayed by a full listen backlog
+ * (SYN retransmitted after 1 s) do not eat into the measured window.
+ * In closed mode, connections that never complete a request during the test
+ * are reported as starved.
+ *
+ * With -q a single CSV line is printed instead (used by server_bench):
+ * 	connected,failed,requests,requests_per_s,starved,p50_us,p99_us,max_us
+ *
+ * Usage:
+ * 	./run/loadgen [-t threads] [-c connections] [-d seconds] [-s size]
+ * 			[-r rate] [-q] [host] [port]
+ * 	./run/loadgen -t 4 -c 1000 -d 10 -s 64
+ * 	./run/loadgen -t 4 -c 1000 -d 10 -s 64 -r 50000
+ *
+ * Copyright (C) 2024 Lazar Razvan.
+ */
+
+#define _GNU_SOURCE
+
+#include <time.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include <netdb.h>
+#include <signal.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+
+#include "debug.h"
+#include "utils.h"
+#include "common.h"
+#include "frame.h"
+#include "histogram.h"
+
+
+/*============================================================================*/
+
+// Default threads
+#define THREADS						1
+
+// Default connections (spread across threads)
+#define CONNECTIONS					16
+
+// Default test duration (seconds)
+#define DURATION					5
+
+// Default request payload size
+#define REQUEST_SIZE				64
+
+// Events handled by each epoll_wait() call
+#define EVENTS_MAX					64
+
+// Connect phase timeout (seconds), covers a retransmitted SYN
+#define CONNECT_TIMEOUT				3
+
+/**
+ * Connection states.
+ */
+#define CONN_CONNECTING				0		// connect() in progress
+#define CONN_IDLE					1		// no request outstanding
+#define CONN_BUSY					2		// request sent, waiting reply
+#define CONN_CLOSED					3		// failed
+
+/**
+ * Connection.
+ */
+typedef struct lg_conn_s {
+
+	int			fd;
+	int			state;			// CONN_*
+	size_t		sent;			// request bytes sent
+	size_t		recvd;			// reply bytes received
+	uint64_t	intended;		// intended send time (open mode, ns)
+	uint64_t	start;			// actual send (or connect) time (ns)
+	uint64_t	requests;		// replies received
+
+} lg_conn_t;
+
+/**
+ * Thread (load generator worker).
+ */
+typedef struct lg_thread_s {
+
+	pthread_t	tid;
+	int			epoll_fd;
+	lg_conn_t	*conns;
+	int			nr_conns;
+	int			*idle;						// idle connections (stack)
+	int			nr_idle;
+	int			connecting;					// connect() in progress
+	int			started;					// test clock started
+
+	uint64_t	start;						// test start (ns)
+	uint64_t	interval;					// between arrivals (open, ns)
+	uint64_t	arrivals;					// requests arrived (open)
+	uint64_t	dispatched;					// arrivals sent (open)
+
+	uint64_t	requests;					// replies received
+	uint64_t	unfinished;					// in flight or waiting at end
+	uint64_t	starved;					// open at end, no reply (closed)
+	uint64_t	connected;					// connections established
+	uint64_t	errors;						// failed connections
+
+	histogram_t	connect;					// connect() to established
+	histogram_t	latency;					// corrected (open) latency
+	histogram_t	latency_raw;				// from actual send
+
+} lg_thread_t;
+
+/**
+ * Test configuration.
+ */
+static struct {
+
+	struct sockaddr_storage	sa;				// server address
+	socklen_t				salen;
+	int						connections;
+	int						threads;
+	int						duration;
+	double					rate;			// open mode (0: closed)
+	char					*req;			// request frame (header, payload)
+	size_t					req_len;
+	pthread_mutex_t			lock;			// start gate
+	pthread_cond_t			cond;
+	int						ready;			// threads done connecting
+	int						go;				// test started (or aborted)
+
+} _cfg = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.cond = PTHREAD_COND_INITIALIZER,
+};
+
+static volatile int _running = 1;
+
+
+/*============================================================================*/
+
+static inline uint64_t
+__time_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * Set events of a connection.
+ */
+static void
+__conn_events(lg_thread_t *t, lg_conn_t *c, uint32_t events)
+{
+	struct epoll_event ev;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = events;
+	ev.data.ptr = c;
+	if (epoll_ctl(t->epoll_fd, EPOLL_CTL_MOD, c->fd, &ev))
+		ERROR("epoll_ctl() failed: %s!\n", strerror(errno));
+}
+
+/**
+ * Close a failed connection.
+ */
+static void
+__conn_fail(lg_thread_t *t, lg_conn_t *c)
+{
+	if (c->state == CONN_CONNECTING) {
+		t->connecting--;
+		t->errors++;
+	} else if (c->state == CONN_IDLE)
+		for (int i = 0; i < t->nr_idle; i++)
+			if (&t->conns[t->idle[i]] == c)
+				t->idle[i] = t->idle[--t->nr_idle];
+
+	epoll_ctl(t->epoll_fd, EPOLL_CTL_DEL, c->fd, NULL);
+	close(c->fd);
+	c->state = CONN_CLOSED;
+}
+
+/**
+ * Send (the rest of) the current request, waiting for EPOLLOUT if the socket
+ * buffer is full.
+ */
+static void
+__conn_send(lg_thread_t *t, lg_conn_t *c)
+{
+	ssize_t send_bytes;
+
+	send_bytes = send(c->fd, _cfg.req + c->sent, _cfg.req_len - c->sent,
+					MSG_NOSIGNAL);
+	if (send_bytes == -1) {
+		if (errno == EAGAIN || errno == EINTR) {
+			__conn_events(t, c, EPOLLIN | EPOLLOUT);
+			return;
+		}
+		ERROR("send() failed: %s!\n", strerror(errno));
+		__conn_fail(t, c);
+		return;
+	}
+
+	c->sent += send_bytes;
+	__conn_events(t, c, c->sent < _cfg.req_len ? EPOLLIN | EPOLLOUT : EPOLLIN);
+}
+
+/**
+ * Start a request on a connection (intended is the send time in open mode).
+ */
+static void
+__conn_request(lg_thread_t *t, lg_conn_t *c, uint64_t intended)
+{
+	c->state = CONN_BUSY;
+	c->sent = 0;
+	c->recvd = 0;
+	c->start = __time_ns();
+	c->intended = intended ? intended : c->start;
+
+	__conn_send(t, c);
+}
+
+/**
+ * Connection became idle (established or reply received).
+ */
+static void
+__conn_idle(lg_thread_t *t, lg_conn_t *c)
+{
+	// closed mode, next request right away
+	if (!_cfg.rate) {
+		__conn_request(t, c, 0);
+		return;
+	}
+
+	c->state = CONN_IDLE;
+	t->idle[t->nr_idle++] = c - t->conns;
+}
+
+/**
+ * Open mode: count arrivals due until now and send them on idle connections.
+ */
+static void
+__dispatch(lg_thread_t *t, uint64_t now)
+{
+	lg_conn_t *c;
+
+	t->arrivals = (now - t->start) / t->interval + 1;
+
+	while (t->dispatched < t->arrivals && t->nr_idle) {
+		c = &t->conns[t->idle[--t->nr_idle]];
+		__conn_request(t, c, t->start + t->dispatched * t->interval);
+		t->dispatched++;
+	}
+}
+
+/**
+ * Handle events of a connection.
+ */
+static void
+__conn_event(lg_thread_t *t, lg_conn_t *c, uint32_t events, char *buf)
+{
+	ssize_t recv_bytes;
+	socklen_t len;
+	uint64_t now;
+	int err;
+
+	/*********************************************************
+	 * connect() completed
+	 ********************************************************/
+	if (c->state == CONN_CONNECTING) {
+		len = sizeof(err);
+		if (getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &err, &len) || err) {
+			__conn_fail(t, c);
+			return;
+		}
+
+		histogram_record(&t->connect, __time_ns() - c->start);
+		t->connecting--;
+		t->connected++;
+		__conn_events(t, c, EPOLLIN);
+
+		// connect phase, requests start with the test clock
+		if (!t->started) {
+			c->state = CONN_IDLE;
+			return;
+		}
+
+		__conn_idle(t, c);
+		return;
+	}
+
+	// rest of the request
+	if ((events & EPOLLOUT) && c->state == CONN_BUSY &&
+		c->sent < _cfg.req_len)
+		__conn_send(t, c);
+
+	if (!(events & (EPOLLIN | EPOLLERR | EPOLLHUP)) || c->state == CONN_CLOSED)
+		return;
+
+	/*********************************************************
+	 * reply (echo of the request frame)
+	 ********************************************************/
+	recv_bytes = recv(c->fd, buf, _cfg.req_len, 0);
+	if (recv_bytes == -1 && (errno == EAGAIN || errno == EINTR))
+		return;
+
+	if (recv_bytes <= 0 || c->state != CONN_BUSY ||
+		c->recvd + recv_bytes > _cfg.req_len) {
+		if (recv_bytes == -1)
+			ERROR("recv() failed: %s!\n", strerror(errno));
+		__conn_fail(t, c);
+		return;
+	}
+
+	c->recvd += recv_bytes;
+	if (c->recvd < _cfg.req_len)
+		return;
+
+	//
+	now = __time_ns();
+	histogram_record(&t->latency, now - c->intended);
+	histogram_record(&t->latency_raw, now - c->start);
+	t->requests++;
+	c->requests++;
+
+	__conn_idle(t, c);
+}
+
+/**
+ * Open connections of a thread (non-blocking connect()).
+ *
+ * Return 0 on success and -1 on error.
+ */
+static int
+__connect_all(lg_thread_t *t)
+{
+	struct epoll_event ev;
+	lg_conn_t *c;
+
+	for (int i = 0; i < t->nr_conns; i++) {
+		c = &t->conns[i];
+		c->state = CONN_CONNECTING;
+		c->start = __time_ns();
+
+		//
+		c->fd = socket(_cfg.sa.ss_family, SOCK_STREAM | SOCK_NONBLOCK, 0);
+		if (c->fd == -1) {
+			ERROR("socket() failed: %s!\n", strerror(errno));
+			goto conns_close;
+		}
+
+		if (connect(c->fd, (struct sockaddr *)&_cfg.sa, _cfg.salen) &&
+			errno != EINPROGRESS) {
+			ERROR("connect() failed: %s!\n", strerror(errno));
+			close(c->fd);
+			c->state = CONN_CLOSED;
+			t->errors++;
+			continue;
+		}
+
+		// writable once connected
+		memset(&ev, 0, sizeof(ev));
+		ev.events = EPOLLOUT;
+		ev.data.ptr = c;
+		if (epoll_ctl(t->epoll_fd, EPOLL_CTL_ADD, c->fd, &ev)) {
+			ERROR("epoll_ctl() failed: %s!\n", strerror(errno));
+			close(c->fd);
+			goto conns_close;
+		}
+		t->connecting++;
+	}
+
+	return 0;
+
+conns_close:
+	// connections opened so far, so the thread has none left on error
+	while (--c >= t->conns)
+		if (c->state != CONN_CLOSED)
+			close(c->fd);
+	t->connecting = 0;
+
+	return -1;
+}
+
+/**
+ * Wait until all connections of a thread are established (or failed), for at
+ * most CONNECT_TIMEOUT seconds.
+ */
+static void
+__connect_wait(lg_thread_t *t, char *buf)
+{
+	struct epoll_event events[EVENTS_MAX];
+	uint64_t now, end;
+	int nr;
+
+	end = __time_ns() + CONNECT_TIMEOUT * 1000000000ULL;
+	while (_running && t->connecting && (now = __time_ns()) < end) {
+		nr = epoll_wait(t->epoll_fd, events, EVENTS_MAX,
+						(end - now) / 1000000 + 1);
+		if (nr == -1) {
+			if (errno == EINTR)
+				continue;
+			ERROR("epoll_wait() failed: %s!\n", strerror(errno));
+			break;
+		}
+
+		for (int i = 0; i < nr; i++)
+			__conn_event(t, events[i].data.ptr, events[i].events, buf);
+	}
+}
+
+/**
+ * Wait at the start gate until main starts the test (all threads done
+ * connecting) or aborts it (_running cleared).
+ */
+static void
+__start_wait(void)
+{
+	pthread_mutex_lock(&_cfg.lock);
+	_cfg.ready++;
+	pthread_cond_broadcast(&_cfg.cond);
+	while (!_cfg.go)
+		pthread_cond_wait(&_cfg.cond, &_cfg.lock);
+	pthread_mutex_unlock(&_cfg.lock);
+}
+
+/**
+ * Open the start gate once nr threads (those started) are waiting at it.
+ */
+static void
+__start_open(int nr)
+{
+	pthread_mutex_lock(&_cfg.lock);
+	while (_cfg.ready < nr)
+		pthread_cond_wait(&_cfg.cond, &_cfg.lock);
+	_cfg.go = 1;
+	pthread_cond_broadcast(&_cfg.cond);
+	pthread_mutex_unlock(&_cfg.lock);
+}
+
+/**
+ * Load generator thread.
+ */
+static void *
+__lg_thread(void *arg)
+{
+	struct epoll_event events[EVENTS_MAX];
+	uint64_t now, next, end, timeout;
+	lg_thread_t *t = arg;
+	struct timespec ts;
+	char *buf;
+	int nr, rv;
+
+	/*********************************************************
+	 * connect phase, all threads (and main) start the test
+	 * together once it is done
+	 ********************************************************/
+	buf = malloc(_cfg.req_len);
+	if (!buf)
+		ERROR("malloc() failed!\n");
+
+	rv = buf ? __connect_all(t) : -1;
+	if (!rv)
+		__connect_wait(t, buf);
+
+	__start_wait();
+	if (rv)
+		goto buf_free;
+
+	//
+	t->start = __time_ns();
+	t->started = 1;
+	end = t->start + _cfg.duration * 1000000000ULL;
+
+	for (int i = 0; i < t->nr_conns; i++)
+		if (t->conns[i].state == CONN_IDLE)
+			__conn_idle(t, &t->conns[i]);
+
+	/*********************************************************
+	 * event loop, wakes up for the next arrival in open mode
+	 ********************************************************/
+	while (_running && (now = __time_ns()) < end) {
+		timeout = end - now;
+		if (_cfg.rate) {
+			__dispatch(t, now);
+			next = t->start + t->arrivals * t->interval;
+			if (next - now < timeout)
+				timeout = next - now;
+		}
+
+		ts.tv_sec = timeout / 1000000000ULL;
+		ts.tv_nsec = timeout % 1000000000ULL;
+		nr = epoll_pwait2(t->epoll_fd, events, EVENTS_MAX, &ts, NULL);
+		if (nr == -1) {
+			if (errno == EINTR)
+				continue;
+			ERROR("epoll_pwait2() failed: %s!\n", strerror(errno));
+			break;
+		}
+
+		for (int i = 0; i < nr; i++)
+			__conn_event(t, events[i].data.ptr, events[i].events, buf);
+	}
+
+	/*********************************************************
+	 * requests in flight or still waiting (open mode) are
+	 * recorded with their latency so far
+	 ********************************************************/
+	now = __time_ns();
+	for (int i = 0; i < t->nr_conns; i++) {
+		if (t->conns[i].state == CONN_BUSY) {
+			histogram_record(&t->latency, now - t->conns[i].intended);
+			t->unfinished++;
+		}
+		if (t->conns[i].state != CONN_CLOSED) {
+			// closed mode, every connection always has a request
+			if (!_cfg.rate && !t->conns[i].requests)
+				t->starved++;
+			close(t->conns[i].fd);
+		}
+	}
+
+	if (_cfg.rate) {
+		t->arrivals = ((now < end ? now : end) - t->start) / t->interval + 1;
+		for (; t->dispatched < t->arrivals; t->dispatched++) {
+			histogram_record(&t->latency,
+						now - (t->start + t->dispatched * t->interval));
+			t->unfinished++;
+		}
+	}
+
+buf_free:
+	free(buf);
+	return NULL;
+}
+
+/**
+ * Resolve server address.
+ *
+ * Return 0 on success and -1 on error.
+ */
+static int
+__resolve(char *host, char *port)
+{
+	struct addrinfo hints, *res;
+	int status;
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_INET;
+	hints.ai_socktype = SOCK_STREAM;
+
+	status = getaddrinfo(host, port, &hints, &res);
+	if (status) {
+		ERROR("getaddrinfo() error: %s!\n", gai_strerror(status));
+		return -1;
+	}
+
+	memcpy(&_cfg.sa, res->ai_addr, res->ai_addrlen);
+	_cfg.salen = res->ai_addrlen;
+	freeaddrinfo(res);
+
+	return 0;
+}
+
+/**
+ * Stop the test (SIGINT).
+ */
+static void
+__on_sigint(int sig)
+{
+	_running = 0;
+}
+
+
+/*============================================================================*/
+
+int main(int argc, char *argv[])
+{
+	char *host = "localhost", *port = SERVER_PORT;
+	uint64_t requests = 0, unfinished = 0, starved = 0, connected = 0;
+	uint64_t errors = 0;
+	histogram_t *connect, *latency, *latency_raw;
+	double pcts[] = { 50.0, 75.0, 90.0, 99.0, 99.9, 99.99 };
+	uint64_t start, elapsed;
+	lg_thread_t *threads;
+	struct rlimit rl;
+	size_t size = REQUEST_SIZE;
+	uint32_t hdr;
+	int opt, nr, rv, quiet = 0;
+
+	/*********************************************************
+	 * parse arguments
+	 ********************************************************/
+	_cfg.threads = THREADS;
+	_cfg.connections = CONNECTIONS;
+	_cfg.duration = DURATION;
+	while ((opt = getopt(argc, argv, "t:c:d:s:r:q")) != -1) {
+		switch (opt) {
+		case 't':
+			_cfg.threads = atoi(optarg);
+			break;
+		case 'c':
+			_cfg.connections = atoi(optarg);
+			break;
+		case 'd':
+			_cfg.duration = atoi(optarg);
+			break;
+		case 's':
+			size = strtoul(optarg, NULL, 10);
+			break;
+		case 'r':
+			_cfg.rate = atof(optarg);
+			break;
+		case 'q':
+			quiet = 1;
+			break;
+		default:
+			printf("Usage: %s [-t threads] [-c connections] [-d seconds] "
+					"[-s size] [-r rate] [-q] [host] [port]\n", argv[0]);
+			return -1;
+		}
+	}
+
+	if (optind < argc)
+		host = argv[optind++];
+	if (optind < argc)
+		port = argv[optind++];
+
+	if (_cfg.threads < 1 || _cfg.connections < _cfg.threads ||
+		_cfg.duration < 1 || size > FRAME_PAYLOAD_MAX || _cfg.rate < 0) {
+		ERROR("Invalid arguments!\n");
+		return -1;
+	}
+
+	if (__resolve(host, port))
+		return -1;
+
+	/*********************************************************
+	 * thousands of connections need descriptors above the
+	 * default soft limit
+	 ********************************************************/
+	if (!getrlimit(RLIMIT_NOFILE, &rl) && rl.rlim_cur < rl.rlim_max) {
+		rl.rlim_cur = rl.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &rl);
+	}
+
+	signal(SIGPIPE, SIG_IGN);
+	signal(SIGINT, __on_sigint);
+
+	/*********************************************************
+	 * request frame (sent by all connections, read only)
+	 ********************************************************/
+	_cfg.req_len = FRAME_HDR_SIZE + size;
+	_cfg.req = malloc(_cfg.req_len);
+	if (!_cfg.req) {
+		ERROR("malloc() failed!\n");
+		return -1;
+	}
+
+	hdr = htonl(size);
+	memcpy(_cfg.req, &hdr, FRAME_HDR_SIZE);
+	memset(_cfg.req + FRAME_HDR_SIZE, 'x', size);
+
+	/*********************************************************
+	 * create threads, connections split between them
+	 ********************************************************/
+	threads = calloc(_cfg.threads, sizeof(lg_thread_t));
+	connect = calloc(3, sizeof(histogram_t));
+	if (!threads || !connect) {
+		ERROR("calloc() failed!\n");
+		return -1;
+	}
+	latency = connect + 1;
+	latency_raw = connect + 2;
+	histogram_init(connect);
+	histogram_init(latency);
+	histogram_init(latency_raw);
+
+	/*********************************************************
+	 * a failure stops the threads already started, they are
+	 * still released from the start gate and joined
+	 ********************************************************/
+	for (nr = 0; nr < _cfg.threads; nr++) {
+		lg_thread_t *t = &threads[nr];
+
+		t->nr_conns = _cfg.connections / _cfg.threads +
+						(nr < _cfg.connections % _cfg.threads);
+		t->conns = calloc(t->nr_conns, sizeof(lg_conn_t));
+		t->idle = calloc(t->nr_conns, sizeof(int));
+		t->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+		if (!t->conns || !t->idle || t->epoll_fd == -1) {
+			ERROR("Thread %d init failed!\n", nr);
+			_running = 0;
+			break;
+		}
+
+		if (_cfg.rate)
+			t->interval = 1e9 * _cfg.threads / _cfg.rate;
+		if (_cfg.rate && !t->interval)
+			t->interval = 1;
+
+		histogram_init(&t->connect);
+		histogram_init(&t->latency);
+		histogram_init(&t->latency_raw);
+
+		rv = pthread_create(&t->tid, NULL, __lg_thread, t);
+		if (rv) {
+			ERROR("pthread_create() failed: %s!\n", strerror(rv));
+			close(t->epoll_fd);
+			_running = 0;
+			break;
+		}
+	}
+
+	// test clock starts once all threads are connected
+	__start_open(nr);
+	start = __time_ns();
+
+	//
+	for (int i = 0; i < nr; i++) {
+		pthread_join(threads[i].tid, NULL);
+
+		requests += threads[i].requests;
+		unfinished += threads[i].unfinished;
+		starved += threads[i].starved;
+		connected += threads[i].connected;
+		errors += threads[i].errors;
+		histogram_merge(connect, &threads[i].connect);
+		histogram_merge(latency, &threads[i].latency);
+		histogram_merge(latency_raw, &threads[i].latency_raw);
+		close(threads[i].epoll_fd);
+	}
+	elapsed = __time_ns() - start;
+
+	if (nr < _cfg.threads)
+		return -1;
+
+	/*********************************************************
+	 * report
+	 ********************************************************/
+	if (quiet) {
+		printf("%lu,%lu,%lu,%.0f,%lu,%.3f,%.3f,%.3f\n", connected, errors,
+				requests, requests * 1e9 / elapsed, starved,
+				histogram_percentile(latency, 50.0) / 1e3,
+				histogram_percentile(latency, 99.0) / 1e3, latency->max / 1e3);
+		return 0;
+	}
+
+	if (_cfg.rate)
+		printf("mode open (%.0f requests/s)", _cfg.rate);
+	else
+		printf("mode closed");
+	printf(", %d threads, %d connections (%lu connected, %lu failed), "
+			"%zu bytes, %d s\n", nr, _cfg.connections, connected, errors,
+			size, _cfg.duration);
+	printf("requests: %lu, %.0f requests/s, %lu unfinished", requests,
+			requests * 1e9 / elapsed, unfinished);
+	if (!_cfg.rate)
+		printf(", %lu connections starved", starved);
+	printf("\n");
+
+	histogram_print(connect, "connect", "us", 1e3);
+	histogram_print(latency, _cfg.rate ? "latency (corrected)" : "latency",
+					"us", 1e3);
+	if (_cfg.rate)
+		histogram_print(latency_raw, "latency (uncorrected)", "us", 1e3);
+
+	// percentile distribution
+	printf("%10s %14s", "percentile", "latency_us");
+	printf(_cfg.rate ? " %16s\n" : "\n", "uncorrected_us");
+	for (int i = 0; i < sizeof(pcts) / sizeof(pcts[0]); i++) {
+		printf("%10.2f %14.3f", pcts[i],
+				histogram_percentile(latency, pcts[i]) / 1e3);
+		if (_cfg.rate)
+			printf(" %16.3f", histogram_percentile(latency_raw, pcts[i]) / 1e3);
+		printf("\n");
+	}
+
+	return 0;
+}
@@ -0,0 +1,871 @@
+/**
+ * Asynchronous lock-free logger.
+ * Copyright (C) 2024 Lazar Razvan.
+ *
+ * DEBUG() and ERROR() macros used to expand to printf(), taking the stdio
+ * lock and formatting a string for each packet on the server hot path. With
+ * this logger, the calling thread only records the call site (format string
+ * pointer, function and line) and the raw arguments into its own ring buffer
+ * (single producer, single consumer). Formatting and writing to stdout is done
+ * by a background thread.
+ *
+ * Arguments are extracted from the va_list by walking the format string, so
+ * only printf conversions are supported. Strings (%s) are copied into the
+ * record (limited to LOG_STRS_MAX bytes per message), since the caller buffer
+ * is reused as soon as the macro returns. Precision is respected when copying,
+ * so "%.*s" can be used on buffers that are not null terminated.
+ *
+ * Other features:
+ * 	1) log level can be changed at runtime (log_set_level()) and initialized
+ * 	from LOG_LEVEL environment variable (error, warn, info, debug or number)
+ * 	2) each call site is rate limited to LOG_RATE_LIMIT messages per second,
+ * 	and the number of suppressed messages is reported
+ * 	3) if a ring is full, the message is dropped and counted
+ * 	4) pending messages are written at exit (atexit) and after fork() the
+ * 	child starts its own background thread
+ * 	5) background thread sleeps on a condition variable while all rings are
+ * 	empty, the first message recorded wakes it up (only that one takes the
+ * 	wake lock) and it writes messages recorded in the next
+ * 	LOG_FLUSH_PERIOD_US together
+ */
+
+#include <time.h>
+#include <ctype.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+
+#include "log.h"
+
+/*============================================================================*/
+/**
+ * Ring index mask.
+ */
+#define LOG_RING_MASK				(LOG_RING_SIZE - 1)
+
+/**
+ * String argument not copied (no space left).
+ */
+#define LOG_STR_NONE				UINT64_MAX
+
+/**
+ * Formatted line max size.
+ */
+#define LOG_LINE_MAX				1024
+
+/**
+ * Length modifiers.
+ */
+enum {
+	LEN_NONE,
+	LEN_HH,
+	LEN_H,
+	LEN_L,
+	LEN_LL,
+	LEN_Z,
+	LEN_J,
+	LEN_T,
+	LEN_LD,
+};
+
+/**
+ * Conversion specification.
+ */
+typedef struct log_spec_s {
+
+	const char	*start;			// specification start ('%')
+	const char	*flags;			// flags start
+	int			flags_len;		// flags length
+	const char	*width;			// width digits (if not '*')
+	int			width_len;		// width digits length
+	int			width_star;		// width is an argument
+	int			has_prec;		// precision is set
+	const char	*prec;			// precision digits (if not '*')
+	int			prec_len;		// precision digits length
+	int			prec_star;		// precision is an argument
+	int			len;			// length modifier
+	char		conv;			// conversion
+
+} log_spec_t;
+
+/**
+ * Message record.
+ */
+typedef struct log_rec_s {
+
+	log_site_t	*site;					// call site
+	uint64_t	suppressed;				// rate limited messages before
+	uint64_t	args[LOG_ARGS_MAX];		// raw arguments
+	uint16_t	strs_len;				// copied strings length
+	char		strs[LOG_STRS_MAX];		// copied strings
+
+} log_rec_t;
+
+/**
+ * Per-thread ring buffer.
+ */
+typedef struct log_ring_s {
+
+	uint64_t	head __attribute__((aligned(64)));	// producer index
+	uint64_t	drops;								// dropped messages
+	uint64_t	tail __attribute__((aligned(64)));	// consumer index
+	int			alive;								// owner is running
+	struct log_ring_s	*next;						// rings list
+
+	log_rec_t	recs[LOG_RING_SIZE];				// messages
+
+} log_ring_t;
+
+/**
+ * Logger global state.
+ */
+typedef struct log_s {
+
+	int				started;		// background thread started
+	pthread_t		thread;			// background thread
+	pthread_mutex_t	lock;			// output lock (thread vs flush vs fork)
+	log_ring_t		*rings;			// all rings (lock-free list)
+	pthread_mutex_t	wake_lock;		// background thread sleep
+	pthread_cond_t	wake;			// first message while sleeping
+	int				sleeping;		// background thread waits (atomic)
+
+} log_t;
+
+
+/*============================================================================*/
+
+int log_level = LOG_LEVEL_DEBUG;
+
+static log_t _log = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.wake_lock = PTHREAD_MUTEX_INITIALIZER,
+	.wake = PTHREAD_COND_INITIALIZER,
+};
+
+static __thread log_ring_t *_ring;
+
+static pthread_key_t _ring_key;
+static pthread_once_t _ring_key_once = PTHREAD_ONCE_INIT;
+
+
+/*============================================================================*/
+
+/**
+ * Parse a conversion specification.
+ *
+ * @f	: Format string pointing after '%'.
+ * @sp	: Specification.
+ *
+ * Return format string pointer after specification.
+ */
+static const char *
+__spec_parse(const char *f, log_spec_t *sp)
+{
+	memset(sp, 0, sizeof(log_spec_t));
+	sp->start = f - 1;
+
+	// flags
+	sp->flags = f;
+	while (*f && strchr("-+ #0'", *f))
+		f++;
+	sp->flags_len = f - sp->flags;
+
+	// width
+	if (*f == '*') {
+		sp->width_star = 1;
+		f++;
+	} else {
+		sp->width = f;
+		while (isdigit((unsigned char)*f))
+			f++;
+		sp->width_len = f - sp->width;
+	}
+
+	// precision
+	if (*f == '.') {
+		sp->has_prec = 1;
+		f++;
+		if (*f == '*') {
+			sp->prec_star = 1;
+			f++;
+		} else {
+			sp->prec = f;
+			while (isdigit((unsigned char)*f))
+				f++;
+			sp->prec_len = f - sp->prec;
+		}
+	}
+
+	// length modifier
+	switch (*f) {
+	case 'h':
+		sp->len = (f[1] == 'h') ? LEN_HH : LEN_H;
+		f += (f[1] == 'h') ? 2 : 1;
+		break;
+	case 'l':
+		sp->len = (f[1] == 'l') ? LEN_LL : LEN_L;
+		f += (f[1] == 'l') ? 2 : 1;
+		break;
+	case 'q':
+		sp->len = LEN_LL; f++;
+		break;
+	case 'z':
+		sp->len = LEN_Z; f++;
+		break;
+	case 'j':
+		sp->len = LEN_J; f++;
+		break;
+	case 't':
+		sp->len = LEN_T; f++;
+		break;
+	case 'L':
+		sp->len = LEN_LD; f++;
+		break;
+	default:
+		break;
+	}
+
+	sp->conv = *f;
+
+	return *f ? f + 1 : f;
+}
+
+/**
+ * Get a signed integer argument (truncated as printf would do).
+ */
+static int64_t
+__arg_signed(va_list *ap, int len)
+{
+	switch (len) {
+	case LEN_HH:	return (signed char)va_arg(*ap, int);
+	case LEN_H:		return (short)va_arg(*ap, int);
+	case LEN_L:		return va_arg(*ap, long);
+	case LEN_LL:	return va_arg(*ap, long long);
+	case LEN_Z:		return va_arg(*ap, ssize_t);
+	case LEN_J:		return va_arg(*ap, intmax_t);
+	case LEN_T:		return va_arg(*ap, ptrdiff_t);
+	default:		return va_arg(*ap, int);
+	}
+}
+
+/**
+ * Get an unsigned integer argument (truncated as printf would do).
+ */
+static uint64_t
+__arg_unsigned(va_list *ap, int len)
+{
+	switch (len) {
+	case LEN_HH:	return (unsigned char)va_arg(*ap, unsigned int);
+	case LEN_H:		return (unsigned short)va_arg(*ap, unsigned int);
+	case LEN_L:		return va_arg(*ap, unsigned long);
+	case LEN_LL:	return va_arg(*ap, unsigned long long);
+	case LEN_Z:		return va_arg(*ap, size_t);
+	case LEN_J:		return va_arg(*ap, uintmax_t);
+	case LEN_T:		return va_arg(*ap, ptrdiff_t);
+	default:		return va_arg(*ap, unsigned int);
+	}
+}
+
+/**
+ * Copy a string argument into record.
+ */
+static uint64_t
+__arg_string(log_rec_t *rec, const char *str, int prec)
+{
+	size_t len, off = rec->strs_len;
+
+	if (!str)
+		str = "(null)";
+
+	len = (prec >= 0) ? strnlen(str, prec) : strlen(str);
+	if (off >= LOG_STRS_MAX)
+		return LOG_STR_NONE;
+
+	// truncate string if no space left
+	if (len > LOG_STRS_MAX - off - 1)
+		len = LOG_STRS_MAX - off - 1;
+
+	memcpy(&rec->strs[off], str, len);
+	rec->strs[off + len] = '\0';
+	rec->strs_len = off + len + 1;
+
+	return off;
+}
+
+/**
+ * Extract raw arguments from va_list into record.
+ */
+static void
+__args_record(log_rec_t *rec, const char *f, va_list *ap)
+{
+	log_spec_t sp;
+	int ai = 0, prec;
+	double d;
+
+	rec->strs_len = 0;
+
+	while (*f) {
+		if (*f++ != '%')
+			continue;
+
+		if (*f == '%') {
+			f++;
+			continue;
+		}
+
+		f = __spec_parse(f, &sp);
+
+		// too many arguments, stop recording (message is truncated)
+		if (ai + sp.width_star + sp.prec_star + 1 > LOG_ARGS_MAX)
+			break;
+
+		if (sp.width_star)
+			rec->args[ai++] = va_arg(*ap, int);
+
+		prec = -1;
+		if (sp.prec_star)
+			rec->args[ai++] = prec = va_arg(*ap, int);
+		else if (sp.has_prec)
+			prec = sp.prec_len ? atoi(sp.prec) : 0;
+
+		switch (sp.conv) {
+		case 'd':
+		case 'i':
+			rec->args[ai++] = __arg_signed(ap, sp.len);
+			break;
+		case 'u':
+		case 'o':
+		case 'x':
+		case 'X':
+			rec->args[ai++] = __arg_unsigned(ap, sp.len);
+			break;
+		case 'c':
+			rec->args[ai++] = va_arg(*ap, int);
+			break;
+		case 'f': case 'F':
+		case 'e': case 'E':
+		case 'g': case 'G':
+		case 'a': case 'A':
+			d = (sp.len == LEN_LD) ? (double)va_arg(*ap, long double) :
+								va_arg(*ap, double);
+			memcpy(&rec->args[ai++], &d, sizeof(double));
+			break;
+		case 's':
+			rec->args[ai++] = __arg_string(rec, va_arg(*ap, const char *),
+											prec);
+			break;
+		case 'p':
+		case 'n':
+			rec->args[ai++] = (uintptr_t)va_arg(*ap, void *);
+			break;
+		default:
+			break;
+		}
+	}
+}
+
+/**
+ * Append formatted output to line buffer.
+ */
+static inline size_t
+__line_add(char *line, size_t len, int n)
+{
+	if (n < 0)
+		return len;
+
+	len += n;
+
+	return (len >= LOG_LINE_MAX) ? LOG_LINE_MAX - 1 : len;
+}
+
+/**
+ * Format a record (background thread).
+ *
+ * Specification is rebuilt with '*' replaced by recorded values and integer
+ * length modifiers replaced by "ll", since values were recorded as 64 bits.
+ */
+static size_t
+__rec_format(log_rec_t *rec, char *line)
+{
+	const char *f = rec->site->fmt;
+	char spec[64];
+	size_t len = 0;
+	log_spec_t sp;
+	int ai = 0, k;
+	double d;
+
+	len = __line_add(line, len, snprintf(line, LOG_LINE_MAX, "%s:%d:%s::",
+								rec->site->func, rec->site->line, rec->site->tag));
+
+	while (*f && len < LOG_LINE_MAX - 1) {
+		if (*f != '%') {
+			line[len++] = *f++;
+			continue;
+		}
+
+		if (f[1] == '%') {
+			line[len++] = '%';
+			f += 2;
+			continue;
+		}
+
+		f = __spec_parse(f + 1, &sp);
+
+		// arguments not recorded (too many), copy specification as is
+		if (ai + sp.width_star + sp.prec_star + 1 > LOG_ARGS_MAX) {
+			len = __line_add(line, len, snprintf(line + len,
+					LOG_LINE_MAX - len, "%.*s", (int)(f - sp.start), sp.start));
+			continue;
+		}
+
+		// rebuild specification
+		k = snprintf(spec, sizeof(spec), "%%%.*s", sp.flags_len, sp.flags);
+
+		if (sp.width_star)
+			k += snprintf(spec + k, sizeof(spec) - k, "%d", (int)rec->args[ai++]);
+		else
+			k += snprintf(spec + k, sizeof(spec) - k, "%.*s", sp.width_len,
+						sp.width);
+
+		if (sp.prec_star)
+			k += snprintf(spec + k, sizeof(spec) - k, ".%d",
+						(int)rec->args[ai++]);
+		else if (sp.has_prec)
+			k += snprintf(spec + k, sizeof(spec) - k, ".%.*s", sp.prec_len,
+						sp.prec);
+
+		if (k >= (int)sizeof(spec) - 4) {
+			ai++;
+			continue;
+		}
+
+		switch (sp.conv) {
+		case 'd':
+		case 'i':
+		case 'u':
+		case 'o':
+		case 'x':
+		case 'X':
+			snprintf(spec + k, sizeof(spec) - k, "ll%c", sp.conv);
+			len = __line_add(line, len, snprintf(line + len,
+						LOG_LINE_MAX - len, spec, rec->args[ai++]));
+			break;
+		case 'c':
+			snprintf(spec + k, sizeof(spec) - k, "c");
+			len = __line_add(line, len, snprintf(line + len,
+						LOG_LINE_MAX - len, spec, (int)rec->args[ai++]));
+			break;
+		case 'f': case 'F':
+		case 'e': case 'E':
+		case 'g': case 'G':
+		case 'a': case 'A':
+			snprintf(spec + k, sizeof(spec) - k, "%c", sp.conv);
+			memcpy(&d, &rec->args[ai++], sizeof(double));
+			len = __line_add(line, len, snprintf(line + len,
+						LOG_LINE_MAX - len, spec, d));
+			break;
+		case 's':
+			snprintf(spec + k, sizeof(spec) - k, "s");
+			len = __line_add(line, len, snprintf(line + len,
+						LOG_LINE_MAX - len, spec,
+						rec->args[ai] == LOG_STR_NONE ? "" :
+						&rec->strs[rec->args[ai]]));
+			ai++;
+			break;
+		case 'p':
+			snprintf(spec + k, sizeof(spec) - k, "p");
+			len = __line_add(line, len, snprintf(line + len,
+						LOG_LINE_MAX - len, spec, (void *)rec->args[ai++]));
+			break;
+		case 'n':
+			ai++;
+			break;
+		default:
+			break;
+		}
+	}
+
+	line[len] = '\0';
+
+	return len;
+}
+
+/**
+ * Format and write all pending records.
+ */
+static void
+__rings_drain(void)
+{
+	char line[LOG_LINE_MAX];
+	log_ring_t *ring;
+	uint64_t head, tail, drops;
+	log_rec_t *rec;
+
+	pthread_mutex_lock(&_log.lock);
+
+	for (ring = __atomic_load_n(&_log.rings, __ATOMIC_ACQUIRE); ring;
+		ring = ring->next) {
+		tail = ring->tail;
+		head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+
+		for (; tail != head; tail++) {
+			rec = &ring->recs[tail & LOG_RING_MASK];
+
+			if (rec->suppressed)
+				printf("%s:%d:%s::(%lu messages suppressed)\n",
+						rec->site->func, rec->site->line, rec->site->tag,
+						rec->suppressed);
+
+			__rec_format(rec, line);
+			fputs(line, stdout);
+		}
+
+		__atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+
+		drops = __atomic_exchange_n(&ring->drops, 0, __ATOMIC_RELAXED);
+		if (drops)
+			printf("log:%lu messages dropped (ring full)\n", drops);
+	}
+
+	fflush(stdout);
+
+	pthread_mutex_unlock(&_log.lock);
+}
+
+/**
+ * Any record not written yet.
+ */
+static int
+__rings_pending(void)
+{
+	log_ring_t *ring;
+
+	for (ring = __atomic_load_n(&_log.rings, __ATOMIC_ACQUIRE); ring;
+		ring = ring->next)
+		if (__atomic_load_n(&ring->head, __ATOMIC_SEQ_CST) !=
+			__atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE))
+			return 1;
+
+	return 0;
+}
+
+/**
+ * Wake up background thread if it sleeps (producer, after a record is
+ * published).
+ */
+static inline void
+__log_wake(void)
+{
+	// pairs with sleeping set before __rings_pending() (no lost wake up)
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (!__atomic_load_n(&_log.sleeping, __ATOMIC_RELAXED) ||
+		!__atomic_exchange_n(&_log.sleeping, 0, __ATOMIC_ACQ_REL))
+		return;
+
+	pthread_mutex_lock(&_log.wake_lock);
+	pthread_cond_signal(&_log.wake);
+	pthread_mutex_unlock(&_log.wake_lock);
+}
+
+/**
+ * Background thread.
+ *
+ * Sleeps until a message is recorded, then waits LOG_FLUSH_PERIOD_US so that
+ * messages of a burst are written together.
+ */
+static void *
+__log_thread(void *arg)
+{
+	struct timespec period = {
+		.tv_sec = 0,
+		.tv_nsec = LOG_FLUSH_PERIOD_US * 1000,
+	};
+
+	while (1) {
+		__rings_drain();
+
+		//
+		pthread_mutex_lock(&_log.wake_lock);
+		while (1) {
+			__atomic_store_n(&_log.sleeping, 1, __ATOMIC_SEQ_CST);
+			if (__rings_pending())
+				break;
+			pthread_cond_wait(&_log.wake, &_log.wake_lock);
+		}
+		__atomic_store_n(&_log.sleeping, 0, __ATOMIC_RELAXED);
+		pthread_mutex_unlock(&_log.wake_lock);
+
+		nanosleep(&period, NULL);
+	}
+
+	return NULL;
+}
+
+/**
+ * Thread exit: ring may be reused by another thread once drained.
+ */
+static void
+__ring_release(void *arg)
+{
+	log_ring_t *ring = (log_ring_t *)arg;
+
+	__atomic_store_n(&ring->alive, 0, __ATOMIC_RELEASE);
+}
+
+static void
+__ring_key_create(void)
+{
+	pthread_key_create(&_ring_key, __ring_release);
+}
+
+/**
+ * Get a ring for calling thread (reuse a drained one or allocate).
+ */
+static log_ring_t *
+__ring_acquire(void)
+{
+	log_ring_t *ring;
+	int dead = 0;
+
+	pthread_once(&_ring_key_once, __ring_key_create);
+
+	// reuse ring of a terminated thread
+	for (ring = __atomic_load_n(&_log.rings, __ATOMIC_ACQUIRE); ring;
+		ring = ring->next) {
+		if (__atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) !=
+			__atomic_load_n(&ring->head, __ATOMIC_ACQUIRE))
+			continue;
+
+		if (__atomic_compare_exchange_n(&ring->alive, &dead, 1, 0,
+								__ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+			goto found;
+
+		dead = 0;
+	}
+
+	// allocate and push a new ring
+	ring = calloc(1, sizeof(log_ring_t));
+	if (!ring)
+		return NULL;
+
+	ring->alive = 1;
+	ring->next = __atomic_load_n(&_log.rings, __ATOMIC_RELAXED);
+	while (!__atomic_compare_exchange_n(&_log.rings, &ring->next, ring, 1,
+								__ATOMIC_RELEASE, __ATOMIC_RELAXED));
+
+found:
+	pthread_setspecific(_ring_key, ring);
+	_ring = ring;
+
+	return ring;
+}
+
+/**
+ * Start background thread (first message of the process).
+ */
+static void
+__log_start(void)
+{
+	sigset_t all, old;
+	int started = 0;
+
+	if (!__atomic_compare_exchange_n(&_log.started, &started, 1, 0,
+								__ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+		return;
+
+	// background thread never handles signals (inherits a full mask), so
+	// signals blocked later by the program are not delivered to it
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+
+	if (pthread_create(&_log.thread, NULL, __log_thread, NULL))
+		fprintf(stderr, "log: pthread_create() failed, messages are "
+						"written at exit!\n");
+
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+}
+
+/**
+ * Check call site rate limit.
+ *
+ * Return 1 if message must be dropped.
+ */
+static inline int
+__rate_limited(log_site_t *site, uint64_t *suppressed)
+{
+	struct timespec ts;
+	uint64_t window;
+
+	if (!LOG_RATE_LIMIT)
+		return 0;
+
+	clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+	window = ts.tv_sec;
+
+	// new window (racy between threads, approximate is enough)
+	if (__atomic_load_n(&site->window, __ATOMIC_RELAXED) != window) {
+		__atomic_store_n(&site->window, window, __ATOMIC_RELAXED);
+		__atomic_store_n(&site->count, 0, __ATOMIC_RELAXED);
+		*suppressed = __atomic_exchange_n(&site->suppressed, 0,
+										__ATOMIC_RELAXED);
+	}
+
+	if (__atomic_fetch_add(&site->count, 1, __ATOMIC_RELAXED) <
+		LOG_RATE_LIMIT)
+		return 0;
+
+	__atomic_fetch_add(&site->suppressed, 1, __ATOMIC_RELAXED);
+
+	return 1;
+}
+
+/**
+ * fork() handlers.
+ *
+ * Output is written and locked before fork, so the child does not inherit
+ * (and write again) pending messages.
+ */
+static void
+__atfork_prepare(void)
+{
+	pthread_mutex_lock(&_log.lock);
+	fflush(stdout);
+}
+
+static void
+__atfork_parent(void)
+{
+	pthread_mutex_unlock(&_log.lock);
+}
+
+static void
+__atfork_child(void)
+{
+	pthread_mutex_unlock(&_log.lock);
+
+	// parent rings and background thread do not exist in child
+	_log.rings = NULL;
+	_log.started = 0;
+	_log.sleeping = 0;
+	pthread_mutex_init(&_log.wake_lock, NULL);
+	pthread_cond_init(&_log.wake, NULL);
+	_ring = NULL;
+}
+
+/**
+ * Parse log level name or number.
+ */
+static int
+__level_parse(const char *str)
+{
+	static const char *names[] = { "error", "warn", "info", "debug" };
+
+	for (int i = 0; i < 4; i++)
+		if (!strcasecmp(str, names[i]))
+			return LOG_LEVEL_ERROR + i;
+
+	if (!strcasecmp(str, "none"))
+		return LOG_LEVEL_NONE;
+
+	return atoi(str);
+}
+
+/**
+ * Logger init (before main).
+ */
+static void __attribute__((constructor))
+__log_init(void)
+{
+	const char *level = getenv(LOG_LEVEL_ENV);
+
+	if (level)
+		log_set_level(__level_parse(level));
+
+	pthread_atfork(__atfork_prepare, __atfork_parent, __atfork_child);
+	atexit(log_flush);
+}
+
+
+/*============================================================================*/
+
+/**
+ * Set log level.
+ *
+ * @level	: LOG_LEVEL_NONE, LOG_LEVEL_ERROR ... LOG_LEVEL_DEBUG.
+ */
+void
+log_set_level(int level)
+{
+	if (level < LOG_LEVEL_NONE)
+		level = LOG_LEVEL_NONE;
+
+	if (level > LOG_LEVEL_DEBUG)
+		level = LOG_LEVEL_DEBUG;
+
+	__atomic_store_n(&log_level, level, __ATOMIC_RELAXED);
+}
+
+/**
+ * Format and write all pending messages.
+ */
+void
+log_flush(void)
+{
+	__rings_drain();
+}
+
+/**
+ * Record a message for the background thread.
+ *
+ * @site	: Call site.
+ * @fmt		: Format string (same as site->fmt, used for compiler checks).
+ */
+void
+log_write(log_site_t *site, const char *fmt, ...)
+{
+	uint64_t head, suppressed = 0;
+	log_ring_t *ring;
+	log_rec_t *rec;
+	va_list ap;
+
+	if (__rate_limited(site, &suppressed))
+		return;
+
+	if (!__atomic_load_n(&_log.started, __ATOMIC_ACQUIRE))
+		__log_start();
+
+	ring = _ring;
+	if (!ring && !(ring = __ring_acquire())) {
+		// no memory for a ring, write synchronously
+		va_start(ap, fmt);
+		printf("%s:%d:%s::", site->func, site->line, site->tag);
+		vprintf(fmt, ap);
+		va_end(ap);
+		return;
+	}
+
+	head = ring->head;
+	if (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) >=
+		LOG_RING_SIZE) {
+		__atomic_fetch_add(&ring->drops, 1, __ATOMIC_RELAXED);
+		return;
+	}
+
+	rec = &ring->recs[head & LOG_RING_MASK];
+	rec->site = site;
+	rec->suppressed = suppressed;
+
+	va_start(ap, fmt);
+	__args_record(rec, fmt, &ap);
+	va_end(ap);
+
+	__atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+
+	__log_wake();
+}
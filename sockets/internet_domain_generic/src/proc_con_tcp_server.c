@@ -5,6 +5,37 @@
  * Mechanism implemented using a new process (fork()) each time a new
  * connection is accepted.
  *
+ * Process can be created in two ways:
+ * 	1) fork() from the accept loop (default)
+ * 		Main process image (heap, caches) is duplicated for each connection,
+ * 	so connection setup cost grows with main process memory.
+ *
+ * 	2) fork() from a zygote (-z)
+ * 		A fork-server is created once, right after the state shared by all
+ * 	connections is initialized (listening socket, resolved config), while its
+ * 	image is still small. Accept loop sends each client socket (SCM_RIGHTS)
+ * 	together with the client address to the zygote over a unix socket and the
+ * 	zygote forks the connection process from its small, warm image.
+ *
+ * Main process memory may be grown (-m) to simulate caches that are built
+ * after startup. Connection setup latency is compared using conn_bench.
+ *
+ * Data is received into pool buffers (buf_pool.c), starting small and grown
+ * for bulk transfers, instead of a fixed stack buffer.
+ *
+ * Idle connections and clients that do not read their replies are closed by a
+ * watchdog thread (deadline.c) of the connection process, so they do not hold
+ * a process forever.
+ *
+ * Signals are handled by the accept loop (and zygote) through signalfd:
+ * 	SIGTERM, SIGINT: stop accepting and exit after all connections are closed
+ * 	SIGHUP: reload (statistics reset)
+ * 	SIGUSR1: statistics dump (shared by all processes)
+ * 	SIGCHLD: reap connection processes
+ *
+ * Usage:
+ * 	./run/proc_con_tcp_server [-z] [-m cache_mb] [-p port]
+ *
  * Copyright (C) 2024 Lazar Razvan.
  */
 
@@ -19,36 +50,95 @@
 #include <signal.h>
 #include <sys/wait.h>
 #include <arpa/inet.h>
+#include <sys/epoll.h>
 #include <sys/socket.h>
 
 #include "debug.h"
 #include "utils.h"
 #include "common.h"
+#include "trace.h"
+#include "stats.h"
+#include "deadline.h"
+#include "buf_pool.h"
+#include "sig_event.h"
+
+
+/*============================================================================*/
+
+// Events handled by each epoll_wait() call
+#define EVENTS_MAX					8
+
+
+/*============================================================================*/
+
+/**
+ * Zygote spawn request (sent together with the client socket).
+ */
+typedef struct spawn_req_s {
+
+	struct sockaddr_storage	addr;		// client address
+	socklen_t				addrlen;	// client address length
+
+} spawn_req_t;
+
+/**
+ * Server state (accept loop and zygote have their own copy).
+ */
+typedef struct server_s {
+
+	sig_event_t			se;				// signal events
+	server_stats_t		*stats;			// statistics (shared memory)
+	deadline_config_t	deadlines;		// connection deadlines
+	int					running;		// cleared on shutdown
+	int					children;		// child processes not reaped
+
+} server_t;
+
+static server_t _srv;
 
 
 /*============================================================================*/
 
 /**
- * Signal handler to wait for zombie child processes.
+ * SIGCHLD handler to wait for zombie child processes.
  *
  * When client close the connection with server, the associated process perform
  * exit() system call triggering SIGCHLD signal to parent. If the parent does
  * not properly wait for the process, it will become zombie.
+ *
+ * Called from the event loop (signalfd), so there are no async-signal-safety
+ * restrictions. Several SIGCHLD are merged in one while pending, so wait for
+ * all children that exited.
  */
 static void
-__closed_connection_handler(int signal_no)
+__closed_connection_handler(struct signalfd_siginfo *info, void *arg)
 {
-	int errno_bak;
+	// loop to handle all zombie processes (note that call will not block
+	// because we use WHOHANG option and returns 0 while children are alive)
+	while (waitpid(-1, NULL, WNOHANG) > 0)
+		_srv.children--;
+}
 
-	// save errno
-	errno_bak = errno;
+/**
+ * Add a descriptor to epoll (EPOLLIN).
+ */
+static int
+__epoll_add(int epoll_fd, int fd)
+{
+	struct epoll_event ev;
 
-	// loop to handle all zombie processes (note that call will not block
-	// because we use WHOHANG option
-	while (waitpid(-1, NULL, WNOHANG) != -1);
+	//
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.fd = fd;
 
-	// restore errno
-	errno = errno_bak;
+	//
+	if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev)) {
+		ERROR("epoll_ctl() failed: %s!\n", strerror(errno));
+		return -1;
+	}
+
+	return 0;
 }
 
 /**
@@ -58,13 +148,27 @@ static void
 __connection_handler(int sfd, struct sockaddr *sa_client, socklen_t len)
 {
 	pid_t pid;
-	ssize_t recv_bytes;
+	ssize_t recv_bytes, send_bytes;
 	char host[NI_MAXHOST];
 	char serv[NI_MAXSERV];
-	char _buf[BUFFER_SIZE];
+	deadline_t deadline;
+	buf_sizer_t sizer;
+	buf_t *buf = NULL;
 
 	//
 	pid = getpid();
+	TRACE_BEGIN("connection");
+
+	// connection process has no event loop (default signal actions)
+	sig_event_destroy(&_srv.se);
+
+	// watchdog thread of this connection
+	buf_sizer_init(&sizer);
+	deadline_init(&deadline, sfd);
+	if (deadline_start(_srv.stats)) {
+		ERROR("[%d] deadline_start() failed!\n", pid);
+		goto finish;
+	}
 
 	//
 	if (sock2name(sa_client, len, host, serv)) {
@@ -74,7 +178,21 @@ __connection_handler(int sfd, struct sockaddr *sa_client, socklen_t len)
 
 	//
 	while (1) {
-		recv_bytes = recv(sfd, _buf, BUFFER_SIZE, 0);
+		// buffer of the size class observed for this connection
+		buf = buf_sizer_refresh(&sizer, buf);
+		if (!buf)
+			goto finish;
+
+		deadline_arm(&deadline, "idle", _srv.deadlines.idle_ms);
+
+		TRACE_BEGIN("recv");
+		recv_bytes = recv(sfd, buf->data, buf->size, 0);
+		TRACE_END("recv");
+		if (deadline_expired(&deadline)) {
+			DEBUG("[%d][%s: %s] Connection timed out!\n", pid, host, serv);
+			goto finish;
+		}
+
 		if (recv_bytes == -1) {
 			ERROR("[%d] recv() failed: %s!\n", pid, strerror(errno));
 			goto finish;
@@ -87,82 +205,359 @@ __connection_handler(int sfd, struct sockaddr *sa_client, socklen_t len)
 		}
 
 		//
-		DEBUG("[%d][%s: %s] Recv: [%.*s]!\n", pid, host, serv, (int)recv_bytes,
-											_buf);
+		buf->len = recv_bytes;
+		DEBUG("[%d][%s: %s] Recv: [%.*s]!\n", pid, host, serv, (int)buf->len,
+											buf->data);
 
 		//
-		if (send(sfd, _buf, recv_bytes, 0) != recv_bytes) {
-			ERROR("[%d] send() failed: %s!\n", pid, strerror(errno));
+		TRACE_BEGIN("send");
+		send_bytes = deadline_send(&deadline, buf->data, buf->len,
+								_srv.deadlines.write_ms);
+		TRACE_END("send");
+		if (send_bytes != recv_bytes) {
+			if (!deadline_expired(&deadline))
+				ERROR("[%d] send() failed: %s!\n", pid, strerror(errno));
 			goto finish;
 		}
+
+		stats_bytes(_srv.stats, recv_bytes, send_bytes);
+		buf_sizer_record(&sizer, recv_bytes);
 	}
 
 finish:
+	buf_unref(buf);
+	deadline_cancel(&deadline);
 	close(sfd);
+	stats_conn_close(_srv.stats);
+	TRACE_END("connection");
 	exit(1);
 }
 
+/**
+ * Fork a connection process.
+ */
+static void
+__connection_fork(int client_fd, int close_fd, struct sockaddr *sa_client,
+				socklen_t len)
+{
+	TRACE_BEGIN("fork");
+	switch (fork()) {
+	case -1:
+		TRACE_END("fork");
+		ERROR("fork() failed: %s!\n", strerror(errno));
+		stats_conn_close(_srv.stats);
+		break;
+	case 0:
+		// child
+		close(close_fd);	// do not need the listening (zygote) socket
+		__connection_handler(client_fd, sa_client, len);
+		exit(1);
+	default:
+		// parent
+		TRACE_END("fork");
+		_srv.children++;
+		break;
+	}
+
+	close(client_fd);	// do not need the client socket
+}
+
+/**
+ * Zygote (fork-server) main loop.
+ *
+ * Receive client sockets from accept loop and fork a connection process for
+ * each one. Zygote stops when accept loop closes the unix socket (or on
+ * SIGTERM) and exits once all its connection processes are reaped.
+ */
+static void
+__zygote(int zygote_fd)
+{
+	int client_fd, epoll_fd, nr;
+	struct epoll_event events[EVENTS_MAX];
+	spawn_req_t req;
+	ssize_t recv_bytes;
+
+	//
+	DEBUG("[%d] Zygote started!\n", getpid());
+	_srv.children = 0;
+
+	//
+	epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (epoll_fd == -1) {
+		ERROR("epoll_create1() failed: %s!\n", strerror(errno));
+		exit(1);
+	}
+
+	if (sig_event_epoll_add(&_srv.se, epoll_fd) ||
+		__epoll_add(epoll_fd, zygote_fd))
+		exit(1);
+
+	//
+	while (_srv.running || _srv.children) {
+		nr = epoll_wait(epoll_fd, events, EVENTS_MAX, -1);
+		if (nr == -1) {
+			ERROR("epoll_wait() failed: %s!\n", strerror(errno));
+			break;
+		}
+
+		for (int i = 0; i < nr; i++) {
+			// signals
+			if (events[i].data.fd == _srv.se.fd) {
+				sig_event_dispatch(&_srv.se);
+				continue;
+			}
+
+			// spawn request
+			recv_bytes = recv_fd(zygote_fd, &client_fd, &req, sizeof(req));
+			if (recv_bytes <= 0) {
+				DEBUG("[%d] Zygote closed!\n", getpid());
+				_srv.running = 0;
+				break;
+			}
+
+			//
+			if (recv_bytes != sizeof(req) || client_fd == -1) {
+				ERROR("Invalid spawn request!\n");
+				if (client_fd != -1)
+					close(client_fd);
+				continue;
+			}
+
+			__connection_fork(client_fd, zygote_fd,
+							(struct sockaddr *)&req.addr, req.addrlen);
+		}
+
+		// stop receiving requests
+		if (!_srv.running && zygote_fd != -1) {
+			close(zygote_fd);
+			zygote_fd = -1;
+		}
+	}
+
+	close(epoll_fd);
+	exit(0);
+}
+
+/**
+ * Start zygote process.
+ *
+ * Return unix socket connected to zygote on success and -1 on error.
+ */
+static int
+__zygote_start(int listen_fd)
+{
+	int sv[2];
+
+	/*********************************************************
+	 * SOCK_SEQPACKET keeps each request (and its descriptor)
+	 * a separate message.
+	 ********************************************************/
+	if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, sv) == -1) {
+		ERROR("socketpair() failed: %s!\n", strerror(errno));
+		return -1;
+	}
+
+	switch (fork()) {
+	case -1:
+		ERROR("fork() failed: %s!\n", strerror(errno));
+		close(sv[0]);
+		close(sv[1]);
+		return -1;
+	case 0:
+		// zygote
+		close(sv[0]);
+		close(listen_fd);	// connection processes do not accept
+		__zygote(sv[1]);
+		exit(1);
+	default:
+		_srv.children++;
+		break;
+	}
+
+	close(sv[1]);
+
+	return sv[0];
+}
+
 
 /*============================================================================*/
 
 int main(int argc, char *argv[])
 {
-	socklen_t addrlen;
-	struct sigaction sa;
-	int listen_fd, client_fd;
-	struct sockaddr sa_client;
+	char *cache;
+	spawn_req_t req;
+	size_t cache_size;
+	struct epoll_event events[EVENTS_MAX];
+	int listen_fd, client_fd, zygote_fd, epoll_fd, use_zygote, opt, nr;
+	char *port = SERVER_PORT;
+
+	/*********************************************************
+	 * parse arguments
+	 ********************************************************/
+	zygote_fd = -1;
+	use_zygote = 0;
+	cache_size = 0;
+	while ((opt = getopt(argc, argv, "zm:p:")) != -1) {
+		switch (opt) {
+		case 'z':
+			use_zygote = 1;
+			break;
+		case 'm':
+			cache_size = strtoul(optarg, NULL, 10) << 20;
+			break;
+		case 'p':
+			port = optarg;
+			break;
+		default:
+			printf("Usage: %s [-z] [-m cache_mb] [-p port]\n", argv[0]);
+			goto finish;
+		}
+	}
 
 	/*********************************************************
-	 * overwrite SIGCHLD signal
+	 * block control signals and SIGCHLD, deliver them through
+	 * signalfd
 	 *
 	 * When connection is closed with client, the process will
-	 * become zombie, so we need to wait for it.
+	 * become zombie, so we need to wait for it (SIGCHLD).
+	 * Statistics are shared with connection processes.
+	 ********************************************************/
+	_srv.running = 1;
+	_srv.stats = stats_create(1);
+	if (!_srv.stats) {
+		ERROR("stats_create() failed!\n");
+		goto finish;
+	}
+
+	if (sig_event_init(&_srv.se) ||
+		stats_signals_register(&_srv.se, _srv.stats, &_srv.running) ||
+		sig_event_register(&_srv.se, SIGCHLD, __closed_connection_handler,
+						NULL)) {
+		ERROR("Fail to init signal events!\n");
+		goto finish;
+	}
+
+	// connection deadlines (IDLE_TIMEOUT_MS and WRITE_TIMEOUT_MS override
+	// defaults), watchdog is started by each connection process
+	deadline_config_env(&_srv.deadlines);
+
+	/*********************************************************
+	 * start tracing (if TRACE_FILE is set)
 	 ********************************************************/
-	sigemptyset(&sa.sa_mask);
-	sa.sa_flags = SA_RESTART;
-	sa.sa_handler = __closed_connection_handler;
-	if (sigaction(SIGCHLD, &sa, NULL) == -1) {
-		ERROR("sigaction() failed: %s!\n", strerror(errno));
+	if (trace_start_env()) {
+		ERROR("trace_start_env() failed!\n");
 		goto finish;
 	}
 
 	/*********************************************************
 	 * create listening socket
 	 ********************************************************/
-	listen_fd = generic_listen(SERVER_PORT, 10, SOCK_STREAM, AF_INET);
+	listen_fd = generic_listen(port, LISTEN_BACKLOG, SOCK_STREAM, AF_INET);
 	if (listen_fd == -1) {
 		ERROR("generic_listen() failed!\n");
 		goto finish;
 	}
 
 	/*********************************************************
-	 * accept connections and create new processes
+	 * start zygote
+	 *
+	 * Done once initialization shared by all connections is
+	 * complete and before main process memory grows.
 	 ********************************************************/
-	while (1) {
-		//
-		addrlen = sizeof(struct sockaddr_storage);
-		client_fd = accept(listen_fd, &sa_client, &addrlen);
-		if (client_fd == -1) {
-			ERROR("acccept() failed: %s!\n", strerror(errno));
-			continue;
+	if (use_zygote) {
+		zygote_fd = __zygote_start(listen_fd);
+		if (zygote_fd == -1) {
+			ERROR("__zygote_start() failed!\n");
+			goto finish;
 		}
+	}
 
-		switch (fork()) {
-		case -1:
-			ERROR("fork() failed: %s!\n", strerror(errno));
-			break;
-		case 0:
-			// child
-			close(listen_fd);	// do not need the listening socket
-			__connection_handler(client_fd, &sa_client, addrlen);
-			exit(1);
-		default:
-			// parent
-			close(client_fd);	// do not need the client socket
+	/*********************************************************
+	 * grow main process memory (caches)
+	 ********************************************************/
+	if (cache_size) {
+		cache = malloc(cache_size);
+		if (!cache) {
+			ERROR("malloc() failed!\n");
+			goto finish;
+		}
+		memset(cache, 1, cache_size);
+		DEBUG("Main process cache: %zu MB\n", cache_size >> 20);
+	}
+
+	/*********************************************************
+	 * create epoll instance (signals and listening socket)
+	 ********************************************************/
+	epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (epoll_fd == -1) {
+		ERROR("epoll_create1() failed: %s!\n", strerror(errno));
+		goto finish;
+	}
+
+	if (sig_event_epoll_add(&_srv.se, epoll_fd) ||
+		__epoll_add(epoll_fd, listen_fd))
+		goto finish;
+
+	/*********************************************************
+	 * accept connections and create new processes
+	 *
+	 * On shutdown the listening socket (and zygote socket) is
+	 * closed and the loop ends when all children exited.
+	 ********************************************************/
+	while (_srv.running || _srv.children) {
+		nr = epoll_wait(epoll_fd, events, EVENTS_MAX, -1);
+		if (nr == -1) {
+			ERROR("epoll_wait() failed: %s!\n", strerror(errno));
 			break;
 		}
+
+		for (int i = 0; i < nr; i++) {
+			// signals
+			if (events[i].data.fd == _srv.se.fd) {
+				sig_event_dispatch(&_srv.se);
+				if (!_srv.running && listen_fd != -1) {
+					close(listen_fd);
+					listen_fd = -1;
+					if (zygote_fd != -1)
+						close(zygote_fd);
+					zygote_fd = -1;
+				}
+				continue;
+			}
+
+			// new connection (listening socket may be closed already)
+			if (events[i].data.fd != listen_fd)
+				continue;
+
+			memset(&req, 0, sizeof(req));
+			req.addrlen = sizeof(req.addr);
+			client_fd = accept(listen_fd, (struct sockaddr *)&req.addr,
+							&req.addrlen);
+			if (client_fd == -1) {
+				ERROR("acccept() failed: %s!\n", strerror(errno));
+				continue;
+			}
+			stats_conn_open(_srv.stats);
+
+			// zygote creates the process
+			if (zygote_fd != -1) {
+				TRACE_BEGIN("send_fd");
+				if (send_fd(zygote_fd, client_fd, &req, sizeof(req))) {
+					ERROR("send_fd() failed!\n");
+					stats_conn_close(_srv.stats);
+				}
+				TRACE_END("send_fd");
+				close(client_fd);
+				continue;
+			}
+
+			__connection_fork(client_fd, listen_fd,
+							(struct sockaddr *)&req.addr, req.addrlen);
+		}
 	}
 
+	stats_dump(_srv.stats, "proc_con_tcp_server");
+
 finish:
 	return 0;
 }
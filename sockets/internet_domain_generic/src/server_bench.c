@@ -0,0 +1,526 @@
+/**
+ * Server models comparison benchmark.
+ *
+ * Each tcp server model is started on its own port and measured for each
+ * client concurrency and message size of the sweep:
+ * 	- connections/s: conn_bench (connect, one echo, close, one at a time)
+ * 	- requests/s and p99 latency: loadgen in closed loop mode (-q), with
+ * 	concurrency connections sending messages of a given size
+ * 	- RSS: peak resident memory of the server and all its processes
+ * 	(connection processes, workers), sampled from /proc every RSS_SAMPLE_MS
+ * 	until loadgen exits (its connect phase has no fixed length)
+ * 	- context switches: voluntary and involuntary, from the rusage of the
+ * 	server (wait4(), includes the processes it reaped)
+ *
+ * The server is restarted for each point and again between conn_bench and
+ * loadgen, so memory and context switches belong to the load of that point
+ * only. loadgen establishes all connections before its clock starts, so the
+ * window measures the server model and not SYN retransmissions. Connections
+ * a model does not serve (full thread pool, busy connection process) show up
+ * as starved: connected, but no request completed during the load.
+ *
+ * All results are printed as one report table (and written as CSV with -o).
+ *
+ * Usage:
+ * 	./run/server_bench [-c concurrency,...] [-s size,...] [-d seconds]
+ * 			[-t threads] [-n connections] [-o file.csv]
+ * 	./run/server_bench -c 1,16,256 -s 64,4096 -d 2 -o server_bench.csv
+ *
+ * Copyright (C) 2024 Lazar Razvan.
+ */
+
+#define _GNU_SOURCE
+
+#include <time.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <libgen.h>
+#include <signal.h>
+#include <dirent.h>
+#include <errno.h>
+
+#include <netdb.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+
+#include "debug.h"
+
+
+/*============================================================================*/
+
+// First port, each model listens on BASE_PORT + model index
+#define BASE_PORT					50100
+
+// Default load duration for each point (seconds)
+#define DURATION					2
+
+// Default load generator threads
+#define THREADS						2
+
+// Default connections opened by conn_bench
+#define CONN_BENCH_CONNECTIONS		500
+
+// Server RSS sampling period while loadgen runs (ms)
+#define RSS_SAMPLE_MS				100
+
+// Server startup and shutdown timeouts (ms)
+#define START_TIMEOUT_MS			2000
+#define STOP_TIMEOUT_MS				3000
+
+// Max values of a list argument and max processes of a server
+#define LIST_MAX					16
+#define PROCS_MAX					4096
+
+/**
+ * Server models.
+ */
+typedef struct model_s {
+
+	const char	*name;
+	const char	*bin;					// executable in run directory
+
+} model_t;
+
+static const model_t models[] = {
+
+	{ "iterative",		"it_tcp_server" },
+	{ "process",		"proc_con_tcp_server" },
+	{ "thread",			"thread_con_tcp_server" },
+	{ "thread_pool",	"thread_pool_con_tcp_server" },
+	{ "load_balancer",	"lb_tcp_server" },
+};
+
+/**
+ * Results of a point.
+ */
+typedef struct result_s {
+
+	double		conn_per_s;
+	unsigned	connected;
+	unsigned	failed;
+	uint64_t	requests;
+	double		req_per_s;
+	uint64_t	starved;
+	double		p50_us;
+	double		p99_us;
+	double		max_us;
+	long		rss_kb;
+	long		ctx_switches;
+
+} result_t;
+
+// Directory with the executables (of server_bench)
+static char *run_dir;
+
+
+/*============================================================================*/
+
+/**
+ * Parse a comma separated list of numbers.
+ *
+ * Return number of values.
+ */
+static int
+__list(char *arg, int *values)
+{
+	char *tok, *save;
+	int nr = 0;
+
+	for (tok = strtok_r(arg, ",", &save); tok && nr < LIST_MAX;
+		tok = strtok_r(NULL, ",", &save))
+		values[nr++] = atoi(tok);
+
+	return nr;
+}
+
+/**
+ * Wait until a server accepts connections on port.
+ *
+ * Return 0 on success and -1 on timeout.
+ */
+static int
+__wait_ready(int port)
+{
+	struct sockaddr_in sa;
+	int sock_fd, rv;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sin_family = AF_INET;
+	sa.sin_port = htons(port);
+	sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	for (int ms = 0; ms < START_TIMEOUT_MS; ms += 10) {
+		sock_fd = socket(AF_INET, SOCK_STREAM, 0);
+		if (sock_fd == -1)
+			return -1;
+
+		rv = connect(sock_fd, (struct sockaddr *)&sa, sizeof(sa));
+		close(sock_fd);
+		if (!rv)
+			return 0;
+
+		usleep(10000);
+	}
+
+	return -1;
+}
+
+/**
+ * Start a server (LOG_LEVEL is inherited, output discarded).
+ *
+ * Return server pid on success and -1 on error.
+ */
+static pid_t
+__server_start(const model_t *m, int port)
+{
+	char path[PATH_MAX], port_str[16];
+	pid_t pid;
+
+	snprintf(path, sizeof(path), "%s/%s", run_dir, m->bin);
+	snprintf(port_str, sizeof(port_str), "%d", port);
+
+	//
+	fflush(stdout);
+	pid = fork();
+	switch (pid) {
+	case -1:
+		ERROR("fork() failed: %s!\n", strerror(errno));
+		return -1;
+	case 0:
+		if (!freopen("/dev/null", "w", stdout) ||
+			!freopen("/dev/null", "w", stderr))
+			exit(-1);
+		execl(path, m->bin, "-p", port_str, (char *)NULL);
+		exit(-1);
+	default:
+		break;
+	}
+
+	//
+	if (__wait_ready(port)) {
+		ERROR("%s not ready on port %d!\n", m->bin, port);
+		kill(pid, SIGKILL);
+		waitpid(pid, NULL, 0);
+		return -1;
+	}
+
+	return pid;
+}
+
+/**
+ * Stop a server (SIGTERM, SIGKILL after STOP_TIMEOUT_MS).
+ *
+ * Return context switches of the server and the processes it reaped.
+ */
+static long
+__server_stop(pid_t pid)
+{
+	struct rusage ru;
+	pid_t rv;
+
+	kill(pid, SIGTERM);
+	for (int ms = 0; ms < STOP_TIMEOUT_MS; ms += 10) {
+		rv = wait4(pid, NULL, WNOHANG, &ru);
+		if (rv == pid)
+			return ru.ru_nvcsw + ru.ru_nivcsw;
+		usleep(10000);
+	}
+
+	//
+	kill(pid, SIGKILL);
+	if (wait4(pid, NULL, 0, &ru) != pid)
+		return 0;
+
+	return ru.ru_nvcsw + ru.ru_nivcsw;
+}
+
+/**
+ * Resident memory (kB) of a process and all its descendants.
+ */
+static long
+__rss_tree(pid_t root)
+{
+	static pid_t pids[PROCS_MAX], ppids[PROCS_MAX];
+	char path[64], line[256];
+	int nr = 0, in[PROCS_MAX];
+	struct dirent *de;
+	long rss = 0, kb;
+	int added;
+	DIR *dir;
+	FILE *f;
+
+	/*********************************************************
+	 * all processes and their parents
+	 ********************************************************/
+	dir = opendir("/proc");
+	if (!dir)
+		return 0;
+
+	while ((de = readdir(dir)) && nr < PROCS_MAX) {
+		pid_t pid = atoi(de->d_name);
+
+		if (pid <= 0)
+			continue;
+
+		snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+		f = fopen(path, "r");
+		if (!f)
+			continue;
+
+		// pid (comm) state ppid, comm may contain spaces
+		if (fgets(line, sizeof(line), f) && strrchr(line, ')')) {
+			pids[nr] = pid;
+			ppids[nr] = atoi(strrchr(line, ')') + 4);
+			in[nr] = pid == root;
+			nr++;
+		}
+		fclose(f);
+	}
+	closedir(dir);
+
+	/*********************************************************
+	 * descendants of root
+	 ********************************************************/
+	do {
+		added = 0;
+		for (int i = 0; i < nr; i++) {
+			if (in[i])
+				continue;
+			for (int j = 0; j < nr; j++) {
+				if (in[j] && ppids[i] == pids[j]) {
+					in[i] = added = 1;
+					break;
+				}
+			}
+		}
+	} while (added);
+
+	//
+	for (int i = 0; i < nr; i++) {
+		if (!in[i])
+			continue;
+
+		snprintf(path, sizeof(path), "/proc/%d/status", pids[i]);
+		f = fopen(path, "r");
+		if (!f)
+			continue;
+
+		while (fgets(line, sizeof(line), f))
+			if (sscanf(line, "VmRSS: %ld kB", &kb) == 1)
+				rss += kb;
+		fclose(f);
+	}
+
+	return rss;
+}
+
+/**
+ * Run a command and read the first line of its output.
+ *
+ * Return 0 on success and -1 on error. If pid is set, RSS of the server tree
+ * is sampled every RSS_SAMPLE_MS until the command writes its output (at exit)
+ * and the peak is kept.
+ */
+static int
+__run(const char *cmd, char *line, size_t len, pid_t pid, long *rss)
+{
+	struct pollfd pfd;
+	long kb;
+	FILE *f;
+	int rv;
+
+	f = popen(cmd, "r");
+	if (!f) {
+		ERROR("popen() failed: %s!\n", strerror(errno));
+		return -1;
+	}
+
+	if (pid) {
+		*rss = 0;
+		pfd.fd = fileno(f);
+		pfd.events = POLLIN;
+		do {
+			kb = __rss_tree(pid);
+			if (kb > *rss)
+				*rss = kb;
+			rv = poll(&pfd, 1, RSS_SAMPLE_MS);
+		} while (!rv || (rv == -1 && errno == EINTR));
+	}
+
+	rv = fgets(line, len, f) ? 0 : -1;
+	while (fgetc(f) != EOF)
+		;
+	pclose(f);
+
+	return rv;
+}
+
+/**
+ * Measure a model for a concurrency and message size.
+ *
+ * Return 0 on success and -1 on error.
+ */
+static int
+__point(const model_t *m, int port, int conc, int size, int duration,
+		int threads, int conns, result_t *r)
+{
+	char cmd[PATH_MAX + 128], line[256];
+	pid_t pid;
+
+	memset(r, 0, sizeof(*r));
+
+	/*********************************************************
+	 * connections per second
+	 ********************************************************/
+	pid = __server_start(m, port);
+	if (pid == -1)
+		return -1;
+
+	snprintf(cmd, sizeof(cmd), "%s/conn_bench -n %d localhost %d", run_dir,
+			conns, port);
+	if (!__run(cmd, line, sizeof(line), 0, NULL))
+		sscanf(line, "%*d connections to %*s %*d failed, %lf",
+				&r->conn_per_s);
+
+	// fresh server, context switches of the load only
+	__server_stop(pid);
+	pid = __server_start(m, port);
+	if (pid == -1)
+		return -1;
+
+	/*********************************************************
+	 * requests per second and latency (closed loop), peak
+	 * memory while loadgen runs
+	 ********************************************************/
+	snprintf(cmd, sizeof(cmd), "%s/loadgen -q -t %d -c %d -d %d -s %d "
+			"localhost %d", run_dir, conc < threads ? conc : threads, conc,
+			duration, size, port);
+	if (!__run(cmd, line, sizeof(line), pid, &r->rss_kb))
+		sscanf(line, "%u,%u,%lu,%lf,%lu,%lf,%lf,%lf", &r->connected,
+				&r->failed, &r->requests, &r->req_per_s, &r->starved,
+				&r->p50_us, &r->p99_us, &r->max_us);
+
+	//
+	r->ctx_switches = __server_stop(pid);
+
+	return 0;
+}
+
+
+/*============================================================================*/
+
+int main(int argc, char *argv[])
+{
+	int def_concs[] = { 1, 16, 256 }, def_sizes[] = { 64, 4096 };
+	int concs[LIST_MAX], sizes[LIST_MAX], nr_concs = 0, nr_sizes = 0;
+	int duration = DURATION, threads = THREADS;
+	int conns = CONN_BENCH_CONNECTIONS, opt;
+	const char *file = NULL;
+	FILE *csv = NULL;
+	result_t r;
+
+	/*********************************************************
+	 * parse arguments
+	 ********************************************************/
+	while ((opt = getopt(argc, argv, "c:s:d:t:n:o:")) != -1) {
+		switch (opt) {
+		case 'c':
+			nr_concs = __list(optarg, concs);
+			break;
+		case 's':
+			nr_sizes = __list(optarg, sizes);
+			break;
+		case 'd':
+			duration = atoi(optarg);
+			break;
+		case 't':
+			threads = atoi(optarg);
+			break;
+		case 'n':
+			conns = atoi(optarg);
+			break;
+		case 'o':
+			file = optarg;
+			break;
+		default:
+			printf("Usage: %s [-c concurrency,...] [-s size,...] "
+					"[-d seconds] [-t threads] [-n connections] "
+					"[-o file.csv]\n", argv[0]);
+			return -1;
+		}
+	}
+
+	if (!nr_concs) {
+		nr_concs = sizeof(def_concs) / sizeof(def_concs[0]);
+		memcpy(concs, def_concs, sizeof(def_concs));
+	}
+	if (!nr_sizes) {
+		nr_sizes = sizeof(def_sizes) / sizeof(def_sizes[0]);
+		memcpy(sizes, def_sizes, sizeof(def_sizes));
+	}
+	if (duration < 1)
+		duration = 1;
+	if (threads < 1)
+		threads = 1;
+
+	//
+	if (file) {
+		csv = fopen(file, "w");
+		if (!csv) {
+			ERROR("File %s open failed: %s!\n", file, strerror(errno));
+			return -1;
+		}
+		fprintf(csv, "model,concurrency,size,conn_per_s,connected,failed,"
+				"requests,req_per_s,starved,p50_us,p99_us,max_us,rss_kb,"
+				"ctx_switches\n");
+	}
+
+	// executables next to server_bench, servers and tools log errors only
+	run_dir = dirname(strdup(argv[0]));
+	setenv("LOG_LEVEL", "error", 0);
+	signal(SIGPIPE, SIG_IGN);
+
+	/*********************************************************
+	 * sweep all models, one report
+	 ********************************************************/
+	printf("%-14s %6s %6s %10s %10s %10s %10s %10s %10s %12s\n", "model",
+			"conc", "size", "conn/s", "connected", "req/s", "starved",
+			"p99_us", "rss_kb", "ctx_switch");
+
+	for (int m = 0; m < sizeof(models) / sizeof(models[0]); m++) {
+		for (int c = 0; c < nr_concs; c++) {
+			for (int s = 0; s < nr_sizes; s++) {
+				if (__point(&models[m], BASE_PORT + m, concs[c], sizes[s],
+							duration, threads, conns, &r)) {
+					printf("%-14s %6d %6d failed to start\n", models[m].name,
+							concs[c], sizes[s]);
+					continue;
+				}
+
+				printf("%-14s %6d %6d %10.0f %10u %10.0f %10lu %10.1f %10ld "
+						"%12ld\n", models[m].name, concs[c], sizes[s],
+						r.conn_per_s, r.connected, r.req_per_s, r.starved,
+						r.p99_us, r.rss_kb, r.ctx_switches);
+				fflush(stdout);
+
+				if (csv)
+					fprintf(csv, "%s,%d,%d,%.0f,%u,%u,%lu,%.0f,%lu,%.3f,"
+							"%.3f,%.3f,%ld,%ld\n", models[m].name, concs[c],
+							sizes[s], r.conn_per_s, r.connected, r.failed,
+							r.requests, r.req_per_s, r.starved, r.p50_us,
+							r.p99_us, r.max_us, r.rss_kb, r.ctx_switches);
+			}
+		}
+	}
+
+	if (csv)
+		fclose(csv);
+
+	return 0;
+}
@@ -0,0 +1,201 @@
+/**
+ * Signal events (signalfd).
+ * Copyright (C) 2024 Lazar Razvan.
+ *
+ * Signals are blocked and delivered through a signalfd descriptor instead of
+ * asynchronous handlers, so they are handled synchronously by an event loop
+ * (epoll) together with the other descriptors:
+ * 	- there is no polling delay (signalfd becomes readable right away)
+ * 	- handlers are not restricted to async-signal-safe functions and do not
+ * 	need volatile sig_atomic_t flags
+ * 	- system calls are never interrupted (EINTR)
+ *
+ * Signals must be blocked in all threads, otherwise the kernel delivers them
+ * to a thread that does not block them (default action). Signal mask is
+ * inherited by threads, so sig_event_init() and sig_event_register() must be
+ * called before any thread is created.
+ *
+ * Signal mask and signalfd are also inherited by a forked child. A child that
+ * does not run an event loop must call sig_event_unblock(), so that signals
+ * get their default action again.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include <pthread.h>
+#include <sys/epoll.h>
+
+#include "debug.h"
+#include "sig_event.h"
+
+/*==================================PUBLIC====================================*/
+
+/**
+ * Init signal events.
+ *
+ * @se	: Signal events.
+ *
+ * Return 0 on success and <0 otherwise.
+ */
+int sig_event_init(sig_event_t *se)
+{
+	memset(se, 0, sizeof(sig_event_t));
+	sigemptyset(&se->mask);
+
+	if (pthread_sigmask(SIG_BLOCK, NULL, &se->old_mask)) {
+		ERROR("pthread_sigmask error!\n");
+		return -1;
+	}
+
+	se->fd = signalfd(-1, &se->mask, SFD_NONBLOCK | SFD_CLOEXEC);
+	if (se->fd == -1) {
+		ERROR("signalfd error: %s!\n", strerror(errno));
+		return -2;
+	}
+
+	return 0;
+}
+
+/**
+ * Register a signal handler.
+ *
+ * Signal is blocked for the calling thread and added to signalfd mask.
+ *
+ * @se		: Signal events.
+ * @signo	: Signal number (SIGKILL and SIGSTOP cannot be blocked).
+ * @handler	: Handler called from sig_event_dispatch().
+ * @arg		: Handler argument.
+ *
+ * Return 0 on success and <0 otherwise.
+ *
+ * Errors:
+ * 	-1: invalid signal
+ * 	-2: fail to block signal
+ * 	-3: fail to update signalfd
+ */
+int sig_event_register(sig_event_t *se, int signo, sig_event_handler_t handler,
+					void *arg)
+{
+	sigset_t set;
+
+	if (signo <= 0 || signo >= SIG_EVENT_NSIG || signo == SIGKILL ||
+		signo == SIGSTOP) {
+		ERROR("Invalid signal %d!\n", signo);
+		return -1;
+	}
+
+	sigemptyset(&set);
+	sigaddset(&set, signo);
+	if (pthread_sigmask(SIG_BLOCK, &set, NULL)) {
+		ERROR("pthread_sigmask error!\n");
+		return -2;
+	}
+
+	sigaddset(&se->mask, signo);
+	if (signalfd(se->fd, &se->mask, 0) == -1) {
+		ERROR("signalfd error: %s!\n", strerror(errno));
+		return -3;
+	}
+
+	se->handlers[signo] = handler;
+	se->args[signo] = arg;
+
+	return 0;
+}
+
+/**
+ * Add signalfd to an epoll instance (level triggered, EPOLLIN).
+ *
+ * @se			: Signal events.
+ * @epoll_fd	: Epoll instance.
+ *
+ * Return 0 on success and <0 otherwise.
+ */
+int sig_event_epoll_add(sig_event_t *se, int epoll_fd)
+{
+	struct epoll_event ev;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.fd = se->fd;
+
+	if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, se->fd, &ev) == -1) {
+		ERROR("epoll_ctl error: %s!\n", strerror(errno));
+		return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * Read pending signals and call their handlers.
+ *
+ * Standard signals are not queued (several deliveries of the same pending
+ * signal are read once), while real-time signals are read once for each
+ * sigqueue().
+ *
+ * @se	: Signal events.
+ *
+ * Return number of handled signals on success and <0 otherwise.
+ */
+int sig_event_dispatch(sig_event_t *se)
+{
+	struct signalfd_siginfo info[SIG_EVENT_BATCH];
+	int handled = 0, nr, signo;
+	ssize_t rv;
+
+	while (1) {
+		rv = read(se->fd, info, sizeof(info));
+		if (rv == -1) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN)
+				break;
+			ERROR("read error: %s!\n", strerror(errno));
+			return -1;
+		}
+
+		nr = rv / sizeof(struct signalfd_siginfo);
+		for (int i = 0; i < nr; i++) {
+			signo = info[i].ssi_signo;
+			if (signo < SIG_EVENT_NSIG && se->handlers[signo])
+				se->handlers[signo](&info[i], se->args[signo]);
+		}
+
+		handled += nr;
+		if (nr < SIG_EVENT_BATCH)
+			break;
+	}
+
+	return handled;
+}
+
+/**
+ * Restore signal mask before sig_event_init() (signalfd is kept open).
+ *
+ * Pending signals are delivered with their disposition once unblocked.
+ *
+ * @se	: Signal events.
+ */
+void sig_event_unblock(sig_event_t *se)
+{
+	if (pthread_sigmask(SIG_SETMASK, &se->old_mask, NULL))
+		ERROR("pthread_sigmask error!\n");
+}
+
+/**
+ * Close signalfd and restore signal mask.
+ *
+ * @se	: Signal events.
+ */
+void sig_event_destroy(sig_event_t *se)
+{
+	if (se->fd != -1)
+		close(se->fd);
+	se->fd = -1;
+
+	sig_event_unblock(se);
+}
@@ -0,0 +1,224 @@
+/**
+ * Server statistics and control signals.
+ *
+ * Servers run an event loop over a signalfd (sig_event), so control signals
+ * are handled synchronously by the loop:
+ * 	- SIGTERM, SIGINT: graceful shutdown (stop accepting connections and wait
+ * 	for active connections to finish)
+ * 	- SIGHUP: reload (statistics are reset)
+ * 	- SIGUSR1: statistics dump
+ *
+ * Copyright (C) 2024 Lazar Razvan.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include <sys/mman.h>
+
+#include "debug.h"
+#include "stats.h"
+
+
+/*============================================================================*/
+
+/**
+ * Signal handlers (called from sig_event_dispatch()).
+ */
+static void
+__on_shutdown(struct signalfd_siginfo *info, void *arg)
+{
+	DEBUG("[%d] %s from pid %u, shutting down...\n", getpid(),
+			strsignal(info->ssi_signo), info->ssi_pid);
+	*(int *)arg = 0;
+}
+
+static void
+__on_reload(struct signalfd_siginfo *info, void *arg)
+{
+	DEBUG("[%d] Reload, statistics reset!\n", getpid());
+	stats_reset((server_stats_t *)arg);
+	__atomic_fetch_add(&((server_stats_t *)arg)->reloads, 1, __ATOMIC_RELAXED);
+}
+
+static void
+__on_dump(struct signalfd_siginfo *info, void *arg)
+{
+	stats_dump((server_stats_t *)arg, NULL);
+}
+
+
+/*============================================================================*/
+
+/**
+ * Create server statistics.
+ *
+ * @shared   : Counters are shared with forked child processes.
+ *
+ * Return statistics on success and NULL on error.
+ */
+server_stats_t *
+stats_create(int shared)
+{
+	server_stats_t *stats;
+
+	/*********************************************************
+	 * shared anonymous mapping is inherited by fork() and is
+	 * not copied on write, so children update the same
+	 * counters as the parent
+	 ********************************************************/
+	if (shared) {
+		stats = mmap(NULL, sizeof(server_stats_t), PROT_READ | PROT_WRITE,
+					MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+		if (stats == MAP_FAILED) {
+			ERROR("mmap() failed: %s!\n", strerror(errno));
+			return NULL;
+		}
+	} else {
+		stats = calloc(1, sizeof(server_stats_t));
+		if (!stats) {
+			ERROR("calloc() failed!\n");
+			return NULL;
+		}
+	}
+
+	//
+	memset(stats, 0, sizeof(server_stats_t));
+
+	return stats;
+}
+
+/**
+ * Destroy server statistics.
+ *
+ * @stats    : Server statistics.
+ * @shared   : Same value used for stats_create().
+ */
+void
+stats_destroy(server_stats_t *stats, int shared)
+{
+	if (shared)
+		munmap(stats, sizeof(server_stats_t));
+	else
+		free(stats);
+}
+
+/**
+ * Record an accepted connection.
+ *
+ * @stats    : Server statistics.
+ */
+void
+stats_conn_open(server_stats_t *stats)
+{
+	__atomic_fetch_add(&stats->accepted, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&stats->active, 1, __ATOMIC_SEQ_CST);
+}
+
+/**
+ * Record a closed connection.
+ *
+ * @stats    : Server statistics.
+ *
+ * Return number of connections still in progress.
+ */
+uint64_t
+stats_conn_close(server_stats_t *stats)
+{
+	__atomic_fetch_add(&stats->closed, 1, __ATOMIC_RELAXED);
+
+	return __atomic_sub_fetch(&stats->active, 1, __ATOMIC_SEQ_CST);
+}
+
+/**
+ * Record a connection timed out (idle, read or write deadline).
+ *
+ * @stats    : Server statistics.
+ */
+void
+stats_conn_timeout(server_stats_t *stats)
+{
+	__atomic_fetch_add(&stats->timeouts, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * Record received and sent bytes.
+ *
+ * @stats    : Server statistics.
+ * @in       : Bytes received.
+ * @out      : Bytes sent.
+ */
+void
+stats_bytes(server_stats_t *stats, uint64_t in, uint64_t out)
+{
+	if (in)
+		__atomic_fetch_add(&stats->bytes_in, in, __ATOMIC_RELAXED);
+
+	if (out)
+		__atomic_fetch_add(&stats->bytes_out, out, __ATOMIC_RELAXED);
+}
+
+/**
+ * Reset counters.
+ *
+ * Active connections are kept, since they are still closed later.
+ *
+ * @stats    : Server statistics.
+ */
+void
+stats_reset(server_stats_t *stats)
+{
+	__atomic_store_n(&stats->accepted, 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&stats->closed, 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&stats->timeouts, 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&stats->bytes_in, 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&stats->bytes_out, 0, __ATOMIC_RELAXED);
+}
+
+/**
+ * Print counters to standard output.
+ *
+ * @stats    : Server statistics.
+ * @name     : Server name (may be NULL).
+ */
+void
+stats_dump(server_stats_t *stats, const char *name)
+{
+	printf("[%d] %s%saccepted=%lu active=%lu closed=%lu timeouts=%lu "
+			"bytes_in=%lu bytes_out=%lu reloads=%lu\n", getpid(), name ? name : "",
+			name ? ": " : "",
+			__atomic_load_n(&stats->accepted, __ATOMIC_RELAXED),
+			__atomic_load_n(&stats->active, __ATOMIC_RELAXED),
+			__atomic_load_n(&stats->closed, __ATOMIC_RELAXED),
+			__atomic_load_n(&stats->timeouts, __ATOMIC_RELAXED),
+			__atomic_load_n(&stats->bytes_in, __ATOMIC_RELAXED),
+			__atomic_load_n(&stats->bytes_out, __ATOMIC_RELAXED),
+			__atomic_load_n(&stats->reloads, __ATOMIC_RELAXED));
+	fflush(stdout);
+}
+
+/**
+ * Register server control signals.
+ *
+ * @se       : Signal events (initialized).
+ * @stats    : Server statistics.
+ * @running  : Flag cleared on shutdown.
+ *
+ * Return 0 on success and -1 on error.
+ */
+int
+stats_signals_register(sig_event_t *se, server_stats_t *stats, int *running)
+{
+	if (sig_event_register(se, SIGTERM, __on_shutdown, running) ||
+		sig_event_register(se, SIGINT, __on_shutdown, running) ||
+		sig_event_register(se, SIGHUP, __on_reload, stats) ||
+		sig_event_register(se, SIGUSR1, __on_dump, stats)) {
+		ERROR("sig_event_register() failed!\n");
+		return -1;
+	}
+
+	return 0;
+}
@@ -1,12 +1,26 @@
 /**
  * TCP client implementation using generic function in utils.
  *
+ * Data is sent as length-prefixed frames (frame.h) and each reply is a frame,
+ * so message boundaries are kept over the stream socket:
+ * 	- interactive (default): each read from stdin is sent as a frame and the
+ * 	reply is waited for.
+ * 	- pipelined (-n requests): requests of -s bytes are sent with up to -p
+ * 	requests outstanding on the connection (one writev() for each window),
+ * 	replies are parsed as they arrive and requests per second is reported.
+ *
+ * Usage:
+ * 	./run/tcp_client [-n requests] [-s size] [-p depth]
+ * 	./run/tcp_client -n 100000 -s 64 -p 32
+ *
  * Copyright (C) 2024 Lazar Razvan.
  */
 
+#include <time.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <unistd.h>
 #include <errno.h>
 
@@ -18,67 +32,221 @@
 #include "debug.h"
 #include "utils.h"
 #include "common.h"
+#include "frame.h"
 
 
 /*============================================================================*/
 
-int main(int argc, char *argv[])
+// Default request payload size (pipelined)
+#define REQUEST_SIZE					64
+
+// Default requests outstanding (pipelined)
+#define PIPELINE_DEPTH					16
+
+
+/*============================================================================*/
+
+static inline uint64_t
+__time_ns(void)
 {
-	int sock_fd;
-	char _buf[BUFFER_SIZE];
-	ssize_t read_bytes, recv_bytes, send_bytes;
+	struct timespec ts;
 
-	/*********************************************************
-	 * connect to server listening socket
-	 *
-	 * Use localhost since running locally.
-	 ********************************************************/
-	sock_fd = generic_connect("localhost", SERVER_PORT, SOCK_STREAM, AF_INET);
-	if (sock_fd == -1) {
-		ERROR("generic_connect() failed!\n");
-		goto finish;
-	}
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * Send data from stdin (one frame for each read) and wait for each reply.
+ *
+ * Return 0 on success and -1 on error.
+ */
+static int
+__interactive(int sock_fd, frame_parser_t *parser)
+{
+	char _buf[BUFFER_SIZE];
+	ssize_t read_bytes, recv_bytes;
+	frame_t frame;
+	int status;
 
-	/*********************************************************
-	 * read data from stdin and send to server
-	 ********************************************************/
 	while (1) {
 		// read
 		read_bytes = read(STDIN_FILENO, _buf, BUFFER_SIZE);
 		if (read_bytes == -1) {
 			ERROR("read() failed: %s!\n", strerror(errno));
-			goto sock_close;
+			return -1;
 		}
 
+		if (read_bytes == 0)
+			return 0;
+
 		// send
-		send_bytes = send(sock_fd, _buf, read_bytes, 0);
-		if (send_bytes == -1) {
+		if (frame_send(sock_fd, _buf, read_bytes)) {
 			ERROR("send() failed: %s!\n", strerror(errno));
-			goto sock_close;
+			return -1;
+		}
+
+		DEBUG("Send data [%.*s]\n", (int)read_bytes, _buf);
+
+		// reply may need several recv() calls
+		while ((status = frame_parser_next(parser, &frame)) == 0) {
+			recv_bytes = frame_parser_recv(parser, sock_fd);
+			if (recv_bytes == -1) {
+				ERROR("recv() failed: %s!\n", strerror(errno));
+				return -1;
+			}
+
+			//
+			if (recv_bytes == 0) {
+				DEBUG("Connection closed!\n");
+				return 0;
+			}
 		}
 
-		if (send_bytes != read_bytes) {
-			ERROR("Partial send to server...!\n");
+		if (status == -1)
+			return -1;
+
+		DEBUG("Recv data [%.*s]\n", (int)frame.len, frame.payload);
+	}
+}
+
+/**
+ * Send requests with up to depth outstanding, parsing replies as a batch.
+ *
+ * Return 0 on success and -1 on error.
+ */
+static int
+__pipelined(int sock_fd, frame_parser_t *parser, long requests, size_t size,
+			int depth)
+{
+	long sent = 0, replies = 0;
+	uint64_t start, elapsed;
+	frame_batch_t batch;
+	ssize_t recv_bytes;
+	frame_t frame;
+	int status;
+	char *payload;
+
+	//
+	payload = malloc(size);
+	if (!payload) {
+		ERROR("malloc() failed!\n");
+		return -1;
+	}
+	memset(payload, 'x', size);
+	frame_batch_init(&batch);
+
+	start = __time_ns();
+	while (replies < requests) {
+		/*********************************************************
+		 * refill the window of outstanding requests
+		 ********************************************************/
+		while (sent < requests && sent - replies < depth &&
+				!frame_batch_add(&batch, payload, size))
+			sent++;
+
+		if (frame_batch_flush(&batch, sock_fd, 0)) {
+			ERROR("send() failed: %s!\n", strerror(errno));
+			goto payload_free;
 		}
 
-		DEBUG("Send data [%.*s]\n", (int)send_bytes, _buf);
+		/*********************************************************
+		 * receive replies (all complete ones of a recv())
+		 ********************************************************/
+		recv_bytes = frame_parser_recv(parser, sock_fd);
+		if (recv_bytes <= 0) {
+			ERROR("recv() failed: %s!\n",
+					recv_bytes ? strerror(errno) : "connection closed");
+			goto payload_free;
+		}
 
-		//
-		recv_bytes = recv(sock_fd, _buf, BUFFER_SIZE, 0);
-		if (recv_bytes == -1) {
-			ERROR("recv() failed: %s!\n", strerror(errno));
-			goto sock_close;
+		while ((status = frame_parser_next(parser, &frame)) == 1) {
+			if (frame.len != size) {
+				ERROR("Invalid reply: %u bytes!\n", frame.len);
+				goto payload_free;
+			}
+			replies++;
 		}
 
-		//
-		if (recv_bytes == 0) {
-			DEBUG("Connection closed!\n");
-			goto sock_close;
+		if (status == -1)
+			goto payload_free;
+	}
+	elapsed = __time_ns() - start;
+
+	printf("%ld requests of %zu bytes, depth %d: %.3f s, %.0f requests/s\n",
+			replies, size, depth, elapsed / 1e9, replies * 1e9 / elapsed);
+
+	free(payload);
+	return 0;
+
+payload_free:
+	free(payload);
+	return -1;
+}
+
+
+/*============================================================================*/
+
+int main(int argc, char *argv[])
+{
+	int sock_fd, opt, depth = PIPELINE_DEPTH;
+	size_t size = REQUEST_SIZE;
+	frame_parser_t parser;
+	long requests = 0;
+
+	/*********************************************************
+	 * parse arguments
+	 ********************************************************/
+	while ((opt = getopt(argc, argv, "n:s:p:")) != -1) {
+		switch (opt) {
+		case 'n':
+			requests = atol(optarg);
+			break;
+		case 's':
+			size = strtoul(optarg, NULL, 10);
+			break;
+		case 'p':
+			depth = atoi(optarg);
+			break;
+		default:
+			printf("Usage: %s [-n requests] [-s size] [-p depth]\n", argv[0]);
+			goto finish;
 		}
 	}
 
-sock_close:
+	if (size > FRAME_PAYLOAD_MAX || depth < 1) {
+		ERROR("Invalid size (max %d) or depth!\n", FRAME_PAYLOAD_MAX);
+		goto finish;
+	}
+
+	if (frame_parser_init(&parser)) {
+		ERROR("frame_parser_init() failed!\n");
+		goto finish;
+	}
+
+	/*********************************************************
+	 * connect to server listening socket
+	 *
+	 * Use localhost since running locally.
+	 ********************************************************/
+	sock_fd = generic_connect("localhost", SERVER_PORT, SOCK_STREAM, AF_INET);
+	if (sock_fd == -1) {
+		ERROR("generic_connect() failed!\n");
+		goto parser_destroy;
+	}
+
+	/*********************************************************
+	 * send data to server (stdin or pipelined requests)
+	 ********************************************************/
+	if (requests > 0)
+		__pipelined(sock_fd, &parser, requests, size, depth);
+	else
+		__interactive(sock_fd, &parser);
+
+//sock_close:
 	close(sock_fd);
+parser_destroy:
+	frame_parser_destroy(&parser);
 finish:
 	return 0;
 }
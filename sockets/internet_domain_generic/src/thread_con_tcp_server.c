@@ -10,6 +10,21 @@
  * resources will be automatically released back to the system without the need
  * of a join.
  *
+ * Data is received into pool buffers (buf_pool.c), starting small and grown
+ * for bulk transfers, instead of a fixed stack buffer.
+ *
+ * Idle connections and clients that do not read their replies are closed by a
+ * watchdog (deadline.c), so they do not hold a thread forever.
+ *
+ * Signals are handled by the accept loop through signalfd (threads inherit the
+ * blocked signal mask):
+ * 	SIGTERM, SIGINT: stop accepting and exit after all connections are closed
+ * 	SIGHUP: reload (statistics reset)
+ * 	SIGUSR1: statistics dump
+ *
+ * Usage:
+ * 	./run/thread_con_tcp_server [-p port]
+ *
  * Copyright (C) 2024 Lazar Razvan.
  */
 
@@ -23,11 +38,24 @@
 #include <sys/un.h>
 #include <pthread.h>
 #include <arpa/inet.h>
+#include <sys/epoll.h>
 #include <sys/socket.h>
+#include <sys/eventfd.h>
 
 #include "debug.h"
 #include "utils.h"
 #include "common.h"
+#include "trace.h"
+#include "stats.h"
+#include "deadline.h"
+#include "buf_pool.h"
+#include "sig_event.h"
+
+
+/*============================================================================*/
+
+// Events handled by each epoll_wait() call
+#define EVENTS_MAX					8
 
 
 /*============================================================================*/
@@ -40,9 +68,26 @@ typedef struct thread_data_s {
 	int					sfd;			// client socket descriptor
 	struct sockaddr 	sa_client;		// client socket address
 	socklen_t			len;			// client address length
+	deadline_t			deadline;		// idle and write deadlines
 
 } thread_data_t;
 
+/**
+ * Server state.
+ */
+typedef struct server_s {
+
+	sig_event_t			se;				// signal events
+	server_stats_t		*stats;			// statistics
+	deadline_config_t	deadlines;		// connection deadlines
+	int					running;		// cleared on shutdown
+	int					draining;		// waiting for connections to close
+	int					drain_fd;		// eventfd (last connection closed)
+
+} server_t;
+
+static server_t _srv;
+
 
 /*============================================================================*/
 
@@ -54,11 +99,12 @@ static void *
 __connection_handler(void *arg)
 {
 	pthread_t tid;
-	ssize_t recv_bytes;
+	ssize_t recv_bytes, send_bytes;
 	thread_data_t *data;
 	char host[NI_MAXHOST];
 	char serv[NI_MAXSERV];
-	char _buf[BUFFER_SIZE];
+	buf_sizer_t sizer;
+	buf_t *buf = NULL;
 
 	//
 	tid = pthread_self();
@@ -66,6 +112,9 @@ __connection_handler(void *arg)
 
 	//
 	pthread_detach(tid);
+	TRACE_SCOPE("connection");
+	deadline_init(&data->deadline, data->sfd);
+	buf_sizer_init(&sizer);
 
 	//
 	if (sock2name(&data->sa_client, data->len, host, serv)) {
@@ -75,7 +124,21 @@ __connection_handler(void *arg)
 
 	//
 	while (1) {
-		recv_bytes = recv(data->sfd, _buf, BUFFER_SIZE, 0);
+		// buffer of the size class observed for this connection
+		buf = buf_sizer_refresh(&sizer, buf);
+		if (!buf)
+			goto finish;
+
+		deadline_arm(&data->deadline, "idle", _srv.deadlines.idle_ms);
+
+		TRACE_BEGIN("recv");
+		recv_bytes = recv(data->sfd, buf->data, buf->size, 0);
+		TRACE_END("recv");
+		if (deadline_expired(&data->deadline)) {
+			DEBUG("[%lu][%s: %s] Connection timed out!\n", tid, host, serv);
+			goto finish;
+		}
+
 		if (recv_bytes == -1) {
 			ERROR("[%lu] recv() failed: %s!\n", tid, strerror(errno));
 			goto finish;
@@ -88,19 +151,36 @@ __connection_handler(void *arg)
 		}
 
 		//
-		DEBUG("[%lu][%s: %s] Recv: [%.*s]!\n", tid, host, serv, (int)recv_bytes,
-											_buf);
+		buf->len = recv_bytes;
+		DEBUG("[%lu][%s: %s] Recv: [%.*s]!\n", tid, host, serv, (int)buf->len,
+											buf->data);
 
 		//
-		if (send(data->sfd, _buf, recv_bytes, 0) != recv_bytes) {
-			ERROR("[%lu] send() failed: %s!\n", tid, strerror(errno));
+		TRACE_BEGIN("send");
+		send_bytes = deadline_send(&data->deadline, buf->data, buf->len,
+								_srv.deadlines.write_ms);
+		TRACE_END("send");
+		if (send_bytes != recv_bytes) {
+			if (!deadline_expired(&data->deadline))
+				ERROR("[%lu] send() failed: %s!\n", tid, strerror(errno));
 			goto finish;
 		}
+
+		stats_bytes(_srv.stats, recv_bytes, send_bytes);
+		buf_sizer_record(&sizer, recv_bytes);
 	}
 
 finish:
+	buf_unref(buf);
+	deadline_cancel(&data->deadline);
 	close(data->sfd);
 	free(data);
+
+	// wake up accept loop when last connection closes during shutdown
+	if (!stats_conn_close(_srv.stats) &&
+		__atomic_load_n(&_srv.draining, __ATOMIC_SEQ_CST))
+		eventfd_write(_srv.drain_fd, 1);
+
 	return NULL;
 }
 
@@ -110,45 +190,175 @@ finish:
 int main(int argc, char *argv[])
 {
 	pthread_t tid;
-	int listen_fd;
+	eventfd_t value;
 	thread_data_t *data;
+	struct epoll_event ev, events[EVENTS_MAX];
+	int listen_fd, epoll_fd, nr, fd, opt;
+	char *port = SERVER_PORT;
+
+	/*********************************************************
+	 * parse arguments
+	 ********************************************************/
+	while ((opt = getopt(argc, argv, "p:")) != -1) {
+		switch (opt) {
+		case 'p':
+			port = optarg;
+			break;
+		default:
+			printf("Usage: %s [-p port]\n", argv[0]);
+			goto finish;
+		}
+	}
+
+	/*********************************************************
+	 * block control signals and deliver them through signalfd
+	 * (before any thread is created)
+	 ********************************************************/
+	_srv.running = 1;
+	_srv.stats = stats_create(0);
+	if (!_srv.stats) {
+		ERROR("stats_create() failed!\n");
+		goto finish;
+	}
+
+	if (sig_event_init(&_srv.se) ||
+		stats_signals_register(&_srv.se, _srv.stats, &_srv.running)) {
+		ERROR("Fail to init signal events!\n");
+		goto finish;
+	}
+
+	_srv.drain_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (_srv.drain_fd == -1) {
+		ERROR("eventfd() failed: %s!\n", strerror(errno));
+		goto finish;
+	}
+
+	/*********************************************************
+	 * connection deadlines watchdog (IDLE_TIMEOUT_MS and
+	 * WRITE_TIMEOUT_MS override defaults)
+	 ********************************************************/
+	deadline_config_env(&_srv.deadlines);
+	if (deadline_start(_srv.stats)) {
+		ERROR("deadline_start() failed!\n");
+		goto finish;
+	}
+
+	/*********************************************************
+	 * start tracing (if TRACE_FILE is set)
+	 ********************************************************/
+	if (trace_start_env()) {
+		ERROR("trace_start_env() failed!\n");
+		goto finish;
+	}
 
 	/*********************************************************
 	 * create listening socket
 	 ********************************************************/
-	listen_fd = generic_listen(SERVER_PORT, 10, SOCK_STREAM, AF_INET);
+	listen_fd = generic_listen(port, LISTEN_BACKLOG, SOCK_STREAM, AF_INET);
 	if (listen_fd == -1) {
 		ERROR("generic_listen() failed!\n");
 		goto finish;
 	}
 
 	/*********************************************************
-	 * accept connections and create new processes
+	 * create epoll instance (signals, listening socket and
+	 * drain eventfd)
 	 ********************************************************/
-	while (1) {
-		//
-		data = malloc(sizeof(thread_data_t));
-		if (!data) {
-			ERROR("malloc() failed!\n");
-			continue;
-		}
+	epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (epoll_fd == -1) {
+		ERROR("epoll_create1() failed: %s!\n", strerror(errno));
+		goto finish;
+	}
 
-		//
-		data->len = sizeof(struct sockaddr_storage);
-		data->sfd = accept(listen_fd, &data->sa_client, &data->len);
-		if (data->sfd == -1) {
-			ERROR("acccept() failed: %s!\n", strerror(errno));
-			continue;
+	if (sig_event_epoll_add(&_srv.se, epoll_fd))
+		goto finish;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.fd = listen_fd;
+	if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &ev)) {
+		ERROR("epoll_ctl() failed: %s!\n", strerror(errno));
+		goto finish;
+	}
+
+	ev.data.fd = _srv.drain_fd;
+	if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, _srv.drain_fd, &ev)) {
+		ERROR("epoll_ctl() failed: %s!\n", strerror(errno));
+		goto finish;
+	}
+
+	/*********************************************************
+	 * accept connections and create new threads
+	 *
+	 * On shutdown the listening socket is closed and the loop
+	 * ends when the last connection thread signals drain_fd.
+	 ********************************************************/
+	while (_srv.running ||
+		   __atomic_load_n(&_srv.stats->active, __ATOMIC_SEQ_CST)) {
+		nr = epoll_wait(epoll_fd, events, EVENTS_MAX, -1);
+		if (nr == -1) {
+			ERROR("epoll_wait() failed: %s!\n", strerror(errno));
+			break;
 		}
 
-		//
-		if (pthread_create(&tid, NULL, __connection_handler, data) != 0) {
-			ERROR("pthread_create() failed: %s!\n", strerror(errno));
-			free(data);
-			continue;
+		for (int i = 0; i < nr; i++) {
+			fd = events[i].data.fd;
+
+			// signals
+			if (fd == _srv.se.fd) {
+				sig_event_dispatch(&_srv.se);
+				if (!_srv.running && listen_fd != -1) {
+					close(listen_fd);
+					listen_fd = -1;
+					__atomic_store_n(&_srv.draining, 1, __ATOMIC_SEQ_CST);
+				}
+				continue;
+			}
+
+			// last connection closed (loop condition is checked again)
+			if (fd == _srv.drain_fd) {
+				eventfd_read(_srv.drain_fd, &value);
+				continue;
+			}
+
+			// new connection (listening socket may be closed already)
+			if (fd != listen_fd)
+				continue;
+
+			//
+			data = malloc(sizeof(thread_data_t));
+			if (!data) {
+				ERROR("malloc() failed!\n");
+				continue;
+			}
+
+			//
+			data->len = sizeof(data->sa_client);
+			data->sfd = accept(listen_fd, &data->sa_client, &data->len);
+			if (data->sfd == -1) {
+				ERROR("acccept() failed: %s!\n", strerror(errno));
+				free(data);
+				continue;
+			}
+			stats_conn_open(_srv.stats);
+
+			//
+			TRACE_BEGIN("pthread_create");
+			if (pthread_create(&tid, NULL, __connection_handler, data) != 0) {
+				TRACE_END("pthread_create");
+				ERROR("pthread_create() failed: %s!\n", strerror(errno));
+				close(data->sfd);
+				free(data);
+				stats_conn_close(_srv.stats);
+				continue;
+			}
+			TRACE_END("pthread_create");
 		}
 	}
 
+	deadline_stop();
+	stats_dump(_srv.stats, "thread_con_tcp_server");
+
 finish:
 	return 0;
 }
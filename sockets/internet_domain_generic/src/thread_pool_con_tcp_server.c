@@ -10,6 +10,24 @@
  * resources will be automatically released back to the system without the need
  * of a join.
  *
+ * Requests are length-prefixed frames (frame.h), so clients may pipeline many
+ * requests on a connection. All complete frames of a recv() are parsed as a
+ * batch and their replies (echo) are coalesced into a single writev().
+ *
+ * Connections are closed by a watchdog (deadline.c) when idle, when a partial
+ * frame is not completed or when replies are not read in time, so a stalled
+ * client does not hold a pool thread forever.
+ *
+ * Signals are handled by the accept loop through signalfd (pool threads inherit
+ * the blocked signal mask):
+ * 	SIGTERM, SIGINT: stop accepting, serve queued connections and exit once
+ * 	all pool threads are done
+ * 	SIGHUP: reload (statistics reset)
+ * 	SIGUSR1: statistics dump
+ *
+ * Usage:
+ * 	./run/thread_pool_con_tcp_server [-p port]
+ *
  * Copyright (C) 2024 Lazar Razvan.
  */
 
@@ -23,11 +41,17 @@
 #include <sys/un.h>
 #include <pthread.h>
 #include <arpa/inet.h>
+#include <sys/epoll.h>
 #include <sys/socket.h>
 
 #include "debug.h"
 #include "utils.h"
 #include "common.h"
+#include "frame.h"
+#include "trace.h"
+#include "stats.h"
+#include "deadline.h"
+#include "sig_event.h"
 
 /*============================================================================*/
 
@@ -36,6 +60,11 @@
  */
 #define MAX_CON_CONNECTIONS				4
 
+/**
+ * Events handled by each epoll_wait() call.
+ */
+#define EVENTS_MAX						8
+
 
 /*============================================================================*/
 
@@ -71,6 +100,7 @@ typedef struct thread_pool_data_s {
 	int					tail;						// pool tail
 	int					size;						// pool size
 	int					capacity;					// pool capacity
+	int					stop;						// no more connections
 
 } thread_pool_data_t;
 
@@ -87,6 +117,12 @@ static void *__connection_handler(void *arg);
 // thread pool global memory
 thread_pool_data_t _pool;
 
+// server statistics
+server_stats_t *_stats;
+
+// connection deadlines
+deadline_config_t _deadlines;
+
 static inline int
 __thread_pool_is_full(void)
 {
@@ -108,6 +144,7 @@ __thread_pool_init(void)
 	_pool.head = 0;
 	_pool.tail = 0;
 	_pool.capacity = MAX_CON_CONNECTIONS;
+	_pool.stop = 0;
 
 	//
 	if (pthread_mutex_init(&_pool.lock, NULL)) {
@@ -184,9 +221,15 @@ __thread_pool_dequeue(void)
 	//
 	pthread_mutex_lock(&_pool.lock);
 
-	while (__thread_pool_is_empty())
+	while (__thread_pool_is_empty() && !_pool.stop)
 		pthread_cond_wait(&_pool.cond_not_empty, &_pool.lock);
 
+	// stopped and all queued connections served
+	if (__thread_pool_is_empty()) {
+		pthread_mutex_unlock(&_pool.lock);
+		return NULL;
+	}
+
 	//
 	conn = &_pool.data[_pool.head];
 
@@ -203,23 +246,60 @@ __thread_pool_dequeue(void)
 	return conn;
 }
 
+static void
+__thread_pool_stop(void)
+{
+	//
+	pthread_mutex_lock(&_pool.lock);
+	_pool.stop = 1;
+	pthread_cond_broadcast(&_pool.cond_not_empty);
+	pthread_mutex_unlock(&_pool.lock);
+}
+
 static void
 __thread_pool_destroy(void)
 {
 
+	// threads exit once stopped and queued connections are served
+	for (int i = 0; i < MAX_CON_CONNECTIONS; i++)
+		pthread_join(_pool.tids[i], NULL);
+
 	//
 	pthread_mutex_destroy(&_pool.lock);
 	pthread_cond_destroy(&_pool.cond_not_full);
 	pthread_cond_destroy(&_pool.cond_not_empty);
-
-	//
-	for (int i = 0; i < MAX_CON_CONNECTIONS; i++)
-		pthread_join(_pool.tids[i], NULL);
 }
 
 
 /*============================================================================*/
 
+/**
+ * Send replies of a batch.
+ *
+ * Batch is sent without blocking first, the write deadline is armed only if
+ * the socket buffer is full (client does not read its replies) and disarmed
+ * once the rest of the batch is sent.
+ *
+ * Return 0 on success and -1 on error (or deadline expired).
+ */
+static int
+__batch_flush(frame_batch_t *batch, deadline_t *deadline)
+{
+	if (!frame_batch_flush(batch, deadline->fd, MSG_DONTWAIT))
+		return 0;
+
+	if (errno != EAGAIN && errno != EWOULDBLOCK)
+		return -1;
+
+	//
+	deadline_arm(deadline, "write", _deadlines.write_ms);
+	if (frame_batch_flush(batch, deadline->fd, 0))
+		return -1;
+	deadline_cancel(deadline);
+
+	return 0;
+}
+
 /**
  * Connction handler.
  */
@@ -227,27 +307,62 @@ static void *
 __connection_handler(void *arg)
 {
 	pthread_t tid;
-	conn_data_t conn;
-	ssize_t recv_bytes;
+	conn_data_t conn, *next;
+	ssize_t recv_bytes, send_bytes;
 	char host[NI_MAXHOST];
 	char serv[NI_MAXSERV];
-	char _buf[BUFFER_SIZE];
+	frame_parser_t parser;
+	frame_batch_t batch;
+	deadline_t deadline;
+	frame_t frame;
+	int status;
+
+	//
+	if (frame_parser_init(&parser)) {
+		ERROR("frame_parser_init() failed!\n");
+		return NULL;
+	}
 
 	while (1) {
 		//
 		tid = pthread_self();
-		conn = *(conn_data_t *)__thread_pool_dequeue();
+		next = __thread_pool_dequeue();
+		if (!next)
+			break;
+
+		conn = *next;
+		TRACE_BEGIN("connection");
 
 		//
 		if (sock2name(&conn.sa_client, conn.len, host, serv)) {
 			ERROR("[%lu] sock2name() failed!\n", tid);
 			close(conn.sfd);
+			stats_conn_close(_stats);
+			TRACE_END("connection");
 			continue;
 		}
 
 		//
+		frame_parser_reset(&parser);
+		frame_batch_init(&batch);
+		deadline_init(&deadline, conn.sfd);
+
 		while (1) {
-			recv_bytes = recv(conn.sfd, _buf, BUFFER_SIZE, 0);
+			// next request (idle) or rest of a partial frame (read)
+			if (frame_parser_pending(&parser))
+				deadline_arm(&deadline, "read", _deadlines.read_ms);
+			else
+				deadline_arm(&deadline, "idle", _deadlines.idle_ms);
+
+			TRACE_BEGIN("recv");
+			recv_bytes = frame_parser_recv(&parser, conn.sfd);
+			TRACE_END("recv");
+			if (deadline_expired(&deadline)) {
+				DEBUG("[%lu][%s: %s] Connection timed out!\n", tid, host,
+						serv);
+				break;
+			}
+
 			if (recv_bytes == -1) {
 				ERROR("[%lu] recv() failed: %s!\n", tid, strerror(errno));
 				break;
@@ -259,21 +374,52 @@ __connection_handler(void *arg)
 				break;
 			}
 
-			//
-			DEBUG("[%lu][%s: %s] Recv: [%.*s]!\n", tid, host, serv,
-												(int)recv_bytes, _buf);
+			/*********************************************************
+			 * parse all complete frames and echo them back, a full
+			 * batch is flushed before parsing more
+			 ********************************************************/
+			send_bytes = 0;
+			TRACE_BEGIN("batch");
+			while ((status = frame_parser_next(&parser, &frame)) == 1) {
+				if (frame_batch_add(&batch, frame.payload, frame.len)) {
+					if (__batch_flush(&batch, &deadline))
+						break;
+					frame_batch_add(&batch, frame.payload, frame.len);
+				}
+				send_bytes += FRAME_HDR_SIZE + frame.len;
+			}
 
 			//
-			if (send(conn.sfd, _buf, recv_bytes, 0) != recv_bytes) {
-				ERROR("[%lu] send() failed: %s!\n", tid, strerror(errno));
+			if (status == 1 || __batch_flush(&batch, &deadline)) {
+				if (deadline_expired(&deadline))
+					DEBUG("[%lu][%s: %s] Connection timed out!\n", tid, host,
+							serv);
+				else
+					DEBUG("[%lu] writev() failed: %s!\n", tid,
+							strerror(errno));
+				TRACE_END("batch");
+				break;
+			}
+			TRACE_END("batch");
+
+			// invalid frame, close connection
+			if (status == -1) {
+				ERROR("[%lu][%s: %s] Invalid frame!\n", tid, host, serv);
 				break;
 			}
+
+			stats_bytes(_stats, recv_bytes, send_bytes);
 		}
 
 // next_connection:
+		deadline_cancel(&deadline);
 		close(conn.sfd);
+		stats_conn_close(_stats);
+		TRACE_END("connection");
 	}
 
+	frame_parser_destroy(&parser);
+
 	return NULL;
 }
 
@@ -285,8 +431,63 @@ int main(int argc, char *argv[])
 {
 	int sfd;
 	int listen_fd;
+	int epoll_fd;
+	int running;
+	int nr;
+	int opt;
 	socklen_t len;
+	sig_event_t se;
+	char *port = SERVER_PORT;
 	struct sockaddr sa_client;
+	struct epoll_event ev, events[EVENTS_MAX];
+
+	/*********************************************************
+	 * parse arguments
+	 ********************************************************/
+	while ((opt = getopt(argc, argv, "p:")) != -1) {
+		switch (opt) {
+		case 'p':
+			port = optarg;
+			break;
+		default:
+			printf("Usage: %s [-p port]\n", argv[0]);
+			goto finish;
+		}
+	}
+
+	/*********************************************************
+	 * block control signals and deliver them through signalfd
+	 * (before pool threads are created)
+	 ********************************************************/
+	running = 1;
+	_stats = stats_create(0);
+	if (!_stats) {
+		ERROR("stats_create() failed!\n");
+		goto finish;
+	}
+
+	if (sig_event_init(&se) || stats_signals_register(&se, _stats, &running)) {
+		ERROR("Fail to init signal events!\n");
+		goto finish;
+	}
+
+	/*********************************************************
+	 * start tracing (if TRACE_FILE is set)
+	 ********************************************************/
+	if (trace_start_env()) {
+		ERROR("trace_start_env() failed!\n");
+		goto finish;
+	}
+
+	/*********************************************************
+	 * connection deadlines watchdog (IDLE_TIMEOUT_MS,
+	 * READ_TIMEOUT_MS and WRITE_TIMEOUT_MS override defaults)
+	 ********************************************************/
+	deadline_config_env(&_deadlines);
+	if (deadline_start(_stats)) {
+		ERROR("deadline_start() failed!\n");
+		goto finish;
+	}
 
 	/*********************************************************
 	 * thread pool initialization
@@ -299,32 +500,77 @@ int main(int argc, char *argv[])
 	/*********************************************************
 	 * create listening socket
 	 ********************************************************/
-	listen_fd = generic_listen(SERVER_PORT, 10, SOCK_STREAM, AF_INET);
+	listen_fd = generic_listen(port, LISTEN_BACKLOG, SOCK_STREAM, AF_INET);
 	if (listen_fd == -1) {
 		ERROR("generic_listen() failed!\n");
 		goto finish;
 	}
 
 	/*********************************************************
-	 * accept connections and create new processes
+	 * create epoll instance (signals and listening socket)
 	 ********************************************************/
-	while (1) {
-		//
-		len = sizeof(struct sockaddr_storage);
-		sfd = accept(listen_fd, &sa_client, &len);
-		if (sfd == -1) {
-			ERROR("acccept() failed: %s!\n", strerror(errno));
-			continue;
+	epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (epoll_fd == -1) {
+		ERROR("epoll_create1() failed: %s!\n", strerror(errno));
+		goto finish;
+	}
+
+	if (sig_event_epoll_add(&se, epoll_fd))
+		goto finish;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.fd = listen_fd;
+	if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &ev)) {
+		ERROR("epoll_ctl() failed: %s!\n", strerror(errno));
+		goto finish;
+	}
+
+	/*********************************************************
+	 * accept connections and enqueue them to the pool
+	 ********************************************************/
+	while (running) {
+		nr = epoll_wait(epoll_fd, events, EVENTS_MAX, -1);
+		if (nr == -1) {
+			ERROR("epoll_wait() failed: %s!\n", strerror(errno));
+			break;
 		}
 
-		//
-		__thread_pool_enqueue(sfd, &sa_client, len);
+		for (int i = 0; i < nr && running; i++) {
+			// signals
+			if (events[i].data.fd == se.fd) {
+				sig_event_dispatch(&se);
+				continue;
+			}
+
+			//
+			len = sizeof(sa_client);
+			sfd = accept(listen_fd, &sa_client, &len);
+			if (sfd == -1) {
+				ERROR("acccept() failed: %s!\n", strerror(errno));
+				continue;
+			}
+			stats_conn_open(_stats);
+
+			//
+			TRACE_BEGIN("enqueue");
+			__thread_pool_enqueue(sfd, &sa_client, len);
+			TRACE_END("enqueue");
+		}
 	}
 
 	/*********************************************************
 	 * thread pool destroy
+	 *
+	 * Stop accepting and wait for pool threads to serve the
+	 * queued and active connections.
 	 ********************************************************/
+	close(listen_fd);
+	__thread_pool_stop();
 	__thread_pool_destroy();
+	deadline_stop();
+
+	stats_dump(_stats, "thread_pool_con_tcp_server");
 
 finish:
 	return 0;
@@ -0,0 +1,270 @@
+/**
+ * Hierarchical timer wheel.
+ * Copyright (C) 2024 Lazar Razvan.
+ *
+ * Timers (connection deadlines) are kept in TIMER_WHEEL_LEVELS wheels of
+ * TIMER_WHEEL_SLOTS slots. Level 0 has one slot for each tick, level L has one
+ * slot for each 2^(L * TIMER_WHEEL_BITS) ticks. A timer is placed in the
+ * lowest level whose range covers its delta (expires - now):
+ *
+ * 1) timer_wheel_add()/timer_wheel_del()
+ * 		Link/unlink in a slot list, O(1) whatever the number of timers.
+ *
+ * 2) timer_wheel_advance()
+ * 		Ticks are processed one by one. When level 0 wraps, the next slot of
+ * 	level 1 is cascaded (its timers are placed again, now in level 0 since
+ * 	they are closer) and so on for the upper levels. Then all timers of the
+ * 	level 0 slot of the tick are expired.
+ *
+ * Each timer is moved at most TIMER_WHEEL_LEVELS - 1 times before it expires,
+ * and most timers (deadlines pushed forward on activity) are cancelled long
+ * before reaching level 0, so they are never cascaded at all.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "debug.h"
+#include "timer_wheel.h"
+
+/*================================= STATIC ===================================*/
+
+/**
+ * Empty slot list (sentinel points to itself).
+ */
+static inline void __list_init(wheel_timer_t *head)
+{
+	head->next = head;
+	head->prev = head;
+}
+
+static inline void __list_add(wheel_timer_t *head, wheel_timer_t *t)
+{
+	t->next = head;
+	t->prev = head->prev;
+	head->prev->next = t;
+	head->prev = t;
+}
+
+static inline void __list_del(wheel_timer_t *t)
+{
+	t->prev->next = t->next;
+	t->next->prev = t->prev;
+	t->next = NULL;
+	t->prev = NULL;
+}
+
+/**
+ * Move all timers of a slot to another list head.
+ */
+static inline void __list_splice(wheel_timer_t *from, wheel_timer_t *to)
+{
+	if (from->next == from) {
+		__list_init(to);
+		return;
+	}
+
+	to->next = from->next;
+	to->prev = from->prev;
+	to->next->prev = to;
+	to->prev->next = to;
+	__list_init(from);
+}
+
+/**
+ * Place timer in the slot covering its delta.
+ */
+static void __place(timer_wheel_t *tw, wheel_timer_t *t)
+{
+	uint64_t expires = t->expires, delta;
+	unsigned int level, slot;
+
+	// already expired, run on next tick
+	if (expires < tw->now)
+		expires = tw->now;
+
+	// too far, park in the last slot reachable (placed again on cascade)
+	delta = expires - tw->now;
+	if (delta > TIMER_WHEEL_MAX_DELTA) {
+		delta = TIMER_WHEEL_MAX_DELTA;
+		expires = tw->now + delta;
+	}
+
+	//
+	for (level = 0; level < TIMER_WHEEL_LEVELS - 1; level++)
+		if (delta < (1ULL << ((level + 1) * TIMER_WHEEL_BITS)))
+			break;
+
+	slot = (expires >> (level * TIMER_WHEEL_BITS)) & TIMER_WHEEL_MASK;
+	__list_add(&tw->slots[level][slot], t);
+}
+
+/**
+ * Place again all timers of a slot (they move to a lower level).
+ *
+ * Return slot index.
+ */
+static unsigned int __cascade(timer_wheel_t *tw, unsigned int level)
+{
+	unsigned int slot;
+	wheel_timer_t head, *t;
+
+	slot = (tw->now >> (level * TIMER_WHEEL_BITS)) & TIMER_WHEEL_MASK;
+	__list_splice(&tw->slots[level][slot], &head);
+
+	while (head.next != &head) {
+		t = head.next;
+		__list_del(t);
+		__place(tw, t);
+	}
+
+	return slot;
+}
+
+/*================================== API =====================================*/
+
+/**
+ * Init an empty wheel.
+ *
+ * @tw       : Timer wheel.
+ * @now      : Current tick.
+ */
+void timer_wheel_init(timer_wheel_t *tw, uint64_t now)
+{
+	for (int l = 0; l < TIMER_WHEEL_LEVELS; l++)
+		for (int s = 0; s < TIMER_WHEEL_SLOTS; s++)
+			__list_init(&tw->slots[l][s]);
+
+	tw->now = now;
+	tw->pending = 0;
+}
+
+/**
+ * Init a timer (not pending).
+ *
+ * @t        : Timer.
+ * @cb       : Expiry callback.
+ * @arg      : Callback argument.
+ */
+void timer_wheel_timer_init(wheel_timer_t *t, wheel_timer_cb_t cb, void *arg)
+{
+	t->next = NULL;
+	t->prev = NULL;
+	t->expires = 0;
+	t->cb = cb;
+	t->arg = arg;
+}
+
+/**
+ * Add a timer, a pending timer is moved to the new expiry tick.
+ *
+ * @tw       : Timer wheel.
+ * @t        : Timer.
+ * @expires  : Expiry tick (absolute).
+ */
+void timer_wheel_add(timer_wheel_t *tw, wheel_timer_t *t, uint64_t expires)
+{
+	if (timer_wheel_pending(t))
+		__list_del(t);
+	else
+		tw->pending++;
+
+	t->expires = expires;
+	__place(tw, t);
+}
+
+/**
+ * Cancel a timer (nothing to do if not pending).
+ *
+ * @tw       : Timer wheel.
+ * @t        : Timer.
+ */
+void timer_wheel_del(timer_wheel_t *tw, wheel_timer_t *t)
+{
+	if (!timer_wheel_pending(t))
+		return;
+
+	__list_del(t);
+	tw->pending--;
+}
+
+/**
+ * Advance wheel and run expired timers callbacks.
+ *
+ * @tw       : Timer wheel.
+ * @now      : Current tick, all timers expiring up to it are run.
+ *
+ * Return number of timers expired.
+ */
+unsigned int timer_wheel_advance(timer_wheel_t *tw, uint64_t now)
+{
+	unsigned int expired = 0, level, slot;
+	wheel_timer_t head, *t;
+
+	while (tw->now <= now) {
+		// nothing pending, jump to now
+		if (!tw->pending) {
+			tw->now = now + 1;
+			break;
+		}
+
+		/*********************************************************
+		 * level 0 wrapped, cascade upper levels (each one only
+		 * when the level below it wrapped too)
+		 ********************************************************/
+		slot = tw->now & TIMER_WHEEL_MASK;
+		for (level = 1; !slot && level < TIMER_WHEEL_LEVELS; level++)
+			slot = __cascade(tw, level);
+
+		/*********************************************************
+		 * expire level 0 slot, the tick is consumed before
+		 * callbacks so timers added by them are not lost in it
+		 ********************************************************/
+		__list_splice(&tw->slots[0][tw->now & TIMER_WHEEL_MASK], &head);
+		tw->now++;
+
+		while (head.next != &head) {
+			t = head.next;
+			__list_del(t);
+			tw->pending--;
+			expired++;
+			t->cb(t, t->arg);
+		}
+	}
+
+	return expired;
+}
+
+/**
+ * Tick of the next wheel event.
+ *
+ * Event is the first non-empty level 0 slot or, if none, the next cascade
+ * (level 0 wrap), so waiting until it never misses an expiry.
+ *
+ * @tw       : Timer wheel.
+ * @tick     : Event tick (absolute).
+ *
+ * Return 0 on success and -1 if no timer is pending.
+ */
+int timer_wheel_next(timer_wheel_t *tw, uint64_t *tick)
+{
+	unsigned int slot;
+
+	if (!tw->pending)
+		return -1;
+
+	for (uint64_t i = 0; i < TIMER_WHEEL_SLOTS; i++) {
+		slot = (tw->now + i) & TIMER_WHEEL_MASK;
+
+		// cascade first
+		if ((i && !slot) ||
+			tw->slots[0][slot].next != &tw->slots[0][slot]) {
+			*tick = tw->now + i;
+			return 0;
+		}
+	}
+
+	*tick = tw->now + TIMER_WHEEL_SLOTS;
+	return 0;
+}
@@ -0,0 +1,674 @@
+/**
+ * Low overhead trace event recorder.
+ * Copyright (C) 2024 Lazar Razvan.
+ *
+ * Record begin/end/instant events to understand where time goes across the
+ * threads of a process, and not only the totals reported by process_time.
+ *
+ * Each thread records events in its own ring buffer (single producer, single
+ * consumer) so the hot path has no lock and no system call:
+ * 	1) timestamp is taken using CLOCK_MONOTONIC (vDSO, no system call)
+ * 	2) event is written in the ring and published with a release store
+ * 	3) if the ring is full, the event is dropped and counted
+ *
+ * A background flusher thread periodically drains all rings and writes the
+ * events either in Chrome trace JSON format or in a compact binary format
+ * (event names are written once, in a string table) that can be converted to
+ * JSON later using trace_convert().
+ *
+ * Rings of terminated threads are reused by new threads once drained, so a
+ * thread per connection server does not grow memory with each connection.
+ *
+ * After fork(), the child drops the parent rings and, if the trace path
+ * contains "%d", starts its own trace file and flusher thread. Only the state
+ * is reset in the fork handler (fopen() and pthread_create() are not safe
+ * there if the parent is multithreaded), the trace is opened by the first
+ * event the child records.
+ */
+
+#include <time.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+
+#include <sys/syscall.h>
+
+#include "debug.h"
+#include "trace.h"
+
+/*============================================================================*/
+/**
+ * Ring index mask.
+ */
+#define TRACE_RING_MASK				(TRACE_RING_SIZE - 1)
+
+/**
+ * Binary format magic, records type and string table size.
+ */
+#define TRACE_BIN_MAGIC				"TRACEv1"
+#define TRACE_BIN_STRING			'S'
+#define TRACE_BIN_EVENT				'E'
+#define TRACE_STRINGS_MAX			4096
+
+/**
+ * Trace path max length.
+ */
+#define TRACE_PATH_MAX				256
+
+/**
+ * Event record.
+ */
+typedef struct trace_rec_s {
+
+	uint64_t		ts;				// timestamp (nanoseconds)
+	const char		*name;			// event name (static string)
+	char			phase;			// event phase
+
+} trace_rec_t;
+
+/**
+ * Per-thread ring buffer.
+ */
+typedef struct trace_ring_s {
+
+	uint64_t		head __attribute__((aligned(64)));	// producer index
+	uint64_t		drops;								// dropped events
+	uint64_t		tail __attribute__((aligned(64)));	// consumer index
+	pid_t			tid;								// owner thread id
+	int				alive;								// owner is running
+	struct trace_ring_s	*next;							// rings list
+
+	trace_rec_t		recs[TRACE_RING_SIZE];				// events
+
+} trace_ring_t;
+
+/**
+ * Binary event record.
+ */
+typedef struct trace_bin_event_s {
+
+	uint8_t			type;			// TRACE_BIN_EVENT
+	char			phase;			// event phase
+	uint16_t		pad;
+	uint32_t		tid;			// thread id
+	uint32_t		name_id;		// string table id
+	uint64_t		ts;				// timestamp (nanoseconds)
+
+} __attribute__((packed)) trace_bin_event_t;
+
+/**
+ * Trace global state.
+ */
+typedef struct trace_s {
+
+	int				enabled;		// events are recorded
+	int				format;			// output format
+	int				stop;			// flusher stop request
+	int				first;			// no event written yet (json)
+	int				reopen;			// forked child, open own trace on first event
+	int				per_process;	// path contains "%d" (file per process)
+	pid_t			pid;			// traced process
+	FILE			*fp;			// output file
+	int				fd;				// output file descriptor (fork)
+	char			path[TRACE_PATH_MAX];	// path format
+	pthread_t		flusher;		// flusher thread
+	pthread_mutex_t	lock;			// output lock (flusher vs fork)
+	trace_ring_t	*rings;			// all rings (lock-free list)
+
+	const char		*strings[TRACE_STRINGS_MAX];	// string table (binary)
+	uint32_t		strings_nr;						// string table size
+
+} trace_t;
+
+
+/*============================================================================*/
+
+static trace_t _trace = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static __thread trace_ring_t *_ring;
+
+static pthread_key_t _ring_key;
+static pthread_once_t _ring_key_once = PTHREAD_ONCE_INIT;
+
+
+/*================================= STATIC ===================================*/
+
+/**
+ * Fast timestamp (nanoseconds).
+ */
+static inline uint64_t __trace_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * Thread exit: ring may be reused by another thread once drained.
+ */
+static void __ring_release(void *arg)
+{
+	trace_ring_t *ring = (trace_ring_t *)arg;
+
+	__atomic_store_n(&ring->alive, 0, __ATOMIC_RELEASE);
+}
+
+static void __ring_key_create(void)
+{
+	pthread_key_create(&_ring_key, __ring_release);
+}
+
+/**
+ * Get a ring for calling thread (reuse a drained one or allocate).
+ */
+static trace_ring_t * __ring_acquire(void)
+{
+	trace_ring_t *ring;
+	int dead = 0;
+
+	pthread_once(&_ring_key_once, __ring_key_create);
+
+	// reuse ring of a terminated thread
+	for (ring = __atomic_load_n(&_trace.rings, __ATOMIC_ACQUIRE); ring;
+		ring = ring->next) {
+		if (__atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) !=
+			__atomic_load_n(&ring->head, __ATOMIC_ACQUIRE))
+			continue;
+
+		if (__atomic_compare_exchange_n(&ring->alive, &dead, 1, 0,
+								__ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+			goto found;
+
+		dead = 0;
+	}
+
+	// allocate and push a new ring
+	ring = calloc(1, sizeof(trace_ring_t));
+	if (!ring)
+		return NULL;
+
+	ring->alive = 1;
+	ring->next = __atomic_load_n(&_trace.rings, __ATOMIC_RELAXED);
+	while (!__atomic_compare_exchange_n(&_trace.rings, &ring->next, ring, 1,
+								__ATOMIC_RELEASE, __ATOMIC_RELAXED));
+
+found:
+	ring->tid = syscall(SYS_gettid);
+	pthread_setspecific(_ring_key, ring);
+	_ring = ring;
+
+	return ring;
+}
+
+/**
+ * Get string table id for a name (binary format), write it if new.
+ */
+static uint32_t __string_id(FILE *fp, const char *name)
+{
+	uint16_t len;
+	uint32_t id;
+
+	for (id = 0; id < _trace.strings_nr; id++)
+		if (_trace.strings[id] == name)
+			return id;
+
+	// table full, reuse last entry
+	if (_trace.strings_nr == TRACE_STRINGS_MAX)
+		id = TRACE_STRINGS_MAX - 1;
+	else
+		_trace.strings_nr++;
+
+	_trace.strings[id] = name;
+
+	len = strlen(name);
+	fputc(TRACE_BIN_STRING, fp);
+	fwrite(&id, sizeof(id), 1, fp);
+	fwrite(&len, sizeof(len), 1, fp);
+	fwrite(name, len, 1, fp);
+
+	return id;
+}
+
+/**
+ * Write a JSON event.
+ */
+static void __json_write(FILE *fp, int *first, pid_t pid, pid_t tid,
+						char phase, const char *name, uint64_t ts)
+{
+	fprintf(fp, "%s\n{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%lu.%03lu,"
+				"\"pid\":%d,\"tid\":%d%s}", *first ? "" : ",", name, phase,
+				ts / 1000, ts % 1000, pid, tid,
+				phase == TRACE_PHASE_INSTANT ? ",\"s\":\"t\"" : "");
+	*first = 0;
+}
+
+/**
+ * Write a ring event.
+ */
+static void __event_write(trace_ring_t *ring, trace_rec_t *rec)
+{
+	trace_bin_event_t ev;
+
+	if (_trace.format == TRACE_FORMAT_JSON) {
+		__json_write(_trace.fp, &_trace.first, _trace.pid, ring->tid,
+					rec->phase, rec->name, rec->ts);
+		return;
+	}
+
+	ev.type		= TRACE_BIN_EVENT;
+	ev.phase	= rec->phase;
+	ev.pad		= 0;
+	ev.tid		= ring->tid;
+	ev.name_id	= __string_id(_trace.fp, rec->name);
+	ev.ts		= rec->ts;
+	fwrite(&ev, sizeof(trace_bin_event_t), 1, _trace.fp);
+}
+
+/**
+ * Drain all rings into output file.
+ */
+static void __rings_drain(void)
+{
+	trace_ring_t *ring;
+	uint64_t head, tail;
+
+	pthread_mutex_lock(&_trace.lock);
+
+	for (ring = __atomic_load_n(&_trace.rings, __ATOMIC_ACQUIRE); ring;
+		ring = ring->next) {
+		tail = ring->tail;
+		head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+
+		for (; tail != head; tail++)
+			__event_write(ring, &ring->recs[tail & TRACE_RING_MASK]);
+
+		__atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+	}
+
+	fflush(_trace.fp);
+
+	pthread_mutex_unlock(&_trace.lock);
+}
+
+/**
+ * Flusher thread.
+ */
+static void * __flusher(void *arg)
+{
+	struct timespec period = {
+		.tv_sec = 0,
+		.tv_nsec = TRACE_FLUSH_PERIOD_US * 1000,
+	};
+
+	while (!__atomic_load_n(&_trace.stop, __ATOMIC_ACQUIRE)) {
+		__rings_drain();
+		nanosleep(&period, NULL);
+	}
+
+	// final drain
+	__rings_drain();
+
+	return NULL;
+}
+
+/**
+ * Build output path, first "%d" is replaced by pid.
+ *
+ * Path comes from the environment, so it is never used as a format string.
+ */
+static void __path_expand(char *buf, size_t size, const char *path, pid_t pid)
+{
+	const char *p = strstr(path, "%d");
+
+	if (!p) {
+		snprintf(buf, size, "%s", path);
+		return;
+	}
+
+	snprintf(buf, size, "%.*s%d%s", (int)(p - path), path, pid, p + 2);
+}
+
+/**
+ * Open output file and start flusher thread.
+ */
+static int __trace_open(void)
+{
+	char path[TRACE_PATH_MAX + 16];
+	sigset_t all, old;
+	int rv;
+
+	_trace.pid = getpid();
+	_trace.first = 1;
+	_trace.stop = 0;
+	_trace.strings_nr = 0;
+
+	__path_expand(path, sizeof(path), _trace.path, _trace.pid);
+
+	_trace.fp = fopen(path, "w");
+	if (!_trace.fp) {
+		ERROR("fopen() %s failed: %s!\n", path, strerror(errno));
+		return -1;
+	}
+	_trace.fd = fileno(_trace.fp);
+
+	if (_trace.format == TRACE_FORMAT_JSON) {
+		fprintf(_trace.fp, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+	} else {
+		fwrite(TRACE_BIN_MAGIC, sizeof(TRACE_BIN_MAGIC), 1, _trace.fp);
+		fwrite(&_trace.pid, sizeof(pid_t), 1, _trace.fp);
+	}
+
+	// flusher never handles signals (inherits a full mask)
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+
+	rv = pthread_create(&_trace.flusher, NULL, __flusher, NULL);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	if (rv) {
+		ERROR("pthread_create() failed!\n");
+		fclose(_trace.fp);
+		return -2;
+	}
+
+	__atomic_store_n(&_trace.enabled, 1, __ATOMIC_RELEASE);
+
+	return 0;
+}
+
+/**
+ * fork() handlers.
+ *
+ * Output file is flushed and locked before fork, so the child does not
+ * inherit (and write again) buffered events.
+ */
+static void __atfork_prepare(void)
+{
+	pthread_mutex_lock(&_trace.lock);
+	if (_trace.fp)
+		fflush(_trace.fp);
+}
+
+static void __atfork_parent(void)
+{
+	pthread_mutex_unlock(&_trace.lock);
+}
+
+static void __atfork_child(void)
+{
+	int enabled = _trace.enabled;
+
+	pthread_mutex_unlock(&_trace.lock);
+
+	if (!enabled)
+		return;
+
+	/**
+	 * Parent rings (and flusher) do not exist in child. Output was flushed
+	 * before fork, so only the descriptor is closed (the FILE is dropped).
+	 */
+	_trace.enabled = 0;
+	_trace.rings = NULL;
+	_ring = NULL;
+	close(_trace.fd);
+	_trace.fp = NULL;
+
+	// child trace only if a file per process is used (opened on first event)
+	_trace.reopen = _trace.per_process;
+}
+
+/**
+ * Open trace of a forked child (first event recorded by child).
+ */
+static void __trace_reopen(void)
+{
+	pthread_mutex_lock(&_trace.lock);
+	if (_trace.reopen) {
+		_trace.reopen = 0;
+		__trace_open();
+	}
+	pthread_mutex_unlock(&_trace.lock);
+}
+
+/*================================= PUBLIC ===================================*/
+
+/**
+ * Start tracing.
+ *
+ * @path	: Output file path (first "%d" is replaced by pid). NULL to disable.
+ * @format	: TRACE_FORMAT_JSON or TRACE_FORMAT_BIN.
+ *
+ * Return 0 on success (or if tracing is disabled) and <0 on error.
+ *
+ * Errors:
+ * 	1) Invalid arguments
+ * 	2) Output file or flusher thread error
+ */
+int trace_start(const char *path, int format)
+{
+	static int atfork_init;
+
+	if (!path)
+		return 0;
+
+	if (strlen(path) >= TRACE_PATH_MAX ||
+		(format != TRACE_FORMAT_JSON && format != TRACE_FORMAT_BIN)) {
+		ERROR("Invalid trace arguments!\n");
+		return -1;
+	}
+
+	if (_trace.enabled) {
+		ERROR("Trace already started!\n");
+		return -1;
+	}
+
+	strcpy(_trace.path, path);
+	_trace.format = format;
+	_trace.per_process = (strstr(path, "%d") != NULL);
+	_trace.reopen = 0;
+
+	if (!atfork_init) {
+		pthread_atfork(__atfork_prepare, __atfork_parent, __atfork_child);
+		atexit(trace_stop);
+		atfork_init = 1;
+	}
+
+	if (__trace_open())
+		return -2;
+
+	return 0;
+}
+
+/**
+ * Start tracing if TRACE_FILE environment variable is set.
+ *
+ * Format is selected using file extension (".json" for Chrome JSON, binary
+ * otherwise).
+ *
+ * Return 0 on success (or if tracing is disabled) and <0 on error.
+ */
+int trace_start_env(void)
+{
+	const char *path = getenv(TRACE_FILE_ENV);
+	size_t len;
+
+	if (!path)
+		return 0;
+
+	len = strlen(path);
+	if (len > 5 && !strcmp(path + len - 5, ".json"))
+		return trace_start(path, TRACE_FORMAT_JSON);
+
+	return trace_start(path, TRACE_FORMAT_BIN);
+}
+
+/**
+ * Stop tracing: drain all rings, close output and release rings.
+ */
+void trace_stop(void)
+{
+	trace_ring_t *ring;
+	uint64_t drops = 0;
+
+	__atomic_store_n(&_trace.reopen, 0, __ATOMIC_RELAXED);
+	if (!_trace.enabled)
+		return;
+
+	__atomic_store_n(&_trace.enabled, 0, __ATOMIC_RELEASE);
+	__atomic_store_n(&_trace.stop, 1, __ATOMIC_RELEASE);
+	pthread_join(_trace.flusher, NULL);
+
+	if (_trace.format == TRACE_FORMAT_JSON)
+		fprintf(_trace.fp, "\n]}\n");
+	fclose(_trace.fp);
+	_trace.fp = NULL;
+
+	// rings are kept, since other threads may still hold them
+	for (ring = _trace.rings; ring; ring = ring->next)
+		drops += ring->drops;
+
+	if (drops)
+		ERROR("%lu trace events dropped (ring full)!\n", drops);
+}
+
+/**
+ * Record an event for calling thread.
+ *
+ * @phase	: Event phase (TRACE_PHASE_*).
+ * @name	: Event name. Must be a static string since only the pointer is
+ * 			recorded.
+ */
+void trace_event(char phase, const char *name)
+{
+	trace_ring_t *ring;
+	trace_rec_t *rec;
+	uint64_t head;
+
+	if (!__atomic_load_n(&_trace.enabled, __ATOMIC_RELAXED)) {
+		if (!__atomic_load_n(&_trace.reopen, __ATOMIC_RELAXED))
+			return;
+
+		__trace_reopen();
+		if (!__atomic_load_n(&_trace.enabled, __ATOMIC_ACQUIRE))
+			return;
+	}
+
+	ring = _ring;
+	if (!ring && !(ring = __ring_acquire()))
+		return;
+
+	head = ring->head;
+	if (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) >=
+		TRACE_RING_SIZE) {
+		ring->drops++;
+		return;
+	}
+
+	rec = &ring->recs[head & TRACE_RING_MASK];
+	rec->ts		= __trace_now();
+	rec->name	= name;
+	rec->phase	= phase;
+
+	__atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * End of a TRACE_SCOPE() (called by cleanup attribute).
+ */
+void __trace_scope_end(const char **name)
+{
+	trace_event(TRACE_PHASE_END, *name);
+}
+
+/**
+ * Convert a binary trace into Chrome trace JSON.
+ *
+ * @bin_path	: Binary trace path.
+ * @json_path	: JSON trace path.
+ *
+ * Return 0 on success and <0 on error.
+ *
+ * Errors:
+ * 	1) Files open error
+ * 	2) Invalid binary trace
+ */
+int trace_convert(const char *bin_path, const char *json_path)
+{
+	char magic[sizeof(TRACE_BIN_MAGIC)], *names[TRACE_STRINGS_MAX] = { 0 };
+	trace_bin_event_t ev;
+	FILE *in, *out;
+	int type, first = 1, rv = 0;
+	uint32_t id;
+	uint16_t len;
+	pid_t pid;
+
+	in = fopen(bin_path, "r");
+	if (!in) {
+		ERROR("fopen() %s failed: %s!\n", bin_path, strerror(errno));
+		rv = -1; goto end;
+	}
+
+	out = fopen(json_path, "w");
+	if (!out) {
+		ERROR("fopen() %s failed: %s!\n", json_path, strerror(errno));
+		rv = -1; goto in_close;
+	}
+
+	if (fread(magic, sizeof(magic), 1, in) != 1 ||
+		memcmp(magic, TRACE_BIN_MAGIC, sizeof(magic)) ||
+		fread(&pid, sizeof(pid_t), 1, in) != 1) {
+		ERROR("%s is not a binary trace!\n", bin_path);
+		rv = -2; goto out_close;
+	}
+
+	fprintf(out, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+
+	while ((type = fgetc(in)) != EOF) {
+		if (type == TRACE_BIN_STRING) {
+			if (fread(&id, sizeof(id), 1, in) != 1 ||
+				fread(&len, sizeof(len), 1, in) != 1 ||
+				id >= TRACE_STRINGS_MAX) {
+				ERROR("Invalid string record!\n");
+				rv = -2; goto names_free;
+			}
+
+			free(names[id]);
+			names[id] = calloc(1, len + 1);
+			if (!names[id] || fread(names[id], 1, len, in) != len) {
+				ERROR("Invalid string record!\n");
+				rv = -2; goto names_free;
+			}
+			continue;
+		}
+
+		ev.type = type;
+		if (type != TRACE_BIN_EVENT ||
+			fread((char *)&ev + 1, sizeof(ev) - 1, 1, in) != 1 ||
+			ev.name_id >= TRACE_STRINGS_MAX || !names[ev.name_id]) {
+			ERROR("Invalid event record!\n");
+			rv = -2; goto names_free;
+		}
+
+		__json_write(out, &first, pid, ev.tid, ev.phase, names[ev.name_id],
+					ev.ts);
+	}
+
+	fprintf(out, "\n]}\n");
+
+names_free:
+	for (int i = 0; i < TRACE_STRINGS_MAX; i++)
+		free(names[i]);
+out_close:
+	fclose(out);
+in_close:
+	fclose(in);
+end:
+	return rv;
+}
@@ -392,3 +392,125 @@ generic_listen(char *serv, int backlog, int sock_type, int fam_type)
 finish:
 	return sock_fd;
 }
+
+/**
+ * Send a file descriptor to another process over a unix domain socket.
+ *
+ * The descriptor is passed as SCM_RIGHTS ancillary data, so the receiver gets
+ * a new descriptor referring to the same open file description. At least one
+ * byte of data must be sent together with ancillary data.
+ *
+ * @sock_fd  : Unix domain socket.
+ * @fd       : File descriptor to be sent.
+ * @data     : Data sent together with the file descriptor.
+ * @len      : Data length (greater than 0).
+ *
+ * Return 0 on success and -1 on error.
+ */
+int
+send_fd(int sock_fd, int fd, void *data, size_t len)
+{
+	struct msghdr msg;
+	struct iovec iov;
+	struct cmsghdr *cmsg;
+	ssize_t sent_bytes;
+	union {
+		char buf[CMSG_SPACE(sizeof(int))];
+		struct cmsghdr align;
+	} control;
+
+	//
+	iov.iov_base = data;
+	iov.iov_len = len;
+
+	//
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control.buf;
+	msg.msg_controllen = sizeof(control.buf);
+
+	//
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+	memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+
+	//
+	sent_bytes = sendmsg(sock_fd, &msg, MSG_NOSIGNAL);
+	if (sent_bytes == -1) {
+		ERROR("sendmsg() failed: %s!\n", strerror(errno));
+		return -1;
+	}
+
+	if (sent_bytes != (ssize_t)len) {
+		ERROR("sendmsg() sent %zd of %zu bytes!\n", sent_bytes, len);
+		return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * Receive a file descriptor from another process over a unix domain socket.
+ *
+ * @sock_fd  : Unix domain socket.
+ * @fd       : Received file descriptor (-1 if message carried no descriptor).
+ * @data     : Buffer for data sent together with the file descriptor.
+ * @len      : Buffer length.
+ *
+ * Return number of data bytes received, 0 if peer closed the socket or -1 on
+ * error.
+ */
+ssize_t
+recv_fd(int sock_fd, int *fd, void *data, size_t len)
+{
+	ssize_t recv_bytes;
+	struct msghdr msg;
+	struct iovec iov;
+	struct cmsghdr *cmsg;
+	union {
+		char buf[CMSG_SPACE(sizeof(int))];
+		struct cmsghdr align;
+	} control;
+
+	//
+	*fd = -1;
+	iov.iov_base = data;
+	iov.iov_len = len;
+
+	//
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control.buf;
+	msg.msg_controllen = sizeof(control.buf);
+
+	/*********************************************************
+	 * receive data and descriptor
+	 *
+	 * MSG_CMSG_CLOEXEC marks the new descriptor close-on-exec
+	 * atomically, so it does not leak into exec'ed programs.
+	 ********************************************************/
+	recv_bytes = recvmsg(sock_fd, &msg, MSG_CMSG_CLOEXEC);
+	if (recv_bytes <= 0) {
+		if (recv_bytes == -1)
+			ERROR("recvmsg() failed: %s!\n", strerror(errno));
+		return recv_bytes;
+	}
+
+	//
+	if (msg.msg_flags & MSG_CTRUNC)
+		ERROR("Ancillary data truncated!\n");
+
+	//
+	for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+		if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+			memcpy(fd, CMSG_DATA(cmsg), sizeof(int));
+			break;
+		}
+	}
+
+	return recv_bytes;
+}
@@ -0,0 +1,25 @@
+#ifndef SEQPACKET_COMMON_H
+#define SEQPACKET_COMMON_H
+
+/*============================================================================*/
+
+// Force using of abstract sockets (no entries in filesystem)
+#define ENABLE_ABSTRACT_SOCKET		1
+
+
+/*============================================================================*/
+
+// Seqpacket server socket
+#define SERVER_SOCK_PATH			"/tmp/seqpacket_server_sock"
+
+// Seqpacket listen backlog (many clients connect at once)
+#define SERVER_SOCK_BACKLOG			128
+
+// Largest message (a bigger one is truncated and reported)
+#define BUFFER_SIZE					4096
+
+// Events handled by each epoll_wait() call
+#define EVENTS_MAX					64
+
+
+#endif	// SEQPACKET_COMMON_H
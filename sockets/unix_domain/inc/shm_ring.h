@@ -0,0 +1,106 @@
+#ifndef SHM_RING_H
+#define SHM_RING_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+/**
+ * Config: Shared memory ring
+ */
+
+// Default ring capacity (bytes, power of two)
+#define SHM_RING_CAPACITY			(1024 * 1024)
+
+// Cache line size (producer and consumer indexes are kept apart)
+#define SHM_RING_CACHELINE			64
+
+// Polls of the ring before sleeping on the eventfd (more than one cpu only)
+#define SHM_RING_SPIN				128
+
+
+/*============================================================================*/
+
+/**
+ * Ring flags.
+ */
+#define SHM_RING_MPSC				0x1		// several producers (processes)
+
+/**
+ * Record header (each message is a record aligned to 8 bytes).
+ *
+ * A padding record fills the end of the ring when the next message does not
+ * fit before wrapping.
+ */
+#define SHM_RING_REC_PAD			0x80000000U
+
+typedef struct shm_ring_rec_s {
+
+	uint32_t	size;					// record size (0: not committed)
+	uint32_t	len;					// message length
+
+} shm_ring_rec_t;
+
+/**
+ * Ring header (start of the shared segment, data follows).
+ */
+typedef struct shm_ring_hdr_s {
+
+	uint64_t	capacity;				// data size (power of two)
+	uint32_t	flags;					// SHM_RING_*
+	uint32_t	closed;					// producer closed the ring
+
+	// producers
+	uint64_t	head __attribute__((aligned(SHM_RING_CACHELINE)));
+	uint32_t	prod_waiting;			// producers sleeping on space_fd
+	uint64_t	data_wakeups;			// data_fd writes
+
+	// consumer
+	uint64_t	tail __attribute__((aligned(SHM_RING_CACHELINE)));
+	uint32_t	cons_waiting;			// consumer sleeping on data_fd
+	uint64_t	space_wakeups;			// space_fd writes
+
+} __attribute__((aligned(SHM_RING_CACHELINE))) shm_ring_hdr_t;
+
+/**
+ * Ring handle (local to each process).
+ */
+typedef struct shm_ring_s {
+
+	shm_ring_hdr_t	*hdr;
+	uint8_t			*data;
+	size_t			map_size;			// header and data
+	int				mem_fd;				// memfd (shared segment)
+	int				data_fd;			// eventfd, ring became non-empty
+	int				space_fd;			// eventfd, space freed (semaphore)
+	int				spin;				// polls before sleeping
+
+} shm_ring_t;
+
+
+/*============================================================================*/
+
+// Create a ring (memfd segment and eventfds)
+int shm_ring_create(shm_ring_t *ring, size_t capacity, int flags);
+
+// Attach to a ring created by another process
+int shm_ring_attach(shm_ring_t *ring, int mem_fd, int data_fd, int space_fd);
+
+// Send ring descriptors over a unix socket (SCM_RIGHTS)
+int shm_ring_send(shm_ring_t *ring, int sock_fd);
+
+// Receive ring descriptors from a unix socket and attach
+int shm_ring_recv(shm_ring_t *ring, int sock_fd);
+
+// Write a message (blocks while ring is full)
+int shm_ring_write(shm_ring_t *ring, const void *buf, uint32_t len);
+
+// Read a message (blocks while ring is empty, 0 when closed and drained)
+ssize_t shm_ring_read(shm_ring_t *ring, void *buf, size_t len);
+
+// Close ring for writing (reader gets 0 once drained)
+void shm_ring_close(shm_ring_t *ring);
+
+// Unmap segment and close descriptors
+void shm_ring_destroy(shm_ring_t *ring);
+
+#endif	// SHM_RING_H
@@ -0,0 +1,39 @@
+#ifndef ZEROCOPY_H
+#define ZEROCOPY_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+/**
+ * Config: Zero-copy stream transfers
+ */
+
+// Pipe size between user pages and socket (bytes moved by each splice())
+#define ZEROCOPY_PIPE_SIZE			(1024 * 1024)
+
+// Sender buffer (page aligned, sent again and again for large transfers)
+#define ZEROCOPY_BUF_SIZE			(4 * 1024 * 1024)
+
+
+/*============================================================================*/
+
+// Create a pipe used by zero-copy transfers (resized to ZEROCOPY_PIPE_SIZE)
+int zerocopy_pipe(int pipe_fd[2]);
+
+// Allocate a page aligned buffer (pages touched, not the shared zero page)
+void *zerocopy_buf_alloc(size_t size);
+
+// Send len bytes from buf: vmsplice() into pipe, splice() pipe to socket
+int zerocopy_send(int sock_fd, int pipe_fd[2], const void *buf, size_t len);
+
+// Receive up to len bytes: splice() socket to pipe, pipe to out_fd
+ssize_t zerocopy_recv(int sock_fd, int pipe_fd[2], int out_fd, size_t len);
+
+// Send len bytes from buf with send() (copy baseline)
+int zerocopy_send_copy(int sock_fd, const void *buf, size_t len);
+
+// Receive up to len bytes with recv() into buf, written to out_fd (baseline)
+ssize_t zerocopy_recv_copy(int sock_fd, void *buf, size_t buf_size, int out_fd,
+							size_t len);
+
+#endif	// ZEROCOPY_H
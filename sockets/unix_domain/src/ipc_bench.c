@@ -0,0 +1,745 @@
+/**
+ * Local IPC benchmark (unix domain sockets and pipes), CSV output.
+ *
+ * Copyright (C) 2024 Lazar Razvan.
+ *
+ * Messages are moved between a parent and a child process over:
+ * 	1) unix stream, datagram and seqpacket sockets, connected through an
+ * 	abstract address (as ENABLE_ABSTRACT_SOCKET), through an entry in the
+ * 	filesystem, or created by socketpair() (as datagram_socketpair.c).
+ *
+ * 	2) pipes (one for each direction).
+ *
+ * For each transport, message size and buffer size (SO_SNDBUF and SO_RCVBUF
+ * on both sockets, F_SETPIPE_SZ for pipes, 0 keeps the system default) a CSV
+ * row is written with:
+ * 	- setup_us: mean time to create a connected pair (socket(), bind(),
+ * 	listen(), connect(), accept(), or socketpair()/pipe()).
+ * 	- throughput: child sends messages back to back, parent receives them
+ * 	(msgs/s and MB/s).
+ * 	- latency: ping-pong between parent and child, round trip time mean and
+ * 	percentiles (us).
+ *
+ * Datagram and seqpacket messages larger than the socket send buffer can not
+ * be sent (EMSGSIZE), these combinations are skipped (noted on stderr, so the
+ * CSV output stays clean).
+ *
+ * Usage:
+ * 	./run/ipc_bench [-n messages] [-s sizes] [-b buffer sizes] [-o file.csv]
+ * 	./run/ipc_bench -n 100000 -s 64,1024,65536 -b 0,32768,262144 -o ipc.csv
+ */
+
+#define _GNU_SOURCE
+
+#include <time.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include <sys/un.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+
+#include "debug.h"
+#include "histogram.h"
+
+
+/*============================================================================*/
+
+// Default messages for each throughput test (latency uses a tenth)
+#define MESSAGES					50000
+
+// Bytes moved by each test at most (limits messages of large sizes)
+#define BYTES_MAX					(64UL * 1024 * 1024)
+
+// Largest message size
+#define MESSAGE_SIZE_MAX			(256 * 1024)
+
+// Pairs created to measure setup time
+#define SETUP_ITERATIONS			100
+
+// Parent gives up waiting for the child (seconds)
+#define RECV_TIMEOUT				5
+
+// Max values of a list argument (-s, -b)
+#define LIST_MAX					32
+
+// Server and client (datagram only) socket addresses
+#define SERVER_SOCK_PATH			"/tmp/ipc_bench_server_sock"
+#define CLIENT_SOCK_PATH			"/tmp/ipc_bench_client_sock"
+
+/**
+ * Addresses.
+ */
+#define ADDR_NONE					0		// socketpair() or pipe()
+#define ADDR_ABSTRACT				1		// '\0' + path, not in filesystem
+#define ADDR_PATH					2		// entry in filesystem
+
+static const char *addr_names[] = {
+
+	[ADDR_NONE]		= "none",
+	[ADDR_ABSTRACT]	= "abstract",
+	[ADDR_PATH]		= "path",
+};
+
+/**
+ * Transports (sock_type 0 is a pipe).
+ */
+typedef struct transport_s {
+
+	const char	*name;
+	int			sock_type;			// SOCK_* or 0 for pipes
+	int			addr;				// ADDR_*
+
+} transport_t;
+
+static const transport_t transports[] = {
+
+	{ "stream",		SOCK_STREAM,	ADDR_ABSTRACT },
+	{ "stream",		SOCK_STREAM,	ADDR_PATH },
+	{ "stream",		SOCK_STREAM,	ADDR_NONE },
+	{ "dgram",		SOCK_DGRAM,		ADDR_ABSTRACT },
+	{ "dgram",		SOCK_DGRAM,		ADDR_PATH },
+	{ "dgram",		SOCK_DGRAM,		ADDR_NONE },
+	{ "seqpacket",	SOCK_SEQPACKET,	ADDR_ABSTRACT },
+	{ "seqpacket",	SOCK_SEQPACKET,	ADDR_PATH },
+	{ "seqpacket",	SOCK_SEQPACKET,	ADDR_NONE },
+	{ "pipe",		0,				ADDR_NONE },
+};
+
+/**
+ * Endpoint (one side), sockets use the same descriptor for both directions.
+ */
+typedef struct endpoint_s {
+
+	int		rfd;
+	int		wfd;
+
+} endpoint_t;
+
+static char _buf[MESSAGE_SIZE_MAX];
+
+
+/*============================================================================*/
+
+static inline uint64_t
+__time_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * Message oriented transport (one read is one message).
+ */
+static inline int
+__is_message(const transport_t *t)
+{
+	return t->sock_type == SOCK_DGRAM || t->sock_type == SOCK_SEQPACKET;
+}
+
+/**
+ * Fill a socket address (abstract or filesystem entry).
+ */
+static void
+__sockaddr(struct sockaddr_un *sa, int addr, const char *path)
+{
+	memset(sa, 0, sizeof(struct sockaddr_un));
+	sa->sun_family = AF_UNIX;
+	if (addr == ADDR_ABSTRACT)
+		memcpy(&sa->sun_path[1], path, strlen(path));
+	else
+		memcpy(sa->sun_path, path, strlen(path));
+}
+
+/**
+ * Create a socket bound to an address (removing an old filesystem entry).
+ *
+ * Return socket on success and -1 on error.
+ */
+static int
+__bind(int sock_type, int addr, const char *path)
+{
+	struct sockaddr_un sa;
+	int sock_fd;
+
+	//
+	sock_fd = socket(AF_UNIX, sock_type, 0);
+	if (sock_fd == -1) {
+		ERROR("Socket creation failed: %s!\n", strerror(errno));
+		return -1;
+	}
+
+	__sockaddr(&sa, addr, path);
+	if (addr == ADDR_PATH && remove(path) == -1 && errno != ENOENT) {
+		ERROR("File %s deletion failed: %s\n", path, strerror(errno));
+		goto socket_close;
+	}
+
+	//
+	if (bind(sock_fd, (struct sockaddr *)&sa, sizeof(sa)) == -1) {
+		ERROR("Socket bind failed: %s!\n", strerror(errno));
+		goto socket_close;
+	}
+
+	return sock_fd;
+
+socket_close:
+	close(sock_fd);
+	return -1;
+}
+
+/**
+ * Connect two sockets through server (and client, datagram) addresses.
+ *
+ * Return 0 on success and -1 on error.
+ */
+static int
+__connect(const transport_t *t, int sv[2])
+{
+	struct sockaddr_un sa_server, sa_client;
+	int listen_sock;
+
+	__sockaddr(&sa_server, t->addr, SERVER_SOCK_PATH);
+	__sockaddr(&sa_client, t->addr, CLIENT_SOCK_PATH);
+	sv[0] = sv[1] = -1;
+
+	/*********************************************************
+	 * datagram: both sides bound, each connected to the other
+	 ********************************************************/
+	if (t->sock_type == SOCK_DGRAM) {
+		sv[0] = __bind(SOCK_DGRAM, t->addr, SERVER_SOCK_PATH);
+		sv[1] = __bind(SOCK_DGRAM, t->addr, CLIENT_SOCK_PATH);
+		if (sv[0] == -1 || sv[1] == -1)
+			goto error;
+
+		if (connect(sv[0], (struct sockaddr *)&sa_client,
+												sizeof(sa_client)) == -1 ||
+			connect(sv[1], (struct sockaddr *)&sa_server,
+												sizeof(sa_server)) == -1) {
+			ERROR("Socket connect failed: %s!\n", strerror(errno));
+			goto error;
+		}
+		goto entries_remove;
+	}
+
+	/*********************************************************
+	 * stream, seqpacket: listen, connect and accept
+	 ********************************************************/
+	listen_sock = __bind(t->sock_type, t->addr, SERVER_SOCK_PATH);
+	if (listen_sock == -1)
+		goto error;
+
+	if (listen(listen_sock, 1) == -1) {
+		ERROR("Socket listen failed: %s!\n", strerror(errno));
+		goto listen_socket_close;
+	}
+
+	sv[1] = socket(AF_UNIX, t->sock_type, 0);
+	if (sv[1] == -1) {
+		ERROR("Socket creation failed: %s!\n", strerror(errno));
+		goto listen_socket_close;
+	}
+
+	if (connect(sv[1], (struct sockaddr *)&sa_server,
+												sizeof(sa_server)) == -1) {
+		ERROR("Socket connect failed: %s!\n", strerror(errno));
+		goto listen_socket_close;
+	}
+
+	sv[0] = accept(listen_sock, NULL, NULL);
+	if (sv[0] == -1) {
+		ERROR("Socket accept failed: %s!\n", strerror(errno));
+		goto listen_socket_close;
+	}
+
+	close(listen_sock);
+
+entries_remove:
+	// connected sockets do not need the filesystem entries anymore
+	if (t->addr == ADDR_PATH) {
+		remove(SERVER_SOCK_PATH);
+		remove(CLIENT_SOCK_PATH);
+	}
+	return 0;
+
+listen_socket_close:
+	close(listen_sock);
+error:
+	if (sv[0] != -1)
+		close(sv[0]);
+	if (sv[1] != -1)
+		close(sv[1]);
+	if (t->addr == ADDR_PATH) {
+		remove(SERVER_SOCK_PATH);
+		remove(CLIENT_SOCK_PATH);
+	}
+	return -1;
+}
+
+/**
+ * Create a connected pair of endpoints, a for parent and b for child.
+ *
+ * Return 0 on success and -1 on error.
+ */
+static int
+__pair(const transport_t *t, endpoint_t *a, endpoint_t *b)
+{
+	int p1[2], p2[2], sv[2];
+
+	/*********************************************************
+	 * pipes: p1 from child to parent, p2 from parent to child
+	 ********************************************************/
+	if (!t->sock_type) {
+		if (pipe(p1) == -1) {
+			ERROR("Pipe creation failed: %s!\n", strerror(errno));
+			return -1;
+		}
+		if (pipe(p2) == -1) {
+			ERROR("Pipe creation failed: %s!\n", strerror(errno));
+			close(p1[0]);
+			close(p1[1]);
+			return -1;
+		}
+
+		a->rfd = p1[0];
+		a->wfd = p2[1];
+		b->rfd = p2[0];
+		b->wfd = p1[1];
+		return 0;
+	}
+
+	/*********************************************************
+	 * sockets
+	 ********************************************************/
+	if (t->addr == ADDR_NONE) {
+		if (socketpair(AF_UNIX, t->sock_type, 0, sv) == -1) {
+			ERROR("Socket pairs creation failed: %s!\n", strerror(errno));
+			return -1;
+		}
+	} else if (__connect(t, sv)) {
+		return -1;
+	}
+
+	a->rfd = a->wfd = sv[0];
+	b->rfd = b->wfd = sv[1];
+
+	return 0;
+}
+
+/**
+ * Close an endpoint.
+ */
+static void
+__close(endpoint_t *e)
+{
+	if (e->wfd != e->rfd)
+		close(e->wfd);
+	close(e->rfd);
+}
+
+/**
+ * Set buffer sizes (0 keeps defaults) and parent receive timeout.
+ *
+ * Return buffer size in use (send buffer of the parent) or -1 on error.
+ */
+static int
+__buffers(const transport_t *t, endpoint_t *a, endpoint_t *b, int buf)
+{
+	struct timeval tv = { .tv_sec = RECV_TIMEOUT };
+	socklen_t len = sizeof(int);
+	int fds[2] = { a->rfd, b->rfd }, val;
+
+	//
+	if (!t->sock_type) {
+		if (buf && (fcntl(a->wfd, F_SETPIPE_SZ, buf) == -1 ||
+					fcntl(b->wfd, F_SETPIPE_SZ, buf) == -1)) {
+			ERROR("Pipe resize failed: %s!\n", strerror(errno));
+			return -1;
+		}
+		return fcntl(a->wfd, F_GETPIPE_SZ);
+	}
+
+	//
+	for (int i = 0; buf && i < 2; i++) {
+		if (setsockopt(fds[i], SOL_SOCKET, SO_SNDBUF, &buf, sizeof(buf)) ||
+			setsockopt(fds[i], SOL_SOCKET, SO_RCVBUF, &buf, sizeof(buf))) {
+			ERROR("Socket buffers failed: %s!\n", strerror(errno));
+			return -1;
+		}
+	}
+
+	setsockopt(a->rfd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+	// kernel doubles the value set (bookkeeping overhead)
+	if (getsockopt(a->wfd, SOL_SOCKET, SO_SNDBUF, &val, &len) == -1)
+		return -1;
+
+	return val;
+}
+
+/**
+ * Check a message of a given size can be sent (datagram and seqpacket
+ * messages must fit in the send buffer).
+ */
+static int
+__fits(const transport_t *t, endpoint_t *a, endpoint_t *b, size_t size)
+{
+	if (!__is_message(t))
+		return 1;
+
+	if (send(b->wfd, _buf, size, MSG_DONTWAIT) != size)
+		return 0;
+
+	return recv(a->rfd, _buf, size, 0) == size;
+}
+
+/**
+ * Send a message (streams and pipes may write partially).
+ *
+ * Return 0 on success and -1 on error.
+ */
+static int
+__send(const transport_t *t, int fd, const void *buf, size_t len)
+{
+	ssize_t send_bytes;
+	size_t sent = 0;
+
+	while (sent < len) {
+		send_bytes = write(fd, (const char *)buf + sent, len - sent);
+		if (send_bytes == -1) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		if (__is_message(t))
+			return send_bytes == len ? 0 : -1;
+		sent += send_bytes;
+	}
+
+	return 0;
+}
+
+/**
+ * Receive a message (streams and pipes read until len bytes).
+ *
+ * Return message size on success, 0 on end of file and -1 on error.
+ */
+static ssize_t
+__recv(const transport_t *t, int fd, void *buf, size_t len)
+{
+	ssize_t recv_bytes;
+	size_t recvd = 0;
+
+	while (recvd < len) {
+		recv_bytes = read(fd, (char *)buf + recvd, len - recvd);
+		if (recv_bytes <= 0) {
+			if (recv_bytes == -1 && errno == EINTR)
+				continue;
+			return recv_bytes;
+		}
+		if (__is_message(t))
+			return recv_bytes;
+		recvd += recv_bytes;
+	}
+
+	return recvd;
+}
+
+/**
+ * Mean time to create a connected pair (us).
+ */
+static double
+__setup(const transport_t *t)
+{
+	endpoint_t a, b;
+	uint64_t start;
+	int done = 0;
+
+	start = __time_ns();
+	for (int i = 0; i < SETUP_ITERATIONS; i++) {
+		if (__pair(t, &a, &b))
+			break;
+		__close(&a);
+		__close(&b);
+		done++;
+	}
+
+	return done ? (__time_ns() - start) / 1e3 / done : 0;
+}
+
+/**
+ * Throughput test, child sends nr messages to the parent.
+ *
+ * Return messages per second (0 on error).
+ */
+static double
+__throughput(const transport_t *t, endpoint_t *a, endpoint_t *b, size_t size,
+			long nr)
+{
+	uint64_t start, elapsed;
+	long received = 0;
+
+	//
+	fflush(NULL);
+	switch (fork()) {
+	case -1:
+		ERROR("Fork failed: %s!\n", strerror(errno));
+		return 0;
+	case 0:
+		__close(a);
+		memset(_buf, 'x', size);
+		for (long i = 0; i < nr; i++)
+			if (__send(t, b->wfd, _buf, size))
+				exit(-1);
+		exit(0);
+	default:
+		// child end closed, parent sees end of file if child fails
+		__close(b);
+		b->rfd = b->wfd = -1;
+		break;
+	}
+
+	//
+	start = __time_ns();
+	while (received < nr) {
+		if (__recv(t, a->rfd, _buf, size) != size) {
+			ERROR("Recv failed: %s!\n", strerror(errno));
+			break;
+		}
+		received++;
+	}
+	elapsed = __time_ns() - start;
+
+	wait(NULL);
+
+	return received == nr ? received * 1e9 / elapsed : 0;
+}
+
+/**
+ * Latency test, ping-pong between parent and an echo child.
+ *
+ * Return 0 on success and -1 on error.
+ */
+static int
+__latency(const transport_t *t, endpoint_t *a, endpoint_t *b, size_t size,
+			long nr, histogram_t *hist)
+{
+	uint64_t t0;
+
+	//
+	fflush(NULL);
+	switch (fork()) {
+	case -1:
+		ERROR("Fork failed: %s!\n", strerror(errno));
+		return -1;
+	case 0:
+		__close(a);
+		for (long i = 0; i < nr; i++) {
+			if (__recv(t, b->rfd, _buf, size) != size ||
+				__send(t, b->wfd, _buf, size))
+				exit(-1);
+		}
+		exit(0);
+	default:
+		__close(b);
+		b->rfd = b->wfd = -1;
+		break;
+	}
+
+	//
+	memset(_buf, 'x', size);
+	for (long i = 0; i < nr; i++) {
+		t0 = __time_ns();
+		if (__send(t, a->wfd, _buf, size) ||
+			__recv(t, a->rfd, _buf, size) != size) {
+			ERROR("Ping failed: %s!\n", strerror(errno));
+			break;
+		}
+		histogram_record(hist, __time_ns() - t0);
+	}
+
+	wait(NULL);
+
+	return hist->total == nr ? 0 : -1;
+}
+
+/**
+ * Run the tests of a transport for a message size and buffer size, each one
+ * on a new pair of endpoints, and write a CSV row.
+ */
+static void
+__bench(FILE *out, const transport_t *t, size_t size, int buf, long nr,
+		double setup_us)
+{
+	double msgs = 0;
+	endpoint_t a, b;
+	histogram_t hist;
+	int real_buf = 0;
+
+	histogram_init(&hist);
+
+	/*********************************************************
+	 * throughput
+	 ********************************************************/
+	if (__pair(t, &a, &b))
+		return;
+
+	real_buf = __buffers(t, &a, &b, buf);
+	if (real_buf == -1)
+		goto pair_close;
+
+	if (!__fits(t, &a, &b, size)) {
+		fprintf(stderr, "skip %s/%s size %zu buffer %d: %s\n", t->name,
+				addr_names[t->addr], size, buf, strerror(errno));
+		goto pair_close;
+	}
+
+	msgs = __throughput(t, &a, &b, size, nr);
+	__close(&a);
+	__close(&b);
+
+	/*********************************************************
+	 * latency (round trip)
+	 ********************************************************/
+	if (__pair(t, &a, &b))
+		return;
+
+	if (__buffers(t, &a, &b, buf) == -1)
+		goto pair_close;
+
+	__latency(t, &a, &b, size, nr / 10 ? nr / 10 : 1, &hist);
+
+	//
+	fprintf(out, "%s,%s,%zu,%d,%d,%.2f,%ld,%.0f,%.1f,%.2f,%.2f,%.2f,%.2f\n",
+			t->name, addr_names[t->addr], size, buf, real_buf, setup_us, nr,
+			msgs, msgs * size / (1 << 20), histogram_mean(&hist) / 1e3,
+			histogram_percentile(&hist, 50.0) / 1e3,
+			histogram_percentile(&hist, 99.0) / 1e3, hist.max / 1e3);
+	fflush(out);
+
+pair_close:
+	__close(&a);
+	__close(&b);
+}
+
+/**
+ * Parse a comma separated list of numbers.
+ *
+ * Return number of values.
+ */
+static int
+__list(char *arg, long *values)
+{
+	char *tok, *save;
+	int nr = 0;
+
+	for (tok = strtok_r(arg, ",", &save); tok && nr < LIST_MAX;
+		tok = strtok_r(NULL, ",", &save))
+		values[nr++] = strtol(tok, NULL, 10);
+
+	return nr;
+}
+
+
+/*============================================================================*/
+
+int main(int argc, char *argv[])
+{
+	long def_sizes[] = { 64, 1024, 16384, 65536 };
+	long def_bufs[] = { 0, 32768, 262144 };
+	long sizes[LIST_MAX], bufs[LIST_MAX], nr = MESSAGES, max;
+	int opt, nr_sizes = 0, nr_bufs = 0;
+	const char *file = NULL;
+	double setup_us;
+	FILE *out = stdout;
+
+	/*********************************************************
+	 * parse arguments
+	 ********************************************************/
+	while ((opt = getopt(argc, argv, "n:s:b:o:")) != -1) {
+		switch (opt) {
+		case 'n':
+			nr = atol(optarg);
+			break;
+		case 's':
+			nr_sizes = __list(optarg, sizes);
+			break;
+		case 'b':
+			nr_bufs = __list(optarg, bufs);
+			break;
+		case 'o':
+			file = optarg;
+			break;
+		default:
+			printf("Usage: %s [-n messages] [-s sizes] [-b buffer sizes] "
+					"[-o file.csv]\n", argv[0]);
+			return -1;
+		}
+	}
+
+	if (!nr_sizes) {
+		nr_sizes = sizeof(def_sizes) / sizeof(def_sizes[0]);
+		memcpy(sizes, def_sizes, sizeof(def_sizes));
+	}
+	if (!nr_bufs) {
+		nr_bufs = sizeof(def_bufs) / sizeof(def_bufs[0]);
+		memcpy(bufs, def_bufs, sizeof(def_bufs));
+	}
+
+	//
+	for (int i = 0; i < nr_sizes; i++) {
+		if (sizes[i] < 1 || sizes[i] > MESSAGE_SIZE_MAX) {
+			ERROR("Message size must be between 1 and %d!\n",
+					MESSAGE_SIZE_MAX);
+			return -1;
+		}
+	}
+	for (int i = 0; i < nr_bufs; i++) {
+		if (bufs[i] < 0) {
+			ERROR("Buffer size must be positive (0 for default)!\n");
+			return -1;
+		}
+	}
+	if (nr < 10)
+		nr = 10;
+
+	if (file) {
+		out = fopen(file, "w");
+		if (!out) {
+			ERROR("File %s open failed: %s!\n", file, strerror(errno));
+			return -1;
+		}
+	}
+
+	/*********************************************************
+	 * run all combinations, one CSV row each
+	 ********************************************************/
+	fprintf(out, "transport,address,size,buffer,buffer_real,setup_us,"
+			"messages,msgs_per_s,mb_per_s,rtt_mean_us,rtt_p50_us,rtt_p99_us,"
+			"rtt_max_us\n");
+
+	for (int t = 0; t < sizeof(transports) / sizeof(transports[0]); t++) {
+		setup_us = __setup(&transports[t]);
+
+		for (int s = 0; s < nr_sizes; s++) {
+			max = BYTES_MAX / sizes[s];
+			for (int b = 0; b < nr_bufs; b++)
+				__bench(out, &transports[t], sizes[s], bufs[b],
+						nr < max ? nr : max, setup_us);
+		}
+	}
+
+	if (file)
+		fclose(out);
+
+	return 0;
+}
@@ -0,0 +1,313 @@
+/**
+ * Load driver for the unix domain seqpacket server.
+ *
+ * Copyright (C) 2024 Lazar Razvan.
+ *
+ * A growing number of client processes (1, 2, 4, ... up to max clients)
+ * connect to seqpacket_server and send messages one after another, waiting
+ * for each echo. For each number of clients, aggregate messages per second,
+ * messages per second per client and the mean round trip time are reported,
+ * showing how the single epoll loop of the server scales with clients.
+ *
+ * Logic:
+ *
+ * 1) fork()
+ * 		Create client processes, each one connects to the server and tells
+ * 	the parent it is ready (pipe).
+ *
+ * 2) start
+ * 		Parent releases all clients at once (pipe) and lets them run for the
+ * 	test duration, then sets the stop flag in shared memory.
+ *
+ * 3) send()/recv()
+ * 		Each client counts the echoed messages in shared memory.
+ *
+ * Usage:
+ * 	./run/seqpacket_load [-c max clients] [-d seconds] [-s message size]
+ * 	./run/seqpacket_load -c 64 -d 2 -s 64
+ */
+
+#include <time.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include <sys/un.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+
+#include "debug.h"
+#include "seqpacket_common.h"
+
+
+/*============================================================================*/
+
+// Default max clients
+#define CLIENTS						32
+
+// Max clients
+#define CLIENTS_MAX					1024
+
+// Default test duration for each number of clients (seconds)
+#define DURATION					2
+
+// Default message size
+#define MESSAGE_SIZE				64
+
+/**
+ * Memory shared by parent and clients.
+ */
+typedef struct shared_s {
+
+	int			stop;						// clients stop sending
+	uint64_t	messages[CLIENTS_MAX];		// messages echoed per client
+	uint64_t	rtt_ns[CLIENTS_MAX];		// round trip time sum per client
+
+} shared_t;
+
+static shared_t *shared;
+
+
+/*============================================================================*/
+
+static inline uint64_t
+__time_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * Connect to the server.
+ *
+ * Return socket on success and -1 on error.
+ */
+static int
+__connect(void)
+{
+	struct sockaddr_un sa_server;
+	int sock_fd;
+
+	//
+	sock_fd = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+	if (sock_fd == -1) {
+		ERROR("Socket creation failed: %s!\n", strerror(errno));
+		return -1;
+	}
+
+	memset(&sa_server, 0, sizeof(struct sockaddr_un));
+	sa_server.sun_family = AF_UNIX;
+#if ENABLE_ABSTRACT_SOCKET
+	memcpy(&sa_server.sun_path[1], SERVER_SOCK_PATH, strlen(SERVER_SOCK_PATH));
+#else
+	memcpy(sa_server.sun_path, SERVER_SOCK_PATH, strlen(SERVER_SOCK_PATH));
+#endif	// ENABLE_ABSTRACT_SOCKET
+
+	//
+	if (connect(sock_fd, (struct sockaddr *)&sa_server,
+										sizeof(struct sockaddr_un)) == -1) {
+		ERROR("Socket connect failed: %s!\n", strerror(errno));
+		close(sock_fd);
+		return -1;
+	}
+
+	return sock_fd;
+}
+
+/**
+ * Client process.
+ */
+static void
+__client(int idx, int ready_fd, int go_fd, size_t size)
+{
+	char _buf[BUFFER_SIZE], c = 'R';
+	ssize_t recv_bytes;
+	uint64_t t0;
+	int sock_fd;
+
+	//
+	sock_fd = __connect();
+	if (sock_fd == -1)
+		exit(-1);
+
+	memset(_buf, 'x', size);
+
+	// ready (pipe closed, so parent sees end of file if a client fails)
+	if (write(ready_fd, &c, 1) != 1)
+		exit(-1);
+	close(ready_fd);
+
+	// wait for start
+	if (read(go_fd, &c, 1) != 1)
+		exit(-1);
+
+	//
+	while (!__atomic_load_n(&shared->stop, __ATOMIC_RELAXED)) {
+		t0 = __time_ns();
+		if (send(sock_fd, _buf, size, 0) != size) {
+			ERROR("Send failed: %s!\n", strerror(errno));
+			break;
+		}
+
+		// one recv() is one whole message
+		recv_bytes = recv(sock_fd, _buf, BUFFER_SIZE, 0);
+		if (recv_bytes != size) {
+			ERROR("Recv failed (%zd bytes): %s!\n", recv_bytes,
+					strerror(errno));
+			break;
+		}
+
+		shared->rtt_ns[idx] += __time_ns() - t0;
+		shared->messages[idx]++;
+	}
+
+	close(sock_fd);
+	exit(0);
+}
+
+/**
+ * Run a test with a given number of clients.
+ */
+static void
+__test(int clients, int duration, size_t size)
+{
+	int ready[2], go[2], started = 0;
+	uint64_t start, elapsed, messages = 0, rtt = 0;
+	char c;
+
+	//
+	memset(shared, 0, sizeof(shared_t));
+	if (pipe(ready) == -1 || pipe(go) == -1) {
+		ERROR("Pipe creation failed: %s!\n", strerror(errno));
+		exit(-1);
+	}
+
+	/*********************************************************
+	 * create clients and wait until all are connected
+	 ********************************************************/
+	fflush(stdout);
+	for (int i = 0; i < clients; i++) {
+		switch (fork()) {
+		case -1:
+			ERROR("Fork failed: %s!\n", strerror(errno));
+			break;
+		case 0:
+			close(ready[0]);
+			close(go[1]);
+			__client(i, ready[1], go[0], size);
+			exit(-1);
+		default:
+			started++;
+			break;
+		}
+	}
+
+	close(ready[1]);
+	close(go[0]);
+	for (int i = 0, nr = started; i < nr; i++)
+		if (read(ready[0], &c, 1) != 1)
+			started--;
+
+	/*********************************************************
+	 * release clients, run, stop
+	 ********************************************************/
+	start = __time_ns();
+	for (int i = 0; i < started; i++)
+		if (write(go[1], &c, 1) != 1)
+			ERROR("Start failed: %s!\n", strerror(errno));
+
+	sleep(duration);
+	__atomic_store_n(&shared->stop, 1, __ATOMIC_RELAXED);
+	elapsed = __time_ns() - start;
+
+	//
+	while (wait(NULL) > 0)
+		;
+	close(ready[0]);
+	close(go[1]);
+
+	for (int i = 0; i < clients; i++) {
+		messages += shared->messages[i];
+		rtt += shared->rtt_ns[i];
+	}
+
+	printf("%8d %8d %14.0f %14.0f %12.2f\n", clients, started,
+			messages * 1e9 / elapsed,
+			started ? messages * 1e9 / elapsed / started : 0,
+			messages ? rtt / 1e3 / messages : 0);
+}
+
+
+/*============================================================================*/
+
+int main(int argc, char *argv[])
+{
+	int opt, max_clients = CLIENTS, duration = DURATION;
+	size_t size = MESSAGE_SIZE;
+
+	/*********************************************************
+	 * parse arguments
+	 ********************************************************/
+	while ((opt = getopt(argc, argv, "c:d:s:")) != -1) {
+		switch (opt) {
+		case 'c':
+			max_clients = atoi(optarg);
+			break;
+		case 'd':
+			duration = atoi(optarg);
+			break;
+		case 's':
+			size = strtoul(optarg, NULL, 10);
+			break;
+		default:
+			printf("Usage: %s [-c max clients] [-d seconds] "
+					"[-s message size]\n", argv[0]);
+			return -1;
+		}
+	}
+
+	if (max_clients < 1)
+		max_clients = 1;
+	if (max_clients > CLIENTS_MAX)
+		max_clients = CLIENTS_MAX;
+	if (duration < 1)
+		duration = 1;
+	if (!size || size > BUFFER_SIZE) {
+		ERROR("Message size must be between 1 and %d!\n", BUFFER_SIZE);
+		return -1;
+	}
+
+	//
+	shared = mmap(NULL, sizeof(shared_t), PROT_READ | PROT_WRITE,
+				MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (shared == MAP_FAILED) {
+		ERROR("Shared memory creation failed: %s!\n", strerror(errno));
+		return -1;
+	}
+
+	/*********************************************************
+	 * double the clients until max clients (always tested)
+	 ********************************************************/
+	printf("message size %zu, %d s per test\n", size, duration);
+	printf("%8s %8s %14s %14s %12s\n", "clients", "running", "msgs/s",
+			"msgs/s/client", "rtt_us");
+	for (int clients = 1; ; clients *= 2) {
+		if (clients > max_clients)
+			clients = max_clients;
+
+		__test(clients, duration, size);
+		if (clients == max_clients)
+			break;
+	}
+
+	munmap(shared, sizeof(shared_t));
+
+	return 0;
+}
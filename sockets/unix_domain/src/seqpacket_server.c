@@ -0,0 +1,365 @@
+/**
+ * Server for unix domain seqpacket sockets application, echoing each message
+ * back to its client and serving all clients from one epoll loop.
+ *
+ * Copyright (C) 2024 Lazar Razvan.
+ *
+ * Seqpacket sockets are connection oriented like stream sockets, but keep
+ * message boundaries like datagram sockets: each recv() returns exactly one
+ * message sent by the peer (truncated if buffer is too small, reported by
+ * MSG_TRUNC), in order and reliably. For unix domain sockets, AF_UNIX(PF_UNIX)
+ * must be used and sockaddr_un data structure.
+ *
+ * Logic:
+ *
+ * 1) socket()
+ * 		Create a seqpacket socket of unix domain.
+ *
+ * 2) bind()
+ * 		Bind the socket to an abstract address (if ENABLE_ABSTRACT_SOCKET) or
+ * 	to an entry in the filesystem.
+ *
+ * 3) listen()
+ * 		Waiting for incoming connections.
+ *
+ * 4) epoll_wait()
+ * 		Wait for new connections (listening socket) or for messages from any
+ * 	client, so no client blocks the others.
+ *
+ * 5) accept()
+ * 		Accept an incoming connection and keep its state (epoll data).
+ *
+ * 6) recv()/send()
+ * 		Receive messages from a client (up to MESSAGES_BATCH at once, so a
+ * 	busy client does not starve the others) and echo each one back without
+ * 	blocking. A client not reading its echoes keeps the reply pending: the
+ * 	server stops reading from it (EPOLLOUT instead of EPOLLIN) until the reply
+ * 	is sent, so the other clients are still served.
+ *
+ * An empty message is valid (and echoed), so end-of-file is told apart by
+ * EPOLLRDHUP/EPOLLHUP and not only by recv() returning 0.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include <sys/un.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+
+#include "debug.h"
+#include "seqpacket_common.h"
+
+
+/*============================================================================*/
+
+// Messages handled for a client before serving the others
+#define MESSAGES_BATCH				16
+
+/**
+ * Connection state.
+ */
+typedef struct connection_s {
+
+	int			fd;				// client socket
+	unsigned	id;				// connection number
+	uint64_t	messages;		// messages echoed
+	uint64_t	bytes;			// bytes echoed
+	uint64_t	truncated;		// messages larger than BUFFER_SIZE
+	uint64_t	stalls;			// replies that would block
+	char		*out;			// pending reply (BUFFER_SIZE, on first stall)
+	ssize_t		out_len;		// pending reply length (-1 if none)
+
+} connection_t;
+
+
+/*============================================================================*/
+
+/**
+ * Set events waited for a client (EPOLLIN, or EPOLLOUT while a reply is
+ * pending).
+ */
+static int
+__epoll_set(int epoll_fd, int op, connection_t *conn, uint32_t events)
+{
+	struct epoll_event ev;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = events | EPOLLRDHUP;
+	ev.data.ptr = conn;
+	if (epoll_ctl(epoll_fd, op, conn->fd, &ev) == -1) {
+		ERROR("Epoll set failed: %s!\n", strerror(errno));
+		return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * Echo a message without blocking.
+ *
+ * Seqpacket send() is atomic, so a message is sent whole or not at all. A
+ * message that would block is copied as the pending reply of the client.
+ *
+ * Return 0 if sent, 1 if pending and -1 on error.
+ */
+static int
+__echo(connection_t *conn, const char *buf, ssize_t len)
+{
+	if (send(conn->fd, buf, len, MSG_DONTWAIT | MSG_NOSIGNAL) == len)
+		return 0;
+
+	// client gone
+	if (errno == EPIPE || errno == ECONNRESET)
+		return -1;
+
+	if (errno != EAGAIN && errno != EWOULDBLOCK) {
+		ERROR("Send to connection %u failed: %s!\n", conn->id,
+				strerror(errno));
+		return -1;
+	}
+
+	//
+	if (!conn->out) {
+		conn->out = malloc(BUFFER_SIZE);
+		if (!conn->out) {
+			ERROR("Reply allocation failed!\n");
+			return -1;
+		}
+	}
+
+	if (buf != conn->out) {
+		memcpy(conn->out, buf, len);
+		conn->out_len = len;
+		conn->stalls++;
+	}
+
+	return 1;
+}
+
+
+/*============================================================================*/
+
+int main(int argc, char *argv[])
+{
+	int listen_sock, epoll_fd, peer_sock, nr, rv;
+	struct epoll_event ev, events[EVENTS_MAX];
+	unsigned connections = 0, active = 0;
+	ssize_t recv_bytes;
+	struct sockaddr_un sa_server;
+	char _buf[BUFFER_SIZE];
+	connection_t *conn;
+
+	/*********************************************************
+	 * create the unix domain, seqpacket socket
+	 ********************************************************/
+	listen_sock = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+	if (listen_sock == -1) {
+		ERROR("Socket creation failed: %s!\n", strerror(errno));
+		goto error;
+	}
+
+#if ENABLE_ABSTRACT_SOCKET
+	/*********************************************************
+	 * create an abstract socket (first byte of sun_path is
+	 * '\0', no entry in the filesystem)
+	 ********************************************************/
+	if (strlen(SERVER_SOCK_PATH) + 1 >= sizeof(sa_server.sun_path)) {
+		ERROR("Socket path exceed buffer size!");
+		goto listen_socket_close;
+	}
+
+	memset(&sa_server, 0, sizeof(struct sockaddr_un));
+	sa_server.sun_family = AF_UNIX;
+	memcpy(&sa_server.sun_path[1], SERVER_SOCK_PATH, strlen(SERVER_SOCK_PATH));
+#else
+	/*********************************************************
+	 * bind socket to an address (make sure path not exceed buffer)
+	 ********************************************************/
+	if (strlen(SERVER_SOCK_PATH) >= sizeof(sa_server.sun_path)) {
+		ERROR("Socket path exceed buffer size!");
+		goto listen_socket_close;
+	}
+
+	memset(&sa_server, 0, sizeof(struct sockaddr_un));
+	sa_server.sun_family = AF_UNIX;
+	memcpy(sa_server.sun_path, SERVER_SOCK_PATH, strlen(SERVER_SOCK_PATH));
+
+	//
+	if (remove(sa_server.sun_path) == -1 && errno != ENOENT) {
+		ERROR("File %s deletion failed: %s\n", sa_server.sun_path,
+				strerror(errno));
+		goto listen_socket_close;
+	}
+#endif	// ENABLE_ABSTRACT_SOCKET
+
+	//
+	if (bind(listen_sock, (struct sockaddr *)&sa_server,
+										sizeof(struct sockaddr_un)) == -1) {
+		ERROR("Socket bind failed: %s!\n", strerror(errno));
+		goto listen_socket_close;
+	}
+
+	/*********************************************************
+	 * listen for new connections
+	 ********************************************************/
+	if (listen(listen_sock, SERVER_SOCK_BACKLOG) == -1) {
+		ERROR("Socket listen failed: %s!\n", strerror(errno));
+		goto bind_entry_remove;
+	}
+
+	/*********************************************************
+	 * create epoll instance, listening socket has no state
+	 * (data.ptr is NULL)
+	 ********************************************************/
+	epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (epoll_fd == -1) {
+		ERROR("Epoll creation failed: %s!\n", strerror(errno));
+		goto bind_entry_remove;
+	}
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.ptr = NULL;
+	if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_sock, &ev) == -1) {
+		ERROR("Epoll add failed: %s!\n", strerror(errno));
+		goto epoll_close;
+	}
+
+	/*********************************************************
+	 * serve all clients
+	 *
+	 * Each message is received whole (boundaries are kept)
+	 * and echoed back. Client closing the connection is seen
+	 * as end-of-file (EPOLLRDHUP and recv() returns 0).
+	 ********************************************************/
+	while (1) {
+		nr = epoll_wait(epoll_fd, events, EVENTS_MAX, -1);
+		if (nr == -1) {
+			if (errno == EINTR)
+				continue;
+			ERROR("Epoll wait failed: %s!\n", strerror(errno));
+			goto epoll_close;
+		}
+
+		for (int i = 0; i < nr; i++) {
+			conn = events[i].data.ptr;
+
+			// new connection
+			if (!conn) {
+				peer_sock = accept(listen_sock, NULL, NULL);
+				if (peer_sock == -1) {
+					ERROR("Socket accept failed: %s!\n", strerror(errno));
+					continue;
+				}
+
+				conn = calloc(1, sizeof(connection_t));
+				if (!conn) {
+					ERROR("Connection allocation failed!\n");
+					close(peer_sock);
+					continue;
+				}
+				conn->fd = peer_sock;
+				conn->id = connections++;
+				conn->out_len = -1;
+
+				//
+				if (__epoll_set(epoll_fd, EPOLL_CTL_ADD, conn, EPOLLIN)) {
+					close(peer_sock);
+					free(conn);
+					continue;
+				}
+
+				active++;
+				DEBUG("Connection %u accepted (%u active)!\n", conn->id, active);
+				continue;
+			}
+
+			/*********************************************************
+			 * pending reply, client can take it now (or closed the
+			 * connection), then read its messages again
+			 ********************************************************/
+			if (conn->out_len != -1) {
+				rv = __echo(conn, conn->out, conn->out_len);
+				if (rv == -1)
+					goto connection_close;
+
+				// client closed its side and does not read (no spin)
+				if (rv == 1) {
+					if (events[i].events & (EPOLLRDHUP | EPOLLHUP))
+						goto connection_close;
+					continue;
+				}
+
+				conn->messages++;
+				conn->bytes += conn->out_len;
+				conn->out_len = -1;
+				if (__epoll_set(epoll_fd, EPOLL_CTL_MOD, conn, EPOLLIN))
+					goto connection_close;
+				continue;
+			}
+
+			// messages from client (without blocking once drained)
+			for (int j = 0; j < MESSAGES_BATCH; j++) {
+				recv_bytes = recv(conn->fd, _buf, BUFFER_SIZE,
+								MSG_DONTWAIT | MSG_TRUNC);
+				if (recv_bytes == -1) {
+					if (errno == EAGAIN || errno == EINTR)
+						break;
+					ERROR("Recv from connection %u failed: %s!\n", conn->id,
+							strerror(errno));
+					goto connection_close;
+				}
+
+				// peer closed the connection (else an empty message)
+				if (recv_bytes == 0 &&
+					events[i].events & (EPOLLRDHUP | EPOLLHUP))
+					goto connection_close;
+
+				// MSG_TRUNC returns the real message length
+				if (recv_bytes > BUFFER_SIZE) {
+					conn->truncated++;
+					recv_bytes = BUFFER_SIZE;
+				}
+
+				// client does not read, stop reading until reply is sent
+				rv = __echo(conn, _buf, recv_bytes);
+				if (rv == -1)
+					goto connection_close;
+				if (rv == 1) {
+					if (__epoll_set(epoll_fd, EPOLL_CTL_MOD, conn, EPOLLOUT))
+						goto connection_close;
+					break;
+				}
+
+				conn->messages++;
+				conn->bytes += recv_bytes;
+			}
+			continue;
+
+connection_close:
+			active--;
+			DEBUG("Connection %u closed: %lu messages, %lu bytes, %lu truncated, "
+					"%lu stalls (%u active)!\n", conn->id, conn->messages,
+					conn->bytes, conn->truncated, conn->stalls, active);
+			close(conn->fd);
+			free(conn->out);
+			free(conn);
+		}
+	}
+
+epoll_close:
+	close(epoll_fd);
+bind_entry_remove:
+#if !ENABLE_ABSTRACT_SOCKET
+	remove(SERVER_SOCK_PATH);
+#endif
+listen_socket_close:
+	close(listen_sock);
+error:
+	return -1;
+}
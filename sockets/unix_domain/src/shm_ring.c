@@ -0,0 +1,625 @@
+/**
+ * Shared memory ring transport (memfd + eventfd).
+ *
+ * Copyright (C) 2024 Lazar Razvan.
+ *
+ * Messages are copied into a ring in a shared memory segment instead of going
+ * through the kernel (send()/recv() copy data into and out of socket buffers
+ * and wake up the peer for each message).
+ *
+ * Logic:
+ *
+ * 1) memfd_create()
+ * 		Create an anonymous shared segment (ring header and data), together
+ * 	with two eventfds used to sleep when the ring is empty (consumer) or full
+ * 	(producers).
+ *
+ * 2) sendmsg() (SCM_RIGHTS)
+ * 		Send the three descriptors over a unix socket, the peer maps the same
+ * 	segment (shm_ring_recv()).
+ *
+ * 3) write
+ * 		Producer reserves a record (head), copies the message and publishes it.
+ * 	With a single producer the head is only stored, with several producers
+ * 	(SHM_RING_MPSC) the record is reserved with compare and swap and published
+ * 	by writing its size last, so the consumer stops at the first record that
+ * 	is not committed yet (consumed records are zeroed).
+ *
+ * 4) read
+ * 		Consumer copies the message and moves the tail.
+ *
+ * Each side polls the ring for a while and then sleeps on an eventfd, after
+ * telling the peer it is waiting (cons_waiting/prod_waiting). The peer writes
+ * the eventfd only in that case, so system calls are done when the ring goes
+ * from empty to non-empty (or from full to non-full) while the peer sleeps,
+ * not for each message. The waiting flag is set before the ring is checked
+ * again and the peer updates the ring before checking the flag (sequentially
+ * consistent atomics), so a wakeup is never lost.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include <sys/un.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/eventfd.h>
+
+#include "debug.h"
+#include "shm_ring.h"
+
+
+/*============================================================================*/
+
+// Descriptors sent for each ring (memfd, data eventfd, space eventfd)
+#define SHM_RING_FDS				3
+
+
+/*============================================================================*/
+
+static inline void
+__cpu_relax(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#endif
+}
+
+/**
+ * Record size (header and message rounded up to 8 bytes).
+ */
+static inline uint64_t
+__rec_size(uint32_t len)
+{
+	return sizeof(shm_ring_rec_t) + (((uint64_t)len + 7) & ~7ULL);
+}
+
+/**
+ * Wake up the consumer if it sleeps (called after publishing).
+ */
+static void
+__data_notify(shm_ring_t *ring)
+{
+	uint64_t val = 1;
+
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (!__atomic_load_n(&ring->hdr->cons_waiting, __ATOMIC_RELAXED))
+		return;
+
+	// several producers may see the flag, only one writes
+	if (__atomic_exchange_n(&ring->hdr->cons_waiting, 0, __ATOMIC_SEQ_CST)) {
+		if (write(ring->data_fd, &val, sizeof(val)) != sizeof(val))
+			ERROR("eventfd write failed: %s!\n", strerror(errno));
+		__atomic_fetch_add(&ring->hdr->data_wakeups, 1, __ATOMIC_RELAXED);
+	}
+}
+
+/**
+ * Wake up sleeping producers (called after moving the tail).
+ */
+static void
+__space_notify(shm_ring_t *ring)
+{
+	uint64_t val;
+
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (!__atomic_load_n(&ring->hdr->prod_waiting, __ATOMIC_RELAXED))
+		return;
+
+	// semaphore eventfd, one token for each waiting producer
+	val = __atomic_exchange_n(&ring->hdr->prod_waiting, 0, __ATOMIC_SEQ_CST);
+	if (val) {
+		if (write(ring->space_fd, &val, sizeof(val)) != sizeof(val))
+			ERROR("eventfd write failed: %s!\n", strerror(errno));
+		__atomic_fetch_add(&ring->hdr->space_wakeups, 1, __ATOMIC_RELAXED);
+	}
+}
+
+/**
+ * Check if size bytes are free after head.
+ *
+ * Another producer may have moved the head (and the consumer the tail) past a
+ * stale head, the difference is then negative and the caller retries.
+ */
+static inline int
+__space_ready(shm_ring_t *ring, uint64_t head, uint64_t size, int order)
+{
+	uint64_t tail = __atomic_load_n(&ring->hdr->tail, order);
+
+	return (int64_t)(head + size - tail) <= (int64_t)ring->hdr->capacity;
+}
+
+/**
+ * Wait until size bytes are free after head.
+ */
+static void
+__space_wait(shm_ring_t *ring, uint64_t head, uint64_t size)
+{
+	shm_ring_hdr_t *hdr = ring->hdr;
+	uint32_t waiting;
+	uint64_t val;
+
+	for (int spin = 0; ; spin++) {
+		if (__space_ready(ring, head, size, __ATOMIC_ACQUIRE))
+			return;
+
+		if (spin < ring->spin) {
+			__cpu_relax();
+			continue;
+		}
+
+		/*********************************************************
+		 * register as waiting and check again, consumer moves
+		 * the tail before checking prod_waiting
+		 ********************************************************/
+		__atomic_fetch_add(&hdr->prod_waiting, 1, __ATOMIC_SEQ_CST);
+		if (__space_ready(ring, head, size, __ATOMIC_SEQ_CST)) {
+			// unregister (a token posted meanwhile is a spurious wakeup)
+			waiting = __atomic_load_n(&hdr->prod_waiting, __ATOMIC_RELAXED);
+			while (waiting && !__atomic_compare_exchange_n(&hdr->prod_waiting,
+								&waiting, waiting - 1, 0, __ATOMIC_SEQ_CST,
+								__ATOMIC_RELAXED))
+				;
+			return;
+		}
+
+		if (read(ring->space_fd, &val, sizeof(val)) == -1 && errno != EINTR)
+			ERROR("eventfd read failed: %s!\n", strerror(errno));
+		spin = 0;
+	}
+}
+
+/**
+ * Check if the record at tail is published.
+ */
+static inline int
+__data_ready(shm_ring_t *ring, uint64_t tail)
+{
+	shm_ring_rec_t *rec = (shm_ring_rec_t *)(ring->data +
+										(tail & (ring->hdr->capacity - 1)));
+
+	if (ring->hdr->flags & SHM_RING_MPSC)
+		return __atomic_load_n(&rec->size, __ATOMIC_ACQUIRE) != 0;
+
+	return __atomic_load_n(&ring->hdr->head, __ATOMIC_ACQUIRE) != tail;
+}
+
+/**
+ * Wait until the record at tail is published.
+ *
+ * Return 0 when a record is ready and -1 if ring is closed and drained.
+ */
+static int
+__data_wait(shm_ring_t *ring, uint64_t tail)
+{
+	shm_ring_hdr_t *hdr = ring->hdr;
+	uint64_t val;
+
+	for (int spin = 0; ; spin++) {
+		if (__data_ready(ring, tail))
+			return 0;
+
+		if (__atomic_load_n(&hdr->closed, __ATOMIC_ACQUIRE))
+			return __data_ready(ring, tail) ? 0 : -1;
+
+		if (spin < ring->spin) {
+			__cpu_relax();
+			continue;
+		}
+
+		/*********************************************************
+		 * register as waiting and check again, producers publish
+		 * before checking cons_waiting
+		 ********************************************************/
+		__atomic_store_n(&hdr->cons_waiting, 1, __ATOMIC_SEQ_CST);
+		if (__data_ready(ring, tail) ||
+			__atomic_load_n(&hdr->closed, __ATOMIC_SEQ_CST)) {
+			__atomic_store_n(&hdr->cons_waiting, 0, __ATOMIC_RELAXED);
+			continue;
+		}
+
+		if (read(ring->data_fd, &val, sizeof(val)) == -1 && errno != EINTR)
+			ERROR("eventfd read failed: %s!\n", strerror(errno));
+		spin = 0;
+	}
+}
+
+/**
+ * Map ring segment.
+ */
+static int
+__ring_map(shm_ring_t *ring, size_t map_size)
+{
+	ring->hdr = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+					ring->mem_fd, 0);
+	if (ring->hdr == MAP_FAILED) {
+		ERROR("mmap failed: %s!\n", strerror(errno));
+		ring->hdr = NULL;
+		return -1;
+	}
+
+	ring->map_size = map_size;
+	ring->data = (uint8_t *)ring->hdr + sizeof(shm_ring_hdr_t);
+
+	// polling only helps if the peer runs on another cpu meanwhile
+	ring->spin = sysconf(_SC_NPROCESSORS_ONLN) > 1 ? SHM_RING_SPIN : 0;
+
+	return 0;
+}
+
+
+/*============================================================================*/
+
+/**
+ * Create a ring.
+ *
+ * @ring     : Ring handle.
+ * @capacity : Data size (rounded up to a power of two).
+ * @flags    : SHM_RING_MPSC if several processes write the ring.
+ *
+ * Return 0 on success and -1 on error.
+ */
+int
+shm_ring_create(shm_ring_t *ring, size_t capacity, int flags)
+{
+	size_t cap = 4096;
+
+	//
+	while (cap < capacity)
+		cap <<= 1;
+
+	memset(ring, 0, sizeof(shm_ring_t));
+	ring->data_fd = -1;
+	ring->space_fd = -1;
+
+	/*********************************************************
+	 * anonymous file in memory, shared by descriptor only
+	 ********************************************************/
+	ring->mem_fd = memfd_create("shm_ring", MFD_CLOEXEC);
+	if (ring->mem_fd == -1) {
+		ERROR("memfd_create failed: %s!\n", strerror(errno));
+		goto error;
+	}
+
+	if (ftruncate(ring->mem_fd, sizeof(shm_ring_hdr_t) + cap) == -1) {
+		ERROR("ftruncate failed: %s!\n", strerror(errno));
+		goto error;
+	}
+
+	/*********************************************************
+	 * space eventfd is a semaphore, each sleeping producer
+	 * consumes one token
+	 ********************************************************/
+	ring->data_fd = eventfd(0, EFD_CLOEXEC);
+	ring->space_fd = eventfd(0, EFD_CLOEXEC | EFD_SEMAPHORE);
+	if (ring->data_fd == -1 || ring->space_fd == -1) {
+		ERROR("eventfd failed: %s!\n", strerror(errno));
+		goto error;
+	}
+
+	//
+	if (__ring_map(ring, sizeof(shm_ring_hdr_t) + cap))
+		goto error;
+
+	// segment is zeroed (no record committed)
+	ring->hdr->capacity = cap;
+	ring->hdr->flags = flags;
+
+	return 0;
+
+error:
+	shm_ring_destroy(ring);
+	return -1;
+}
+
+/**
+ * Attach to a ring created by another process.
+ *
+ * @ring     : Ring handle.
+ * @mem_fd   : Ring memfd.
+ * @data_fd  : Data eventfd.
+ * @space_fd : Space eventfd.
+ *
+ * Return 0 on success and -1 on error.
+ */
+int
+shm_ring_attach(shm_ring_t *ring, int mem_fd, int data_fd, int space_fd)
+{
+	struct stat st;
+
+	//
+	memset(ring, 0, sizeof(shm_ring_t));
+	ring->mem_fd = mem_fd;
+	ring->data_fd = data_fd;
+	ring->space_fd = space_fd;
+
+	//
+	if (fstat(mem_fd, &st) == -1) {
+		ERROR("fstat failed: %s!\n", strerror(errno));
+		goto error;
+	}
+
+	if (st.st_size <= sizeof(shm_ring_hdr_t)) {
+		ERROR("Invalid ring segment size %ld!\n", (long)st.st_size);
+		goto error;
+	}
+
+	if (__ring_map(ring, st.st_size))
+		goto error;
+
+	//
+	if (ring->hdr->capacity != st.st_size - sizeof(shm_ring_hdr_t) ||
+		(ring->hdr->capacity & (ring->hdr->capacity - 1))) {
+		ERROR("Invalid ring capacity!\n");
+		goto error;
+	}
+
+	return 0;
+
+error:
+	shm_ring_destroy(ring);
+	return -1;
+}
+
+/**
+ * Send ring descriptors over a unix socket (SCM_RIGHTS).
+ *
+ * @ring     : Ring handle.
+ * @sock_fd  : Unix domain socket.
+ *
+ * Return 0 on success and -1 on error.
+ */
+int
+shm_ring_send(shm_ring_t *ring, int sock_fd)
+{
+	int fds[SHM_RING_FDS] = { ring->mem_fd, ring->data_fd, ring->space_fd };
+	struct msghdr msg;
+	struct iovec iov;
+	struct cmsghdr *cmsg;
+	char byte = 'R';
+	union {
+		char buf[CMSG_SPACE(sizeof(fds))];
+		struct cmsghdr align;
+	} control;
+
+	// at least one byte of data is sent together with ancillary data
+	iov.iov_base = &byte;
+	iov.iov_len = 1;
+
+	//
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control.buf;
+	msg.msg_controllen = sizeof(control.buf);
+
+	//
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+	memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+	//
+	if (sendmsg(sock_fd, &msg, 0) != 1) {
+		ERROR("sendmsg failed: %s!\n", strerror(errno));
+		return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * Receive ring descriptors from a unix socket and attach to the ring.
+ *
+ * @ring     : Ring handle.
+ * @sock_fd  : Unix domain socket.
+ *
+ * Return 0 on success and -1 on error.
+ */
+int
+shm_ring_recv(shm_ring_t *ring, int sock_fd)
+{
+	int fds[SHM_RING_FDS];
+	struct msghdr msg;
+	struct iovec iov;
+	struct cmsghdr *cmsg;
+	char byte;
+	union {
+		char buf[CMSG_SPACE(sizeof(fds))];
+		struct cmsghdr align;
+	} control;
+
+	//
+	iov.iov_base = &byte;
+	iov.iov_len = 1;
+
+	//
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control.buf;
+	msg.msg_controllen = sizeof(control.buf);
+
+	//
+	if (recvmsg(sock_fd, &msg, MSG_CMSG_CLOEXEC) != 1) {
+		ERROR("recvmsg failed: %s!\n", strerror(errno));
+		return -1;
+	}
+
+	//
+	cmsg = CMSG_FIRSTHDR(&msg);
+	if (!cmsg || cmsg->cmsg_level != SOL_SOCKET ||
+		cmsg->cmsg_type != SCM_RIGHTS ||
+		cmsg->cmsg_len != CMSG_LEN(sizeof(fds))) {
+		ERROR("Ring descriptors not received!\n");
+		return -1;
+	}
+	memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+
+	return shm_ring_attach(ring, fds[0], fds[1], fds[2]);
+}
+
+/**
+ * Write a message, block while ring is full.
+ *
+ * @ring     : Ring handle.
+ * @buf      : Message.
+ * @len      : Message length (record must fit in the ring).
+ *
+ * Return 0 on success and -1 if message is too large.
+ */
+int
+shm_ring_write(shm_ring_t *ring, const void *buf, uint32_t len)
+{
+	shm_ring_hdr_t *hdr = ring->hdr;
+	uint64_t cap = hdr->capacity, need = __rec_size(len), head, off, size;
+	int mpsc = hdr->flags & SHM_RING_MPSC;
+	shm_ring_rec_t *rec;
+
+	//
+	if (need > cap || len & SHM_RING_REC_PAD) {
+		ERROR("Message too large (%u bytes)!\n", len);
+		return -1;
+	}
+
+	while (1) {
+		head = __atomic_load_n(&hdr->head, __ATOMIC_RELAXED);
+		off = head & (cap - 1);
+
+		// record does not fit before the end, pad and wrap
+		size = off + need > cap ? cap - off : need;
+
+		//
+		__space_wait(ring, head, size);
+		if (mpsc && !__atomic_compare_exchange_n(&hdr->head, &head,
+								head + size, 0, __ATOMIC_RELAXED,
+								__ATOMIC_RELAXED))
+			continue;
+
+		//
+		rec = (shm_ring_rec_t *)(ring->data + off);
+		if (size != need) {
+			if (mpsc) {
+				__atomic_store_n(&rec->size, size | SHM_RING_REC_PAD,
+								__ATOMIC_RELEASE);
+			} else {
+				rec->size = size | SHM_RING_REC_PAD;
+				__atomic_store_n(&hdr->head, head + size, __ATOMIC_RELEASE);
+			}
+			continue;
+		}
+
+		// size is written last, it commits the record
+		rec->len = len;
+		memcpy(rec + 1, buf, len);
+		if (mpsc) {
+			__atomic_store_n(&rec->size, need, __ATOMIC_RELEASE);
+		} else {
+			rec->size = need;
+			__atomic_store_n(&hdr->head, head + need, __ATOMIC_RELEASE);
+		}
+
+		__data_notify(ring);
+		return 0;
+	}
+}
+
+/**
+ * Read a message, block while ring is empty.
+ *
+ * Single consumer only. A message larger than len is truncated.
+ *
+ * @ring     : Ring handle.
+ * @buf      : Message buffer.
+ * @len      : Buffer size.
+ *
+ * Return message length copied and 0 if ring is closed and drained.
+ */
+ssize_t
+shm_ring_read(shm_ring_t *ring, void *buf, size_t len)
+{
+	shm_ring_hdr_t *hdr = ring->hdr;
+	uint64_t tail = hdr->tail, size;
+	int mpsc = hdr->flags & SHM_RING_MPSC;
+	shm_ring_rec_t *rec;
+	uint32_t pad;
+	size_t copy;
+
+	while (1) {
+		if (__data_wait(ring, tail))
+			return 0;
+
+		//
+		rec = (shm_ring_rec_t *)(ring->data + (tail & (hdr->capacity - 1)));
+		size = rec->size & ~SHM_RING_REC_PAD;
+		pad = rec->size & SHM_RING_REC_PAD;
+
+		//
+		copy = 0;
+		if (!pad) {
+			copy = rec->len < len ? rec->len : len;
+			memcpy(buf, rec + 1, copy);
+		}
+
+		/*********************************************************
+		 * with several producers, a record header may later be
+		 * written anywhere in the consumed bytes, so they are
+		 * zeroed (not committed) before being released
+		 ********************************************************/
+		if (mpsc)
+			memset(rec, 0, size);
+
+		tail += size;
+		__atomic_store_n(&hdr->tail, tail, __ATOMIC_SEQ_CST);
+		__space_notify(ring);
+
+		if (!pad)
+			return copy;
+	}
+}
+
+/**
+ * Close ring for writing.
+ *
+ * Consumer reads remaining messages and then gets 0. With several producers,
+ * call it once all of them are done.
+ *
+ * @ring     : Ring handle.
+ */
+void
+shm_ring_close(shm_ring_t *ring)
+{
+	__atomic_store_n(&ring->hdr->closed, 1, __ATOMIC_SEQ_CST);
+	__data_notify(ring);
+}
+
+/**
+ * Unmap segment and close descriptors.
+ *
+ * @ring     : Ring handle.
+ */
+void
+shm_ring_destroy(shm_ring_t *ring)
+{
+	if (ring->hdr)
+		munmap(ring->hdr, ring->map_size);
+	ring->hdr = NULL;
+
+	if (ring->mem_fd != -1)
+		close(ring->mem_fd);
+	if (ring->data_fd != -1)
+		close(ring->data_fd);
+	if (ring->space_fd != -1)
+		close(ring->space_fd);
+
+	ring->mem_fd = -1;
+	ring->data_fd = -1;
+	ring->space_fd = -1;
+}
@@ -0,0 +1,538 @@
+/**
+ * Shared memory ring transport benchmark.
+ *
+ * Copyright (C) 2024 Lazar Razvan.
+ *
+ * Messages of a given size are moved between processes using:
+ * 	1) shm ring (see shm_ring.c)
+ * 		Ring descriptors (memfd, eventfds) are sent over the unix stream
+ * 	socket, which is then used only to start the test.
+ *
+ * 	2) unix stream socket (socketpair())
+ * 		Each message is read in full (recv() until size bytes).
+ *
+ * 	3) unix datagram socket (socketpair())
+ * 		One message per datagram.
+ *
+ * Tests:
+ * 	- throughput: producer process(es) send messages back to back to the
+ * 	consumer (parent), messages per second and MB/s are reported, together
+ * 	with the eventfd wakeups of the ring (producer waking the consumer and
+ * 	consumer waking producers), that stay far below the number of messages
+ * 	while the ring is not empty. The multi producer ring (SHM_RING_MPSC) is
+ * 	measured with two producers.
+ * 	- latency: ping-pong between parent and child (two rings for shm), round
+ * 	trip time percentiles are reported.
+ *
+ * Each message starts with its producer and a per producer sequence number
+ * (also stored in its last byte), checked by the consumer, so a transport
+ * that drops, duplicates, reorders or tears messages is reported instead of
+ * showing a good throughput.
+ *
+ * Usage:
+ * 	./run/shm_ring_bench [-n messages] [-c capacity_kb] [size...]
+ * 	./run/shm_ring_bench -n 1000000 64 4096 65536
+ */
+
+#define _GNU_SOURCE
+
+#include <time.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+
+#include "debug.h"
+#include "shm_ring.h"
+#include "histogram.h"
+
+
+/*============================================================================*/
+
+// Default messages for each throughput test (latency uses a tenth)
+#define MESSAGES					100000
+
+// Bytes moved by each test at most (limits messages of large sizes)
+#define BYTES_MAX					(256UL * 1024 * 1024)
+
+// Largest message size (datagram must fit in the socket send buffer)
+#define MESSAGE_SIZE_MAX			(64 * 1024)
+
+// Smallest message size (message stamp and its last byte)
+#define MESSAGE_SIZE_MIN			((int)sizeof(stamp_t) + 1)
+
+// Producers of the multi producer ring test
+#define MPSC_PRODUCERS				2
+
+/**
+ * Transports.
+ */
+#define TRANSPORT_SHM				0
+#define TRANSPORT_STREAM			1
+#define TRANSPORT_DGRAM				2
+
+static const char *transport_names[] = {
+
+	[TRANSPORT_SHM]		= "shm ring",
+	[TRANSPORT_STREAM]	= "unix stream",
+	[TRANSPORT_DGRAM]	= "unix dgram",
+};
+
+/**
+ * Message stamp (start of each message).
+ */
+typedef struct stamp_s {
+
+	uint32_t	producer;		// producer index
+	uint32_t	seq;			// producer sequence number
+
+} stamp_t;
+
+/**
+ * Connection (one side).
+ */
+typedef struct conn_s {
+
+	int			type;			// TRANSPORT_*
+	int			fd;				// unix socket
+	shm_ring_t	rx;				// ring read by this side
+	shm_ring_t	tx;				// ring written by this side
+
+} conn_t;
+
+static size_t capacity = SHM_RING_CAPACITY;
+static char _buf[MESSAGE_SIZE_MAX];
+
+
+/*============================================================================*/
+
+static inline uint64_t
+__time_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * Send a message.
+ *
+ * Return 0 on success and -1 on error.
+ */
+static int
+__send(conn_t *c, const void *buf, size_t len)
+{
+	ssize_t send_bytes;
+	size_t sent = 0;
+
+	switch (c->type) {
+	case TRANSPORT_SHM:
+		return shm_ring_write(&c->tx, buf, len);
+	case TRANSPORT_DGRAM:
+		return send(c->fd, buf, len, 0) == len ? 0 : -1;
+	default:
+		// stream, partial writes are possible
+		while (sent < len) {
+			send_bytes = send(c->fd, (const char *)buf + sent, len - sent, 0);
+			if (send_bytes == -1) {
+				if (errno == EINTR)
+					continue;
+				return -1;
+			}
+			sent += send_bytes;
+		}
+		return 0;
+	}
+}
+
+/**
+ * Receive a message.
+ *
+ * Return message size on success, 0 on end of file and -1 on error.
+ */
+static ssize_t
+__recv(conn_t *c, void *buf, size_t len)
+{
+	ssize_t recv_bytes;
+	size_t recvd = 0;
+
+	switch (c->type) {
+	case TRANSPORT_SHM:
+		return shm_ring_read(&c->rx, buf, len);
+	case TRANSPORT_DGRAM:
+		return recv(c->fd, buf, len, 0);
+	default:
+		// stream, no message boundaries
+		while (recvd < len) {
+			recv_bytes = recv(c->fd, (char *)buf + recvd, len - recvd, 0);
+			if (recv_bytes <= 0) {
+				if (recv_bytes == -1 && errno == EINTR)
+					continue;
+				return recv_bytes;
+			}
+			recvd += recv_bytes;
+		}
+		return recvd;
+	}
+}
+
+/**
+ * Stamp a message of size bytes.
+ */
+static inline void
+__stamp(char *buf, size_t size, uint32_t producer, uint32_t seq)
+{
+	stamp_t s = { producer, seq };
+
+	memcpy(buf, &s, sizeof(s));
+	buf[size - 1] = (char)seq;
+}
+
+/**
+ * Check a received message stamp against the expected sequence number.
+ *
+ * Return 0 if message is the expected one and -1 otherwise.
+ */
+static inline int
+__stamp_check(const char *buf, size_t size, uint32_t producer, uint32_t seq)
+{
+	stamp_t s;
+
+	memcpy(&s, buf, sizeof(s));
+	if (s.producer != producer || s.seq != seq || buf[size - 1] != (char)seq)
+		return -1;
+
+	return 0;
+}
+
+/**
+ * Create a connected socket pair for a transport (stream for shm ring).
+ */
+static int
+__socketpair(int type, int sv[2])
+{
+	int sock_type = type == TRANSPORT_DGRAM ? SOCK_DGRAM : SOCK_STREAM;
+	int size = 4 * MESSAGE_SIZE_MAX;
+
+	if (socketpair(AF_UNIX, sock_type, 0, sv) == -1) {
+		ERROR("Socket pairs creation failed: %s!\n", strerror(errno));
+		return -1;
+	}
+
+	// make sure a whole datagram fits in the socket buffer
+	for (int i = 0; i < 2; i++)
+		setsockopt(sv[i], SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+
+	return 0;
+}
+
+/**
+ * Messages moved by a test of a given size.
+ */
+static long
+__messages(long nr, size_t size)
+{
+	long max = BYTES_MAX / size;
+
+	return nr < max ? nr : max;
+}
+
+/**
+ * Throughput test, producers send nr messages in total to the parent.
+ */
+static void
+__throughput(int type, size_t size, long nr, int producers)
+{
+	uint32_t next[MPSC_PRODUCERS] = { 0 };
+	long got[MPSC_PRODUCERS] = { 0 };
+	int sv[MPSC_PRODUCERS][2];
+	uint64_t start, elapsed;
+	long received = 0, bad = 0;
+	char go = 'G';
+	stamp_t s;
+	conn_t c;
+	pid_t pid;
+
+	//
+	memset(&c, 0, sizeof(c));
+	c.type = type;
+
+	/*********************************************************
+	 * consumer creates the ring it reads, producers get it
+	 * over their unix stream socket
+	 ********************************************************/
+	if (type == TRANSPORT_SHM &&
+		shm_ring_create(&c.rx, capacity, producers > 1 ? SHM_RING_MPSC : 0))
+		return;
+
+	// children must not flush parent output
+	fflush(stdout);
+
+	for (int p = 0; p < producers; p++) {
+		if (__socketpair(type, sv[p]))
+			exit(-1);
+
+		switch (pid = fork()) {
+		case -1:
+			ERROR("Fork failed: %s!\n", strerror(errno));
+			exit(-1);
+		case 0:
+			/*********************************************************
+			 * producer
+			 ********************************************************/
+			close(sv[p][0]);
+			c.fd = sv[p][1];
+			if (type == TRANSPORT_SHM) {
+				shm_ring_destroy(&c.rx);
+				if (shm_ring_recv(&c.tx, c.fd))
+					exit(-1);
+			} else if (read(c.fd, &go, 1) != 1) {
+				exit(-1);
+			}
+
+			memset(_buf, 'x', size);
+			for (long i = p, seq = 0; i < nr; i += producers, seq++) {
+				__stamp(_buf, size, p, seq);
+				if (__send(&c, _buf, size)) {
+					ERROR("Send failed: %s!\n", strerror(errno));
+					exit(-1);
+				}
+			}
+			exit(0);
+		default:
+			close(sv[p][1]);
+			break;
+		}
+	}
+
+	/*********************************************************
+	 * start producers and receive all messages
+	 ********************************************************/
+	start = __time_ns();
+	for (int p = 0; p < producers; p++) {
+		if (type == TRANSPORT_SHM)
+			shm_ring_send(&c.rx, sv[p][0]);
+		else if (write(sv[p][0], &go, 1) != 1)
+			ERROR("Start failed: %s!\n", strerror(errno));
+	}
+
+	c.fd = sv[0][0];
+	while (received < nr) {
+		if (__recv(&c, _buf, size) != size) {
+			ERROR("Recv failed: %s!\n", strerror(errno));
+			break;
+		}
+		received++;
+
+		// producers are independent, sequence is checked per producer
+		memcpy(&s, _buf, sizeof(s));
+		if (s.producer >= producers) {
+			bad++;
+			continue;
+		}
+
+		if (__stamp_check(_buf, size, s.producer, next[s.producer]))
+			bad++;
+		next[s.producer] = s.seq + 1;
+		got[s.producer]++;
+	}
+	elapsed = __time_ns() - start;
+
+	// each producer message received once
+	for (int p = 0; p < producers; p++)
+		bad += labs(got[p] - (nr - p + producers - 1) / producers);
+
+	if (bad)
+		ERROR("%s size %zu: %ld sequence errors (lost, duplicated or "
+				"corrupted messages)!\n", transport_names[type], size, bad);
+
+	//
+	for (int p = 0; p < producers; p++) {
+		close(sv[p][0]);
+		wait(NULL);
+	}
+
+	//
+	printf("%-8zu %-14s %2d %10ld %12.0f %10.1f", size, transport_names[type],
+			producers, received, received * 1e9 / elapsed,
+			(double)received * size * 1e9 / elapsed / (1 << 20));
+	if (type == TRANSPORT_SHM) {
+		printf(" %10lu %10lu", c.rx.hdr->data_wakeups,
+				c.rx.hdr->space_wakeups);
+		shm_ring_destroy(&c.rx);
+	}
+	printf("\n");
+}
+
+/**
+ * Latency test, ping-pong between parent and an echo child.
+ */
+static void
+__latency(int type, size_t size, long nr)
+{
+	histogram_t hist;
+	uint64_t t0;
+	long bad = 0;
+	int sv[2];
+	conn_t c;
+
+	//
+	memset(&c, 0, sizeof(c));
+	c.type = type;
+	histogram_init(&hist);
+
+	if (__socketpair(type, sv))
+		exit(-1);
+
+	fflush(stdout);
+	switch (fork()) {
+	case -1:
+		ERROR("Fork failed: %s!\n", strerror(errno));
+		exit(-1);
+	case 0:
+		/*********************************************************
+		 * echo child, each side creates the ring it reads
+		 ********************************************************/
+		close(sv[0]);
+		c.fd = sv[1];
+		if (type == TRANSPORT_SHM &&
+			(shm_ring_create(&c.rx, capacity, 0) ||
+			shm_ring_send(&c.rx, c.fd) || shm_ring_recv(&c.tx, c.fd)))
+			exit(-1);
+
+		for (long i = 0; i < nr; i++) {
+			if (__recv(&c, _buf, size) != size || __send(&c, _buf, size)) {
+				ERROR("Echo failed: %s!\n", strerror(errno));
+				exit(-1);
+			}
+		}
+		exit(0);
+	default:
+		close(sv[1]);
+		break;
+	}
+
+	//
+	c.fd = sv[0];
+	if (type == TRANSPORT_SHM &&
+		(shm_ring_create(&c.rx, capacity, 0) ||
+		shm_ring_send(&c.rx, c.fd) || shm_ring_recv(&c.tx, c.fd)))
+		exit(-1);
+
+	memset(_buf, 'x', size);
+	for (long i = 0; i < nr; i++) {
+		__stamp(_buf, size, 0, i);
+		t0 = __time_ns();
+		if (__send(&c, _buf, size) || __recv(&c, _buf, size) != size) {
+			ERROR("Ping failed: %s!\n", strerror(errno));
+			break;
+		}
+		histogram_record(&hist, __time_ns() - t0);
+
+		if (__stamp_check(_buf, size, 0, i))
+			bad++;
+	}
+
+	if (bad)
+		ERROR("%s size %zu: %ld replies are not the request!\n",
+				transport_names[type], size, bad);
+
+	//
+	wait(NULL);
+	close(sv[0]);
+	if (type == TRANSPORT_SHM) {
+		shm_ring_destroy(&c.rx);
+		shm_ring_destroy(&c.tx);
+	}
+
+	printf("%-8zu %-14s %10lu %10.2f %10.2f %10.2f %10.2f\n", size,
+			transport_names[type], hist.total, histogram_mean(&hist) / 1e3,
+			histogram_percentile(&hist, 50.0) / 1e3,
+			histogram_percentile(&hist, 99.0) / 1e3,
+			hist.max / 1e3);
+}
+
+
+/*============================================================================*/
+
+int main(int argc, char *argv[])
+{
+	size_t def_sizes[] = { 64, 256, 1024, 4096, 16384, 65536 };
+	size_t sizes[32];
+	long nr = MESSAGES;
+	int opt, nr_sizes = 0;
+
+	/*********************************************************
+	 * parse arguments
+	 ********************************************************/
+	while ((opt = getopt(argc, argv, "n:c:")) != -1) {
+		switch (opt) {
+		case 'n':
+			nr = atol(optarg);
+			break;
+		case 'c':
+			capacity = strtoul(optarg, NULL, 10) << 10;
+			break;
+		default:
+			printf("Usage: %s [-n messages] [-c capacity_kb] [size...]\n",
+					argv[0]);
+			return -1;
+		}
+	}
+
+	for (int i = optind; i < argc && nr_sizes < 32; i++)
+		sizes[nr_sizes++] = strtoul(argv[i], NULL, 10);
+
+	if (!nr_sizes) {
+		nr_sizes = sizeof(def_sizes) / sizeof(def_sizes[0]);
+		memcpy(sizes, def_sizes, sizeof(def_sizes));
+	}
+
+	//
+	for (int i = 0; i < nr_sizes; i++) {
+		if (sizes[i] < MESSAGE_SIZE_MIN || sizes[i] > MESSAGE_SIZE_MAX) {
+			ERROR("Message size must be between %d and %d!\n",
+					MESSAGE_SIZE_MIN, MESSAGE_SIZE_MAX);
+			return -1;
+		}
+	}
+
+	if (nr < 10)
+		nr = 10;
+	if (capacity < 2 * (MESSAGE_SIZE_MAX + sizeof(shm_ring_rec_t)))
+		capacity = 2 * (MESSAGE_SIZE_MAX + sizeof(shm_ring_rec_t));
+
+	/*********************************************************
+	 * throughput
+	 ********************************************************/
+	printf("ring capacity %zu KB\n", capacity >> 10);
+	printf("================ throughput ================\n");
+	printf("%-8s %-14s %2s %10s %12s %10s %10s %10s\n", "size", "transport",
+			"p", "messages", "msgs/s", "MB/s", "data_wake", "space_wake");
+	for (int i = 0; i < nr_sizes; i++) {
+		for (int t = TRANSPORT_SHM; t <= TRANSPORT_DGRAM; t++)
+			__throughput(t, sizes[i], __messages(nr, sizes[i]), 1);
+		__throughput(TRANSPORT_SHM, sizes[i], __messages(nr, sizes[i]),
+					MPSC_PRODUCERS);
+	}
+
+	/*********************************************************
+	 * latency (round trip)
+	 ********************************************************/
+	printf("================ latency (round trip, us) ================\n");
+	printf("%-8s %-14s %10s %10s %10s %10s %10s\n", "size", "transport",
+			"count", "mean", "p50", "p99", "max");
+	for (int i = 0; i < nr_sizes; i++)
+		for (int t = TRANSPORT_SHM; t <= TRANSPORT_DGRAM; t++)
+			__latency(t, sizes[i], __messages(nr / 10, sizes[i]));
+
+	return 0;
+}
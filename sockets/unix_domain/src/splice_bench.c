@@ -0,0 +1,234 @@
+/**
+ * Zero-copy (vmsplice/splice) against send()/recv() unix stream benchmark.
+ *
+ * Copyright (C) 2024 Lazar Razvan.
+ *
+ * A parent sends transfers of a given size (1 MB to 1 GB by default) to a
+ * child over a unix stream socket pair, the child writes the data to a file
+ * (/dev/null by default) and acknowledges each transfer:
+ * 	copy		send() and recv() + write() (see zerocopy_send_copy())
+ * 	zerocopy	vmsplice() + splice() and splice() (see zerocopy_send())
+ *
+ * Small transfers are repeated (TRANSFER_BYTES in total at least). GB/s of
+ * both modes, the GB/s gained by zero-copy and the speedup are reported.
+ *
+ * Usage:
+ * 	./run/splice_bench [-o file] [MB...]
+ * 	./run/splice_bench 1 16 256 1024
+ */
+
+#define _GNU_SOURCE
+
+#include <time.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include <sys/wait.h>
+#include <sys/socket.h>
+
+#include "debug.h"
+#include "zerocopy.h"
+
+
+/*============================================================================*/
+
+// Bytes moved by each test at least (small transfers are repeated)
+#define TRANSFER_BYTES				(256UL * 1024 * 1024)
+
+// Max transfer sizes on command line
+#define SIZES_MAX					32
+
+/**
+ * Transfer modes.
+ */
+#define MODE_COPY					0
+#define MODE_ZEROCOPY				1
+
+static const char *file = "/dev/null";
+
+
+/*============================================================================*/
+
+static inline uint64_t
+__time_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * Receiver process, rounds transfers of size bytes, each one acknowledged.
+ */
+static void
+__receiver(int sock_fd, int mode, size_t size, long rounds)
+{
+	int out_fd, pipe_fd[2];
+	void *buf = NULL;
+	char ack = 'A';
+
+	//
+	out_fd = open(file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (out_fd == -1) {
+		ERROR("File %s open failed: %s!\n", file, strerror(errno));
+		exit(-1);
+	}
+
+	if (mode == MODE_ZEROCOPY ? zerocopy_pipe(pipe_fd) :
+		!(buf = zerocopy_buf_alloc(ZEROCOPY_BUF_SIZE)))
+		exit(-1);
+
+	//
+	for (long i = 0; i < rounds; i++) {
+		// files grow up to one transfer, /dev/null ignores it
+		lseek(out_fd, 0, SEEK_SET);
+
+		if ((mode == MODE_ZEROCOPY ?
+				zerocopy_recv(sock_fd, pipe_fd, out_fd, size) :
+				zerocopy_recv_copy(sock_fd, buf, ZEROCOPY_BUF_SIZE, out_fd,
+									size)) != size)
+			exit(-1);
+
+		if (write(sock_fd, &ack, 1) != 1)
+			exit(-1);
+	}
+
+	exit(0);
+}
+
+/**
+ * Run transfers of a given size in a mode.
+ *
+ * Return GB/s (0 on error).
+ */
+static double
+__test(int mode, size_t size, void *buf, int pipe_fd[2])
+{
+	long rounds = TRANSFER_BYTES / size ? TRANSFER_BYTES / size : 1, done;
+	uint64_t start, elapsed;
+	size_t sent, chunk;
+	int sv[2];
+	char ack;
+
+	//
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == -1) {
+		ERROR("Socket pairs creation failed: %s!\n", strerror(errno));
+		return 0;
+	}
+
+	fflush(stdout);
+	switch (fork()) {
+	case -1:
+		ERROR("Fork failed: %s!\n", strerror(errno));
+		return 0;
+	case 0:
+		close(sv[0]);
+		__receiver(sv[1], mode, size, rounds);
+		exit(-1);
+	default:
+		close(sv[1]);
+		break;
+	}
+
+	/*********************************************************
+	 * send each transfer (buffer sent again and again) and
+	 * wait for its acknowledge
+	 ********************************************************/
+	start = __time_ns();
+	for (done = 0; done < rounds; done++) {
+		for (sent = 0; sent < size; sent += chunk) {
+			chunk = size - sent;
+			if (chunk > ZEROCOPY_BUF_SIZE)
+				chunk = ZEROCOPY_BUF_SIZE;
+
+			if (mode == MODE_ZEROCOPY ?
+					zerocopy_send(sv[0], pipe_fd, buf, chunk) :
+					zerocopy_send_copy(sv[0], buf, chunk))
+				goto out;
+		}
+
+		if (read(sv[0], &ack, 1) != 1) {
+			ERROR("Acknowledge failed!\n");
+			goto out;
+		}
+	}
+
+out:
+	elapsed = __time_ns() - start;
+	close(sv[0]);
+	wait(NULL);
+
+	if (done != rounds)
+		return 0;
+
+	return (double)size * rounds * 1e9 / elapsed / (1 << 30);
+}
+
+
+/*============================================================================*/
+
+int main(int argc, char *argv[])
+{
+	size_t def_sizes[] = { 1, 4, 16, 64, 256, 1024 };
+	size_t sizes[SIZES_MAX];
+	int opt, nr_sizes = 0, pipe_fd[2];
+	double copy, zerocopy;
+	void *buf;
+
+	/*********************************************************
+	 * parse arguments
+	 ********************************************************/
+	while ((opt = getopt(argc, argv, "o:")) != -1) {
+		switch (opt) {
+		case 'o':
+			file = optarg;
+			break;
+		default:
+			printf("Usage: %s [-o file] [MB...]\n", argv[0]);
+			return -1;
+		}
+	}
+
+	for (int i = optind; i < argc && nr_sizes < SIZES_MAX; i++)
+		sizes[nr_sizes++] = strtoul(argv[i], NULL, 10);
+
+	if (!nr_sizes) {
+		nr_sizes = sizeof(def_sizes) / sizeof(def_sizes[0]);
+		memcpy(sizes, def_sizes, sizeof(def_sizes));
+	}
+
+	//
+	buf = zerocopy_buf_alloc(ZEROCOPY_BUF_SIZE);
+	if (!buf || zerocopy_pipe(pipe_fd))
+		return -1;
+
+	/*********************************************************
+	 * copy and zerocopy for each transfer size
+	 ********************************************************/
+	printf("output %s\n", file);
+	printf("%-10s %12s %12s %12s %10s\n", "size_mb", "copy_gbs",
+			"zerocopy_gbs", "gain_gbs", "speedup");
+	for (int i = 0; i < nr_sizes; i++) {
+		if (!sizes[i])
+			continue;
+
+		copy = __test(MODE_COPY, sizes[i] << 20, buf, pipe_fd);
+		zerocopy = __test(MODE_ZEROCOPY, sizes[i] << 20, buf, pipe_fd);
+
+		printf("%-10zu %12.2f %12.2f %12.2f %9.2fx\n", sizes[i], copy,
+				zerocopy, zerocopy - copy, copy ? zerocopy / copy : 0);
+	}
+
+	close(pipe_fd[0]);
+	close(pipe_fd[1]);
+	free(buf);
+
+	return 0;
+}
@@ -22,11 +22,22 @@
  *
  * 4) send()
  * 		Send stream data to server.
+ *
+ * Bulk mode (-n MB) sends a page aligned buffer again and again instead of
+ * stdin, then waits for the server to close the connection (all data
+ * received) and reports GB/s. With -z, the buffer is vmsplice()d into a pipe
+ * and spliced to the socket (no copy, see zerocopy.c), the server should run
+ * with -z (or -c) too.
+ *
+ * Usage:
+ * 	./run/stream_client [-n MB] [-z]
  */
 
+#include <time.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <unistd.h>
 #include <assert.h>
 #include <errno.h>
@@ -35,9 +46,80 @@
 #include <sys/socket.h>
 
 #include "debug.h"
+#include "zerocopy.h"
 #include "stream_common.h"
 
 
+/*============================================================================*/
+
+static inline uint64_t
+__time_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * Send total bytes (bulk mode) and wait for the server to close.
+ *
+ * Return 0 on success and -1 on error.
+ */
+static int
+__bulk_send(int sock_fd, size_t total, int zerocopy)
+{
+	int pipe_fd[2] = { -1, -1 }, ret = -1;
+	uint64_t start, elapsed;
+	size_t sent, chunk;
+	void *buf;
+	char c;
+
+	//
+	buf = zerocopy_buf_alloc(ZEROCOPY_BUF_SIZE);
+	if (!buf)
+		return -1;
+	if (zerocopy && zerocopy_pipe(pipe_fd))
+		goto buf_free;
+
+	/*********************************************************
+	 * send the buffer until total, then end-of-file
+	 ********************************************************/
+	start = __time_ns();
+	for (sent = 0; sent < total; sent += chunk) {
+		chunk = total - sent;
+		if (chunk > ZEROCOPY_BUF_SIZE)
+			chunk = ZEROCOPY_BUF_SIZE;
+
+		if (zerocopy ? zerocopy_send(sock_fd, pipe_fd, buf, chunk) :
+						zerocopy_send_copy(sock_fd, buf, chunk))
+			goto pipe_close;
+	}
+
+	shutdown(sock_fd, SHUT_WR);
+
+	// server closes the connection once all data is received
+	while (recv(sock_fd, &c, 1, 0) > 0)
+		;
+	elapsed = __time_ns() - start;
+
+	printf("%s: %zu bytes in %.3f s, %.2f GB/s\n",
+			zerocopy ? "zerocopy" : "copy", total, elapsed / 1e9,
+			total * 1e9 / (elapsed ? elapsed : 1) / (1 << 30));
+	ret = 0;
+
+pipe_close:
+	if (zerocopy) {
+		close(pipe_fd[0]);
+		close(pipe_fd[1]);
+	}
+buf_free:
+	free(buf);
+	return ret;
+}
+
+
 /*============================================================================*/
 
 int main(int argc, char *argv[])
@@ -47,6 +129,25 @@ int main(int argc, char *argv[])
 	char _buf[BUFFER_SIZE];
 	ssize_t send_bytes, read_bytes;
 	struct sockaddr_un sa_client, sa_server;
+	int opt, zerocopy = 0;
+	size_t bulk = 0;
+
+	/*********************************************************
+	 * parse arguments
+	 ********************************************************/
+	while ((opt = getopt(argc, argv, "n:z")) != -1) {
+		switch (opt) {
+		case 'n':
+			bulk = strtoul(optarg, NULL, 10) << 20;
+			break;
+		case 'z':
+			zerocopy = 1;
+			break;
+		default:
+			printf("Usage: %s [-n MB] [-z]\n", argv[0]);
+			goto error;
+		}
+	}
 
 	/*********************************************************
 	 * create the unix domain, stream socket
@@ -167,6 +268,16 @@ int main(int argc, char *argv[])
 	DEBUG("CLIENT: %s\n", sa_client.sun_path);
 	DEBUG("SERVER: %s\n", sa_server.sun_path);
 
+	/*********************************************************
+	 * bulk mode (instead of stdin)
+	 ********************************************************/
+	if (bulk) {
+		if (__bulk_send(sock_fd, bulk, zerocopy))
+			goto sock_close;
+		close(sock_fd);
+		return 0;
+	}
+
 	/*********************************************************
 	 * send stream data to server
 	 *
@@ -25,21 +25,89 @@
  *
  * 5) recv()
  * 		Recevie stream data from client.
+ *
+ * Bulk modes (large transfers, e.g. log shipping) receive each connection
+ * until end-of-file into a file (-o, /dev/null by default) and report GB/s:
+ * 	-c	recv() into a buffer and write() it (two copies with the sender)
+ * 	-z	splice() socket to pipe to file, no copy to user space (zerocopy.c)
+ *
+ * Usage:
+ * 	./run/stream_server [-c | -z] [-o file]
  */
 
+#include <time.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <errno.h>
 
 #include <sys/un.h>
 #include <sys/socket.h>
 
 #include "debug.h"
+#include "zerocopy.h"
 #include "stream_common.h"
 
 
+/*============================================================================*/
+
+/**
+ * Receive modes.
+ */
+#define MODE_PRINT					0		// print data (BUFFER_SIZE chunks)
+#define MODE_COPY					1		// bulk, recv() and write()
+#define MODE_ZEROCOPY				2		// bulk, splice()
+
+static const char *mode_names[] = {
+
+	[MODE_PRINT]	= "print",
+	[MODE_COPY]		= "copy",
+	[MODE_ZEROCOPY]	= "zerocopy",
+};
+
+
+/*============================================================================*/
+
+static inline uint64_t
+__time_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * Receive a connection until end-of-file (bulk modes) and report throughput.
+ */
+static void
+__bulk_recv(int peer_sock, int mode, int out_fd, int pipe_fd[2], void *buf)
+{
+	uint64_t start, elapsed;
+	ssize_t recvd;
+
+	//
+	start = __time_ns();
+	if (mode == MODE_ZEROCOPY)
+		recvd = zerocopy_recv(peer_sock, pipe_fd, out_fd, SIZE_MAX);
+	else
+		recvd = zerocopy_recv_copy(peer_sock, buf, ZEROCOPY_BUF_SIZE, out_fd,
+									SIZE_MAX);
+	elapsed = __time_ns() - start;
+
+	if (recvd == -1)
+		return;
+
+	printf("%s: %zd bytes in %.3f s, %.2f GB/s\n", mode_names[mode], recvd,
+			elapsed / 1e9, recvd * 1e9 / (elapsed ? elapsed : 1) / (1 << 30));
+	fflush(stdout);
+}
+
+
 /*============================================================================*/
 
 int main(int argc, char *argv[])
@@ -49,6 +117,46 @@ int main(int argc, char *argv[])
 	char _buf[BUFFER_SIZE];
 	int listen_sock, peer_sock;
 	struct sockaddr_un sa_client, sa_server;
+	int opt, mode = MODE_PRINT, out_fd = -1, pipe_fd[2] = { -1, -1 };
+	const char *file = "/dev/null";
+	void *bulk_buf = NULL;
+
+	/*********************************************************
+	 * parse arguments
+	 ********************************************************/
+	while ((opt = getopt(argc, argv, "czo:")) != -1) {
+		switch (opt) {
+		case 'c':
+			mode = MODE_COPY;
+			break;
+		case 'z':
+			mode = MODE_ZEROCOPY;
+			break;
+		case 'o':
+			file = optarg;
+			break;
+		default:
+			printf("Usage: %s [-c | -z] [-o file]\n", argv[0]);
+			goto error;
+		}
+	}
+
+	/*********************************************************
+	 * bulk modes: output file and buffer (copy) or pipe
+	 * (zerocopy)
+	 ********************************************************/
+	if (mode != MODE_PRINT) {
+		out_fd = open(file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if (out_fd == -1) {
+			ERROR("File %s open failed: %s!\n", file, strerror(errno));
+			goto error;
+		}
+
+		if (mode == MODE_COPY)
+			bulk_buf = zerocopy_buf_alloc(ZEROCOPY_BUF_SIZE);
+		if (mode == MODE_COPY ? !bulk_buf : zerocopy_pipe(pipe_fd) == -1)
+			goto error;
+	}
 
 	/*********************************************************
 	 * create the unix domain, stream socket
@@ -149,6 +257,12 @@ int main(int argc, char *argv[])
 			goto next_connection;
 		}
 
+		// bulk modes, whole connection at once
+		if (mode != MODE_PRINT) {
+			__bulk_recv(peer_sock, mode, out_fd, pipe_fd, bulk_buf);
+			goto next_connection;
+		}
+
 		// get peer data (block until data is received)
 		while (1) {
 			errno = 0;
@@ -0,0 +1,233 @@
+/**
+ * Zero-copy transfers over unix stream sockets (vmsplice + splice).
+ *
+ * Copyright (C) 2024 Lazar Razvan.
+ *
+ * With send()/recv() data is copied twice: from the sender buffer into the
+ * socket buffer and from the socket buffer into the receiver buffer. Moving
+ * pages through pipes avoids both copies:
+ *
+ * 1) vmsplice()
+ * 		Sender maps its (page aligned) buffer pages into a pipe, no copy.
+ *
+ * 2) splice() pipe -> socket
+ * 		Pipe pages are attached to the socket buffers (kernels with
+ * 	MSG_SPLICE_PAGES support for unix sockets, older kernels copy here).
+ *
+ * 3) splice() socket -> pipe -> file
+ * 		Receiver moves the socket pages into a pipe and from the pipe into a
+ * 	file, another pipe or /dev/null, never copying them to user space.
+ *
+ * The pages are referenced, not copied, so the sender must not modify a
+ * buffer until the receiver consumed it (vmsplice(2)). Buffers sent again and
+ * again with the same content (benchmarks) are fine, a log shipper would
+ * rotate more buffers than the pipe and socket buffers can hold.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include <sys/uio.h>
+#include <sys/socket.h>
+
+#include "debug.h"
+#include "zerocopy.h"
+
+
+/*============================================================================*/
+
+/**
+ * Move len bytes from a pipe to a descriptor.
+ *
+ * Return 0 on success and -1 on error.
+ */
+static int
+__drain(int pipe_rfd, int out_fd, size_t len)
+{
+	ssize_t moved;
+
+	while (len) {
+		moved = splice(pipe_rfd, NULL, out_fd, NULL, len,
+						SPLICE_F_MOVE | SPLICE_F_MORE);
+		if (moved == -1) {
+			if (errno == EINTR)
+				continue;
+			ERROR("Splice from pipe failed: %s!\n", strerror(errno));
+			return -1;
+		}
+		len -= moved;
+	}
+
+	return 0;
+}
+
+
+/*============================================================================*/
+
+int zerocopy_pipe(int pipe_fd[2])
+{
+	if (pipe(pipe_fd) == -1) {
+		ERROR("Pipe creation failed: %s!\n", strerror(errno));
+		return -1;
+	}
+
+	// larger pipe, fewer splice() calls (limited by fs.pipe-max-size)
+	if (fcntl(pipe_fd[1], F_SETPIPE_SZ, ZEROCOPY_PIPE_SIZE) == -1)
+		DEBUG("Pipe resize failed: %s!\n", strerror(errno));
+
+	return 0;
+}
+
+void *zerocopy_buf_alloc(size_t size)
+{
+	long page = sysconf(_SC_PAGESIZE);
+	void *buf;
+
+	//
+	size = (size + page - 1) & ~(page - 1);
+	if (posix_memalign(&buf, page, size)) {
+		ERROR("Buffer allocation failed!\n");
+		return NULL;
+	}
+
+	memset(buf, 'x', size);
+
+	return buf;
+}
+
+int zerocopy_send(int sock_fd, int pipe_fd[2], const void *buf, size_t len)
+{
+	struct iovec iov;
+	ssize_t moved;
+
+	while (len) {
+		/*********************************************************
+		 * map user pages into the pipe (up to the pipe size)
+		 ********************************************************/
+		iov.iov_base = (void *)buf;
+		iov.iov_len = len < ZEROCOPY_PIPE_SIZE ? len : ZEROCOPY_PIPE_SIZE;
+
+		moved = vmsplice(pipe_fd[1], &iov, 1, 0);
+		if (moved == -1) {
+			if (errno == EINTR)
+				continue;
+			ERROR("Vmsplice failed: %s!\n", strerror(errno));
+			return -1;
+		}
+
+		/*********************************************************
+		 * move the pipe pages to the socket
+		 ********************************************************/
+		if (__drain(pipe_fd[0], sock_fd, moved))
+			return -1;
+
+		buf = (const char *)buf + moved;
+		len -= moved;
+	}
+
+	return 0;
+}
+
+ssize_t zerocopy_recv(int sock_fd, int pipe_fd[2], int out_fd, size_t len)
+{
+	size_t recvd = 0, chunk;
+	ssize_t moved;
+
+	while (recvd < len) {
+		/*********************************************************
+		 * move socket pages into the pipe (0 is end of file)
+		 ********************************************************/
+		chunk = len - recvd;
+		if (chunk > ZEROCOPY_PIPE_SIZE)
+			chunk = ZEROCOPY_PIPE_SIZE;
+
+		moved = splice(sock_fd, NULL, pipe_fd[1], NULL, chunk,
+						SPLICE_F_MOVE | SPLICE_F_MORE);
+		if (moved == -1) {
+			if (errno == EINTR)
+				continue;
+			ERROR("Splice from socket failed: %s!\n", strerror(errno));
+			return -1;
+		}
+
+		if (moved == 0)
+			break;
+
+		/*********************************************************
+		 * move the pipe pages to the output
+		 ********************************************************/
+		if (__drain(pipe_fd[0], out_fd, moved))
+			return -1;
+
+		recvd += moved;
+	}
+
+	return recvd;
+}
+
+int zerocopy_send_copy(int sock_fd, const void *buf, size_t len)
+{
+	ssize_t send_bytes;
+
+	while (len) {
+		send_bytes = send(sock_fd, buf, len, MSG_NOSIGNAL);
+		if (send_bytes == -1) {
+			if (errno == EINTR)
+				continue;
+			ERROR("Send failed: %s!\n", strerror(errno));
+			return -1;
+		}
+
+		buf = (const char *)buf + send_bytes;
+		len -= send_bytes;
+	}
+
+	return 0;
+}
+
+ssize_t zerocopy_recv_copy(int sock_fd, void *buf, size_t buf_size, int out_fd,
+							size_t len)
+{
+	ssize_t recv_bytes, write_bytes;
+	size_t recvd = 0, chunk, off;
+
+	while (recvd < len) {
+		chunk = len - recvd;
+		if (chunk > buf_size)
+			chunk = buf_size;
+
+		recv_bytes = recv(sock_fd, buf, chunk, 0);
+		if (recv_bytes == -1) {
+			if (errno == EINTR)
+				continue;
+			ERROR("Recv failed: %s!\n", strerror(errno));
+			return -1;
+		}
+
+		if (recv_bytes == 0)
+			break;
+
+		//
+		for (off = 0; off < recv_bytes; off += write_bytes) {
+			write_bytes = write(out_fd, (char *)buf + off, recv_bytes - off);
+			if (write_bytes == -1) {
+				if (errno == EINTR) {
+					write_bytes = 0;
+					continue;
+				}
+				ERROR("Write failed: %s!\n", strerror(errno));
+				return -1;
+			}
+		}
+
+		recvd += recv_bytes;
+	}
+
+	return recvd;
+}
@@ -0,0 +1,71 @@
+#ifndef SORT_H
+#define SORT_H
+
+#include <stddef.h>
+
+/**
+ * Config: Sort algorithms
+ */
+
+// Bubble sort is O(n*n), benchmarks skip it for larger arrays (elements)
+#define SORT_BUBBLE_MAX				(8 * 1024)
+
+// Introsort partitions smaller than this are insertion sorted (elements)
+#define SORT_INSERTION_MAX			16
+
+// Sorting network block (8 vectors of 8 elements)
+#define SORT_NETWORK_BLOCK			64
+
+// Parallel merge sort minimum elements for each thread
+#define SORT_PARALLEL_MIN			(64 * 1024)
+
+// Parallel merge sort maximum number of threads
+#define SORT_THREADS_MAX			64
+
+
+/*============================================================================*/
+
+/**
+ * Sort function (return 0 on success and <0 otherwise).
+ */
+typedef int (*sort_fn_t)(int *v, size_t n);
+
+/**
+ * Sort algorithm description.
+ */
+typedef struct sort_algo_s {
+
+	const char	*name;			// algorithm name
+	sort_fn_t	sort;			// sort function
+	size_t		max;			// max number of elements (0 for no limit)
+
+} sort_algo_t;
+
+
+/*============================================================================*/
+
+// Bubble sort (baseline, O(n*n))
+int sort_bubble(int *v, size_t n);
+
+// C library qsort()
+int sort_qsort(int *v, size_t n);
+
+// Introsort (quicksort, heapsort on deep recursion, insertion sort)
+int sort_intro(int *v, size_t n);
+
+// LSD radix sort (8 bits digits)
+int sort_radix(int *v, size_t n);
+
+// Sorting network blocks (AVX2 when supported) and bottom-up merge
+int sort_network(int *v, size_t n);
+
+// Parallel merge sort (introsort chunks and parallel merge)
+int sort_parallel(int *v, size_t n);
+
+// Set number of threads for parallel merge sort (0 for online CPUs)
+void sort_parallel_threads(int threads);
+
+// Check if array is sorted (return 0 if sorted)
+int sort_check(const int *v, size_t n);
+
+#endif	// SORT_H
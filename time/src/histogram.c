@@ -0,0 +1,271 @@
+/**
+ * Log-linear latency histogram.
+ * Copyright (C) 2024 Lazar Razvan.
+ *
+ * HdrHistogram style histogram used to aggregate samples (latencies) instead
+ * of printing them one by one. Values lower than HISTOGRAM_SUB_COUNT are
+ * recorded exactly, while larger values are recorded in a bucket of a power
+ * of two range that is split in HISTOGRAM_HALF_COUNT linear sub-buckets. This
+ * keeps a constant relative error on the whole uint64_t range with a fixed
+ * memory footprint.
+ *
+ * Recording is done in two ways:
+ * 	1) histogram_record()
+ * 		Plain increments, to be used on a histogram owned by a single thread
+ * 	(per-thread histogram) that is later merged in a global one using
+ * 	histogram_merge().
+ *
+ * 	2) histogram_record_atomic()
+ * 		Atomic increments, to be used directly on a shared histogram.
+ *
+ * The global histogram is never locked, so histogram_snapshot() may be called
+ * while other threads are merging. A sample recorded during a snapshot with
+ * reset ends up either in the current or in the next interval.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "debug.h"
+#include "histogram.h"
+
+/*================================= STATIC ===================================*/
+
+/**
+ * Get bucket index for a value.
+ */
+static inline unsigned int __bucket_index(uint64_t value)
+{
+	unsigned int msb, shift;
+
+	if (value < HISTOGRAM_SUB_COUNT)
+		return (unsigned int)value;
+
+	// value >> shift is in [HALF_COUNT, SUB_COUNT)
+	msb = 63 - __builtin_clzll(value);
+	shift = msb - HISTOGRAM_SUB_BITS + 1;
+
+	return shift * HISTOGRAM_HALF_COUNT + (unsigned int)(value >> shift);
+}
+
+/**
+ * Get highest value that is recorded in a bucket.
+ */
+static inline uint64_t __bucket_highest(unsigned int idx)
+{
+	unsigned int shift;
+	uint64_t top;
+
+	if (idx < HISTOGRAM_SUB_COUNT)
+		return idx;
+
+	shift = idx / HISTOGRAM_HALF_COUNT - 1;
+	top = HISTOGRAM_HALF_COUNT + idx % HISTOGRAM_HALF_COUNT;
+
+	return ((top + 1) << shift) - 1;
+}
+
+/**
+ * Atomically lower a value (lock-free min).
+ */
+static inline void __atomic_min(uint64_t *ptr, uint64_t value)
+{
+	uint64_t curr = __atomic_load_n(ptr, __ATOMIC_RELAXED);
+
+	while (value < curr && !__atomic_compare_exchange_n(ptr, &curr, value, 1,
+								__ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+/**
+ * Atomically raise a value (lock-free max).
+ */
+static inline void __atomic_max(uint64_t *ptr, uint64_t value)
+{
+	uint64_t curr = __atomic_load_n(ptr, __ATOMIC_RELAXED);
+
+	while (value > curr && !__atomic_compare_exchange_n(ptr, &curr, value, 1,
+								__ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+/*================================= PUBLIC ===================================*/
+
+/**
+ * Initialize an empty histogram.
+ *
+ * @h	: Histogram.
+ */
+void histogram_init(histogram_t *h)
+{
+	memset(h, 0, sizeof(histogram_t));
+	h->min = UINT64_MAX;
+}
+
+/**
+ * Record a value in a histogram owned by the calling thread.
+ *
+ * @h		: Histogram.
+ * @value	: Sample value.
+ */
+void histogram_record(histogram_t *h, uint64_t value)
+{
+	h->counts[__bucket_index(value)]++;
+	h->total++;
+	h->sum += value;
+
+	if (value < h->min)
+		h->min = value;
+
+	if (value > h->max)
+		h->max = value;
+}
+
+/**
+ * Record a value in a histogram shared between threads.
+ *
+ * @h		: Histogram.
+ * @value	: Sample value.
+ */
+void histogram_record_atomic(histogram_t *h, uint64_t value)
+{
+	__atomic_fetch_add(&h->counts[__bucket_index(value)], 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&h->total, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&h->sum, value, __ATOMIC_RELAXED);
+	__atomic_min(&h->min, value);
+	__atomic_max(&h->max, value);
+}
+
+/**
+ * Merge a per-thread histogram into a global histogram.
+ *
+ * Only non empty buckets are touched in the global histogram, so merging a
+ * sparse per-thread histogram is cheap. The per-thread histogram is reset.
+ *
+ * @dst	: Global (shared) histogram.
+ * @src	: Per-thread histogram.
+ */
+void histogram_merge(histogram_t *dst, histogram_t *src)
+{
+	if (!src->total)
+		return;
+
+	for (unsigned int i = 0; i < HISTOGRAM_BUCKETS; i++)
+		if (src->counts[i])
+			__atomic_fetch_add(&dst->counts[i], src->counts[i],
+								__ATOMIC_RELAXED);
+
+	__atomic_fetch_add(&dst->total, src->total, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&dst->sum, src->sum, __ATOMIC_RELAXED);
+	__atomic_min(&dst->min, src->min);
+	__atomic_max(&dst->max, src->max);
+
+	histogram_init(src);
+}
+
+/**
+ * Take a snapshot of a (global) histogram.
+ *
+ * @h		: Histogram.
+ * @snap	: Snapshot histogram (private to caller).
+ * @reset	: Reset histogram to start a new interval.
+ */
+void histogram_snapshot(histogram_t *h, histogram_t *snap, int reset)
+{
+	if (!reset) {
+		for (unsigned int i = 0; i < HISTOGRAM_BUCKETS; i++)
+			snap->counts[i] = __atomic_load_n(&h->counts[i], __ATOMIC_RELAXED);
+
+		snap->total = __atomic_load_n(&h->total, __ATOMIC_RELAXED);
+		snap->sum = __atomic_load_n(&h->sum, __ATOMIC_RELAXED);
+		snap->min = __atomic_load_n(&h->min, __ATOMIC_RELAXED);
+		snap->max = __atomic_load_n(&h->max, __ATOMIC_RELAXED);
+		return;
+	}
+
+	for (unsigned int i = 0; i < HISTOGRAM_BUCKETS; i++)
+		snap->counts[i] = __atomic_exchange_n(&h->counts[i], 0,
+								__ATOMIC_RELAXED);
+
+	snap->total = __atomic_exchange_n(&h->total, 0, __ATOMIC_RELAXED);
+	snap->sum = __atomic_exchange_n(&h->sum, 0, __ATOMIC_RELAXED);
+	snap->min = __atomic_exchange_n(&h->min, UINT64_MAX, __ATOMIC_RELAXED);
+	snap->max = __atomic_exchange_n(&h->max, 0, __ATOMIC_RELAXED);
+}
+
+/**
+ * Get the value at a given percentile.
+ *
+ * Value is reported as the highest value equivalent to the bucket, but never
+ * higher than the maximum recorded value.
+ *
+ * @h			: Histogram.
+ * @percentile	: Percentile (0.0 - 100.0).
+ *
+ * Return percentile value or 0 for an empty histogram.
+ */
+uint64_t histogram_percentile(histogram_t *h, double percentile)
+{
+	uint64_t total = 0, target, seen = 0, value;
+
+	// count from buckets to be consistent with a concurrent snapshot
+	for (unsigned int i = 0; i < HISTOGRAM_BUCKETS; i++)
+		total += h->counts[i];
+
+	if (!total)
+		return 0;
+
+	if (percentile > 100.0)
+		percentile = 100.0;
+
+	target = (uint64_t)(percentile / 100.0 * total + 0.5);
+	if (target == 0)
+		target = 1;
+
+	for (unsigned int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+		seen += h->counts[i];
+		if (seen >= target) {
+			value = __bucket_highest(i);
+			return value > h->max ? h->max : value;
+		}
+	}
+
+	return h->max;
+}
+
+/**
+ * Get the mean value.
+ *
+ * @h	: Histogram.
+ */
+double histogram_mean(histogram_t *h)
+{
+	if (!h->total)
+		return 0;
+
+	return (double)h->sum / h->total;
+}
+
+/**
+ * Print histogram summary.
+ *
+ * @h		: Histogram.
+ * @name	: Histogram name.
+ * @unit	: Unit used for printing.
+ * @div		: Divider to convert recorded values into unit.
+ */
+void histogram_print(histogram_t *h, const char *name, const char *unit,
+					double div)
+{
+	if (!h->total) {
+		printf("%s: no samples\n", name);
+		return;
+	}
+
+	printf("%s: count=%lu mean=%.3f%s p50=%.3f%s p99=%.3f%s p99.9=%.3f%s "
+			"max=%.3f%s\n", name, h->total,
+			histogram_mean(h) / div, unit,
+			histogram_percentile(h, 50.0) / div, unit,
+			histogram_percentile(h, 99.0) / div, unit,
+			histogram_percentile(h, 99.9) / div, unit,
+			h->max / div, unit);
+}
@@ -1,140 +1,309 @@
 /**
- * Test program for process_time implementation.
+ * Sorting benchmark for process_time implementation.
  * Copyright (C) 2022 Lazar Razvan.
  *
  * Expose the implementation by creating a large array on heap and fill in each
- * value (system CPU time intensive) and sorting the array using bubble sort
- * mechanism (user CPU time intensive).
+ * value (system CPU time intensive, since each page is faulted in on first
+ * write) and sorting copies of the array using each algorithm (user CPU time
+ * intensive).
  *
- * 1) array sort that is usermode intensive
- * 2) TODO
+ * 1) bubble sort (baseline, only for small arrays)
+ * 2) qsort() and introsort
+ * 3) LSD radix sort
+ * 4) sorting network (AVX2) and merge
+ * 5) parallel merge sort
+ *
+ * Array sizes (in bytes, using K, M or G suffix) are given as arguments, so
+ * that arrays fitting in caches are compared with arrays up to several GB
+ * that only fit in memory. User, system and wall time of each sort are
+ * reported by process_time.
+ *
+ * Options:
+ * 	-c			: timers in counters mode (cache and branch behavior of each
+ * 				algorithm, when hardware counters are available)
+ * 	-r <num>	: repeat each sort and report wall time percentiles
+ * 	-t <num>	: number of threads for parallel merge sort
+ *
+ * Usage:
+ * 	./run/measure [-c] [-r repeat] [-t threads] [size ...]
+ * 	./run/measure 32K 1M 64M 4G
  */
 
 #include <time.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <assert.h>
+#include <string.h>
+#include <stdint.h>
 #include <unistd.h>
 
 #include "debug.h"
 #include "process_time.h"
+#include "sort.h"
 
 /*============================================================================*/
 
 /**
- * Global buffer to be used for sorting.
+ * Default array sizes (L1/L2 cache, last level cache and memory).
+ */
+static const char *default_sizes[] = { "32K", "1M", "64M" };
+
+/**
+ * Sort algorithms.
  */
-#define BUF_SIZE		(2 * 4096)
+static const sort_algo_t algos[] = {
+	{ "bubble sort",			sort_bubble,	SORT_BUBBLE_MAX	},
+	{ "qsort",					sort_qsort,		0				},
+	{ "introsort",				sort_intro,		0				},
+	{ "radix sort",				sort_radix,		0				},
+	{ "sorting network",		sort_network,	0				},
+	{ "parallel merge sort",	sort_parallel,	0				},
+};
+
+/**
+ * Options.
+ */
+static int counters;
+static int repeat = 1;
 
 /*============================================================================*/
 
 /**
- * Sort buffer (bubble sort).
+ * Parse a size in bytes (K, M or G suffix).
  *
- * Note that complexity for bubble sort is often O(n*n). You should not use this
- * in practice. It is choose for now to measure intense user mode process time.
+ * Return number of elements on success and 0 otherwise.
  */
-static void __buf_sort(int *v)
+static size_t __size_parse(const char *str)
 {
-	int temp, sort_timer_fd;
+	unsigned long long size;
+	char *end;
 
-	// Register buffer creation timer and start measuring time
-	sort_timer_fd = process_time_register();
-	if (sort_timer_fd < 0) {
-		ERROR("Fail to register buffer sort timer!\n");
-		return;
+	size = strtoull(str, &end, 10);
+	switch (*end) {
+	case 'G':
+	case 'g':
+		size <<= 10;
+		// fallthrough
+	case 'M':
+	case 'm':
+		size <<= 10;
+		// fallthrough
+	case 'K':
+	case 'k':
+		size <<= 10;
+		end++;
+		break;
 	}
-	DEBUG("Buffer sort timer_fd = %d\n", sort_timer_fd);
 
-	if (process_time_start(sort_timer_fd) < 0) {
-		ERROR("Fail to start buffer sort timer!\n");
-		return;
-	};
-
-	for (int i = 0; i < BUF_SIZE - 1; i++) {
-		for (int j = 0; j < BUF_SIZE - i - 1; j++) {
-			if (v[j] > v[j+1]) {
-				temp = v[j];
-				v[j] = v[j+1];
-				v[j+1] = temp;
-			}
-		}
+	if (*end != '\0')
+		return 0;
+
+	return size / sizeof(int);
+}
+
+/**
+ * Start a timer (counters mode or histogram attached based on options).
+ *
+ * Return timer descriptor on success and <0 otherwise.
+ */
+static int __timer_start(const char *name, histogram_t *hist)
+{
+	int timer_fd;
+
+	timer_fd = process_time_register();
+	if (timer_fd < 0) {
+		ERROR("Fail to register %s timer!\n", name);
+		return -1;
 	}
+	DEBUG("%s timer_fd = %d\n", name, timer_fd);
 
-	// Stop timer and release
-	DEBUG("Buffer sort timer!\n");
-	if (process_time_end(sort_timer_fd) < 0) {
-		ERROR("Fail to stop buffer sort timer!\n");
-		free(v);
-		return;
+	if (hist && process_time_histogram(timer_fd, hist) < 0) {
+		ERROR("Fail to attach %s histogram!\n", name);
+		goto release;
 	}
 
-	if (process_time_release(sort_timer_fd)) {
-		ERROR("Fail to release buffer sort timer!\n");
-		free(v);
-		return;
+	if (counters && process_time_counters(timer_fd) < 0) {
+		ERROR("Fail to enable %s timer counters!\n", name);
+		goto release;
+	}
+
+	if (process_time_start(timer_fd) < 0) {
+		ERROR("Fail to start %s timer!\n", name);
+		goto release;
 	}
+
+	return timer_fd;
+
+release:
+	process_time_release(timer_fd);
+	return -2;
+}
+
+/**
+ * Stop and release a timer.
+ */
+static void __timer_end(const char *name, int timer_fd)
+{
+	DEBUG("%s timer!\n", name);
+	if (process_time_end(timer_fd) < 0)
+		ERROR("Fail to stop %s timer!\n", name);
+
+	if (process_time_release(timer_fd))
+		ERROR("Fail to release %s timer!\n", name);
 }
 
 /**
- * Alloc and fill in a buffer of BUF_SIZE elements.
+ * Alloc and fill in a buffer of n elements.
+ *
+ * Note that elements are generated using a xorshift generator instead of
+ * rand(), so that creating GB arrays is dominated by page faults.
+ *
+ * Return buffer on success and NULL otherwise.
  */
-static void __buf_create(void)
+static int *__buf_create(size_t n)
 {
+	uint32_t x = time(NULL) ^ getpid();
 	int *v = NULL;
-	int create_timer_fd;
+	int timer_fd;
 
-	// Register buffer creation timer and start measuring time
-	create_timer_fd = process_time_register();
-	if (create_timer_fd < 0) {
-		ERROR("Fail to register buffer create timer!\n");
-		return;
+	printf("---------------- buffer create ----------------\n");
+	timer_fd = __timer_start("buffer create", NULL);
+	if (timer_fd < 0)
+		return NULL;
+
+	v = malloc(n * sizeof(int));
+	if (!v) {
+		ERROR("Fail to alloc buffer of %zu elements!\n", n);
+		goto end;
 	}
-	DEBUG("Buffer create timer_fd = %d\n", create_timer_fd);
 
-	if (process_time_start(create_timer_fd) < 0) {
-		ERROR("Fail to start buffer create timer!\n");
-		return;
-	};
-
-	/**
-	 * Create buffer
-	 *
-	 * Note that we use getpid to generate elements so that a syscall is
-	 * performed (this only work for glibc versions >= 2.25 when cached pid
-	 * value was removed).
-	 */
-	srand(time(NULL));
-
-	v = calloc(BUF_SIZE, sizeof(int));
-	assert(v);
-
-	for (int i = 0; i < BUF_SIZE; i++)
-		v[i] = getpid() + rand();
-
-	// Stop timer and release
-	DEBUG("Buffer create timer!\n");
-	if (process_time_end(create_timer_fd) < 0) {
-		ERROR("Fail to stop buffer create timer!\n");
-		free(v);
+	for (size_t i = 0; i < n; i++) {
+		x ^= x << 13;
+		x ^= x >> 17;
+		x ^= x << 5;
+		v[i] = x;
+	}
+
+end:
+	__timer_end("buffer create", timer_fd);
+	return v;
+}
+
+/**
+ * Sort copies of buffer using an algorithm.
+ *
+ * Copy is done before starting the timer, so that only the sort is measured.
+ */
+static void __buf_sort(const sort_algo_t *algo, const int *v, int *c, size_t n)
+{
+	histogram_t *hist = NULL;
+	int timer_fd, rv;
+
+	printf("---------------- %s ----------------\n", algo->name);
+	if (algo->max && n > algo->max) {
+		printf("skipped (more than %zu elements)\n", algo->max);
 		return;
 	}
 
-	if (process_time_release(create_timer_fd)) {
-		ERROR("Fail to release buffer create timer!\n");
+	if (repeat > 1) {
+		hist = malloc(sizeof(histogram_t));
+		if (!hist) {
+			ERROR("Fail to alloc %s histogram!\n", algo->name);
+			return;
+		}
+		histogram_init(hist);
+	}
+
+	for (int i = 0; i < repeat; i++) {
+		memcpy(c, v, n * sizeof(int));
+
+		timer_fd = __timer_start(algo->name, hist);
+		if (timer_fd < 0)
+			break;
+
+		rv = algo->sort(c, n);
+
+		__timer_end(algo->name, timer_fd);
+
+		if (rv) {
+			ERROR("%s failed (%d)!\n", algo->name, rv);
+			break;
+		}
+
+		if (sort_check(c, n)) {
+			ERROR("%s result is not sorted!\n", algo->name);
+			break;
+		}
+	}
+
+	if (hist) {
+		histogram_print(hist, algo->name, "ms", 1e6);
+		free(hist);
+	}
+}
+
+/**
+ * Run all algorithms on an array of n elements.
+ */
+static void __buf_bench(const char *size, size_t n)
+{
+	int *v, *c;
+
+	printf("================ %s (%zu elements) ================\n", size, n);
+
+	v = __buf_create(n);
+	if (!v)
+		return;
+
+	c = malloc(n * sizeof(int));
+	if (!c) {
+		ERROR("Fail to alloc sort buffer of %zu elements!\n", n);
 		free(v);
 		return;
 	}
 
-	// Sort the buffer
-	__buf_sort(v);
+	for (int i = 0; i < sizeof(algos) / sizeof(algos[0]); i++)
+		__buf_sort(&algos[i], v, c, n);
+
+	free(c);
+	free(v);
 }
 
 /*============================================================================*/
 
-int main()
+int main(int argc, char *argv[])
 {
-	int main_timer_fd;
+	int main_timer_fd, opt, nr_sizes;
+	const char **sizes;
+	size_t n;
+
+	while ((opt = getopt(argc, argv, "cr:t:")) != -1) {
+		switch (opt) {
+		case 'c':
+			counters = 1;
+			break;
+		case 'r':
+			repeat = atoi(optarg);
+			break;
+		case 't':
+			sort_parallel_threads(atoi(optarg));
+			break;
+		default:
+			printf("Usage: %s [-c] [-r repeat] [-t threads] [size ...]\n",
+					argv[0]);
+			return -1;
+		}
+	}
+
+	if (repeat < 1)
+		repeat = 1;
+
+	if (optind < argc) {
+		sizes = (const char **)&argv[optind];
+		nr_sizes = argc - optind;
+	} else {
+		sizes = default_sizes;
+		nr_sizes = sizeof(default_sizes) / sizeof(default_sizes[0]);
+	}
 
 	// Init process time for measuring program time
 	process_time_init();
@@ -152,12 +321,20 @@ int main()
 		return -2;
 	}
 
+	// Sort benchmark for each array size
+	for (int i = 0; i < nr_sizes; i++) {
+		n = __size_parse(sizes[i]);
+		if (!n) {
+			ERROR("Invalid size %s!\n", sizes[i]);
+			continue;
+		}
 
-	// Buffer creation and sort
-	__buf_create();
+		__buf_bench(sizes[i], n);
+	}
 
 	// Stop main timer and release
 	DEBUG("Main timer!\n");
+	printf("================ total ================\n");
 	if (process_time_end(main_timer_fd) < 0) {
 		ERROR("Fail to stop main timer!\n");
 		return -3;
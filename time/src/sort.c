@@ -0,0 +1,701 @@
+/**
+ * Sort algorithms for integer arrays.
+ * Copyright (C) 2024 Lazar Razvan.
+ *
+ * Implementations used by the sorting benchmark:
+ * 	1) bubble sort
+ * 		O(n*n) baseline, only usable on small arrays.
+ *
+ * 	2) qsort() and introsort
+ * 		qsort() from C library (indirect compare calls) against an inlined
+ * 	introsort: median of three quicksort that switches to heapsort when the
+ * 	recursion is too deep (O(n*log(n)) worst case) and to insertion sort for
+ * 	small partitions.
+ *
+ * 	3) LSD radix sort
+ * 		Four counting passes of 8 bits digits (O(n)), trading comparisons for
+ * 	sequential memory traffic. Passes where all elements share the same digit
+ * 	are skipped.
+ *
+ * 	4) sorting network
+ * 		Blocks of 8x8 elements are loaded in 8 AVX2 registers and sorted on
+ * 	columns using a 19 comparators network (vector min/max, no branches).
+ * 	The block is then transposed so that each row is a sorted run of 8
+ * 	elements and runs are merged bottom-up. CPUs without AVX2 use the same
+ * 	network on scalars.
+ *
+ * 	5) parallel merge sort
+ * 		Array is split in chunks that are sorted using introsort by separate
+ * 	threads. Chunks are then merged in rounds and each merge is split between
+ * 	threads on merge path (co-rank) boundaries, so that all threads are busy
+ * 	up to the last round.
+ *
+ * Algorithms that need a temporary buffer allocate it on each call and return
+ * <0 if allocation fails.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "debug.h"
+#include "sort.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#	include <immintrin.h>
+#	define SORT_AVX2_ENABLE		1
+#else
+#	define SORT_AVX2_ENABLE		0
+#endif
+
+/*============================================================================*/
+
+/**
+ * Parallel merge sort task (merge a[] and b[] into dst[]).
+ */
+typedef struct merge_task_s {
+
+	const int	*a;				// first sorted run
+	size_t		na;				// first run elements
+	const int	*b;				// second sorted run
+	size_t		nb;				// second run elements
+	int			*dst;			// destination (na + nb elements)
+
+} merge_task_t;
+
+/**
+ * Parallel merge sort chunk sort task.
+ */
+typedef struct chunk_task_s {
+
+	int			*v;				// chunk
+	size_t		n;				// chunk elements
+
+} chunk_task_t;
+
+/**
+ * Parallel merge sort threads (0 for online CPUs).
+ */
+static int sort_threads;
+
+/*================================= STATIC ===================================*/
+
+/**
+ * Compare and exchange (branchless on scalars).
+ */
+#define __CMP_SWAP(x, y)							\
+	do {											\
+		int __min = (x) < (y) ? (x) : (y);			\
+		int __max = (x) < (y) ? (y) : (x);			\
+		(x) = __min;								\
+		(y) = __max;								\
+	} while (0)
+
+static inline void __swap(int *x, int *y)
+{
+	int temp = *x;
+
+	*x = *y;
+	*y = temp;
+}
+
+/**
+ * Insertion sort (in place).
+ */
+static void __insertion_sort(int *v, size_t n)
+{
+	size_t i, j;
+	int key;
+
+	for (i = 1; i < n; i++) {
+		key = v[i];
+		for (j = i; j > 0 && v[j-1] > key; j--)
+			v[j] = v[j-1];
+		v[j] = key;
+	}
+}
+
+/**
+ * Heap sort (in place).
+ */
+static void __sift_down(int *v, size_t root, size_t n)
+{
+	size_t child;
+
+	while ((child = 2 * root + 1) < n) {
+		if (child + 1 < n && v[child] < v[child+1])
+			child++;
+
+		if (v[root] >= v[child])
+			return;
+
+		__swap(&v[root], &v[child]);
+		root = child;
+	}
+}
+
+static void __heap_sort(int *v, size_t n)
+{
+	for (size_t i = n / 2; i > 0; i--)
+		__sift_down(v, i - 1, n);
+
+	for (size_t i = n - 1; i > 0; i--) {
+		__swap(&v[0], &v[i]);
+		__sift_down(v, 0, i);
+	}
+}
+
+/**
+ * Introsort recursion.
+ *
+ * Hoare partition around the median of first, middle and last elements. The
+ * smaller partition is sorted recursively and the larger one in the loop, so
+ * that stack depth is O(log(n)).
+ */
+static void __intro_sort(int *v, size_t n, int depth)
+{
+	size_t mid;
+	long i, j;
+	int pivot;
+
+	while (n > SORT_INSERTION_MAX) {
+		if (depth-- == 0) {
+			__heap_sort(v, n);
+			return;
+		}
+
+		mid = n / 2;
+		if (v[mid] < v[0])
+			__swap(&v[mid], &v[0]);
+		if (v[n-1] < v[mid])
+			__swap(&v[n-1], &v[mid]);
+		if (v[mid] < v[0])
+			__swap(&v[mid], &v[0]);
+		pivot = v[mid];
+
+		// pivot is not the last element, so both partitions are not empty
+		i = -1;
+		j = n;
+		for (;;) {
+			do i++; while (v[i] < pivot);
+			do j--; while (v[j] > pivot);
+			if (i >= j)
+				break;
+			__swap(&v[i], &v[j]);
+		}
+
+		if ((size_t)j + 1 < n - j - 1) {
+			__intro_sort(v, j + 1, depth);
+			v += j + 1;
+			n -= j + 1;
+		} else {
+			__intro_sort(v + j + 1, n - j - 1, depth);
+			n = j + 1;
+		}
+	}
+
+	__insertion_sort(v, n);
+}
+
+/**
+ * Merge two sorted runs (stable, first run wins on equal elements).
+ */
+static void __merge(const int *a, size_t na, const int *b, size_t nb, int *dst)
+{
+	size_t i = 0, j = 0, k = 0;
+
+	while (i < na && j < nb)
+		dst[k++] = (b[j] < a[i]) ? b[j++] : a[i++];
+
+	if (i < na)
+		memcpy(dst + k, a + i, (na - i) * sizeof(int));
+
+	if (j < nb)
+		memcpy(dst + k, b + j, (nb - j) * sizeof(int));
+}
+
+/**
+ * Bottom-up merge of sorted runs of "width" elements.
+ *
+ * Return 0 on success and <0 otherwise.
+ */
+static int __merge_runs(int *v, size_t n, size_t width)
+{
+	int *src = v, *dst, *tmp;
+	size_t lo, mid, hi;
+
+	if (width >= n)
+		return 0;
+
+	tmp = malloc(n * sizeof(int));
+	if (!tmp) {
+		ERROR("Fail to alloc merge buffer!\n");
+		return -1;
+	}
+
+	dst = tmp;
+	for (; width < n; width *= 2) {
+		for (lo = 0; lo < n; lo += 2 * width) {
+			mid = (lo + width < n) ? lo + width : n;
+			hi = (lo + 2 * width < n) ? lo + 2 * width : n;
+			__merge(src + lo, mid - lo, src + mid, hi - mid, dst + lo);
+		}
+
+		src = dst;
+		dst = (dst == tmp) ? v : tmp;
+	}
+
+	if (src != v)
+		memcpy(v, src, n * sizeof(int));
+
+	free(tmp);
+
+	return 0;
+}
+
+/**
+ * Sorting network for 8 elements (19 comparators).
+ *
+ * Applied on vectors, each column of the 8 vectors is sorted.
+ */
+#define __NETWORK_8(CMP, r)													\
+	do {																	\
+		CMP(r[0], r[2]); CMP(r[1], r[3]); CMP(r[4], r[6]); CMP(r[5], r[7]);	\
+		CMP(r[0], r[4]); CMP(r[1], r[5]); CMP(r[2], r[6]); CMP(r[3], r[7]);	\
+		CMP(r[0], r[1]); CMP(r[2], r[3]); CMP(r[4], r[5]); CMP(r[6], r[7]);	\
+		CMP(r[2], r[4]); CMP(r[3], r[5]);									\
+		CMP(r[1], r[4]); CMP(r[3], r[6]);									\
+		CMP(r[1], r[2]); CMP(r[3], r[4]); CMP(r[5], r[6]);					\
+	} while (0)
+
+/**
+ * Sort runs of 8 elements (scalar network, insertion sort for last run).
+ */
+static void __network_runs_scalar(int *v, size_t n)
+{
+	size_t i;
+
+	for (i = 0; i + 8 <= n; i += 8)
+		__NETWORK_8(__CMP_SWAP, (v + i));
+
+	__insertion_sort(v + i, n - i);
+}
+
+#if SORT_AVX2_ENABLE
+
+#define __CMP_SWAP_AVX2(x, y)										\
+	do {															\
+		__m256i __min = _mm256_min_epi32(x, y);						\
+		(y) = _mm256_max_epi32(x, y);								\
+		(x) = __min;												\
+	} while (0)
+
+/**
+ * Sort runs of 8 elements using AVX2 (blocks of 8x8 elements).
+ *
+ * Columns are sorted by the network and the block is transposed in registers,
+ * so that columns become rows (runs) before storing.
+ */
+__attribute__((target("avx2")))
+static void __network_runs_avx2(int *v, size_t n)
+{
+	__m256i r[8], t[8];
+	size_t i;
+
+	for (i = 0; i + SORT_NETWORK_BLOCK <= n; i += SORT_NETWORK_BLOCK) {
+		for (int k = 0; k < 8; k++)
+			r[k] = _mm256_loadu_si256((__m256i *)(v + i + 8 * k));
+
+		__NETWORK_8(__CMP_SWAP_AVX2, r);
+
+		// transpose 8x8 (32 bits elements)
+		for (int k = 0; k < 8; k += 2) {
+			t[k]   = _mm256_unpacklo_epi32(r[k], r[k+1]);
+			t[k+1] = _mm256_unpackhi_epi32(r[k], r[k+1]);
+		}
+
+		for (int k = 0; k < 8; k += 4) {
+			r[k]   = _mm256_unpacklo_epi64(t[k], t[k+2]);
+			r[k+1] = _mm256_unpackhi_epi64(t[k], t[k+2]);
+			r[k+2] = _mm256_unpacklo_epi64(t[k+1], t[k+3]);
+			r[k+3] = _mm256_unpackhi_epi64(t[k+1], t[k+3]);
+		}
+
+		for (int k = 0; k < 4; k++) {
+			t[k]   = _mm256_permute2x128_si256(r[k], r[k+4], 0x20);
+			t[k+4] = _mm256_permute2x128_si256(r[k], r[k+4], 0x31);
+		}
+
+		for (int k = 0; k < 8; k++)
+			_mm256_storeu_si256((__m256i *)(v + i + 8 * k), t[k]);
+	}
+
+	__network_runs_scalar(v + i, n - i);
+}
+
+#endif	// SORT_AVX2_ENABLE
+
+/**
+ * Merge path co-rank: number of elements of a[] in the first k elements of
+ * the merge of a[] and b[] (consistent with __merge() on equal elements).
+ */
+static size_t __co_rank(size_t k, const int *a, size_t na, const int *b,
+						size_t nb)
+{
+	size_t lo = (k > nb) ? k - nb : 0;
+	size_t hi = (k < na) ? k : na;
+	size_t i, j;
+
+	while (lo < hi) {
+		i = lo + (hi - lo) / 2;
+		j = k - i;
+		if (j > 0 && a[i] <= b[j-1])
+			lo = i + 1;
+		else
+			hi = i;
+	}
+
+	return lo;
+}
+
+static void *__chunk_task(void *arg)
+{
+	chunk_task_t *task = (chunk_task_t *)arg;
+
+	sort_intro(task->v, task->n);
+
+	return NULL;
+}
+
+static void *__merge_task(void *arg)
+{
+	merge_task_t *task = (merge_task_t *)arg;
+
+	__merge(task->a, task->na, task->b, task->nb, task->dst);
+
+	return NULL;
+}
+
+/**
+ * Run a task on each thread and wait for all of them.
+ *
+ * Last task is run by the calling thread. If a thread can not be created, its
+ * task and the following ones are also run by the calling thread.
+ */
+static void __tasks_run(void *(*fn)(void *), void *tasks, size_t task_size,
+						int nr)
+{
+	pthread_t tid[SORT_THREADS_MAX];
+	int created;
+
+	for (created = 0; created < nr - 1; created++) {
+		if (pthread_create(&tid[created], NULL, fn,
+						(char *)tasks + created * task_size)) {
+			ERROR("pthread_create() failed!\n");
+			break;
+		}
+	}
+
+	for (int i = created; i < nr; i++)
+		fn((char *)tasks + i * task_size);
+
+	for (int i = 0; i < created; i++)
+		pthread_join(tid[i], NULL);
+}
+
+/*================================= PUBLIC ===================================*/
+
+/**
+ * Bubble sort (in place).
+ *
+ * Note that complexity for bubble sort is O(n*n). You should not use this in
+ * practice. It is used as a baseline for intense user mode process time.
+ *
+ * @v	: Array.
+ * @n	: Number of elements.
+ *
+ * Return 0.
+ */
+int sort_bubble(int *v, size_t n)
+{
+	for (size_t i = 0; i + 1 < n; i++)
+		for (size_t j = 0; j < n - i - 1; j++)
+			if (v[j] > v[j+1])
+				__swap(&v[j], &v[j+1]);
+
+	return 0;
+}
+
+/**
+ * qsort() compare function.
+ */
+static int __int_cmp(const void *a, const void *b)
+{
+	int x = *(const int *)a, y = *(const int *)b;
+
+	return (x > y) - (x < y);
+}
+
+/**
+ * C library qsort().
+ *
+ * @v	: Array.
+ * @n	: Number of elements.
+ *
+ * Return 0.
+ */
+int sort_qsort(int *v, size_t n)
+{
+	qsort(v, n, sizeof(int), __int_cmp);
+
+	return 0;
+}
+
+/**
+ * Introsort (in place).
+ *
+ * @v	: Array.
+ * @n	: Number of elements.
+ *
+ * Return 0.
+ */
+int sort_intro(int *v, size_t n)
+{
+	int depth = 0;
+
+	// 2 * log2(n) partitions before switching to heap sort
+	for (size_t i = n; i > 1; i >>= 1)
+		depth += 2;
+
+	__intro_sort(v, n, depth);
+
+	return 0;
+}
+
+/**
+ * LSD radix sort.
+ *
+ * Signed integers are sorted as unsigned keys with the sign bit flipped.
+ *
+ * @v	: Array.
+ * @n	: Number of elements.
+ *
+ * Return 0 on success and <0 otherwise.
+ *
+ * Errors:
+ * 	1) Fail to alloc temporary buffer
+ */
+int sort_radix(int *v, size_t n)
+{
+	size_t count[4][256] = { { 0 } };
+	int *src = v, *dst, *tmp;
+	uint32_t key;
+	size_t sum;
+
+	if (n < 2)
+		return 0;
+
+	tmp = malloc(n * sizeof(int));
+	if (!tmp) {
+		ERROR("Fail to alloc radix buffer!\n");
+		return -1;
+	}
+
+	// histogram of all digits in a single pass
+	for (size_t i = 0; i < n; i++) {
+		key = (uint32_t)v[i] ^ 0x80000000;
+		count[0][key & 0xff]++;
+		count[1][(key >> 8) & 0xff]++;
+		count[2][(key >> 16) & 0xff]++;
+		count[3][key >> 24]++;
+	}
+
+	dst = tmp;
+	for (int d = 0; d < 4; d++) {
+		// all elements have the same digit, order is unchanged
+		key = (uint32_t)src[0] ^ 0x80000000;
+		if (count[d][(key >> (8 * d)) & 0xff] == n)
+			continue;
+
+		// exclusive prefix sum (bucket start offsets)
+		sum = 0;
+		for (int b = 0; b < 256; b++) {
+			size_t c = count[d][b];
+
+			count[d][b] = sum;
+			sum += c;
+		}
+
+		for (size_t i = 0; i < n; i++) {
+			key = (uint32_t)src[i] ^ 0x80000000;
+			dst[count[d][(key >> (8 * d)) & 0xff]++] = src[i];
+		}
+
+		src = dst;
+		dst = (dst == tmp) ? v : tmp;
+	}
+
+	if (src != v)
+		memcpy(v, src, n * sizeof(int));
+
+	free(tmp);
+
+	return 0;
+}
+
+/**
+ * Sorting network runs and bottom-up merge.
+ *
+ * @v	: Array.
+ * @n	: Number of elements.
+ *
+ * Return 0 on success and <0 otherwise.
+ *
+ * Errors:
+ * 	1) Fail to alloc temporary buffer
+ */
+int sort_network(int *v, size_t n)
+{
+#if SORT_AVX2_ENABLE
+	if (__builtin_cpu_supports("avx2"))
+		__network_runs_avx2(v, n);
+	else
+		__network_runs_scalar(v, n);
+#else
+	__network_runs_scalar(v, n);
+#endif
+
+	return __merge_runs(v, n, 8);
+}
+
+/**
+ * Parallel merge sort.
+ *
+ * Number of threads is limited so that each thread sorts at least
+ * SORT_PARALLEL_MIN elements. On a single thread introsort is used.
+ *
+ * @v	: Array.
+ * @n	: Number of elements.
+ *
+ * Return 0 on success and <0 otherwise.
+ *
+ * Errors:
+ * 	1) Fail to alloc temporary buffer
+ */
+int sort_parallel(int *v, size_t n)
+{
+	size_t bounds[SORT_THREADS_MAX + 1];
+	merge_task_t merge[SORT_THREADS_MAX];
+	chunk_task_t chunk[SORT_THREADS_MAX];
+	int *src = v, *dst, *tmp;
+	size_t lo, mid, hi, total, k0, k1, i0, i1;
+	int threads, runs, tasks, workers;
+
+	threads = sort_threads ? sort_threads : sysconf(_SC_NPROCESSORS_ONLN);
+	if (threads > SORT_THREADS_MAX)
+		threads = SORT_THREADS_MAX;
+
+	if ((size_t)threads > n / SORT_PARALLEL_MIN)
+		threads = n / SORT_PARALLEL_MIN;
+
+	if (threads <= 1)
+		return sort_intro(v, n);
+
+	tmp = malloc(n * sizeof(int));
+	if (!tmp) {
+		ERROR("Fail to alloc merge buffer!\n");
+		return -1;
+	}
+
+	// sort chunks
+	for (int t = 0; t <= threads; t++)
+		bounds[t] = n * t / threads;
+
+	for (int t = 0; t < threads; t++) {
+		chunk[t].v = v + bounds[t];
+		chunk[t].n = bounds[t+1] - bounds[t];
+	}
+
+	__tasks_run(__chunk_task, chunk, sizeof(chunk_task_t), threads);
+
+	// merge rounds, runs pairs share all threads
+	dst = tmp;
+	for (runs = threads; runs > 1; runs = (runs + 1) / 2) {
+		workers = threads / (runs / 2);
+		tasks = 0;
+
+		for (int r = 0; r < runs; r += 2) {
+			lo = bounds[r];
+			mid = bounds[r+1];
+			hi = (r + 2 <= runs) ? bounds[r+2] : mid;
+
+			// odd run, nothing to merge
+			if (r + 1 == runs) {
+				memcpy(dst + lo, src + lo, (mid - lo) * sizeof(int));
+				continue;
+			}
+
+			// split output on merge path
+			total = hi - lo;
+			for (int w = 0; w < workers; w++) {
+				k0 = total * w / workers;
+				k1 = total * (w + 1) / workers;
+				i0 = __co_rank(k0, src + lo, mid - lo, src + mid, hi - mid);
+				i1 = __co_rank(k1, src + lo, mid - lo, src + mid, hi - mid);
+
+				merge[tasks].a = src + lo + i0;
+				merge[tasks].na = i1 - i0;
+				merge[tasks].b = src + mid + (k0 - i0);
+				merge[tasks].nb = (k1 - i1) - (k0 - i0);
+				merge[tasks].dst = dst + lo + k0;
+				tasks++;
+			}
+		}
+
+		__tasks_run(__merge_task, merge, sizeof(merge_task_t), tasks);
+
+		for (int r = 0; 2 * r < runs; r++)
+			bounds[r] = bounds[2 * r];
+		bounds[(runs + 1) / 2] = n;
+
+		src = dst;
+		dst = (dst == tmp) ? v : tmp;
+	}
+
+	if (src != v)
+		memcpy(v, src, n * sizeof(int));
+
+	free(tmp);
+
+	return 0;
+}
+
+/**
+ * Set number of threads for parallel merge sort.
+ *
+ * @threads	: Number of threads (0 for online CPUs).
+ */
+void sort_parallel_threads(int threads)
+{
+	sort_threads = threads;
+}
+
+/**
+ * Check if array is sorted.
+ *
+ * @v	: Array.
+ * @n	: Number of elements.
+ *
+ * Return 0 if sorted and <0 otherwise.
+ */
+int sort_check(const int *v, size_t n)
+{
+	for (size_t i = 1; i < n; i++)
+		if (v[i-1] > v[i])
+			return -1;
+
+	return 0;
+}